@@ -0,0 +1,122 @@
+/* microbenchmark for the BRR decoder: every sample chain in rroll.spc's directory, decoded
+   with the scalar reference and each vector implementation */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/spcecho.h"
+#include "../src/brr.h"
+#include "../src/spc700.h"
+#include "../src/stats.h"
+
+/* the song builds its sample directory at runtime, so play it for a moment first */
+#define WARMUP_SAMPLES DSP_RATE
+#define MIN_SECONDS    0.5
+#define MAX_DECODED    0x10000
+#define LOOP_PASSES    2
+
+static long decodeAll(brr_impl_t impl, const unsigned char *ram, const aram_map_t *map, short *out)
+{
+    long total = 0;
+    int i = 0;
+
+    for(; i < map->entries; i++)
+    {
+        const aram_sample_t *sample = &map->samples[i];
+
+        if(sample->valid)
+            total += brrDecodeSampleWith(impl, ram, sample->start, sample->loop, LOOP_PASSES, out, MAX_DECODED);
+    }
+
+    return total;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "testfiles/rroll.spc";
+    static short scratch[WARMUP_SAMPLES * 2];
+    unsigned char pageMap[PAGE_MAP_BYTES];
+    short *reference, *decoded;
+    aram_map_t *map = malloc(sizeof *map);
+    spc700_t *cpu = malloc(sizeof *cpu);
+    spcecho_ctx ctx;
+    int impl = BRR_SCALAR, i, blocks[4] = { 0 };
+    double baseline = 0;
+
+    spcechoInit(&ctx);
+
+    if(map == NULL || cpu == NULL || spcechoLoadFile(&ctx, path) != SPCECHO_OK || !spc700Load(cpu, ctx.buffer, (long) ctx.length))
+    {
+        printf("Unable to load %s!\n", path);
+        return 1;
+    }
+
+    spc700Run(cpu, scratch, WARMUP_SAMPLES);
+
+    scanPages(cpu->ram, pageMap);
+    aramMapBuild(map, cpu->ram, cpu->dsp.regs, pageMap);
+
+    for(i = 0; i < map->entries; i++)
+    {
+        const aram_sample_t *sample = &map->samples[i];
+        unsigned int address = sample->start;
+
+        for(; sample->valid && address < sample->end; address += BRR_BLOCK) blocks[(cpu->ram[address] >> 2) & 3]++;
+    }
+
+    printf("%s: %d samples in the directory at 0x%04X, %d valid\n", path, map->entries, map->directory, map->validSamples);
+    printf("blocks by filter: 0: %d  1: %d  2: %d  3: %d\n", blocks[0], blocks[1], blocks[2], blocks[3]);
+    printf("BRR implementations available: up to %s\n\n", brrName(brrBest()));
+
+    reference = malloc(MAX_DECODED * sizeof *reference);
+    decoded = malloc(MAX_DECODED * sizeof *decoded);
+
+    if(reference == NULL || decoded == NULL || map->validSamples == 0) return 1;
+
+    for(; impl <= (int) brrBest(); impl++)
+    {
+        long samples = 0, rounds = 0;
+        double start, elapsed;
+
+        /* bit-exact against the scalar reference, chain by chain */
+        for(i = 0; i < map->entries; i++)
+        {
+            const aram_sample_t *sample = &map->samples[i];
+            int expected, count;
+
+            if(!sample->valid) continue;
+
+            expected = brrDecodeSampleWith(BRR_SCALAR, cpu->ram, sample->start, sample->loop, LOOP_PASSES, reference, MAX_DECODED);
+            count = brrDecodeSampleWith((brr_impl_t) impl, cpu->ram, sample->start, sample->loop, LOOP_PASSES, decoded, MAX_DECODED);
+
+            if(count != expected || memcmp(reference, decoded, (size_t) count * sizeof *decoded) != 0)
+            {
+                printf("  %s: MISMATCH on sample %02X\n", brrName((brr_impl_t) impl), i);
+                return 1;
+            }
+        }
+
+        start = statsClock();
+
+        do
+        {
+            samples += decodeAll((brr_impl_t) impl, cpu->ram, map, decoded);
+            rounds++;
+        }
+        while((elapsed = statsClock() - start) < MIN_SECONDS);
+
+        if(impl == BRR_SCALAR) baseline = (double) samples / elapsed;
+
+        printf("  %-6s %12.0f samples/sec  (%ld samples per pass, %5.2fx)\n", brrName((brr_impl_t) impl),
+               (double) samples / elapsed, samples / rounds, (double) samples / elapsed / baseline);
+    }
+
+    free(reference);
+    free(decoded);
+    free(cpu);
+    free(map);
+    spcechoFree(&ctx);
+
+    return 0;
+}
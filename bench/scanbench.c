@@ -0,0 +1,109 @@
+/* microbenchmark for the end-of-data scan: the original byte loop against scan.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/spcecho.h"
+#include "../src/scan.h"
+#include "../src/stats.h"
+
+#define ITERATIONS 20000
+
+/* the loop echoAddress() used before scan.c */
+static int byteLoop(const unsigned char *buffer)
+{
+    int i = 0xFFFF;
+
+    for (; i > 0; i--)
+    {
+        if (buffer[i] == 0x00) continue;
+        if (buffer[i] == 0xFF) continue;
+        break;
+    }
+
+    return i;
+}
+
+static volatile int sink;
+
+static void benchImage(const char *label, const unsigned char *image)
+{
+    unsigned char pageMap[PAGE_MAP_BYTES], reference[PAGE_MAP_BYTES];
+    double start, baseline;
+    int impl = SCAN_SCALAR, n, expected = byteLoop(image);
+
+    printf("\n%s (end of data at file offset 0x%04X)\n", label, expected);
+
+    start = statsClock();
+    for(n = 0; n < ITERATIONS; n++) sink = byteLoop(image);
+    baseline = (statsClock() - start) / ITERATIONS;
+
+    printf("  %-22s %9.1f ns\n", "byte loop", baseline * 1e9);
+
+    scanPagesWith(SCAN_SCALAR, image + RAM_OFFSET, reference);
+
+    for(; impl <= (int) scanBest(); impl++)
+    {
+        double last, pages;
+        int found = 1 + scanLastDataWith((scan_impl_t) impl, image + 1, 0xFFFF);
+
+        scanPagesWith((scan_impl_t) impl, image + RAM_OFFSET, pageMap);
+
+        if(found != expected || memcmp(pageMap, reference, sizeof pageMap) != 0)
+        {
+            printf("  %s: MISMATCH (found 0x%04X)\n", scanName((scan_impl_t) impl), found);
+            exit(1);
+        }
+
+        start = statsClock();
+        for(n = 0; n < ITERATIONS; n++) sink = scanLastDataWith((scan_impl_t) impl, image + 1, 0xFFFF);
+        last = (statsClock() - start) / ITERATIONS;
+
+        start = statsClock();
+        for(n = 0; n < ITERATIONS; n++) scanPagesWith((scan_impl_t) impl, image + RAM_OFFSET, pageMap);
+        pages = (statsClock() - start) / ITERATIONS;
+
+        printf("  %-6s last data     %9.1f ns  (%5.1fx)\n", scanName((scan_impl_t) impl), last * 1e9, baseline / last);
+        printf("  %-6s page map      %9.1f ns  (%.1f GB/s)\n", scanName((scan_impl_t) impl), pages * 1e9, 65536.0 / pages / 1e9);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "testfiles/rroll.spc";
+    unsigned char *image = calloc(1, ADDRESS_OFFSET + 0x100);
+    FILE *spc;
+
+    if(image == NULL) return 1;
+
+    if((spc = fopen(path, "rb")) == NULL)
+    {
+        printf("Unable to open %s!\n", path);
+        free(image);
+        return 1;
+    }
+
+    if(fread(image, 1, ADDRESS_OFFSET + 0x100, spc) < ADDRESS_OFFSET)
+    {
+        printf("Error while reading %s!\n", path);
+        fclose(spc);
+        free(image);
+        return 1;
+    }
+
+    fclose(spc);
+
+    printf("scan implementations available: up to %s\n", scanName(scanBest()));
+
+    benchImage(path, image);
+
+    /* worst case for the byte loop: nothing but the header before a long empty RAM */
+    memset(image + RAM_OFFSET, 0, 0x10000);
+    image[RAM_OFFSET + 0x0400] = 0x42;
+    benchImage("near-empty RAM", image);
+
+    free(image);
+
+    return 0;
+}
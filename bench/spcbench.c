@@ -0,0 +1,269 @@
+/* benchmark over a corpus from spcgen: median and p99 per file for each phase of a
+   single-file run (read, scan, place, write), batch throughput with both I/O engines,
+   and the same numbers as JSON so two versions can be compared */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../src/batch.h"
+#include "../src/readwrite.h"
+#include "../src/stats.h"
+
+#define ROUNDS 3
+
+typedef enum BenchPhase
+{
+    PHASE_READ  = 0,
+    PHASE_SCAN  = 1,
+    PHASE_PLACE = 2,
+    PHASE_WRITE = 3,
+    PHASE_TOTAL = 4,
+    PHASES      = 5
+
+} bench_phase_t;
+
+static const char *phaseNames[PHASES] = { "read", "scan", "place", "write", "total" };
+
+/* what each file's timings go into: seconds per phase, then 1 if every phase succeeded */
+typedef struct BenchRecord
+{
+    double seconds[PHASES];
+    int ok;
+
+} benchrecord_t;
+
+typedef struct BenchRun
+{
+    const spcfile_t *settings;
+    const char *outDir;
+
+} benchrun_t;
+
+typedef struct BenchStat
+{
+    double median;
+    double p99;
+    double mean;
+
+} benchstat_t;
+
+static int compareSeconds(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* the steps main() takes for one file, each timed on its own */
+static void timePhases(const char *path, void *record, void *arg)
+{
+    const benchrun_t *run = arg;
+    benchrecord_t *times = record;
+    const char *base = strrchr(path, '/');
+    char outPath[FILENAME_MAX];
+    spcfile_t file;
+    double mark[PHASES];
+    int ok;
+
+    snprintf(outPath, sizeof outPath, "%s/%s", run->outDir, base != NULL ? base + 1 : path);
+    fileInitFrom(&file, run->settings);
+
+    mark[0] = statsClock();
+    ok = fileRead(&file, path);
+    mark[1] = statsClock();
+    ok = ok && fileScan(&file);
+    mark[2] = statsClock();
+    ok = ok && echoPlace(&file);
+    mark[3] = statsClock();
+    ok = ok && fileWrite(&file, outPath);
+    mark[4] = statsClock();
+
+    freeBuffer(&file);
+
+    times->seconds[PHASE_READ] = mark[1] - mark[0];
+    times->seconds[PHASE_SCAN] = mark[2] - mark[1];
+    times->seconds[PHASE_PLACE] = mark[3] - mark[2];
+    times->seconds[PHASE_WRITE] = mark[4] - mark[3];
+    times->seconds[PHASE_TOTAL] = mark[4] - mark[0];
+    times->ok = ok;
+}
+
+static benchstat_t summarize(double *samples, size_t count)
+{
+    benchstat_t stat;
+    double total = 0;
+    size_t i = 0;
+
+    qsort(samples, count, sizeof *samples, compareSeconds);
+
+    for(; i < count; i++) total += samples[i];
+
+    stat.median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    stat.p99 = samples[(count * 99 + 99) / 100 - 1];
+    stat.mean = total / (double) count;
+
+    return stat;
+}
+
+/* runBatch() as the command line runs it, with its per-file table sent to /dev/null */
+static double batchSeconds(const char *corpus, const char *outDir, const spcfile_t *settings, int *ok)
+{
+    int saved, devNull;
+    double started;
+
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    devNull = open("/dev/null", O_WRONLY);
+
+    if(saved >= 0 && devNull >= 0) dup2(devNull, STDOUT_FILENO);
+
+    started = statsClock();
+    *ok = runBatch(corpus, outDir, 0, settings);
+    started = statsClock() - started;
+
+    fflush(stdout);
+
+    if(saved >= 0 && devNull >= 0) dup2(saved, STDOUT_FILENO);
+    if(saved >= 0) close(saved);
+    if(devNull >= 0) close(devNull);
+
+    return started;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *corpus, *resultsPath, *label;
+    char outDir[FILENAME_MAX], **paths = NULL;
+    double *samples, stdioSeconds, uringSeconds, bytes = 0;
+    benchstat_t stats[PHASES];
+    benchrecord_t *records[ROUNDS];
+    size_t count = 0, i, failed = 0;
+    int round = 0, phase, stdioOk, uringOk;
+    spcfile_t settings, uringSettings;
+    benchrun_t run;
+    FILE *results;
+
+    if(argc < 3)
+    {
+        printf("Usage: spcbench corpusdir results.json [label]\n");
+        return 1;
+    }
+
+    corpus = argv[1];
+    resultsPath = argv[2];
+    label = argc > 3 ? argv[3] : "";
+
+    snprintf(outDir, sizeof outDir, "%s/out", corpus);
+
+    if(mkdir(outDir, 0755) != 0 && errno != EEXIST)
+    {
+        printf("Unable to create %s!\n", outDir);
+        return 1;
+    }
+
+    /* the settings a typical run uses: every echo value set, buffer placed automatically */
+    fileInit(&settings, POLICY_FIX);
+    settings.quiet = 1;
+    valueSet(&settings, 'l', 0x40);
+    valueSet(&settings, 'r', 0x40);
+    valueSet(&settings, 'f', 0x30);
+    valueSet(&settings, 't', 6);
+    valueSet(&settings, 'c', 0xFF);
+
+    run.settings = &settings;
+    run.outDir = outDir;
+
+    /* one worker, so the phases aren't competing with each other for the disk */
+    for(; round < ROUNDS; round++)
+    {
+        size_t roundCount;
+
+        if(round > 0)
+        {
+            for(i = 0; i < count; i++) free(paths[i]);
+            free(paths);
+        }
+
+        if((records[round] = batchEach(corpus, 1, sizeof(benchrecord_t), timePhases, &run, &paths, &roundCount)) == NULL)
+        {
+            while(round-- > 0) free(records[round]);
+            return 1;
+        }
+
+        count = roundCount;
+    }
+
+    if((samples = malloc(count * ROUNDS * sizeof *samples)) == NULL) return 1;
+
+    for(phase = 0; phase < PHASES; phase++)
+    {
+        size_t n = 0;
+
+        for(round = 0; round < ROUNDS; round++)
+        {
+            for(i = 0; i < count; i++) samples[n++] = records[round][i].seconds[phase];
+        }
+
+        stats[phase] = summarize(samples, n);
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        struct stat st;
+
+        if(!records[0][i].ok) failed++;
+        if(stat(paths[i], &st) == 0) bytes += (double) st.st_size;
+    }
+
+    uringSettings = settings;
+    uringSettings.ioUring = 1;
+
+    stdioSeconds = batchSeconds(corpus, outDir, &settings, &stdioOk);
+    uringSeconds = batchSeconds(corpus, outDir, &uringSettings, &uringOk);
+
+    printf("\n%lu files in %s, %d rounds, %lu failed\n\n", (unsigned long) count, corpus, ROUNDS, (unsigned long) failed);
+    printf("%-8s %12s %12s %12s\n", "phase", "median us", "p99 us", "mean us");
+
+    for(phase = 0; phase < PHASES; phase++)
+        printf("%-8s %12.2f %12.2f %12.2f\n", phaseNames[phase], stats[phase].median * 1e6, stats[phase].p99 * 1e6, stats[phase].mean * 1e6);
+
+    printf("\nbatch, stdio:    %9.1f files/sec %8.1f MB/sec%s\n", (double) count / stdioSeconds, bytes / stdioSeconds / 1e6,
+           stdioOk ? "" : "  (failures)");
+    printf("batch, io_uring: %9.1f files/sec %8.1f MB/sec%s\n", (double) count / uringSeconds, bytes / uringSeconds / 1e6,
+           uringOk ? "" : "  (failures)");
+
+    if((results = fopen(resultsPath, "w")) == NULL)
+    {
+        printf("Unable to write %s!\n", resultsPath);
+    }
+    else
+    {
+        fprintf(results, "{\n  \"label\": \"%s\",\n  \"files\": %lu,\n  \"rounds\": %d,\n  \"failed\": %lu,\n  \"phases\": {\n",
+                label, (unsigned long) count, ROUNDS, (unsigned long) failed);
+
+        for(phase = 0; phase < PHASES; phase++)
+            fprintf(results, "    \"%s\": { \"median_us\": %.3f, \"p99_us\": %.3f, \"mean_us\": %.3f }%s\n", phaseNames[phase],
+                    stats[phase].median * 1e6, stats[phase].p99 * 1e6, stats[phase].mean * 1e6, phase + 1 < PHASES ? "," : "");
+
+        fprintf(results, "  },\n  \"batch\": {\n");
+        fprintf(results, "    \"stdio\": { \"files_per_sec\": %.1f, \"mb_per_sec\": %.2f },\n",
+                (double) count / stdioSeconds, bytes / stdioSeconds / 1e6);
+        fprintf(results, "    \"uring\": { \"files_per_sec\": %.1f, \"mb_per_sec\": %.2f }\n  }\n}\n",
+                (double) count / uringSeconds, bytes / uringSeconds / 1e6);
+
+        fclose(results);
+        printf("\nresults written to %s\n", resultsPath);
+    }
+
+    for(i = 0; i < count; i++) free(paths[i]);
+    for(round = 0; round < ROUNDS; round++) free(records[round]);
+    free(paths);
+    free(samples);
+
+    return failed == 0 && stdioOk && uringOk ? 0 : 1;
+}
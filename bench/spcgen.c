@@ -0,0 +1,203 @@
+/* seeded generator for a corpus of synthetic but well-formed .spc files, for the benchmarks:
+   ID666 header, driver code and song data, a sample directory with BRR chains of varying
+   density, an 0x00/0xFF tail (sometimes holding an enabled echo buffer) and a DSP page
+   that agrees with all of it. The same seed always writes the same files */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "../src/dspregs.h"
+#include "../src/spcecho.h"
+
+#define SPC_SIZE (ADDRESS_OFFSET + 0x100)
+
+/* xorshift64*: small, seedable and the same everywhere */
+static unsigned long long rngState;
+
+static unsigned long long rngNext(void)
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+
+    return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+static int rngRange(int low, int high)
+{
+    return low + (int) (rngNext() % (unsigned long long) (high - low + 1));
+}
+
+static void putText(unsigned char *spc, int offset, int length, const char *text)
+{
+    memset(spc + offset, 0, (size_t) length);
+    memcpy(spc + offset, text, strlen(text) < (size_t) length ? strlen(text) : (size_t) length);
+}
+
+static void header(unsigned char *spc, int number, unsigned seed, int codeStart)
+{
+    char text[64];
+
+    memcpy(spc, "SNES-SPC700 Sound File Data v0.30", 33);
+    spc[0x21] = spc[0x22] = 26;
+    spc[0x23] = 26;                 /* ID666 present */
+    spc[0x24] = 30;
+
+    spc[0x25] = (unsigned char) (codeStart & 0xFF);
+    spc[0x26] = (unsigned char) (codeStart >> 8);
+    spc[0x2B] = 0xEF;               /* SP */
+
+    snprintf(text, sizeof text, "Synthetic %d", number);
+    putText(spc, 0x2E, 32, text);
+    putText(spc, 0x4E, 32, "spcgen");
+    putText(spc, 0x6E, 16, "bench");
+    snprintf(text, sizeof text, "seed %u", seed);
+    putText(spc, 0x7E, 32, text);
+    putText(spc, 0x9E, 11, "01/01/2000");
+    snprintf(text, sizeof text, "%03d", rngRange(60, 240));
+    putText(spc, 0xA9, 3, text);
+    putText(spc, 0xAC, 5, "10000");
+    putText(spc, 0xB1, 32, "spcgen");
+}
+
+/* one sample's BRR chain at ram[start]; sparse samples are mostly silent blocks */
+static int brrChain(unsigned char *ram, int start, int blocks, int density, int loops)
+{
+    int block = 0, i;
+
+    for(; block < blocks; block++)
+    {
+        unsigned char *at = ram + start + block * 9;
+        int silent = rngRange(0, 99) >= density;
+
+        at[0] = (unsigned char) (silent ? 0x00 : (rngRange(1, 12) << 4 | rngRange(0, 3) << 2));
+
+        for(i = 1; i < 9; i++) at[i] = silent ? 0x00 : (unsigned char) rngNext();
+    }
+
+    ram[start + (blocks - 1) * 9] |= (unsigned char) (loops ? 0x03 : 0x01);
+
+    return start + blocks * 9;
+}
+
+static void generate(unsigned char *spc, int number, unsigned seed)
+{
+    unsigned char *ram = spc + RAM_OFFSET, *dsp = spc + ADDRESS_OFFSET;
+    int codeStart = 0x0200 + rngRange(0, 0x20) * 0x10;
+    int codeEnd = codeStart + rngRange(0x0800, 0x2000);
+    int directory = (codeEnd + 0xFF) >> 8;
+    int samples = rngRange(4, 48);
+    int density = rngRange(30, 100), budget = rngRange(0x1000, 0x9000);
+    int next = (directory << 8) + samples * 4, i, edl = 0, esa = 0;
+    unsigned char tail = rngRange(0, 3) == 0 ? 0xFF : 0x00;
+
+    memset(spc, 0, SPC_SIZE);
+    header(spc, number, seed, codeStart);
+
+    /* direct page, stack and driver code with its song data are just busy bytes */
+    for(i = 0; i < 0xF0; i++) ram[i] = (unsigned char) rngNext();
+    for(i = 0x0100; i < 0x0200; i++) ram[i] = (unsigned char) (rngRange(0, 3) == 0 ? rngNext() : 0);
+    for(i = codeStart; i < codeEnd; i++) ram[i] = (unsigned char) rngNext();
+
+    for(i = 0; i < samples; i++)
+    {
+        int blocks = rngRange(8, budget / 9 / samples + 8), start = next, loops = rngRange(0, 1), loop;
+
+        if(next + blocks * 9 > 0xD000) blocks = (0xD000 - next) / 9;
+        if(blocks < 1) blocks = 1;
+
+        next = brrChain(ram, start, blocks, density, loops);
+        loop = start + (loops ? rngRange(0, blocks - 1) * 9 : 0);
+
+        ram[(directory << 8) + i * 4] = (unsigned char) (start & 0xFF);
+        ram[(directory << 8) + i * 4 + 1] = (unsigned char) (start >> 8);
+        ram[(directory << 8) + i * 4 + 2] = (unsigned char) (loop & 0xFF);
+        ram[(directory << 8) + i * 4 + 3] = (unsigned char) (loop >> 8);
+    }
+
+    /* what is left is the 00h/FFh tail, sometimes with the song's own echo buffer at the top */
+    memset(ram + next, tail, (size_t) (0x10000 - next));
+
+    if(rngRange(0, 2) == 0)
+    {
+        edl = rngRange(1, 4);
+        esa = 0x100 - edl * 8;
+
+        if((esa << 8) > next) for(i = esa << 8; i < 0x10000; i++) ram[i] = (unsigned char) (rngRange(0, 7) == 0 ? rngNext() : 0);
+        else edl = esa = 0;
+    }
+
+    for(i = 0; i < 8; i++)
+    {
+        dsp[i << 4 | 0x00] = dsp[i << 4 | 0x01] = (unsigned char) rngRange(0x20, 0x7F);
+        dsp[i << 4 | 0x02] = (unsigned char) rngNext();
+        dsp[i << 4 | 0x03] = (unsigned char) rngRange(0x04, 0x20);
+        dsp[i << 4 | 0x04] = (unsigned char) rngRange(0, samples - 1);
+        dsp[i << 4 | 0x05] = 0x8F;
+        dsp[i << 4 | 0x06] = 0xE0;
+        dsp[i << 4 | 0x07] = 0x7F;
+        dsp[i << 4 | 0x0F] = i == 0 ? 0x7F : 0x00;
+    }
+
+    dsp[DSP_MVOLL] = dsp[DSP_MVOLR] = 0x7F;
+    dsp[DSP_EVOLL] = dsp[DSP_EVOLR] = (unsigned char) (edl ? rngRange(0x10, 0x40) : 0);
+    dsp[DSP_EFB] = (unsigned char) (edl ? rngRange(0x10, 0x60) : 0);
+    dsp[DSP_EON] = (unsigned char) (edl ? rngRange(1, 0xFF) : 0);
+    dsp[DSP_DIR] = (unsigned char) directory;
+    dsp[DSP_FLG] = (unsigned char) (edl ? 0x00 : FLG_ECHO_OFF);
+    dsp[DSP_ESA] = (unsigned char) esa;
+    dsp[DSP_EDL] = (unsigned char) edl;
+
+    /* the extra RAM behind the IPL ROM */
+    memset(spc + ADDRESS_OFFSET + 0xC0, tail, 0x40);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char *spc;
+    char path[FILENAME_MAX];
+    long count;
+    unsigned seed;
+    int i = 0;
+
+    if(argc < 4 || (count = strtol(argv[2], NULL, 10)) < 1)
+    {
+        printf("Usage: spcgen directory count seed\n");
+        return 1;
+    }
+
+    seed = (unsigned) strtoul(argv[3], NULL, 10);
+    rngState = 0x9E3779B97F4A7C15ULL ^ seed;
+
+    if(mkdir(argv[1], 0755) != 0 && errno != EEXIST)
+    {
+        printf("Unable to create %s!\n", argv[1]);
+        return 1;
+    }
+
+    if((spc = malloc(SPC_SIZE)) == NULL) return 1;
+
+    for(; i < count; i++)
+    {
+        FILE *out;
+
+        generate(spc, i, seed);
+        snprintf(path, sizeof path, "%s/gen%05d.spc", argv[1], i);
+
+        if((out = fopen(path, "wb")) == NULL || fwrite(spc, 1, SPC_SIZE, out) != SPC_SIZE || fclose(out) != 0)
+        {
+            printf("Unable to write %s!\n", path);
+            free(spc);
+            return 1;
+        }
+    }
+
+    printf("%ld synthetic .spc files in %s (seed %u)\n", count, argv[1], seed);
+
+    free(spc);
+
+    return 0;
+}
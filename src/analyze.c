@@ -0,0 +1,734 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "analyze.h"
+#include "disasm.h"
+#include "dspregs.h"
+#include "stats.h"
+
+/* states kept apart at one address before new ones are merged into the last of them.
+   Enough to follow a loop over the eight voices without losing the register numbers */
+#define PATHS 8
+
+/* distinct DSP stores kept while walking, before they are narrowed to echo registers */
+#define STORE_CAP 1024
+
+/* $FFC0-$FFFF is the IPL ROM; nothing a driver runs lives there */
+#define ROM_START 0xFFC0
+
+#define DSP_ADDR 0xF2
+#define DSP_DATA 0xF3
+
+#define STACK_DEPTH 4
+
+enum { R_A, R_X, R_Y, R_DSP, REGS };
+
+/* what the walk knows at one instruction; -1 wherever it doesn't */
+typedef struct WalkState
+{
+    int pc;
+    int reg[REGS];              /* A, X, Y and the DSP register number last put in $F2 */
+    int from[REGS];             /* instruction that loaded each straight from an immediate */
+    int bits[REGS];             /* bits each could have set, which bounds jump table indexes */
+    int stack[STACK_DEPTH];     /* values PUSHed since the routine began, newest last */
+    int depth;
+    int p;                      /* direct page 0 or 1 */
+    int guessed;                /* reached through a jump table that had to be guessed */
+
+} walkstate_t;
+
+typedef struct WalkSite
+{
+    int count;
+    walkstate_t states[PATHS];
+
+} walksite_t;
+
+typedef struct Walker
+{
+    const unsigned char *ram;
+    spcanalysis_t *analysis;
+
+    int *siteIndex;                 /* 64k entries into sites, -1 before an address is reached */
+    walksite_t *sites;
+    int siteCount, siteCapacity;
+
+    walkstate_t *work;
+    size_t workCount, workCapacity;
+
+    spcdspwrite_t *stores;
+    int storeCount;
+
+    unsigned char storeSites[0x2000];
+    int outOfMemory;
+
+} walker_t;
+
+static const char *firNames[8] = { "FIR0", "FIR1", "FIR2", "FIR3", "FIR4", "FIR5", "FIR6", "FIR7" };
+
+int spcechoIsEchoRegister(int reg)
+{
+    switch(reg)
+    {
+    case DSP_EVOLL: case DSP_EVOLR: case DSP_EFB: case DSP_EON: case DSP_FLG: case DSP_ESA: case DSP_EDL:
+        return 1;
+
+    default:
+        return reg >= 0 && reg < 0x80 && (reg & 0x0F) == 0x0F;
+    }
+}
+
+const char *spcechoRegisterName(int reg)
+{
+    switch(reg)
+    {
+    case DSP_EVOLL: return "EVOLL";
+    case DSP_EVOLR: return "EVOLR";
+    case DSP_EFB: return "EFB";
+    case DSP_EON: return "EON";
+    case DSP_FLG: return "FLG";
+    case DSP_ESA: return "ESA";
+    case DSP_EDL: return "EDL";
+
+    default:
+        if(reg >= 0 && reg < 0x80 && (reg & 0x0F) == 0x0F) return firNames[reg >> 4];
+        return "?";
+    }
+}
+
+static void forget(walkstate_t *s, int r)
+{
+    s->reg[r] = s->from[r] = -1;
+    s->bits[r] = 0xFF;
+}
+
+/* keeps what both states agree on. Returns 1 if into lost anything */
+static int merge(walkstate_t *into, const walkstate_t *s)
+{
+    int changed = 0, i = 0;
+
+    for(; i < REGS; i++)
+    {
+        if(into->reg[i] != s->reg[i] && into->reg[i] >= 0) { into->reg[i] = -1; changed = 1; }
+        if(into->from[i] != s->from[i] && into->from[i] >= 0) { into->from[i] = -1; changed = 1; }
+        if((into->bits[i] | s->bits[i]) != into->bits[i]) { into->bits[i] |= s->bits[i]; changed = 1; }
+    }
+
+    if(into->depth != s->depth && into->depth >= 0) { into->depth = -1; changed = 1; }
+
+    for(i = 0; i < STACK_DEPTH; i++)
+        if(into->stack[i] != s->stack[i] && into->stack[i] >= 0) { into->stack[i] = -1; changed = 1; }
+
+    if(into->p != s->p && into->p >= 0) { into->p = -1; changed = 1; }
+    if(s->guessed && !into->guessed) { into->guessed = 1; changed = 1; }
+
+    return changed;
+}
+
+/* 1 if the state is new at its address and has to be walked. Once an address holds PATHS
+   states, later ones are merged into the last, which can only lose knowledge, so every
+   address is walked a bounded number of times */
+static int visit(walker_t *w, walkstate_t *s)
+{
+    walksite_t *site;
+    int i = 0;
+
+    if(w->siteIndex[s->pc] < 0)
+    {
+        if(w->siteCount == w->siteCapacity)
+        {
+            int capacity = w->siteCapacity ? w->siteCapacity * 2 : 512;
+            walksite_t *grown = realloc(w->sites, (size_t) capacity * sizeof *grown);
+
+            if(grown == NULL)
+            {
+                w->outOfMemory = 1;
+                return 0;
+            }
+
+            w->sites = grown;
+            w->siteCapacity = capacity;
+        }
+
+        w->siteIndex[s->pc] = w->siteCount;
+        w->sites[w->siteCount++].count = 0;
+    }
+
+    site = &w->sites[w->siteIndex[s->pc]];
+
+    for(; i < site->count; i++)
+        if(memcmp(&site->states[i], s, sizeof *s) == 0) return 0;
+
+    if(site->count < PATHS) site->states[site->count++] = *s;
+    else if(merge(&site->states[PATHS - 1], s)) *s = site->states[PATHS - 1];
+    else return 0;
+
+    w->analysis->states++;
+
+    return 1;
+}
+
+static void push(walker_t *w, const walkstate_t *s, int pc)
+{
+    if(pc >= ROM_START) return;
+
+    if(w->workCount == w->workCapacity)
+    {
+        size_t capacity = w->workCapacity ? w->workCapacity * 2 : 256;
+        walkstate_t *grown = realloc(w->work, capacity * sizeof *grown);
+
+        if(grown == NULL)
+        {
+            w->outOfMemory = 1;
+            return;
+        }
+
+        w->work = grown;
+        w->workCapacity = capacity;
+    }
+
+    w->work[w->workCount] = *s;
+    w->work[w->workCount++].pc = pc;
+}
+
+static int word(const unsigned char *ram, int addr)
+{
+    return ram[addr & 0xFFFF] | ram[(addr + 1) & 0xFFFF] << 8;
+}
+
+/* the address an instruction writes, -1 if it depends on something the walk doesn't know */
+static int storeAddress(const walkstate_t *s, const opinfo_t *op, int b1, int b2)
+{
+    int page = s->p << 8;
+
+    switch(op->store)
+    {
+    case STORE_ABS:  return b1 | b2 << 8;
+    case STORE_ABSX: return s->reg[R_X] < 0 ? -1 : ((b1 | b2 << 8) + s->reg[R_X]) & 0xFFFF;
+    case STORE_ABSY: return s->reg[R_Y] < 0 ? -1 : ((b1 | b2 << 8) + s->reg[R_Y]) & 0xFFFF;
+    case STORE_BIT:  return (b1 | b2 << 8) & 0x1FFF;
+    }
+
+    if(s->p < 0) return -1;
+
+    switch(op->store)
+    {
+    case STORE_DP:
+    case STORE_DPW:  return page | b1;
+    case STORE_DP2:  return page | b2;
+    case STORE_DPX:  return s->reg[R_X] < 0 ? -1 : page | ((b1 + s->reg[R_X]) & 0xFF);
+    case STORE_DPY:  return s->reg[R_Y] < 0 ? -1 : page | ((b1 + s->reg[R_Y]) & 0xFF);
+    case STORE_IX:   return s->reg[R_X] < 0 ? -1 : page | s->reg[R_X];
+
+    default: return -1;
+    }
+}
+
+/* a store that could land anywhere in the direct page might have hit $F2 */
+static int mayHitDirectPage(const opinfo_t *op)
+{
+    switch(op->store)
+    {
+    case STORE_DP: case STORE_DP2: case STORE_DPX: case STORE_DPY: case STORE_IX: case STORE_DPW:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+static void recordStore(walker_t *w, const walkstate_t *s, int data, int immediate)
+{
+    spcdspwrite_t *store;
+    int pc = s->pc, i = 0;
+
+    w->storeSites[pc >> 3] |= (unsigned char) (1 << (pc & 7));
+
+    for(; i < w->storeCount; i++)
+    {
+        store = &w->stores[i];
+        if(store->pc == pc && store->reg == s->reg[R_DSP] && store->data == data && store->regFrom == s->from[R_DSP]) return;
+    }
+
+    if(w->storeCount == STORE_CAP)
+    {
+        w->analysis->truncated = 1;
+        return;
+    }
+
+    store = &w->stores[w->storeCount++];
+    store->pc = pc;
+    store->reg = s->reg[R_DSP];
+    store->data = data;
+    store->regFrom = s->from[R_DSP];
+    store->patchAt = -1;
+    store->pin = PIN_NONE;
+
+    /* a constant written straight to $F3 can be replaced; otherwise the register
+       number can be pushed into the ignored $80-$FF range where it was loaded */
+    if(immediate && store->reg >= 0)
+    {
+        store->patchAt = (pc + 1) & 0xFFFF;
+        store->pin = PIN_VALUE;
+    }
+    else if(store->regFrom >= 0)
+    {
+        store->patchAt = (store->regFrom + 1) & 0xFFFF;
+        store->pin = PIN_MUTE;
+    }
+}
+
+/* the register a MOV to memory stores, -1 if the instruction isn't one */
+static int storedRegister(int opcode)
+{
+    switch(opcode)
+    {
+    case 0xC4: case 0xC5: case 0xC6: case 0xC7: case 0xD4: case 0xD5: case 0xD6: case 0xD7: case 0xAF:
+        return R_A;
+
+    case 0xD8: case 0xC9: case 0xD9:
+        return R_X;
+
+    case 0xCB: case 0xCC: case 0xDB:
+        return R_Y;
+
+    default:
+        return -1;
+    }
+}
+
+/* follows writes to the DSP address and data ports */
+static void storeEffects(walker_t *w, walkstate_t *s, const opinfo_t *op, int opcode, int b1, int b2)
+{
+    int addr, r = storedRegister(opcode);
+
+    if(op->store == STORE_NONE) return;
+
+    if((addr = storeAddress(s, op, b1, b2)) < 0)
+    {
+        if(mayHitDirectPage(op)) forget(s, R_DSP);
+        return;
+    }
+
+    /* MOVW $F2, YA sets the register with A and writes Y to it in one go */
+    if(op->store == STORE_DPW && (addr & 0xFF) == DSP_ADDR)
+    {
+        if(opcode == 0xDA)
+        {
+            s->reg[R_DSP] = s->reg[R_A];
+            s->from[R_DSP] = s->from[R_A];
+            recordStore(w, s, s->reg[R_Y], 0);
+        }
+        else
+        {
+            forget(s, R_DSP);
+            recordStore(w, s, -1, 0);
+        }
+
+        return;
+    }
+
+    if(op->store == STORE_DPW && (addr & 0xFF) == DSP_ADDR - 1) forget(s, R_DSP);
+
+    if(addr == DSP_ADDR)
+    {
+        int known = s->reg[R_DSP] >= 0;
+
+        if(opcode == 0x8F)
+        {
+            s->reg[R_DSP] = b1;
+            s->from[R_DSP] = s->pc;
+        }
+        else if(r >= 0)
+        {
+            s->reg[R_DSP] = s->reg[r];
+            s->from[R_DSP] = s->from[r];
+        }
+        else if(known && (opcode == 0xAB || opcode == 0xAC || opcode == 0xBB))
+        {
+            s->reg[R_DSP] = (s->reg[R_DSP] + 1) & 0xFF;
+            s->from[R_DSP] = -1;
+        }
+        else if(known && (opcode == 0x8B || opcode == 0x8C || opcode == 0x9B))
+        {
+            s->reg[R_DSP] = (s->reg[R_DSP] - 1) & 0xFF;
+            s->from[R_DSP] = -1;
+        }
+        else forget(s, R_DSP);
+    }
+    else if(addr == DSP_DATA)
+    {
+        if(opcode == 0x8F) recordStore(w, s, b1, 1);
+        else recordStore(w, s, r >= 0 ? s->reg[r] : -1, 0);
+    }
+}
+
+static void setRegister(walkstate_t *s, int r, int value)
+{
+    s->reg[r] = value < 0 ? -1 : value & 0xFF;
+    s->from[r] = -1;
+    s->bits[r] = value < 0 ? 0xFF : value & 0xFF;
+}
+
+static void loadImmediate(walkstate_t *s, int r, int value)
+{
+    s->reg[r] = s->bits[r] = value;
+    s->from[r] = s->pc;
+}
+
+/* a result known only by which bits it can have */
+static void setBits(walkstate_t *s, int r, int bits)
+{
+    s->reg[r] = s->from[r] = -1;
+    s->bits[r] = bits & 0xFF;
+}
+
+/* value plus by, or unknown */
+static int offset(const walkstate_t *s, int r, int by)
+{
+    return s->reg[r] < 0 ? -1 : s->reg[r] + by;
+}
+
+static void copyRegister(walkstate_t *s, int to, int r)
+{
+    s->reg[to] = s->reg[r];
+    s->from[to] = s->from[r];
+    s->bits[to] = s->bits[r];
+}
+
+static void pushValue(walkstate_t *s, int value)
+{
+    if(s->depth < 0) return;
+
+    if(s->depth == STACK_DEPTH)
+    {
+        memmove(s->stack, s->stack + 1, (STACK_DEPTH - 1) * sizeof *s->stack);
+        s->depth--;
+    }
+
+    s->stack[s->depth++] = value;
+}
+
+static int popValue(walkstate_t *s)
+{
+    int value;
+
+    if(s->depth <= 0) return -1;
+
+    value = s->stack[--s->depth];
+    s->stack[s->depth] = -1;
+
+    return value;
+}
+
+/* register moves, immediates and the simple arithmetic a driver does on a register number
+   (OR A, #n on a voice's base, XCN A, shifts) */
+static void registerEffects(walkstate_t *s, const opinfo_t *op, int opcode, int b1)
+{
+    int a = s->reg[R_A], bits = s->bits[R_A];
+
+    switch(opcode)
+    {
+    case 0xE8: loadImmediate(s, R_A, b1); return;
+    case 0xCD: loadImmediate(s, R_X, b1); return;
+    case 0x8D: loadImmediate(s, R_Y, b1); return;
+
+    case 0x5D: copyRegister(s, R_X, R_A); return;
+    case 0x7D: copyRegister(s, R_A, R_X); return;
+    case 0xFD: copyRegister(s, R_Y, R_A); return;
+    case 0xDD: copyRegister(s, R_A, R_Y); return;
+
+    case 0xBC: setRegister(s, R_A, offset(s, R_A, 1)); return;
+    case 0x9C: setRegister(s, R_A, offset(s, R_A, -1)); return;
+    case 0x3D: setRegister(s, R_X, offset(s, R_X, 1)); return;
+    case 0x1D: setRegister(s, R_X, offset(s, R_X, -1)); return;
+    case 0xFC: setRegister(s, R_Y, offset(s, R_Y, 1)); return;
+    case 0xDC: setRegister(s, R_Y, offset(s, R_Y, -1)); return;
+
+    case 0x08: if(a < 0) setBits(s, R_A, bits | b1); else setRegister(s, R_A, a | b1); return;
+    case 0x28: if(a < 0) setBits(s, R_A, bits & b1); else setRegister(s, R_A, a & b1); return;
+    case 0x48: if(a < 0) setBits(s, R_A, bits | b1); else setRegister(s, R_A, a ^ b1); return;
+    case 0x1C: if(a < 0) setBits(s, R_A, bits << 1); else setRegister(s, R_A, a << 1); return;
+    case 0x5C: if(a < 0) setBits(s, R_A, bits >> 1); else setRegister(s, R_A, a >> 1); return;
+    case 0x9F: if(a < 0) setBits(s, R_A, bits >> 4 | bits << 4); else setRegister(s, R_A, a >> 4 | a << 4); return;
+
+    case 0xAF: setRegister(s, R_X, offset(s, R_X, 1)); return;
+    case 0xBF: forget(s, R_A); setRegister(s, R_X, offset(s, R_X, 1)); return;
+
+    case 0x2D: pushValue(s, s->reg[R_A]); return;
+    case 0x4D: pushValue(s, s->reg[R_X]); return;
+    case 0x6D: pushValue(s, s->reg[R_Y]); return;
+    case 0x0D: pushValue(s, -1); return;
+    case 0xAE: setRegister(s, R_A, popValue(s)); return;
+    case 0xCE: setRegister(s, R_X, popValue(s)); return;
+    case 0xEE: setRegister(s, R_Y, popValue(s)); return;
+    case 0x8E: popValue(s); s->p = -1; return;
+
+    case 0x20: s->p = 0; return;
+    case 0x40: s->p = 1; return;
+    }
+
+    if(op->clobbers & CLOBBER_A) forget(s, R_A);
+    if(op->clobbers & CLOBBER_X) forget(s, R_X);
+    if(op->clobbers & CLOBBER_Y) forget(s, R_Y);
+}
+
+/* JMP [!a+X] with X unknown. The table is bounded by the bits X can have, and taken to end
+   early at an entry that is itself code or doesn't point at RAM a driver could run from.
+   Tables found in code that was only reached through a guess aren't guessed again */
+static void guessTable(walker_t *w, const walkstate_t *s, int table)
+{
+    walkstate_t entry = *s;
+    int index = 0;
+
+    w->analysis->unresolvedJumps++;
+
+    if(s->guessed) return;
+    entry.guessed = 1;
+
+    for(; index <= s->bits[R_X]; index += 2)
+    {
+        int at = (table + index) & 0xFFFF, target = word(w->ram, at);
+
+        if((index & s->bits[R_X]) != index) continue;
+
+        if(w->analysis->code[at >> 3] & (1 << (at & 7))) break;
+        if(target < 0x200 || target >= ROM_START) break;
+
+        push(w, &entry, target);
+    }
+}
+
+/* a routine starts with nothing pushed; whatever it pops from before that is unknown */
+static void pushCall(walker_t *w, const walkstate_t *s, int target)
+{
+    walkstate_t callee = *s;
+
+    memset(callee.stack, 0xFF, sizeof callee.stack);
+    callee.depth = 0;
+
+    push(w, &callee, target);
+}
+
+/* walks straight-line code from one state, queueing every other path it finds */
+static void walk(walker_t *w, walkstate_t s)
+{
+    const unsigned char *ram = w->ram;
+    spcanalysis_t *analysis = w->analysis;
+
+    while(s.pc < ROM_START && visit(w, &s))
+    {
+        int pc = s.pc, opcode = ram[pc];
+        const opinfo_t *op = disasmOp(opcode);
+        int b1 = ram[(pc + 1) & 0xFFFF], b2 = ram[(pc + 2) & 0xFFFF];
+        int next = (pc + op->length) & 0xFFFF;
+        int target = (next + (signed char) (op->length == 3 ? b2 : b1)) & 0xFFFF;
+
+        if(!(analysis->code[pc >> 3] & (1 << (pc & 7))))
+        {
+            analysis->code[pc >> 3] |= (unsigned char) (1 << (pc & 7));
+            analysis->instructions++;
+        }
+
+        storeEffects(w, &s, op, opcode, b1, b2);
+        registerEffects(&s, op, opcode, b1);
+
+        switch(op->flow)
+        {
+        case FLOW_BRANCH:
+            push(w, &s, target);
+            break;
+
+        case FLOW_BRA:
+            next = target;
+            break;
+
+        case FLOW_JMP:
+            next = b1 | b2 << 8;
+            break;
+
+        case FLOW_JMPX:
+            if(s.reg[R_X] < 0)
+            {
+                guessTable(w, &s, b1 | b2 << 8);
+                return;
+            }
+
+            next = word(ram, (b1 | b2 << 8) + s.reg[R_X]);
+            break;
+
+        case FLOW_CALL:
+        case FLOW_PCALL:
+        case FLOW_TCALL:
+            if(op->flow == FLOW_CALL) target = b1 | b2 << 8;
+            else if(op->flow == FLOW_PCALL) target = 0xFF00 | b1;
+            else target = word(ram, 0xFFDE - (opcode >> 4) * 2);
+
+            pushCall(w, &s, target);
+
+            /* the callee may leave anything in the registers and the DSP address */
+            forget(&s, R_A);
+            forget(&s, R_X);
+            forget(&s, R_Y);
+            forget(&s, R_DSP);
+            break;
+
+        case FLOW_BRK:
+            pushCall(w, &s, word(ram, 0xFFDE));
+            return;
+
+        case FLOW_RET:
+        case FLOW_STOP:
+            return;
+        }
+
+        s.pc = next;
+    }
+}
+
+/* two stores pinned through the same byte must agree on the register, or the patch would hit both.
+   FLG is never muted, since that would drop its reset, mute and noise bits too; its mute sites
+   are only let go once they have kept other registers from being muted through them */
+static void dropSharedPins(walker_t *w)
+{
+    int i = 0, j;
+
+    for(; i < w->storeCount; i++)
+    {
+        for(j = 0; j < w->storeCount && w->stores[i].pin != PIN_NONE; j++)
+        {
+            if(w->stores[j].patchAt != w->stores[i].patchAt || w->stores[j].reg == w->stores[i].reg) continue;
+
+            w->stores[i].pin = PIN_NONE;
+            w->stores[i].patchAt = -1;
+        }
+    }
+
+    for(i = 0; i < w->storeCount; i++)
+    {
+        if(w->stores[i].reg != DSP_FLG || w->stores[i].pin != PIN_MUTE) continue;
+
+        w->stores[i].pin = PIN_NONE;
+        w->stores[i].patchAt = -1;
+    }
+}
+
+/* walks the driver from the header PC, following the DSP register number through
+   immediates, register moves and calls, and lists every store to an echo register
+   plus every store whose register couldn't be worked out */
+spcecho_error_t spcechoAnalyze(const spcecho_ctx *ctx, spcanalysis_t *analysis)
+{
+    double started = statsClock();
+    const unsigned char *header = ctx->buffer;
+    walkstate_t start;
+    walker_t *w;
+    int i = 0;
+
+    memset(analysis, 0, sizeof *analysis);
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+    if(ctx->length < ADDRESS_OFFSET + 0x80) return SPCECHO_E_TOOSHORT;
+
+    if((w = calloc(1, sizeof *w)) == NULL) return SPCECHO_E_NOMEM;
+
+    w->ram = ctx->buffer + RAM_OFFSET;
+    w->analysis = analysis;
+    w->siteIndex = malloc(0x10000 * sizeof *w->siteIndex);
+    w->stores = malloc(STORE_CAP * sizeof *w->stores);
+
+    if(w->siteIndex == NULL || w->stores == NULL) w->outOfMemory = 1;
+    else
+    {
+        memset(w->siteIndex, 0xFF, 0x10000 * sizeof *w->siteIndex);
+
+        /* the registers saved in the header are where the driver resumes. The DSP ports
+           only answer in page 0, so that's the direct page whatever the saved PSW says */
+        memset(&start, 0, sizeof start);
+        memset(start.stack, 0xFF, sizeof start.stack);
+
+        for(; i < REGS; i++) forget(&start, i);
+
+        setRegister(&start, R_A, header[0x27]);
+        setRegister(&start, R_X, header[0x28]);
+        setRegister(&start, R_Y, header[0x29]);
+
+        push(w, &start, header[0x25] | header[0x26] << 8);
+
+        while(w->workCount > 0 && !w->outOfMemory) walk(w, w->work[--w->workCount]);
+
+        dropSharedPins(w);
+
+        for(i = 0; i < w->storeCount; i++)
+        {
+            const spcdspwrite_t *store = &w->stores[i];
+
+            if(store->reg >= 0 && !spcechoIsEchoRegister(store->reg)) continue;
+
+            if(analysis->writeCount == ANALYZE_MAX_WRITES)
+            {
+                analysis->truncated = 1;
+                break;
+            }
+
+            analysis->writes[analysis->writeCount++] = *store;
+        }
+
+        for(i = 0; i < 0x2000; i++)
+            for(; w->storeSites[i]; w->storeSites[i] &= (unsigned char) (w->storeSites[i] - 1)) analysis->dspStores++;
+    }
+
+    i = w->outOfMemory;
+
+    free(w->siteIndex);
+    free(w->sites);
+    free(w->stores);
+    free(w->work);
+    free(w);
+
+    analysis->elapsed = statsClock() - started;
+
+    return i ? SPCECHO_E_NOMEM : SPCECHO_OK;
+}
+
+/* the value the context writes to a DSP register, -1 if it leaves the register alone */
+static int overriddenValue(const spcecho_ctx *ctx, int reg)
+{
+    int i = 0;
+
+    for(; i < 6; i++)
+        if(ctx->addresses[i].overwrite && ctx->addresses[i].address == ADDRESS_OFFSET + reg) return ctx->addresses[i].value;
+
+    if(ctx->firOverwrite && (reg & 0x0F) == 0x0F && reg < 0x80) return (unsigned char) ctx->fir[reg >> 4];
+
+    return -1;
+}
+
+/* rewrites the driver's own stores to the registers the context sets, so the values written
+   to the DSP page aren't undone once the song starts. FLG only has its echo-disable bit
+   cleared, the same bit spcechoPatch() clears. Returns the number of bytes changed */
+int spcechoPinWrites(spcecho_ctx *ctx, const spcanalysis_t *analysis)
+{
+    unsigned char *ram = ctx->buffer + RAM_OFFSET;
+    int pinned = 0, i = 0;
+
+    for(; i < analysis->writeCount; i++)
+    {
+        const spcdspwrite_t *write = &analysis->writes[i];
+        int before, value;
+
+        if(write->pin == PIN_NONE) continue;
+
+        before = ram[write->patchAt];
+
+        if(write->reg == DSP_FLG) ram[write->patchAt] &= (unsigned char) ~FLG_ECHO_OFF;
+        else if((value = overriddenValue(ctx, write->reg)) >= 0)
+        {
+            if(write->pin == PIN_VALUE) ram[write->patchAt] = (unsigned char) value;
+            else ram[write->patchAt] |= 0x80;
+        }
+
+        if(ram[write->patchAt] != before) pinned++;
+    }
+
+    return pinned;
+}
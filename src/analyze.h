@@ -0,0 +1,51 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include "spcecho.h"
+
+#define ANALYZE_MAX_WRITES 128
+
+/* how a driver's DSP write can be pinned without moving any code */
+typedef enum SpcPin
+{
+    PIN_NONE  = 0,
+    PIN_VALUE = 1,      /* MOV $F3, #imm: the immediate becomes our value */
+    PIN_MUTE  = 2       /* the register number loaded for $F2 gets bit 7 set, so the write goes nowhere */
+
+} spc_pin_t;
+
+/* a $F3 store the analyzer reached, to an echo register or to one it couldn't pin down */
+typedef struct SpcDspWrite
+{
+    int pc;                 /* the storing instruction */
+    int reg;                /* DSP register, -1 if not known */
+    int data;               /* value stored, -1 if not constant */
+    int regFrom;            /* instruction that loaded the register number, -1 if not an immediate */
+    int patchAt;            /* RAM byte pinning changes, -1 if it can't be pinned */
+    spc_pin_t pin;
+
+} spcdspwrite_t;
+
+typedef struct SpcAnalysis
+{
+    int instructions;           /* distinct instruction addresses reached from the header PC */
+    int states;                 /* (address, known registers) pairs walked */
+    int dspStores;              /* distinct instructions that store to $F3 */
+    int unresolvedJumps;        /* JMP [!a+X] whose table had to be guessed */
+    int truncated;              /* more writes than fit in writes[] */
+    double elapsed;             /* wall-clock seconds spent walking */
+
+    spcdspwrite_t writes[ANALYZE_MAX_WRITES];
+    int writeCount;
+
+    unsigned char code[0x2000];     /* bitmap of instruction start addresses */
+
+} spcanalysis_t;
+
+int spcechoIsEchoRegister(int reg);
+const char *spcechoRegisterName(int reg);
+
+spcecho_error_t spcechoAnalyze(const spcecho_ctx *ctx, spcanalysis_t *analysis);
+int spcechoPinWrites(spcecho_ctx *ctx, const spcanalysis_t *analysis);
+
+#endif /*ANALYZE_H*/
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "apply.h"
+#include "delta.h"
+#include "stats.h"
+
+static int sameFile(const struct stat *source, const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 && st.st_dev == source->st_dev && st.st_ino == source->st_ino;
+}
+
+/* replays every record in one patch file, or stdin for "-", onto copies of the source */
+static void applyStream(FILE *in, const char *patchName, const spcecho_ctx *source, unsigned long long hash,
+                        const struct stat *sourceStat, const char *dir, unsigned char *scratch,
+                        unsigned long *applied, unsigned long *failed)
+{
+    spcecho_ctx ctx;
+    int c;
+
+    spcechoInit(&ctx);
+
+    while((c = getc(in)) != EOF)
+    {
+        char outPath[FILENAME_MAX];
+        const char *name;
+        spcdelta_t delta;
+        spcecho_error_t err;
+
+        ungetc(c, in);
+
+        memcpy(scratch, source->buffer, source->length);
+        ctx.buffer = scratch;
+        ctx.length = source->length;
+
+        if((err = spcechoDeltaApply(&ctx, hash, in, &delta)) == SPCECHO_E_READ)
+        {
+            printf("%s: not a patch or cut short!\n", patchName);
+            (*failed)++;
+            break;
+        }
+
+        /* the name is only ever a file name inside the output directory */
+        name = strrchr(delta.name, '/') != NULL ? strrchr(delta.name, '/') + 1 : delta.name;
+        snprintf(outPath, sizeof outPath, "%s", dir);
+        snprintf(outPath + strlen(outPath), sizeof outPath - strlen(outPath), "%s", name);
+
+        if(err == SPCECHO_OK && (name[0] == '\0' || strcmp(name, "..") == 0)) err = SPCECHO_E_ARG;
+        if(err == SPCECHO_OK && sameFile(sourceStat, outPath))
+        {
+            printf("%-8s  %s (%s: would overwrite the source, use -o)\n", "failed", outPath, patchName);
+            (*failed)++;
+            continue;
+        }
+
+        if(err == SPCECHO_OK) err = spcechoSaveFile(&ctx, outPath);
+
+        if(err != SPCECHO_OK)
+        {
+            printf("%-8s  %s (%s: %s)\n", "failed", outPath, patchName, spcechoStrerror(err));
+            (*failed)++;
+            continue;
+        }
+
+        printf("%-8s  %s (%lu change%s)\n", "written", outPath, delta.changes, delta.changes == 1 ? "" : "s");
+        (*applied)++;
+    }
+}
+
+/* apply mode: the source is read and hashed once, then each record in the patch files
+   is replayed onto a fresh copy of it and written under the name it carries */
+int runApply(const char *sourceName, char **patches, int count, const char *outDir)
+{
+    char dir[FILENAME_MAX];
+    const char *slash = strrchr(sourceName, '/');
+    unsigned char *scratch;
+    unsigned long long hash;
+    unsigned long applied = 0, failed = 0;
+    double started = statsClock();
+    struct stat sourceStat;
+    spcecho_ctx source;
+    spcecho_error_t err;
+    int i = 0;
+
+    spcechoInit(&source);
+
+    if((err = spcechoLoadFile(&source, sourceName)) != SPCECHO_OK || stat(sourceName, &sourceStat) != 0)
+    {
+        printf("%s: %s!\n", sourceName, spcechoStrerror(err != SPCECHO_OK ? err : SPCECHO_E_OPEN));
+        spcechoFree(&source);
+        return 0;
+    }
+
+    if((scratch = malloc(source.length)) == NULL)
+    {
+        printf("Unable to allocate memory for file!\n");
+        spcechoFree(&source);
+        return 0;
+    }
+
+    if(outDir != NULL) snprintf(dir, sizeof dir, "%s/", outDir);
+    else snprintf(dir, sizeof dir, "%.*s", slash != NULL ? (int) (slash - sourceName + 1) : 0, sourceName);
+
+    hash = spcechoHash(source.buffer, source.length);
+
+    printf("\n%-8s  file\n", "status");
+
+    for(; i < count; i++)
+    {
+        FILE *in = strcmp(patches[i], "-") == 0 ? stdin : fopen(patches[i], "rb");
+
+        if(in == NULL)
+        {
+            printf("%s: %s!\n", patches[i], spcechoStrerror(SPCECHO_E_OPEN));
+            failed++;
+            continue;
+        }
+
+        applyStream(in, patches[i], &source, hash, &sourceStat, dir, scratch, &applied, &failed);
+
+        if(in != stdin) fclose(in);
+    }
+
+    printf("\n%lu patch%s applied, %lu failed in %.3f s\n", applied, applied == 1 ? "" : "es", failed,
+           statsClock() - started);
+
+    free(scratch);
+    spcechoFree(&source);
+
+    return failed == 0;
+}
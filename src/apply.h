@@ -0,0 +1,6 @@
+#ifndef APPLY_H
+#define APPLY_H
+
+int runApply(const char *sourceName, char **patches, int count, const char *outDir);
+
+#endif /*APPLY_H*/
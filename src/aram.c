@@ -0,0 +1,247 @@
+#include <string.h>
+
+#include "aram.h"
+#include "brr.h"
+#include "dspregs.h"
+#include "scan.h"
+
+static const char *typeNames[ARAM_TYPES] =
+{
+    "free",
+    "echo",
+    "code/data",
+    "samples",
+    "directory",
+    "stack",
+    "direct page",
+};
+
+static const char typeLetters[ARAM_TYPES] = { '.', 'e', 'C', 'S', 'D', 's', 'Z' };
+
+/* chain walks are cached by start address: directories often point several entries
+   (and loop points) at the same blocks */
+#define CHAIN_CACHE 512
+
+typedef struct ChainResult
+{
+    unsigned int start;         /* key + 1, 0 means empty slot */
+    unsigned int end;
+    unsigned short blocks;
+    char loops;
+    char valid;
+
+} chain_result_t;
+
+typedef struct ChainCache
+{
+    chain_result_t slots[CHAIN_CACHE];
+
+} chain_cache_t;
+
+static const chain_result_t *walkChain(chain_cache_t *cache, const unsigned char *ram, unsigned int start)
+{
+    unsigned int slot = (start * 2654435761u) >> 23 & (CHAIN_CACHE - 1);
+    unsigned int address = start;
+    chain_result_t *result;
+
+    while(cache->slots[slot].start != 0 && cache->slots[slot].start != start + 1) slot = (slot + 1) & (CHAIN_CACHE - 1);
+
+    result = &cache->slots[slot];
+    if(result->start == start + 1) return result;
+
+    result->start = start + 1;
+    result->blocks = 0;
+    result->valid = 0;
+    result->loops = 0;
+
+    while(address + BRR_BLOCK <= 0x10000)
+    {
+        unsigned char header = ram[address];
+
+        result->blocks++;
+        address += BRR_BLOCK;
+
+        if(header & BRR_END)
+        {
+            result->valid = 1;
+            result->loops = (header & BRR_LOOP) != 0;
+            break;
+        }
+    }
+
+    result->end = address;
+
+    return result;
+}
+
+static void markPages(aram_map_t *map, unsigned int start, unsigned int end, aram_type_t type)
+{
+    unsigned int page = start >> 8;
+
+    if(end > 0x10000) end = 0x10000;
+
+    for(; page < 0x100 && (page << 8) < end; page++)
+    {
+        if(map->pageType[page] < type) map->pageType[page] = (unsigned char) type;
+    }
+}
+
+static int entryValid(const aram_map_t *map, const chain_result_t *chain, unsigned int start, unsigned int entry)
+{
+    if(start < 0x200 || !chain->valid) return 0;
+
+    /* an entry can't point back into the part of the directory read so far */
+    return !(start < entry + 4 && chain->end > (unsigned) map->directory);
+}
+
+static void readDirectory(aram_map_t *map, chain_cache_t *cache, const unsigned char *ram, const unsigned char *dsp)
+{
+    unsigned int lowestSample = 0x10000;
+    int used = 0, voice = 0, i = 0;
+
+    /* every voice's SRCN must be in the directory, whatever state its entry is in */
+    for(; voice < 8; voice++)
+    {
+        if(dsp[(voice << 4) | 0x04] + 1 > used) used = dsp[(voice << 4) | 0x04] + 1;
+    }
+
+    for(; i < 0x100; i++)
+    {
+        unsigned int entry = (unsigned) map->directory + ((unsigned) i << 2);
+        aram_sample_t *sample = &map->samples[i];
+        const chain_result_t *chain;
+
+        /* past the SRCNs in use the directory ends at the first entry that doesn't
+           lead to a BRR chain, or where sample data begins */
+        if(entry + 4 > 0x10000) break;
+        if(i >= used && entry >= lowestSample) break;
+
+        sample->start = (unsigned short) (ram[entry] | ram[entry + 1] << 8);
+        sample->loop  = (unsigned short) (ram[entry + 2] | ram[entry + 3] << 8);
+
+        chain = walkChain(cache, ram, sample->start);
+        sample->valid = (char) entryValid(map, chain, sample->start, entry);
+
+        if(!sample->valid)
+        {
+            if(i >= used) break;
+            continue;
+        }
+
+        sample->end = chain->end;
+        sample->blocks = chain->blocks;
+        sample->loops = chain->loops;
+        sample->loopEnd = sample->end;
+
+        /* a loop point outside the chain starts a chain of its own */
+        if(sample->loops && (sample->loop < sample->start || sample->loop >= sample->end))
+        {
+            const chain_result_t *loopChain = walkChain(cache, ram, sample->loop);
+
+            if(loopChain->valid) sample->loopEnd = loopChain->end;
+        }
+
+        if(sample->start < lowestSample) lowestSample = sample->start;
+
+        map->validSamples++;
+        map->entries = i + 1;
+    }
+
+    if(map->entries < used) map->entries = used;
+}
+
+/* zeroed pages wedged between code/data are usually driver variables or tables that
+   haven't been filled yet; only gaps of a whole echo step (2kb) or more count as free */
+static void closeCodeGaps(aram_map_t *map)
+{
+    int page = 1;
+
+    while(page < 0x100)
+    {
+        int start = page;
+
+        if(map->pageType[page] != ARAM_FREE || map->pageType[page - 1] != ARAM_CODE)
+        {
+            page++;
+            continue;
+        }
+
+        while(page < 0x100 && map->pageType[page] == ARAM_FREE) page++;
+
+        if(page < 0x100 && page - start < 8 && map->pageType[page] == ARAM_CODE)
+            memset(map->pageType + start, ARAM_CODE, (size_t) (page - start));
+    }
+}
+
+/* types every RAM page from the DSP registers, the sample directory and the page map */
+void aramMapBuild(aram_map_t *map, const unsigned char *ram, const unsigned char *dsp, const unsigned char *pageMap)
+{
+    chain_cache_t cache;
+    int page = 0, i = 0;
+
+    memset(map, 0, sizeof *map);
+    memset(&cache, 0, sizeof cache);
+
+    map->directory = dsp[DSP_DIR] << 8;
+
+    /* an echo buffer the song already writes to holds echo, not music data */
+    if(!(dsp[DSP_FLG] & FLG_ECHO_OFF))
+    {
+        int pages = (dsp[DSP_EDL] & 0x0F) ? (dsp[DSP_EDL] & 0x0F) << 3 : 1;
+
+        map->echoStart = dsp[DSP_ESA] << 8;
+        map->echoEnd = map->echoStart + (pages << 8);
+        if(map->echoEnd > 0x10000) map->echoEnd = 0x10000;
+
+        markPages(map, (unsigned) map->echoStart, (unsigned) map->echoEnd, ARAM_ECHO);
+    }
+
+    for(; page < 0x100; page++)
+    {
+        if(PAGE_USED(pageMap, page) && map->pageType[page] != ARAM_ECHO) map->pageType[page] = ARAM_CODE;
+    }
+
+    closeCodeGaps(map);
+
+    readDirectory(map, &cache, ram, dsp);
+
+    for(; i < map->entries; i++)
+    {
+        const aram_sample_t *sample = &map->samples[i];
+
+        if(!sample->valid) continue;
+
+        markPages(map, sample->start, sample->end, ARAM_SAMPLE);
+        if(sample->loopEnd != sample->end) markPages(map, sample->loop, sample->loopEnd, ARAM_SAMPLE);
+    }
+
+    /* an empty directory is filled in by the driver at runtime: keep its page */
+    markPages(map, (unsigned) map->directory,
+              (unsigned) map->directory + (map->validSamples ? (unsigned) map->entries << 2 : 0x100), ARAM_DIRECTORY);
+
+    map->pageType[0x01] = ARAM_STACK;
+    map->pageType[0x00] = ARAM_DIRECT;
+}
+
+/* page map (same layout as scanPages()) of pages an echo buffer must not touch */
+void aramBlockedPages(const aram_map_t *map, unsigned char *blockedMap)
+{
+    int page = 0;
+
+    memset(blockedMap, 0, PAGE_MAP_BYTES);
+
+    for(; page < 0x100; page++)
+    {
+        if(map->pageType[page] > ARAM_ECHO) blockedMap[page >> 3] |= (unsigned char) (1 << (page & 7));
+    }
+}
+
+const char *aramTypeName(aram_type_t type)
+{
+    return typeNames[type];
+}
+
+char aramTypeLetter(aram_type_t type)
+{
+    return typeLetters[type];
+}
@@ -0,0 +1,51 @@
+#ifndef ARAM_H
+#define ARAM_H
+
+/* what a page of SPC700 RAM is used for, most restrictive first */
+typedef enum AramType
+{
+    ARAM_FREE      = 0,     /* 00h/FFh only and claimed by nothing below */
+    ARAM_ECHO      = 1,     /* echo buffer already enabled in the snapshot, safe to reuse */
+    ARAM_CODE      = 2,     /* driver code and song data: used, not otherwise identified */
+    ARAM_SAMPLE    = 3,     /* BRR blocks reachable from the sample directory */
+    ARAM_DIRECTORY = 4,     /* sample directory at DIR * 100h */
+    ARAM_STACK     = 5,     /* page 01h */
+    ARAM_DIRECT    = 6      /* direct page and I/O registers, page 00h */
+
+} aram_type_t;
+
+#define ARAM_TYPES 7
+
+/* one sample directory entry and the BRR chain it points at */
+typedef struct AramSample
+{
+    unsigned short start;
+    unsigned short loop;
+    unsigned int end;           /* one past the block with the end flag */
+    unsigned int loopEnd;       /* end of the loop chain when it lies outside start..end */
+    unsigned short blocks;
+    char loops;                 /* end block has the loop flag */
+    char valid;                 /* chain terminates inside RAM */
+
+} aram_sample_t;
+
+typedef struct AramMap
+{
+    unsigned char pageType[0x100];
+
+    int directory;              /* DIR * 100h */
+    int entries;                /* directory entries in use */
+    int validSamples;
+    aram_sample_t samples[0x100];
+
+    int echoStart;              /* echo region enabled in the snapshot, echoEnd == echoStart if none */
+    int echoEnd;
+
+} aram_map_t;
+
+void aramMapBuild(aram_map_t *map, const unsigned char *ram, const unsigned char *dsp, const unsigned char *pageMap);
+void aramBlockedPages(const aram_map_t *map, unsigned char *blockedMap);
+const char *aramTypeName(aram_type_t type);
+char aramTypeLetter(aram_type_t type);
+
+#endif /*ARAM_H*/
@@ -0,0 +1,622 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "inflate.h"
+#include "stats.h"
+
+/* members larger than this aren't SPC sets and are refused rather than held in memory */
+#define MEMBER_LIMIT (64UL << 20)
+
+#define TAR_BLOCK 512
+
+typedef enum ArchiveType
+{
+    ARCHIVE_DIR = 0,
+    ARCHIVE_ZIP = 1,
+    ARCHIVE_TAR = 2
+
+} archive_type_t;
+
+typedef struct ArchiveMember
+{
+    char name[FILENAME_MAX];
+    time_t mtime;
+    spcinflate_t data;          /* reused from member to member */
+
+} archivemember_t;
+
+/* where a zip member went, for the central directory */
+typedef struct ZipEntry
+{
+    char *name;
+    unsigned long crc;
+    unsigned long size;
+    unsigned long offset;
+    unsigned dosTime;
+    unsigned dosDate;
+
+} zipentry_t;
+
+typedef struct ArchiveWriter
+{
+    archive_type_t type;
+    const char *path;
+    FILE *out;
+    unsigned long offset;
+    zipentry_t *entries;
+    size_t count;
+    size_t capacity;
+
+} archivewriter_t;
+
+static const char *outcomeNames[] =
+{
+    "written",
+    "fixed",
+    "forced",
+    "skipped",
+    "cached",
+    "failed",
+};
+
+static int hasExtension(const char *name, const char *extension)
+{
+    size_t length = strlen(name), extLength = strlen(extension);
+
+    return length > extLength && strcasecmp(name + length - extLength, extension) == 0;
+}
+
+int isArchive(const char *path)
+{
+    struct stat st;
+
+    return (hasExtension(path, ".zip") || hasExtension(path, ".tar")) && stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static unsigned long getLE(const unsigned char *in, int bytes)
+{
+    unsigned long value = 0;
+
+    while(bytes-- > 0) value = value << 8 | in[bytes];
+
+    return value;
+}
+
+static void putLE(unsigned char *out, unsigned long value, int bytes)
+{
+    int i = 0;
+
+    for(; i < bytes; i++) out[i] = (unsigned char) (value >> (i * 8));
+}
+
+static int readExact(FILE *in, unsigned char *buffer, size_t length)
+{
+    return fread(buffer, 1, length, in) == length;
+}
+
+static int skipBytes(FILE *in, unsigned long length)
+{
+    unsigned char scratch[4096];
+
+    while(length > 0)
+    {
+        size_t chunk = length < sizeof scratch ? length : sizeof scratch;
+
+        if(!readExact(in, scratch, chunk)) return 0;
+        length -= chunk;
+    }
+
+    return 1;
+}
+
+/* reads length bytes into the member, replacing what it held */
+static int readMember(FILE *in, archivemember_t *member, unsigned long length)
+{
+    if(length > MEMBER_LIMIT) return 0;
+
+    if(length > member->data.capacity)
+    {
+        unsigned char *grown = realloc(member->data.data, length);
+
+        if(grown == NULL) return 0;
+
+        member->data.data = grown;
+        member->data.capacity = length;
+    }
+
+    member->data.length = length;
+
+    return readExact(in, member->data.data, length);
+}
+
+static time_t fromDos(unsigned dosTime, unsigned dosDate)
+{
+    struct tm tm;
+
+    memset(&tm, 0, sizeof tm);
+    tm.tm_sec = (int) (dosTime & 0x1F) * 2;
+    tm.tm_min = (int) (dosTime >> 5) & 0x3F;
+    tm.tm_hour = (int) (dosTime >> 11);
+    tm.tm_mday = (int) (dosDate & 0x1F);
+    tm.tm_mon = (int) ((dosDate >> 5) & 0x0F) - 1;
+    tm.tm_year = (int) (dosDate >> 9) + 80;
+    tm.tm_isdst = -1;
+
+    return mktime(&tm);
+}
+
+static void toDos(time_t when, unsigned *dosTime, unsigned *dosDate)
+{
+    struct tm tm;
+
+    localtime_r(&when, &tm);
+
+    if(tm.tm_year < 80) tm.tm_year = 80, tm.tm_mon = 0, tm.tm_mday = 1, tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+
+    *dosTime = (unsigned) (tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2);
+    *dosDate = (unsigned) ((tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday);
+}
+
+/* next file in a zip, following the local headers front to back, so the central directory at
+   the end is never needed. 1: a member, 0: no more, -1: something this reader can't follow */
+static int zipNext(FILE *in, archivemember_t *member)
+{
+    for(;;)
+    {
+        unsigned char header[30];
+        unsigned long flags, method, crc, compressed, size, nameLength, extraLength;
+
+        if(!readExact(in, header, 4) || getLE(header, 4) != 0x04034B50UL) return 0;
+        if(!readExact(in, header + 4, sizeof header - 4)) return -1;
+
+        flags = getLE(header + 6, 2);
+        method = getLE(header + 8, 2);
+        crc = getLE(header + 14, 4);
+        compressed = getLE(header + 18, 4);
+        size = getLE(header + 22, 4);
+        nameLength = getLE(header + 26, 2);
+        extraLength = getLE(header + 28, 2);
+
+        if(nameLength >= sizeof member->name || !readExact(in, (unsigned char *) member->name, nameLength)) return -1;
+
+        member->name[nameLength] = '\0';
+        member->mtime = fromDos((unsigned) getLE(header + 10, 2), (unsigned) getLE(header + 12, 2));
+
+        /* encrypted, zip64, or stored with its size only in a trailing descriptor */
+        if((flags & 1) || compressed == 0xFFFFFFFFUL || size == 0xFFFFFFFFUL) return -1;
+        if(method == 0 && (flags & 8)) return -1;
+        if(!skipBytes(in, extraLength)) return -1;
+
+        if(method == 0)
+        {
+            if(!readMember(in, member, compressed)) return -1;
+        }
+        else if(method == 8)
+        {
+            member->data.length = 0;
+            member->data.limit = MEMBER_LIMIT;
+
+            if(spcechoInflate(in, &member->data) != SPCECHO_OK) return -1;
+            if(!(flags & 8) && (member->data.consumed > compressed || !skipBytes(in, compressed - member->data.consumed)))
+                return -1;
+        }
+        else return -1;
+
+        if(flags & 8)
+        {
+            unsigned char descriptor[16];
+
+            if(!readExact(in, descriptor, 12)) return -1;
+
+            /* the descriptor's signature is optional */
+            if(getLE(descriptor, 4) == 0x08074B50UL)
+            {
+                if(!readExact(in, descriptor + 12, 4)) return -1;
+                memmove(descriptor, descriptor + 4, 12);
+            }
+
+            crc = getLE(descriptor, 4);
+            size = getLE(descriptor + 8, 4);
+        }
+
+        if(member->data.length != size || spcechoCrc32(0, member->data.data, member->data.length) != crc) return -1;
+
+        if(nameLength > 0 && member->name[nameLength - 1] == '/') continue;
+
+        return 1;
+    }
+}
+
+static unsigned long octal(const unsigned char *field, int length)
+{
+    unsigned long value = 0;
+    int i = 0;
+
+    for(; i < length && (field[i] == ' ' || field[i] == '\0'); i++);
+    for(; i < length && field[i] >= '0' && field[i] <= '7'; i++) value = value << 3 | (unsigned long) (field[i] - '0');
+
+    return value;
+}
+
+/* next regular file in a tar: ustar prefixes, GNU long names and pax path records are followed */
+static int tarNext(FILE *in, archivemember_t *member)
+{
+    char longName[FILENAME_MAX] = "";
+
+    for(;;)
+    {
+        unsigned char header[TAR_BLOCK];
+        unsigned long size, padded;
+        int type, i = 0;
+
+        if(!readExact(in, header, sizeof header)) return 0;
+
+        for(; i < TAR_BLOCK && header[i] == 0; i++);
+        if(i == TAR_BLOCK) return 0;
+
+        size = octal(header + 124, 12);
+        padded = (size + TAR_BLOCK - 1) & ~(unsigned long) (TAR_BLOCK - 1);
+        type = header[156];
+
+        if(type == 'L' || type == 'x')
+        {
+            if(!readMember(in, member, padded) || size >= member->data.capacity) return -1;
+
+            member->data.data[size] = '\0';
+
+            if(type == 'L') snprintf(longName, sizeof longName, "%s", (char *) member->data.data);
+            else
+            {
+                /* pax records are "LENGTH path=NAME\n" */
+                char *path = strstr((char *) member->data.data, " path=");
+
+                if(path != NULL) snprintf(longName, sizeof longName, "%.*s", (int) strcspn(path + 6, "\n"), path + 6);
+            }
+
+            continue;
+        }
+
+        if(type != '0' && type != '\0')
+        {
+            if(!skipBytes(in, padded)) return -1;
+            continue;
+        }
+
+        if(longName[0] != '\0') snprintf(member->name, sizeof member->name, "%s", longName);
+        else if(memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0')
+            snprintf(member->name, sizeof member->name, "%.155s/%.100s", (char *) header + 345, (char *) header);
+        else snprintf(member->name, sizeof member->name, "%.100s", (char *) header);
+
+        member->mtime = (time_t) octal(header + 136, 12);
+
+        if(!readMember(in, member, size) || !skipBytes(in, padded - size)) return -1;
+
+        return 1;
+    }
+}
+
+/* no absolute paths and no .. components, so every output stays under the output directory */
+static int safeName(const char *name)
+{
+    const char *part = name;
+
+    if(name[0] == '/' || name[0] == '\0') return 0;
+
+    while(*part != '\0')
+    {
+        size_t length = strcspn(part, "/");
+
+        if(length == 2 && strncmp(part, "..", 2) == 0) return 0;
+
+        part += length + (part[length] == '/');
+    }
+
+    return 1;
+}
+
+static int makeParents(char *path)
+{
+    char *slash = path;
+
+    while((slash = strchr(slash + 1, '/')) != NULL)
+    {
+        *slash = '\0';
+
+        if(mkdir(path, 0755) != 0 && errno != EEXIST)
+        {
+            *slash = '/';
+            return 0;
+        }
+
+        *slash = '/';
+    }
+
+    return 1;
+}
+
+static int tarHeader(archivewriter_t *writer, const char *name, unsigned long size, time_t mtime)
+{
+    unsigned char header[TAR_BLOCK];
+    size_t length = strlen(name), split = 0;
+    unsigned long sum = 0;
+    int i = 0;
+
+    memset(header, 0, sizeof header);
+
+    if(length > 100)
+    {
+        /* ustar: up to 155 bytes of directory in the prefix field */
+        for(split = length - 1; split > 0 && !(name[split] == '/' && length - split - 1 <= 100 && split <= 155); split--);
+        if(split == 0) return 0;
+
+        memcpy(header + 345, name, split);
+        name += split + 1;
+    }
+
+    memcpy(header, name, strlen(name));
+    snprintf((char *) header + 100, 8, "%07o", 0644);
+    snprintf((char *) header + 108, 8, "%07o", 0);
+    snprintf((char *) header + 116, 8, "%07o", 0);
+    snprintf((char *) header + 124, 12, "%011lo", size);
+    snprintf((char *) header + 136, 12, "%011lo", (unsigned long) mtime);
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    memset(header + 148, ' ', 8);
+    for(; i < TAR_BLOCK; i++) sum += header[i];
+    snprintf((char *) header + 148, 8, "%06lo", sum);
+
+    return fwrite(header, 1, sizeof header, writer->out) == sizeof header;
+}
+
+static int zipLocal(archivewriter_t *writer, const char *name, const unsigned char *data, unsigned long size, time_t mtime)
+{
+    unsigned char header[30];
+    size_t nameLength = strlen(name);
+    zipentry_t *entry;
+
+    if(writer->count == writer->capacity)
+    {
+        size_t capacity = writer->capacity ? writer->capacity * 2 : 64;
+        zipentry_t *grown = realloc(writer->entries, capacity * sizeof *grown);
+
+        if(grown == NULL) return 0;
+
+        writer->entries = grown;
+        writer->capacity = capacity;
+    }
+
+    entry = &writer->entries[writer->count];
+
+    if(nameLength > 0xFFFF || (entry->name = malloc(nameLength + 1)) == NULL) return 0;
+
+    strcpy(entry->name, name);
+    entry->crc = spcechoCrc32(0, data, size);
+    entry->size = size;
+    entry->offset = writer->offset;
+    toDos(mtime, &entry->dosTime, &entry->dosDate);
+    writer->count++;
+
+    putLE(header, 0x04034B50UL, 4);
+    putLE(header + 4, 10, 2);
+    putLE(header + 6, 0, 2);
+    putLE(header + 8, 0, 2);
+    putLE(header + 10, entry->dosTime, 2);
+    putLE(header + 12, entry->dosDate, 2);
+    putLE(header + 14, entry->crc, 4);
+    putLE(header + 18, size, 4);
+    putLE(header + 22, size, 4);
+    putLE(header + 26, nameLength, 2);
+    putLE(header + 28, 0, 2);
+
+    writer->offset += sizeof header + nameLength + size;
+
+    return fwrite(header, 1, sizeof header, writer->out) == sizeof header &&
+           fwrite(name, 1, nameLength, writer->out) == nameLength;
+}
+
+/* one member to the output: a file under the directory, or the next entry in the archive */
+static int writeMember(archivewriter_t *writer, const char *name, const unsigned char *data, unsigned long size, time_t mtime)
+{
+    if(writer->type == ARCHIVE_DIR)
+    {
+        char path[FILENAME_MAX];
+        FILE *out;
+        int ok;
+
+        snprintf(path, sizeof path, "%s/%s", writer->path, name);
+
+        if(!makeParents(path) || (out = fopen(path, "wb")) == NULL) return 0;
+
+        ok = fwrite(data, 1, size, out) == size;
+
+        return fclose(out) == 0 && ok;
+    }
+
+    if(writer->type == ARCHIVE_TAR)
+    {
+        static const unsigned char zeros[TAR_BLOCK] = { 0 };
+        unsigned long pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+
+        return tarHeader(writer, name, size, mtime) && fwrite(data, 1, size, writer->out) == size &&
+               fwrite(zeros, 1, pad, writer->out) == pad;
+    }
+
+    return zipLocal(writer, name, data, size, mtime) && fwrite(data, 1, size, writer->out) == size;
+}
+
+/* the tar end marker, or the zip central directory; frees what the writer kept */
+static int finishWriter(archivewriter_t *writer)
+{
+    unsigned long start = writer->offset;
+    size_t i = 0;
+    int ok = 1;
+
+    if(writer->type == ARCHIVE_TAR)
+    {
+        static const unsigned char zeros[TAR_BLOCK * 2] = { 0 };
+
+        ok = fwrite(zeros, 1, sizeof zeros, writer->out) == sizeof zeros;
+    }
+
+    for(; writer->type == ARCHIVE_ZIP && i < writer->count; i++)
+    {
+        const zipentry_t *entry = &writer->entries[i];
+        unsigned char header[46];
+        size_t nameLength = strlen(entry->name);
+
+        memset(header, 0, sizeof header);
+        putLE(header, 0x02014B50UL, 4);
+        putLE(header + 4, 0x031E, 2);
+        putLE(header + 6, 10, 2);
+        putLE(header + 12, entry->dosTime, 2);
+        putLE(header + 14, entry->dosDate, 2);
+        putLE(header + 16, entry->crc, 4);
+        putLE(header + 20, entry->size, 4);
+        putLE(header + 24, entry->size, 4);
+        putLE(header + 28, nameLength, 2);
+        putLE(header + 38, 0100644UL << 16, 4);
+        putLE(header + 42, entry->offset, 4);
+
+        ok = ok && fwrite(header, 1, sizeof header, writer->out) == sizeof header &&
+             fwrite(entry->name, 1, nameLength, writer->out) == nameLength;
+
+        writer->offset += sizeof header + nameLength;
+    }
+
+    if(writer->type == ARCHIVE_ZIP)
+    {
+        unsigned char end[22];
+
+        memset(end, 0, sizeof end);
+        putLE(end, 0x06054B50UL, 4);
+        putLE(end + 8, writer->count, 2);
+        putLE(end + 10, writer->count, 2);
+        putLE(end + 12, writer->offset - start, 4);
+        putLE(end + 16, start, 4);
+
+        ok = ok && fwrite(end, 1, sizeof end, writer->out) == sizeof end;
+    }
+
+    for(i = 0; i < writer->count; i++) free(writer->entries[i].name);
+    free(writer->entries);
+
+    if(writer->out != NULL && fclose(writer->out) != 0) ok = 0;
+
+    return ok;
+}
+
+/* the same steps as a batch file, on the member in memory */
+static file_outcome_t patchMember(archivemember_t *member, const spcfile_t *settings)
+{
+    spcfile_t file;
+
+    fileInitFrom(&file, settings);
+    file.quiet = 1;
+
+    if(spcechoAttach(&file.ctx, member->data.data, member->data.length) != SPCECHO_OK) return OUTCOME_FAILED;
+
+    if(echoAddress(&file) && filePatch(&file)) file.fileSaved = 1;
+
+    file.bytesRead = member->data.length;
+    freeBuffer(&file);
+
+    return fileOutcome(&file);
+}
+
+/* -b on a .zip or .tar: one pass through the archive, each .spc member patched in memory and
+   written to outPath, which is a directory or, if it ends in .zip or .tar, a new archive.
+   Other members, and .spc members left alone by -p skip or a failure, are copied unchanged */
+int runArchive(const char *source, const char *outPath, const spcfile_t *settings)
+{
+    archivemember_t member;
+    archivewriter_t writer;
+    size_t totals[OUTCOME_FAILED + 1] = { 0 }, members = 0;
+    double started = statsClock(), bytes = 0;
+    int zip = hasExtension(source, ".zip"), next, ok = 1;
+    FILE *in;
+
+    if((in = fopen(source, "rb")) == NULL)
+    {
+        printf("%s: %s!\n", source, spcechoStrerror(SPCECHO_E_OPEN));
+        return 0;
+    }
+
+    memset(&member, 0, sizeof member);
+    memset(&writer, 0, sizeof writer);
+
+    writer.path = outPath;
+    writer.type = hasExtension(outPath, ".zip") ? ARCHIVE_ZIP : hasExtension(outPath, ".tar") ? ARCHIVE_TAR : ARCHIVE_DIR;
+
+    if(writer.type != ARCHIVE_DIR && (writer.out = fopen(outPath, "wb")) == NULL)
+    {
+        printf("%s: %s!\n", outPath, spcechoStrerror(SPCECHO_E_OPEN));
+        fclose(in);
+        return 0;
+    }
+
+    printf("\n%-8s  member\n", "status");
+
+    while(ok && (next = zip ? zipNext(in, &member) : tarNext(in, &member)) != 0)
+    {
+        file_outcome_t outcome = OUTCOME_WRITTEN;
+
+        if(next < 0)
+        {
+            printf("%s: can't read past %s (encrypted, zip64 or damaged)!\n", source, members ? member.name : "the start");
+            ok = 0;
+            break;
+        }
+
+        members++;
+        bytes += (double) member.data.length;
+
+        if(!safeName(member.name))
+        {
+            printf("%-8s  %s (unsafe name)\n", outcomeNames[OUTCOME_FAILED], member.name);
+            totals[OUTCOME_FAILED]++;
+            continue;
+        }
+
+        if(hasExtension(member.name, ".spc"))
+        {
+            outcome = patchMember(&member, settings);
+            totals[outcome]++;
+        }
+
+        /* skipped and failed .spc members only go to archives, unchanged */
+        if((outcome == OUTCOME_SKIPPED || outcome == OUTCOME_FAILED) && writer.type == ARCHIVE_DIR) ;
+        else if(!writeMember(&writer, member.name, member.data.data, member.data.length, member.mtime))
+        {
+            printf("%s: %s!\n", outPath, spcechoStrerror(SPCECHO_E_WRITE));
+            ok = 0;
+        }
+
+        if(hasExtension(member.name, ".spc")) printf("%-8s  %s\n", outcomeNames[outcome], member.name);
+    }
+
+    if(!finishWriter(&writer) && ok)
+    {
+        printf("%s: %s!\n", outPath, spcechoStrerror(SPCECHO_E_WRITE));
+        ok = 0;
+    }
+
+    fclose(in);
+    free(member.data.data);
+
+    printf("\n%lu members: %lu written, %lu fixed, %lu forced, %lu skipped, %lu failed\n",
+           (unsigned long) members, (unsigned long) totals[OUTCOME_WRITTEN], (unsigned long) totals[OUTCOME_FIXED],
+           (unsigned long) totals[OUTCOME_FORCED], (unsigned long) totals[OUTCOME_SKIPPED],
+           (unsigned long) totals[OUTCOME_FAILED]);
+
+    printf("%.3f s elapsed, %.0f bytes/sec\n", statsClock() - started, bytes / (statsClock() - started + 1e-9));
+
+    return ok && totals[OUTCOME_FAILED] == 0;
+}
@@ -0,0 +1,9 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "readwrite.h"
+
+int isArchive(const char *path);
+int runArchive(const char *source, const char *outPath, const spcfile_t *settings);
+
+#endif /*ARCHIVE_H*/
@@ -0,0 +1,609 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <glob.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "cache.h"
+#include "readwrite.h"
+#include "stats.h"
+#include "uring.h"
+
+typedef struct BatchFile
+{
+    char *path;
+    long size;
+    size_t bytesWritten;
+    double seconds;
+    file_outcome_t outcome;
+    spcecho_error_t error;      /* why it failed, shown in the summary */
+    const char *sameAs;         /* -o: an earlier input that writes the same output; not run */
+    spcstats_t stats;           /* --stats */
+
+} batchfile_t;
+
+typedef struct BatchList
+{
+    batchfile_t *files;
+    size_t count;
+    size_t capacity;
+
+} batchlist_t;
+
+/* shared between the worker threads; only next is written after start-up */
+typedef struct BatchPool
+{
+    batchlist_t *list;
+    const char *outDir;
+    const spcfile_t *settings;
+
+    /* batchEach(): called per file instead of processFile() */
+    batch_each_t each;
+    unsigned char *records;
+    size_t recordSize;
+    void *arg;
+
+    /* --io=uring: each worker's rings, merged as they finish */
+    int uring;
+    int ringsFailed;
+    spciostats_t ioStats;
+
+    size_t next;
+    pthread_mutex_t lock;
+
+} batchpool_t;
+
+static const char *outcomeNames[] =
+{
+    "written",
+    "fixed",
+    "forced",
+    "skipped",
+    "cached",
+    "failed",
+};
+
+static int hasSpcExtension(const char *name)
+{
+    size_t len = strlen(name);
+
+    if(len < 4) return 0;
+
+    return name[len - 4] == '.' &&
+           tolower((unsigned char) name[len - 3]) == 's' &&
+           tolower((unsigned char) name[len - 2]) == 'p' &&
+           tolower((unsigned char) name[len - 1]) == 'c';
+}
+
+static int listAdd(batchlist_t *list, const char *path)
+{
+    struct stat st;
+
+    if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return 1;
+
+    if(list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        batchfile_t *files = realloc(list->files, capacity * sizeof *files);
+
+        if(files == NULL) return 0;
+
+        list->files = files;
+        list->capacity = capacity;
+    }
+
+    memset(&list->files[list->count], 0, sizeof *list->files);
+
+    if((list->files[list->count].path = strdup(path)) == NULL) return 0;
+
+    list->files[list->count].size = (long) st.st_size;
+    list->files[list->count].outcome = OUTCOME_FAILED;
+    list->count++;
+
+    return 1;
+}
+
+static int compareFiles(const void *a, const void *b)
+{
+    return strcmp(((const batchfile_t *) a)->path, ((const batchfile_t *) b)->path);
+}
+
+static int collectDirectory(batchlist_t *list, const char *dirName)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char path[FILENAME_MAX];
+
+    if((dir = opendir(dirName)) == NULL) return 0;
+
+    while((entry = readdir(dir)) != NULL)
+    {
+        if(!hasSpcExtension(entry->d_name)) continue;
+
+        snprintf(path, sizeof path, "%s/%s", dirName, entry->d_name);
+
+        if(!listAdd(list, path))
+        {
+            closedir(dir);
+            return 0;
+        }
+    }
+
+    closedir(dir);
+
+    return 1;
+}
+
+static int collectList(batchlist_t *list, const char *listName)
+{
+    FILE *listFile;
+    char line[FILENAME_MAX];
+
+    if(strcmp(listName, "-") == 0) listFile = stdin;
+    else if((listFile = fopen(listName, "r")) == NULL) return 0;
+
+    while(fgets(line, sizeof line, listFile) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if(line[0] == '\0' || line[0] == '#') continue;
+
+        if(!listAdd(list, line))
+        {
+            if(listFile != stdin) fclose(listFile);
+            return 0;
+        }
+    }
+
+    if(listFile != stdin) fclose(listFile);
+
+    return 1;
+}
+
+static int collectGlob(batchlist_t *list, const char *pattern)
+{
+    glob_t matches;
+    size_t i = 0;
+
+    if(glob(pattern, 0, NULL, &matches) != 0) return 0;
+
+    for(; i < matches.gl_pathc; i++)
+    {
+        if(!listAdd(list, matches.gl_pathv[i]))
+        {
+            globfree(&matches);
+            return 0;
+        }
+    }
+
+    globfree(&matches);
+
+    return 1;
+}
+
+/* source is a directory, "@listfile" (one path per line, "@-" for stdin) or a glob pattern */
+static int collectFiles(batchlist_t *list, const char *source)
+{
+    struct stat st;
+
+    if(source[0] == '@') return collectList(list, source + 1);
+
+    if(stat(source, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        if(!collectDirectory(list, source)) return 0;
+
+        qsort(list->files, list->count, sizeof *list->files, compareFiles);
+        return 1;
+    }
+
+    return collectGlob(list, source);
+}
+
+static const char *baseName(const char *path)
+{
+    const char *base = strrchr(path, '/');
+
+    return base != NULL ? base + 1 : path;
+}
+
+static void outputPath(char *out, size_t outSize, const char *inPath, const char *outDir)
+{
+    if(outDir == NULL)
+    {
+        snprintf(out, outSize, "%s", inPath);
+        return;
+    }
+
+    snprintf(out, outSize, "%s/%s", outDir, baseName(inPath));
+}
+
+/* by basename, then by place in the list so the first input of each name sorts first */
+static int compareBaseNames(const void *a, const void *b)
+{
+    const batchfile_t *x = *(batchfile_t * const *) a, *y = *(batchfile_t * const *) b;
+    int order = strcmp(baseName(x->path), baseName(y->path));
+
+    if(order != 0) return order;
+
+    return x < y ? -1 : x > y;
+}
+
+/* with -o, inputs that share a basename would race on one output file: the first one in the
+   list keeps it and the others fail before the pool starts */
+static int markDuplicates(batchlist_t *list)
+{
+    batchfile_t **sorted;
+    size_t i = 0;
+
+    if((sorted = malloc(list->count * sizeof *sorted)) == NULL)
+    {
+        printf("Unable to allocate memory for the file list!\n");
+        return 0;
+    }
+
+    for(; i < list->count; i++) sorted[i] = &list->files[i];
+
+    qsort(sorted, list->count, sizeof *sorted, compareBaseNames);
+
+    for(i = 1; i < list->count; i++)
+    {
+        if(strcmp(baseName(sorted[i]->path), baseName(sorted[i - 1]->path)) != 0) continue;
+
+        sorted[i]->sameAs = sorted[i - 1]->sameAs != NULL ? sorted[i - 1]->sameAs : sorted[i - 1]->path;
+    }
+
+    free(sorted);
+
+    return 1;
+}
+
+/* the next file a worker should run, skipping the ones markDuplicates() turned away */
+static size_t nextFile(batchpool_t *pool)
+{
+    size_t index;
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->next < pool->list->count && pool->list->files[pool->next].sameAs != NULL) pool->next++;
+    index = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+
+    return index;
+}
+
+/* same steps as a single-file run, on a private context */
+static void processFile(batchfile_t *batchFile, const char *outDir, const spcfile_t *settings, spcimage_t *arena)
+{
+    spcfile_t file;
+    char outPath[FILENAME_MAX];
+    double started = statsClock();
+
+    outputPath(outPath, sizeof outPath, batchFile->path, outDir);
+    fileInitFrom(&file, settings);
+    if(settings->statsPath != NULL) file.stats = &batchFile->stats;
+    file.arena = arena;
+
+    if(file.verify)
+    {
+        if(fileRead(&file, batchFile->path) && echoAddress(&file)) fileVerify(&file, batchFile->path);
+    }
+    else if(file.levels)
+    {
+        if(fileRead(&file, batchFile->path) && echoAddress(&file)) fileLevels(&file, batchFile->path);
+    }
+    else if(file.renderSeconds > 0)
+    {
+        char spcOut[FILENAME_MAX];
+
+        snprintf(spcOut, sizeof spcOut, "%s", outPath);
+        wavPath(outPath, sizeof outPath, spcOut);
+
+        if(fileRead(&file, batchFile->path) && echoAddress(&file)) fileRender(&file, outPath);
+    }
+    else if(file.cache != NULL) cachedWrite(&file, batchFile->path, outPath);
+    else if(file.writeMode != WRITE_COPY) filePatchInPlace(&file, batchFile->path);
+    else if(fileRead(&file, batchFile->path) && echoAddress(&file)) fileWrite(&file, outPath);
+
+    freeBuffer(&file);
+
+    batchFile->outcome = fileOutcome(&file);
+    batchFile->error = file.error;
+    batchFile->bytesWritten = file.bytesWritten;
+    batchFile->seconds = statsClock() - started;
+}
+
+static int uringNext(void *arg, size_t *index, const char **inPath, char *outPath, size_t outSize)
+{
+    batchpool_t *pool = arg;
+
+    if((*index = nextFile(pool)) >= pool->list->count) return 0;
+
+    *inPath = pool->list->files[*index].path;
+    outputPath(outPath, outSize, *inPath, pool->outDir);
+
+    return 1;
+}
+
+static void uringDone(void *arg, size_t index, const spcfile_t *file, double seconds)
+{
+    batchfile_t *batchFile = &((batchpool_t *) arg)->list->files[index];
+
+    batchFile->outcome = fileOutcome(file);
+    batchFile->error = file->error;
+    batchFile->bytesWritten = file->bytesWritten;
+    batchFile->seconds = seconds;
+}
+
+static void *batchWorker(void *arg)
+{
+    batchpool_t *pool = arg;
+    spcimage_t *arena = NULL;
+
+    if(pool->uring)
+    {
+        spciostats_t stats;
+        int ran = uringRun(pool->settings, uringNext, uringDone, pool, &stats);
+
+        pthread_mutex_lock(&pool->lock);
+        if(ran) uringMerge(&pool->ioStats, &stats);
+        else pool->ringsFailed++;
+        pthread_mutex_unlock(&pool->lock);
+
+        /* without a ring this worker takes its files the stdio way */
+        if(ran) return NULL;
+    }
+
+    /* one image per worker, reused for every file it takes; without it files go on the heap */
+    if(pool->each == NULL) arena = malloc(sizeof *arena);
+
+    for(;;)
+    {
+        size_t index = nextFile(pool);
+
+        if(index >= pool->list->count) break;
+
+        if(pool->each != NULL) pool->each(pool->list->files[index].path, pool->records + index * pool->recordSize, pool->arg);
+        else processFile(&pool->list->files[index], pool->outDir, pool->settings, arena);
+    }
+
+    free(arena);
+
+    return NULL;
+}
+
+static void printSummary(const batchlist_t *list, double elapsed)
+{
+    size_t i = 0, totals[OUTCOME_FAILED + 1] = { 0 };
+    double bytes = 0, written = 0;
+
+    printf("\n%-8s %10s %10s %10s  %s\n", "status", "ms", "bytes", "written", "file");
+
+    for(; i < list->count; i++)
+    {
+        const batchfile_t *file = &list->files[i];
+
+        printf("%-8s %10.2f %10ld %10lu  %s", outcomeNames[file->outcome],
+               file->seconds * 1000.0, file->size, (unsigned long) file->bytesWritten, file->path);
+
+        /* the workers ran quiet, so this is the only place the reason shows */
+        if(file->sameAs != NULL) printf(": same output file as %s", file->sameAs);
+        else if(file->outcome == OUTCOME_FAILED && file->error != SPCECHO_OK) printf(": %s", spcechoStrerror(file->error));
+        printf("\n");
+
+        totals[file->outcome]++;
+        bytes += (double) file->size;
+        written += (double) file->bytesWritten;
+    }
+
+    if(elapsed <= 0) elapsed = 1e-9;
+
+    printf("\n%lu files: %lu written, %lu fixed, %lu forced, %lu skipped, %lu cached, %lu failed\n",
+           (unsigned long) list->count,
+           (unsigned long) totals[OUTCOME_WRITTEN], (unsigned long) totals[OUTCOME_FIXED],
+           (unsigned long) totals[OUTCOME_FORCED], (unsigned long) totals[OUTCOME_SKIPPED],
+           (unsigned long) totals[OUTCOME_CACHED], (unsigned long) totals[OUTCOME_FAILED]);
+
+    printf("%.0f bytes written\n", written);
+
+    printf("%.3f s elapsed, %.1f files/sec, %.0f bytes/sec\n",
+           elapsed, (double) list->count / elapsed, bytes / elapsed);
+}
+
+/* --stats=json for every file in the batch */
+static void writeStats(const batchlist_t *list, const char *where)
+{
+    const char **paths = malloc(list->count * sizeof *paths);
+    spcstats_t *stats = malloc(list->count * sizeof *stats);
+    size_t i = 0;
+
+    if(paths == NULL || stats == NULL) printf("Unable to allocate memory for stats!\n");
+    else
+    {
+        for(; i < list->count; i++)
+        {
+            paths[i] = list->files[i].path;
+            stats[i] = list->files[i].stats;
+        }
+
+        if(!statsWrite(where, paths, stats, list->count)) printf("%s: %s!\n", where, spcechoStrerror(SPCECHO_E_WRITE));
+    }
+
+    free(paths);
+    free(stats);
+}
+
+/* creates outDir if it isn't there, so a bad -o is one message instead of a failure per file */
+int prepareOutDir(const char *outDir)
+{
+    struct stat st;
+
+    if(outDir == NULL) return 1;
+
+    if(mkdir(outDir, 0755) != 0 && errno != EEXIST)
+    {
+        printf("\n!!!! Unable to create output directory %s: %s! !!!!\n", outDir, strerror(errno));
+        return 0;
+    }
+
+    if(stat(outDir, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        printf("\n!!!! %s is not a directory! !!!!\n", outDir);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* jobs <= 0 means one worker per core */
+static int workerCount(int jobs, size_t files)
+{
+    if(jobs <= 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cores > 0 ? (int) cores : 1;
+    }
+
+    return (size_t) jobs > files ? (int) files : jobs;
+}
+
+/* runs the pool's work on jobs threads, or on this one if none can be started */
+static int runPool(batchpool_t *pool, int jobs)
+{
+    pthread_t *workers;
+    int started = 0;
+
+    if((workers = malloc((size_t) jobs * sizeof *workers)) == NULL)
+    {
+        printf("Unable to allocate memory for workers!\n");
+        return 0;
+    }
+
+    pool->next = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+
+    for(; started < jobs; started++)
+    {
+        if(pthread_create(&workers[started], NULL, batchWorker, pool) != 0) break;
+    }
+
+    if(started == 0) batchWorker(pool);
+
+    while(started > 0) pthread_join(workers[--started], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    free(workers);
+
+    return 1;
+}
+
+int runBatch(const char *source, const char *outDir, int jobs, const spcfile_t *settings)
+{
+    batchlist_t list = { NULL, 0, 0 };
+    batchpool_t pool;
+    spcfile_t quietSettings = *settings;
+    size_t i = 0, failed = 0;
+    double startTime;
+
+    if(!collectFiles(&list, source) || list.count == 0)
+    {
+        printf("\n!!!! No .spc files found for %s! !!!!\n", source);
+        free(list.files);
+        return 0;
+    }
+
+    /* verify and levels only read, so only runs that write into -o can collide */
+    if(!prepareOutDir(outDir) || (outDir != NULL && !settings->verify && !settings->levels && !markDuplicates(&list)))
+    {
+        for(; i < list.count; i++) free(list.files[i].path);
+        free(list.files);
+        return 0;
+    }
+
+    jobs = workerCount(jobs, list.count);
+
+    /* workers never print or read stdin; the summary reports what happened */
+    quietSettings.quiet = 1;
+
+    memset(&pool, 0, sizeof pool);
+    pool.list = &list;
+    pool.outDir = outDir;
+    pool.settings = &quietSettings;
+    pool.uring = settings->ioUring;
+
+    printf("\nProcessing %lu files with %d workers...\n", (unsigned long) list.count, jobs);
+
+    startTime = statsClock();
+
+    if(!runPool(&pool, jobs))
+    {
+        for(; i < list.count; i++) free(list.files[i].path);
+        free(list.files);
+        return 0;
+    }
+
+    printSummary(&list, statsClock() - startTime);
+
+    if(pool.ringsFailed > 0) printf("\nio_uring unavailable for %d worker%s, used stdio instead\n", pool.ringsFailed, pool.ringsFailed == 1 ? "" : "s");
+    if(pool.ioStats.rings > 0) uringReport(&pool.ioStats);
+    if(settings->statsPath != NULL) writeStats(&list, settings->statsPath);
+
+    for(; i < list.count; i++)
+    {
+        if(list.files[i].outcome == OUTCOME_FAILED) failed++;
+        free(list.files[i].path);
+    }
+
+    free(list.files);
+
+    return failed == 0;
+}
+
+/* the worker pool for other modes: every file source names is handed to each() with its own
+   recordSize bytes of the returned array, zeroed, in file order. *paths gets the names */
+void *batchEach(const char *source, int jobs, size_t recordSize, batch_each_t each, void *arg,
+                char ***paths, size_t *count)
+{
+    batchlist_t list = { NULL, 0, 0 };
+    batchpool_t pool;
+    size_t i = 0;
+
+    *paths = NULL;
+    *count = 0;
+
+    if(!collectFiles(&list, source) || list.count == 0)
+    {
+        printf("\n!!!! No .spc files found for %s! !!!!\n", source);
+        free(list.files);
+        return NULL;
+    }
+
+    memset(&pool, 0, sizeof pool);
+    pool.list = &list;
+    pool.each = each;
+    pool.recordSize = recordSize;
+    pool.arg = arg;
+
+    if((pool.records = calloc(list.count, recordSize)) == NULL || (*paths = malloc(list.count * sizeof **paths)) == NULL ||
+       !runPool(&pool, workerCount(jobs, list.count)))
+    {
+        for(; i < list.count; i++) free(list.files[i].path);
+        free(pool.records);
+        free(*paths);
+        free(list.files);
+        *paths = NULL;
+
+        return NULL;
+    }
+
+    for(; i < list.count; i++) (*paths)[i] = list.files[i].path;
+
+    *count = list.count;
+    free(list.files);
+
+    return pool.records;
+}
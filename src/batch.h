@@ -0,0 +1,14 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "readwrite.h"
+
+typedef void (*batch_each_t)(const char *path, void *record, void *arg);
+
+int prepareOutDir(const char *outDir);
+int runBatch(const char *source, const char *outDir, int jobs, const spcfile_t *settings);
+
+void *batchEach(const char *source, int jobs, size_t recordSize, batch_each_t each, void *arg,
+                char ***paths, size_t *count);
+
+#endif /*BATCH_H*/
@@ -0,0 +1,197 @@
+#include "brr.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BRR_X86 1
+#include <immintrin.h>
+#endif
+
+#define CLAMP16(s) ((s) < -0x8000 ? -0x8000 : (s) > 0x7FFF ? 0x7FFF : (s))
+
+static const char *implNames[] = { "scalar", "sse2" };
+
+brr_impl_t brrBest(void)
+{
+#ifdef BRR_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("sse2")) return BRR_SSE2;
+#endif
+
+    return BRR_SCALAR;
+}
+
+const char *brrName(brr_impl_t impl)
+{
+    return implNames[impl];
+}
+
+/* one prediction filter over a block: each output feeds the next, so this part stays serial.
+   A loop per filter keeps the filter choice out of the per-sample path */
+#define FILTER_LOOP(predict) \
+    for(; i < BRR_SAMPLES; i++) \
+    { \
+        int s = residual[i], half = p2 >> 1; \
+        (void) half; \
+        s += (predict); \
+        s = CLAMP16(s); \
+        s = (short) (s * 2); \
+        out[i] = (short) s; \
+        p2 = p1; \
+        p1 = s; \
+    }
+
+static void filterBlock(int filter, const short *residual, brr_state_t *state, short *out)
+{
+    int p1 = state->p1, p2 = state->p2, i = 0;
+
+    switch(filter)
+    {
+    case 0: FILTER_LOOP(0); break;
+    case 1: FILTER_LOOP((p1 >> 1) + ((-p1) >> 5)); break;
+    case 2: FILTER_LOOP(p1 - half + (half >> 4) + ((p1 * -3) >> 6)); break;
+    default: FILTER_LOOP(p1 - half + ((p1 * -13) >> 7) + ((half * 3) >> 4)); break;
+    }
+
+    state->p1 = p1;
+    state->p2 = p2;
+}
+
+/* nibbles to signed samples, shifted by the block's range */
+static void residualsScalar(const unsigned char *block, short *residual)
+{
+    int shift = block[0] >> 4, i = 0;
+
+    for(; i < BRR_SAMPLES; i++)
+    {
+        int nibble = (i & 1) ? block[1 + (i >> 1)] & 0x0F : block[1 + (i >> 1)] >> 4;
+        int s = (nibble ^ 8) - 8;
+
+        /* ranges 13-15 only keep the sign */
+        if(shift <= 12) s = (s << shift) >> 1;
+        else s = s < 0 ? -0x800 : 0;
+
+        residual[i] = (short) s;
+    }
+}
+
+/* bit-exact S-DSP decode of one block: range shift, then filter 0-3 against the previous
+   two outputs, clamp to 16 bits and keep 15 (outputs are stored doubled, as the DSP does) */
+void brrDecodeBlock(const unsigned char *block, brr_state_t *state, short *out)
+{
+    short residual[BRR_SAMPLES];
+
+    residualsScalar(block, residual);
+    filterBlock((block[0] >> 2) & 0x03, residual, state, out);
+}
+
+#ifdef BRR_X86
+
+/* all 16 range shifts at once: a shifted nibble always fits in 16 bits */
+__attribute__((target("sse2")))
+static void residualsSse2(const unsigned char *block, __m128i *first, __m128i *second)
+{
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F), eight = _mm_set1_epi16(8);
+    __m128i bytes = _mm_loadl_epi64((const __m128i *) (block + 1));
+    __m128i nibbles = _mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask),
+                                        _mm_and_si128(bytes, nibbleMask));
+    __m128i lo = _mm_sub_epi16(_mm_xor_si128(_mm_unpacklo_epi8(nibbles, _mm_setzero_si128()), eight), eight);
+    __m128i hi = _mm_sub_epi16(_mm_xor_si128(_mm_unpackhi_epi8(nibbles, _mm_setzero_si128()), eight), eight);
+    int shift = block[0] >> 4;
+
+    if(shift <= 12)
+    {
+        __m128i count = _mm_cvtsi32_si128(shift);
+
+        lo = _mm_srai_epi16(_mm_sll_epi16(lo, count), 1);
+        hi = _mm_srai_epi16(_mm_sll_epi16(hi, count), 1);
+    }
+    else
+    {
+        lo = _mm_and_si128(_mm_srai_epi16(lo, 15), _mm_set1_epi16(-0x800));
+        hi = _mm_and_si128(_mm_srai_epi16(hi, 15), _mm_set1_epi16(-0x800));
+    }
+
+    *first = lo;
+    *second = hi;
+}
+
+/* filter 0 has no prediction and never clamps (a residual doubled still fits in 16 bits),
+   so the whole block is one add; the other filters run the serial loop on the residuals */
+__attribute__((target("sse2")))
+static void decodeBlockSse2(const unsigned char *block, brr_state_t *state, short *out)
+{
+    __m128i lo, hi;
+    int filter = (block[0] >> 2) & 0x03;
+
+    residualsSse2(block, &lo, &hi);
+
+    if(filter == 0)
+    {
+        _mm_storeu_si128((__m128i *) out, _mm_add_epi16(lo, lo));
+        _mm_storeu_si128((__m128i *) (out + 8), _mm_add_epi16(hi, hi));
+
+        state->p1 = out[15];
+        state->p2 = out[14];
+    }
+    else
+    {
+        short residual[BRR_SAMPLES];
+
+        _mm_storeu_si128((__m128i *) residual, lo);
+        _mm_storeu_si128((__m128i *) (residual + 8), hi);
+
+        filterBlock(filter, residual, state, out);
+    }
+}
+
+#endif
+
+typedef void (*decode_block_fn)(const unsigned char *block, brr_state_t *state, short *out);
+
+static decode_block_fn blockFor(brr_impl_t impl)
+{
+#ifdef BRR_X86
+    if(impl == BRR_SSE2) return decodeBlockSse2;
+#else
+    (void) impl;
+#endif
+
+    return brrDecodeBlock;
+}
+
+/* decodes a sample from start to its end flag, then loopPasses more times from the loop
+   point if the end block loops. Returns the number of samples written, -1 if the chain
+   runs off the end of RAM */
+int brrDecodeSampleWith(brr_impl_t impl, const unsigned char *ram, unsigned int start, unsigned int loop,
+                        int loopPasses, short *out, int maxSamples)
+{
+    decode_block_fn decodeBlock = blockFor(impl);
+    brr_state_t state = { 0, 0 };
+    unsigned int address = start;
+    int count = 0;
+
+    for(;;)
+    {
+        unsigned char header;
+
+        if(address + BRR_BLOCK > 0x10000) return -1;
+        if(count + BRR_SAMPLES > maxSamples) return count;
+
+        header = ram[address];
+        decodeBlock(ram + address, &state, out + count);
+
+        count += BRR_SAMPLES;
+        address += BRR_BLOCK;
+
+        if(!(header & BRR_END)) continue;
+        if(!(header & BRR_LOOP) || loopPasses-- <= 0) return count;
+
+        address = loop;
+    }
+}
+
+int brrDecodeSample(const unsigned char *ram, unsigned int start, unsigned int loop, int loopPasses,
+                    short *out, int maxSamples)
+{
+    return brrDecodeSampleWith(brrBest(), ram, start, loop, loopPasses, out, maxSamples);
+}
@@ -0,0 +1,34 @@
+#ifndef BRR_H
+#define BRR_H
+
+/* BRR sample data comes in 9-byte blocks: a header byte then 16 4-bit samples */
+#define BRR_BLOCK   9
+#define BRR_SAMPLES 16
+#define BRR_END     0x01
+#define BRR_LOOP    0x02
+
+typedef enum BrrImpl
+{
+    BRR_SCALAR = 0,     /* reference: range shift and filter one sample at a time */
+    BRR_SSE2   = 1      /* range shift 16 at a time, filter 0 blocks fully vectorized */
+
+} brr_impl_t;
+
+/* the two previous outputs the prediction filters work from */
+typedef struct BrrState
+{
+    int p1;
+    int p2;
+
+} brr_state_t;
+
+brr_impl_t brrBest(void);
+const char *brrName(brr_impl_t impl);
+
+void brrDecodeBlock(const unsigned char *block, brr_state_t *state, short *out);
+int brrDecodeSample(const unsigned char *ram, unsigned int start, unsigned int loop, int loopPasses,
+                    short *out, int maxSamples);
+int brrDecodeSampleWith(brr_impl_t impl, const unsigned char *ram, unsigned int start, unsigned int loop,
+                        int loopPasses, short *out, int maxSamples);
+
+#endif /*BRR_H*/
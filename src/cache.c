@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "delta.h"
+
+#define CACHE_MAGIC "SPCC"
+
+/* bytes of an entry that go to disk: everything before the path pointer */
+#define CACHE_RECORD offsetof(cacheentry_t, path)
+
+static int statFile(const char *path, cachestat_t *out)
+{
+    struct stat st;
+
+    if(stat(path, &st) != 0) return 0;
+
+    out->size = (unsigned long long) st.st_size;
+    out->inode = (unsigned long long) st.st_ino;
+    out->mtimeSec = (unsigned long long) st.st_mtim.tv_sec;
+    out->mtimeNsec = (unsigned long long) st.st_mtim.tv_nsec;
+
+    return 1;
+}
+
+static int statEqual(const cachestat_t *a, const cachestat_t *b)
+{
+    return a->size == b->size && a->inode == b->inode && a->mtimeSec == b->mtimeSec && a->mtimeNsec == b->mtimeNsec;
+}
+
+static size_t pathHash(const char *path)
+{
+    return (size_t) spcechoHash((const unsigned char *) path, strlen(path));
+}
+
+/* slot in index holding path, or the empty slot it would go in */
+static size_t findSlot(const spccache_t *cache, const char *path)
+{
+    size_t mask = cache->indexSize - 1, slot = pathHash(path) & mask;
+
+    while(cache->index[slot] != 0 && strcmp(cache->entries[cache->index[slot] - 1].path, path) != 0)
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+/* keeps the index at most half full */
+static int growIndex(spccache_t *cache, size_t wanted)
+{
+    size_t size = 64, i = 0, *index;
+
+    if(wanted * 2 <= cache->indexSize) return 1;
+
+    while(size < wanted * 2) size <<= 1;
+
+    /* the old table stays in use if there's no room for the new one */
+    if((index = calloc(size, sizeof *index)) == NULL) return 0;
+
+    free(cache->index);
+    cache->index = index;
+    cache->indexSize = size;
+
+    for(; i < cache->count; i++) cache->index[findSlot(cache, cache->entries[i].path)] = i + 1;
+
+    return 1;
+}
+
+static cacheentry_t *addEntry(spccache_t *cache, const char *path)
+{
+    cacheentry_t *entry;
+
+    if(cache->count == cache->capacity)
+    {
+        size_t capacity = cache->capacity ? cache->capacity * 2 : 256;
+        cacheentry_t *grown = realloc(cache->entries, capacity * sizeof *grown);
+
+        if(grown == NULL) return NULL;
+
+        cache->entries = grown;
+        cache->capacity = capacity;
+    }
+
+    if(!growIndex(cache, cache->count + 1)) return NULL;
+
+    entry = &cache->entries[cache->count];
+    memset(entry, 0, sizeof *entry);
+
+    if((entry->path = malloc(strlen(path) + 1)) == NULL) return NULL;
+    strcpy(entry->path, path);
+
+    cache->index[findSlot(cache, path)] = ++cache->count;
+
+    return entry;
+}
+
+static void loadEntries(spccache_t *cache, FILE *in)
+{
+    unsigned char header[16];
+    unsigned long count, i = 0;
+
+    if(fread(header, 1, sizeof header, in) < sizeof header || memcmp(header, CACHE_MAGIC, 4) != 0) return;
+
+    /* written by this build for this machine, so plain host-order words */
+    if(*(unsigned int *) (header + 4) != CACHE_VERSION || *(unsigned int *) (header + 8) != CACHE_RECORD) return;
+
+    count = *(unsigned int *) (header + 12);
+
+    for(; i < count; i++)
+    {
+        cacheentry_t record, *entry;
+        char path[FILENAME_MAX];
+        unsigned short length;
+
+        if(fread(&record, 1, CACHE_RECORD, in) < CACHE_RECORD) return;
+        if(fread(&length, sizeof length, 1, in) < 1 || length >= sizeof path) return;
+        if(fread(path, 1, length, in) < length) return;
+
+        path[length] = '\0';
+
+        if((entry = addEntry(cache, path)) == NULL) return;
+
+        record.path = entry->path;
+        *entry = record;
+    }
+}
+
+/* results of earlier runs kept in one file; a missing or unreadable one starts out empty */
+spccache_t *cacheOpen(const char *path)
+{
+    spccache_t *cache = calloc(1, sizeof *cache);
+    FILE *in;
+
+    if(cache == NULL) return NULL;
+
+    cache->path = path;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    if(!growIndex(cache, 1))
+    {
+        free(cache);
+        return NULL;
+    }
+
+    if((in = fopen(path, "rb")) != NULL)
+    {
+        loadEntries(cache, in);
+        fclose(in);
+    }
+
+    return cache;
+}
+
+static int saveEntries(const spccache_t *cache)
+{
+    char tempPath[FILENAME_MAX];
+    unsigned int header[4];
+    FILE *out;
+    size_t i = 0;
+    int ok;
+
+    snprintf(tempPath, sizeof tempPath, "%s.tmp", cache->path);
+
+    if((out = fopen(tempPath, "wb")) == NULL) return 0;
+
+    memcpy(header, CACHE_MAGIC, 4);
+    header[1] = CACHE_VERSION;
+    header[2] = (unsigned int) CACHE_RECORD;
+    header[3] = (unsigned int) cache->count;
+
+    ok = fwrite(header, sizeof header, 1, out) == 1;
+
+    for(; ok && i < cache->count; i++)
+    {
+        unsigned short length = (unsigned short) strlen(cache->entries[i].path);
+
+        ok = fwrite(&cache->entries[i], 1, CACHE_RECORD, out) == CACHE_RECORD &&
+             fwrite(&length, sizeof length, 1, out) == 1 &&
+             fwrite(cache->entries[i].path, 1, length, out) == length;
+    }
+
+    if(fclose(out) != 0) ok = 0;
+
+    /* renamed into place so an interrupted run leaves the old cache whole */
+    if(!ok || rename(tempPath, cache->path) != 0)
+    {
+        remove(tempPath);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* writes the cache back if this run changed it, and frees it */
+int cacheClose(spccache_t *cache)
+{
+    size_t i = 0;
+    int ok = 1;
+
+    if(cache == NULL) return 1;
+
+    if(cache->dirty && !(ok = saveEntries(cache))) printf("\n!!!! Could not write cache %s! !!!!\n", cache->path);
+
+    for(; i < cache->count; i++) free(cache->entries[i].path);
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache->index);
+    free(cache);
+
+    return ok;
+}
+
+static int lookup(spccache_t *cache, const char *path, cacheentry_t *out)
+{
+    size_t slot;
+    int found;
+
+    pthread_mutex_lock(&cache->lock);
+
+    slot = findSlot(cache, path);
+    if((found = cache->index[slot] != 0)) *out = cache->entries[cache->index[slot] - 1];
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return found;
+}
+
+static void store(spccache_t *cache, const char *path, const cacheentry_t *result)
+{
+    cacheentry_t *entry;
+    size_t slot;
+
+    pthread_mutex_lock(&cache->lock);
+
+    slot = findSlot(cache, path);
+    entry = cache->index[slot] != 0 ? &cache->entries[cache->index[slot] - 1] : addEntry(cache, path);
+
+    if(entry != NULL)
+    {
+        char *keep = entry->path;
+
+        *entry = *result;
+        entry->path = keep;
+        cache->dirty = 1;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* everything that decides what ends up in the output */
+static unsigned long long settingsHash(const spcfile_t *file, const char *outPath)
+{
+    unsigned char settings[FILENAME_MAX + 32];
+    size_t length = 0, i = 0;
+
+    for(; i < 6; i++)
+    {
+        settings[length++] = file->ctx.addresses[i].value;
+        settings[length++] = (unsigned char) file->ctx.addresses[i].overwrite;
+    }
+
+    for(i = 0; i < 8; i++) settings[length++] = (unsigned char) file->ctx.fir[i];
+
+    settings[length++] = (unsigned char) file->ctx.firOverwrite;
+    settings[length++] = (unsigned char) file->ctx.pinWrites;
+    settings[length++] = (unsigned char) file->policy;
+    settings[length++] = (unsigned char) file->writeMode;
+    settings[length++] = (unsigned char) file->defrag;
+    settings[length++] = (unsigned char) file->deltaOut;
+
+    i = strlen(outPath);
+    memcpy(settings + length, outPath, i < FILENAME_MAX ? i : FILENAME_MAX);
+
+    return spcechoHash(settings, length + (i < FILENAME_MAX ? i : FILENAME_MAX));
+}
+
+static int cachedResult(spcfile_t *file, const char *inPath)
+{
+    file->cacheHit = file->fileSaved = 1;
+
+    if(!file->quiet) printf("\n%s is unchanged since the last run, nothing to do\n", inPath);
+
+    return 1;
+}
+
+/* fileRead(), echoAddress() and fileWrite(), or filePatchInPlace(), unless the cache shows the
+   output of an earlier run with the same settings is still there and the input hasn't changed.
+   An input whose contents are unchanged but whose settings differ reuses its saved scan */
+int cachedWrite(spcfile_t *file, const char *inName, const char *outName)
+{
+    char inPath[FILENAME_MAX], outPath[FILENAME_MAX];
+    cacheentry_t entry, result;
+    cachestat_t outStat;
+    int found, ok;
+
+    spcPath(inPath, sizeof inPath, inName);
+
+    if(file->writeMode != WRITE_COPY) snprintf(outPath, sizeof outPath, "%s", inPath);
+    else if(file->deltaOut) deltaPath(outPath, sizeof outPath, outName);
+    else spcPath(outPath, sizeof outPath, outName);
+
+    memset(&entry, 0, sizeof entry);
+    memset(&result, 0, sizeof result);
+    result.settingsHash = settingsHash(file, outPath);
+
+    found = lookup(file->cache, inPath, &entry) && entry.settingsHash == result.settingsHash;
+
+    if(found && statFile(inPath, &result.input) && statEqual(&result.input, &entry.input) &&
+       statFile(outPath, &outStat) && statEqual(&outStat, &entry.output))
+        return cachedResult(file, inPath);
+
+    if(file->writeMode != WRITE_COPY) ok = filePatchInPlace(file, inName);
+    else
+    {
+        if(!fileRead(file, inName)) return 0;
+
+        result.contentHash = spcechoHash(file->ctx.buffer, file->ctx.length);
+
+        /* only touched: same bytes, same settings, output still as written */
+        if(found && entry.contentHash == result.contentHash && statFile(inPath, &entry.input) &&
+           statFile(outPath, &outStat) && statEqual(&outStat, &entry.output))
+        {
+            freeBuffer(file);
+            store(file->cache, inPath, &entry);
+
+            return cachedResult(file, inPath);
+        }
+
+        if(!file->defrag && entry.scanValid && entry.contentHash == result.contentHash &&
+           spcechoScanRestore(&file->ctx, &entry.scan) == SPCECHO_OK) ok = echoPlace(file);
+        else ok = echoAddress(file);
+
+        if(ok && !file->defrag)
+        {
+            spcechoScanSave(&file->ctx, &result.scan);
+            result.scanValid = 1;
+        }
+
+        ok = ok && fileWrite(file, outName);
+    }
+
+    if(ok && file->fileSaved && statFile(inPath, &result.input) && statFile(outPath, &result.output))
+        store(file->cache, inPath, &result);
+
+    return ok;
+}
@@ -0,0 +1,54 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "readwrite.h"
+
+/* bumped whenever a cache entry's layout or meaning changes; older caches are ignored */
+#define CACHE_VERSION 1
+
+typedef struct CacheStat
+{
+    unsigned long long size;
+    unsigned long long inode;
+    unsigned long long mtimeSec;
+    unsigned long long mtimeNsec;
+
+} cachestat_t;
+
+/* what a run did with one input; stored as is up to path */
+typedef struct CacheEntry
+{
+    unsigned long long settingsHash;    /* echo values, modes and output path it was written with */
+    unsigned long long contentHash;     /* the input as it was read, 0 if it wasn't read whole */
+    cachestat_t input;                  /* both files as the run left them */
+    cachestat_t output;
+    int scanValid;
+    spcscan_t scan;                     /* the input's RAM maps, for reruns with other values */
+
+    char *path;                         /* the input */
+
+} cacheentry_t;
+
+/* shared by the batch workers; lookups and updates take the lock */
+typedef struct SpcCache
+{
+    const char *path;
+    cacheentry_t *entries;
+    size_t count;
+    size_t capacity;
+    size_t *index;          /* open addressing on the path's hash: entry number + 1, 0 if empty */
+    size_t indexSize;
+    int dirty;
+
+    pthread_mutex_t lock;
+
+} spccache_t;
+
+spccache_t *cacheOpen(const char *path);
+int cacheClose(spccache_t *cache);
+int cachedWrite(spcfile_t *file, const char *inName, const char *outName);
+
+#endif /*CACHE_H*/
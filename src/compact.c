@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "brr.h"
+#include "compact.h"
+
+/* a span of RAM holding one or more overlapping BRR chains; moved as a whole */
+typedef struct SampleUnit
+{
+    unsigned int start;
+    unsigned int end;
+    unsigned int dest;
+
+} sample_unit_t;
+
+/* every chain a directory entry reaches: start..end, plus the loop chain if it's elsewhere */
+#define MAX_UNITS 0x200
+
+/* samples decoded per entry when verifying; the loop is played through twice */
+#define VERIFY_SAMPLES 0x10000
+#define VERIFY_LOOPS   2
+
+static int compareUnits(const void *a, const void *b)
+{
+    const sample_unit_t *x = a, *y = b;
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static int collectUnits(const aram_map_t *map, sample_unit_t *units)
+{
+    int count = 0, merged = 0, i = 0;
+
+    for(; i < map->entries; i++)
+    {
+        const aram_sample_t *sample = &map->samples[i];
+
+        if(!sample->valid) continue;
+
+        units[count].start = sample->start;
+        units[count++].end = sample->end;
+
+        if(sample->loopEnd != sample->end)
+        {
+            units[count].start = sample->loop;
+            units[count++].end = sample->loopEnd;
+        }
+    }
+
+    if(count == 0) return 0;
+
+    qsort(units, (size_t) count, sizeof *units, compareUnits);
+
+    /* overlapping chains (shared tails, loop points inside another chain) move together */
+    for(i = 1; i < count; i++)
+    {
+        if(units[i].start < units[merged].end)
+        {
+            if(units[i].end > units[merged].end) units[merged].end = units[i].end;
+            continue;
+        }
+
+        units[++merged] = units[i];
+    }
+
+    return merged + 1;
+}
+
+static const sample_unit_t *unitFor(const sample_unit_t *units, int count, unsigned int address)
+{
+    int i = 0;
+
+    for(; i < count; i++)
+    {
+        if(address >= units[i].start && address < units[i].end) return &units[i];
+    }
+
+    return NULL;
+}
+
+static unsigned int relocate(const sample_unit_t *units, int count, unsigned int address)
+{
+    const sample_unit_t *unit = unitFor(units, count, address);
+
+    return unit == NULL ? address : unit->dest + (address - unit->start);
+}
+
+/* bytes samples may not be moved onto: everything outside free and echo pages except the
+   chains themselves. A sample page can share its page with code whose data ends in 00h or FFh,
+   so only bytes that belong to a chain are known to be free once the chains move */
+static void blockedBytes(const spcecho_ctx *ctx, const sample_unit_t *units, int count, unsigned char *blocked)
+{
+    unsigned int address = 0;
+
+    for(; address < 0x10000; address++)
+    {
+        aram_type_t type = (aram_type_t) ctx->aram.pageType[address >> 8];
+
+        if(type == ARAM_FREE || type == ARAM_ECHO) blocked[address] = 0;
+        else blocked[address] = type != ARAM_SAMPLE || unitFor(units, count, address) == NULL;
+    }
+}
+
+static int firstFit(const unsigned char *blocked, unsigned int length)
+{
+    unsigned int address = FIRST_FREE_PAGE << 8, run = 0;
+
+    for(; address < 0x10000; address++)
+    {
+        run = blocked[address] ? 0 : run + 1;
+
+        if(run == length) return (int) (address + 1 - length);
+    }
+
+    return -1;
+}
+
+/* every directory entry must decode to the same PCM, loop included, from its new home */
+static int verify(const spcecho_ctx *ctx, const unsigned char *packed, const sample_unit_t *units, int count,
+                  short *before, short *after)
+{
+    const unsigned char *ram = ctx->buffer + RAM_OFFSET;
+    int i = 0, verified = 0;
+
+    for(; i < ctx->aram.entries; i++)
+    {
+        const aram_sample_t *sample = &ctx->aram.samples[i];
+        int oldCount, newCount;
+
+        if(!sample->valid) continue;
+
+        oldCount = brrDecodeSample(ram, sample->start, sample->loop, VERIFY_LOOPS, before, VERIFY_SAMPLES);
+        newCount = brrDecodeSample(packed, relocate(units, count, sample->start), relocate(units, count, sample->loop),
+                                   VERIFY_LOOPS, after, VERIFY_SAMPLES);
+
+        if(oldCount < 0 || oldCount != newCount) return -1;
+        if(memcmp(before, after, (size_t) oldCount * sizeof *before) != 0) return -1;
+
+        verified++;
+    }
+
+    return verified;
+}
+
+/* packs the sample chains as low as they'll go around code and the directory, rewrites the
+   directory's start and loop pointers, and proves the samples still decode identically.
+   The image is only changed if every sample verifies */
+spcecho_error_t spcechoCompact(spcecho_ctx *ctx, spccompact_t *result)
+{
+    sample_unit_t units[MAX_UNITS];
+    unsigned char *blocked, *packed;
+    short *before, *after;
+    int count, i = 0, verified;
+    spcecho_error_t err;
+
+    memset(result, 0, sizeof *result);
+
+    if((err = spcechoScan(ctx)) != SPCECHO_OK) return err;
+
+    for(; i < ctx->freeRunCount; i++)
+    {
+        if(ctx->freeRuns[i].pages > result->largestBefore) result->largestBefore = ctx->freeRuns[i].pages;
+    }
+    result->largestAfter = result->largestBefore;
+
+    if((count = collectUnits(&ctx->aram, units)) == 0) return SPCECHO_OK;
+
+    blocked = malloc(0x10000);
+    packed = malloc(0x10000);
+    before = malloc(VERIFY_SAMPLES * sizeof *before);
+    after = malloc(VERIFY_SAMPLES * sizeof *after);
+
+    if(blocked == NULL || packed == NULL || before == NULL || after == NULL)
+    {
+        err = SPCECHO_E_NOMEM;
+        goto done;
+    }
+
+    blockedBytes(ctx, units, count, blocked);
+
+    memcpy(packed, ctx->buffer + RAM_OFFSET, 0x10000);
+    for(i = 0; i < count; i++) memset(packed + units[i].start, 0, units[i].end - units[i].start);
+
+    for(i = 0; i < count; i++)
+    {
+        unsigned int length = units[i].end - units[i].start;
+        int dest = firstFit(blocked, length);
+
+        if(dest < 0)
+        {
+            err = SPCECHO_E_VERIFY;
+            goto done;
+        }
+
+        units[i].dest = (unsigned int) dest;
+        memset(blocked + dest, 1, length);
+        memcpy(packed + dest, ctx->buffer + RAM_OFFSET + units[i].start, length);
+
+        if(units[i].dest != units[i].start)
+        {
+            result->unitsMoved++;
+            result->bytesMoved += (int) length;
+        }
+    }
+
+    for(i = 0; i < ctx->aram.entries; i++)
+    {
+        const aram_sample_t *sample = &ctx->aram.samples[i];
+        unsigned int entry = (unsigned) ctx->aram.directory + ((unsigned) i << 2);
+        unsigned int start, loop;
+
+        if(!sample->valid) continue;
+
+        start = relocate(units, count, sample->start);
+        loop = relocate(units, count, sample->loop);
+
+        packed[entry]     = (unsigned char) start;
+        packed[entry + 1] = (unsigned char) (start >> 8);
+        packed[entry + 2] = (unsigned char) loop;
+        packed[entry + 3] = (unsigned char) (loop >> 8);
+    }
+
+    if((verified = verify(ctx, packed, units, count, before, after)) < 0)
+    {
+        err = SPCECHO_E_VERIFY;
+        goto done;
+    }
+
+    result->samplesVerified = verified;
+
+    memcpy(ctx->buffer + RAM_OFFSET, packed, 0x10000);
+
+    if((err = spcechoScan(ctx)) != SPCECHO_OK) goto done;
+
+    for(i = 0; i < ctx->freeRunCount; i++)
+    {
+        if(ctx->freeRuns[i].pages > result->largestAfter) result->largestAfter = ctx->freeRuns[i].pages;
+    }
+
+done:
+    free(blocked);
+    free(packed);
+    free(before);
+    free(after);
+
+    return err;
+}
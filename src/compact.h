@@ -0,0 +1,18 @@
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include "spcecho.h"
+
+typedef struct SpcCompact
+{
+    int unitsMoved;             /* contiguous sample spans relocated */
+    int bytesMoved;
+    int samplesVerified;        /* directory entries decoded and compared after the move */
+    int largestBefore;          /* longest free run in pages, before and after */
+    int largestAfter;
+
+} spccompact_t;
+
+spcecho_error_t spcechoCompact(spcecho_ctx *ctx, spccompact_t *result);
+
+#endif /*COMPACT_H*/
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+
+static void putLE(unsigned char *out, unsigned long long value, int bytes)
+{
+    int i = 0;
+
+    for(; i < bytes; i++) out[i] = (unsigned char) (value >> (i * 8));
+}
+
+static unsigned long long getLE(const unsigned char *in, int bytes)
+{
+    unsigned long long value = 0;
+
+    while(bytes-- > 0) value = value << 8 | in[bytes];
+
+    return value;
+}
+
+/* FNV-1a over the whole image; a patch is only replayed onto the image it was made from */
+unsigned long long spcechoHash(const unsigned char *image, size_t length)
+{
+    unsigned long long hash = 0xCBF29CE484222325ULL;
+    size_t i = 0;
+
+    for(; i < length; i++) hash = (hash ^ image[i]) * 0x100000001B3ULL;
+
+    return hash;
+}
+
+/* writes one record holding every byte where the patched image in ctx differs from source,
+   the unpatched image of the same length */
+spcecho_error_t spcechoDeltaWrite(const spcecho_ctx *ctx, const unsigned char *source, const char *name,
+                                  FILE *out, size_t *written)
+{
+    unsigned char header[DELTA_HEADER], change[DELTA_CHANGE];
+    size_t nameLength = strlen(name), i = 0;
+    unsigned long changes = 0;
+
+    *written = 0;
+
+    if(ctx->buffer == NULL || source == NULL) return SPCECHO_E_NOIMAGE;
+    if(nameLength > 0xFFFF || ctx->length > 0xFFFFFFFFUL) return SPCECHO_E_ARG;
+
+    for(; i < ctx->length; i++) changes += ctx->buffer[i] != source[i];
+
+    memcpy(header, DELTA_MAGIC, 4);
+    putLE(header + 4, DELTA_VERSION, 2);
+    putLE(header + 6, nameLength, 2);
+    putLE(header + 8, ctx->length, 4);
+    putLE(header + 12, spcechoHash(source, ctx->length), 8);
+    putLE(header + 20, changes, 4);
+
+    if(fwrite(header, 1, sizeof header, out) < sizeof header) return SPCECHO_E_WRITE;
+    if(fwrite(name, 1, nameLength, out) < nameLength) return SPCECHO_E_WRITE;
+
+    for(i = 0; i < ctx->length; i++)
+    {
+        if(ctx->buffer[i] == source[i]) continue;
+
+        putLE(change, i, 4);
+        change[4] = source[i];
+        change[5] = ctx->buffer[i];
+
+        if(fwrite(change, 1, sizeof change, out) < sizeof change) return SPCECHO_E_WRITE;
+    }
+
+    *written = sizeof header + nameLength + changes * DELTA_CHANGE;
+
+    return SPCECHO_OK;
+}
+
+/* reads the next record from in and replays it onto the image in ctx, whose hash the caller
+   worked out once with spcechoHash(). The whole record is always consumed, so the next one in
+   a stream can still be read after a mismatch */
+spcecho_error_t spcechoDeltaApply(spcecho_ctx *ctx, unsigned long long sourceHash, FILE *in, spcdelta_t *delta)
+{
+    unsigned char header[DELTA_HEADER], change[DELTA_CHANGE];
+    size_t nameLength;
+    unsigned long i = 0;
+    spcecho_error_t err = SPCECHO_OK;
+
+    memset(delta, 0, sizeof *delta);
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+
+    if(fread(header, 1, sizeof header, in) < sizeof header) return SPCECHO_E_READ;
+    if(memcmp(header, DELTA_MAGIC, 4) != 0 || getLE(header + 4, 2) != DELTA_VERSION) return SPCECHO_E_READ;
+
+    nameLength = (size_t) getLE(header + 6, 2);
+    delta->sourceLength = (unsigned long) getLE(header + 8, 4);
+    delta->sourceHash = getLE(header + 12, 8);
+    delta->changes = (unsigned long) getLE(header + 20, 4);
+
+    if(nameLength >= sizeof delta->name) return SPCECHO_E_READ;
+    if(fread(delta->name, 1, nameLength, in) < nameLength) return SPCECHO_E_READ;
+
+    if(delta->sourceLength != ctx->length || delta->sourceHash != sourceHash) err = SPCECHO_E_MISMATCH;
+
+    for(; i < delta->changes; i++)
+    {
+        unsigned long offset;
+
+        if(fread(change, 1, sizeof change, in) < sizeof change) return SPCECHO_E_READ;
+        if(err != SPCECHO_OK) continue;
+
+        offset = (unsigned long) getLE(change, 4);
+
+        if(offset >= ctx->length || ctx->buffer[offset] != change[4])
+        {
+            err = SPCECHO_E_MISMATCH;
+            continue;
+        }
+
+        ctx->buffer[offset] = change[5];
+    }
+
+    return err;
+}
@@ -0,0 +1,38 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdio.h>
+
+#include "spcecho.h"
+
+/* One patch record, little-endian; any number of them can be concatenated into a stream:
+
+     0  "SPCD"
+     4  version (u16), currently 1
+     6  name length (u16)
+     8  source image length (u32)
+    12  source image hash (u64, FNV-1a)
+    20  change count (u32)
+    24  name of the patched file, not terminated
+        then per change: offset into the image (u32), old byte, new byte */
+#define DELTA_MAGIC "SPCD"
+#define DELTA_VERSION 1
+#define DELTA_HEADER 24
+#define DELTA_CHANGE 6
+
+typedef struct SpcDelta
+{
+    unsigned long sourceLength;
+    unsigned long long sourceHash;
+    unsigned long changes;
+    char name[FILENAME_MAX];
+
+} spcdelta_t;
+
+unsigned long long spcechoHash(const unsigned char *image, size_t length);
+
+spcecho_error_t spcechoDeltaWrite(const spcecho_ctx *ctx, const unsigned char *source, const char *name,
+                                  FILE *out, size_t *written);
+spcecho_error_t spcechoDeltaApply(spcecho_ctx *ctx, unsigned long long sourceHash, FILE *in, spcdelta_t *delta);
+
+#endif /*DELTA_H*/
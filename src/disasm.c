@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "disasm.h"
+
+#define A CLOBBER_A
+#define X CLOBBER_X
+#define Y CLOBBER_Y
+
+/* shorthands so each opcode fits on one line */
+#define OP(text, length, store, clobbers)  { text, length, FLOW_NEXT, STORE_##store, clobbers }
+#define GO(text, length, flow)             { text, length, FLOW_##flow, STORE_NONE, 0 }
+#define BR(text, length)                   { text, length, FLOW_BRANCH, STORE_NONE, 0 }
+
+/* every SPC700 opcode, in order */
+static const opinfo_t ops[0x100] =
+{
+    /* 0x */
+    OP("NOP", 1, NONE, 0),          GO("TCALL 0", 1, TCALL),        OP("SET1 d.0", 2, DP, 0),       BR("BBS d.0, r", 3),
+    OP("OR A, d", 2, NONE, A),      OP("OR A, !a", 3, NONE, A),     OP("OR A, (X)", 1, NONE, A),    OP("OR A, [d+X]", 2, NONE, A),
+    OP("OR A, #i", 2, NONE, A),     OP("OR e, d", 3, DP2, 0),       OP("OR1 C, m", 3, NONE, 0),     OP("ASL d", 2, DP, 0),
+    OP("ASL !a", 3, ABS, 0),        OP("PUSH PSW", 1, NONE, 0),     OP("TSET1 !a", 3, ABS, 0),      GO("BRK", 1, BRK),
+
+    /* 1x */
+    BR("BPL r", 2),                 GO("TCALL 1", 1, TCALL),        OP("CLR1 d.0", 2, DP, 0),       BR("BBC d.0, r", 3),
+    OP("OR A, d+X", 2, NONE, A),    OP("OR A, !a+X", 3, NONE, A),   OP("OR A, !a+Y", 3, NONE, A),   OP("OR A, [d]+Y", 2, NONE, A),
+    OP("OR e, #i", 3, DP2, 0),      OP("OR (X), (Y)", 1, IX, 0),    OP("DECW d", 2, DPW, 0),        OP("ASL d+X", 2, DPX, 0),
+    OP("ASL A", 1, NONE, A),        OP("DEC X", 1, NONE, X),        OP("CMP X, !a", 3, NONE, 0),    GO("JMP [!a+X]", 3, JMPX),
+
+    /* 2x */
+    OP("CLRP", 1, NONE, 0),         GO("TCALL 2", 1, TCALL),        OP("SET1 d.1", 2, DP, 0),       BR("BBS d.1, r", 3),
+    OP("AND A, d", 2, NONE, A),     OP("AND A, !a", 3, NONE, A),    OP("AND A, (X)", 1, NONE, A),   OP("AND A, [d+X]", 2, NONE, A),
+    OP("AND A, #i", 2, NONE, A),    OP("AND e, d", 3, DP2, 0),      OP("OR1 C, /m", 3, NONE, 0),    OP("ROL d", 2, DP, 0),
+    OP("ROL !a", 3, ABS, 0),        OP("PUSH A", 1, NONE, 0),       BR("CBNE d, r", 3),             GO("BRA r", 2, BRA),
+
+    /* 3x */
+    BR("BMI r", 2),                 GO("TCALL 3", 1, TCALL),        OP("CLR1 d.1", 2, DP, 0),       BR("BBC d.1, r", 3),
+    OP("AND A, d+X", 2, NONE, A),   OP("AND A, !a+X", 3, NONE, A),  OP("AND A, !a+Y", 3, NONE, A),  OP("AND A, [d]+Y", 2, NONE, A),
+    OP("AND e, #i", 3, DP2, 0),     OP("AND (X), (Y)", 1, IX, 0),   OP("INCW d", 2, DPW, 0),        OP("ROL d+X", 2, DPX, 0),
+    OP("ROL A", 1, NONE, A),        OP("INC X", 1, NONE, X),        OP("CMP X, d", 2, NONE, 0),     GO("CALL !a", 3, CALL),
+
+    /* 4x */
+    OP("SETP", 1, NONE, 0),         GO("TCALL 4", 1, TCALL),        OP("SET1 d.2", 2, DP, 0),       BR("BBS d.2, r", 3),
+    OP("EOR A, d", 2, NONE, A),     OP("EOR A, !a", 3, NONE, A),    OP("EOR A, (X)", 1, NONE, A),   OP("EOR A, [d+X]", 2, NONE, A),
+    OP("EOR A, #i", 2, NONE, A),    OP("EOR e, d", 3, DP2, 0),      OP("AND1 C, m", 3, NONE, 0),    OP("LSR d", 2, DP, 0),
+    OP("LSR !a", 3, ABS, 0),        OP("PUSH X", 1, NONE, 0),       OP("TCLR1 !a", 3, ABS, 0),      GO("PCALL u", 2, PCALL),
+
+    /* 5x */
+    BR("BVC r", 2),                 GO("TCALL 5", 1, TCALL),        OP("CLR1 d.2", 2, DP, 0),       BR("BBC d.2, r", 3),
+    OP("EOR A, d+X", 2, NONE, A),   OP("EOR A, !a+X", 3, NONE, A),  OP("EOR A, !a+Y", 3, NONE, A),  OP("EOR A, [d]+Y", 2, NONE, A),
+    OP("EOR e, #i", 3, DP2, 0),     OP("EOR (X), (Y)", 1, IX, 0),   OP("CMPW YA, d", 2, NONE, 0),   OP("LSR d+X", 2, DPX, 0),
+    OP("LSR A", 1, NONE, A),        OP("MOV X, A", 1, NONE, X),     OP("CMP Y, !a", 3, NONE, 0),    GO("JMP !a", 3, JMP),
+
+    /* 6x */
+    OP("CLRC", 1, NONE, 0),         GO("TCALL 6", 1, TCALL),        OP("SET1 d.3", 2, DP, 0),       BR("BBS d.3, r", 3),
+    OP("CMP A, d", 2, NONE, 0),     OP("CMP A, !a", 3, NONE, 0),    OP("CMP A, (X)", 1, NONE, 0),   OP("CMP A, [d+X]", 2, NONE, 0),
+    OP("CMP A, #i", 2, NONE, 0),    OP("CMP e, d", 3, NONE, 0),     OP("AND1 C, /m", 3, NONE, 0),   OP("ROR d", 2, DP, 0),
+    OP("ROR !a", 3, ABS, 0),        OP("PUSH Y", 1, NONE, 0),       { "DBNZ d, r", 3, FLOW_BRANCH, STORE_DP, 0 }, GO("RET", 1, RET),
+
+    /* 7x */
+    BR("BVS r", 2),                 GO("TCALL 7", 1, TCALL),        OP("CLR1 d.3", 2, DP, 0),       BR("BBC d.3, r", 3),
+    OP("CMP A, d+X", 2, NONE, 0),   OP("CMP A, !a+X", 3, NONE, 0),  OP("CMP A, !a+Y", 3, NONE, 0),  OP("CMP A, [d]+Y", 2, NONE, 0),
+    OP("CMP e, #i", 3, NONE, 0),    OP("CMP (X), (Y)", 1, NONE, 0), OP("ADDW YA, d", 2, NONE, A|Y), OP("ROR d+X", 2, DPX, 0),
+    OP("ROR A", 1, NONE, A),        OP("MOV A, X", 1, NONE, A),     OP("CMP Y, d", 2, NONE, 0),     GO("RETI", 1, RET),
+
+    /* 8x */
+    OP("SETC", 1, NONE, 0),         GO("TCALL 8", 1, TCALL),        OP("SET1 d.4", 2, DP, 0),       BR("BBS d.4, r", 3),
+    OP("ADC A, d", 2, NONE, A),     OP("ADC A, !a", 3, NONE, A),    OP("ADC A, (X)", 1, NONE, A),   OP("ADC A, [d+X]", 2, NONE, A),
+    OP("ADC A, #i", 2, NONE, A),    OP("ADC e, d", 3, DP2, 0),      OP("EOR1 C, m", 3, NONE, 0),    OP("DEC d", 2, DP, 0),
+    OP("DEC !a", 3, ABS, 0),        OP("MOV Y, #i", 2, NONE, Y),    OP("POP PSW", 1, NONE, 0),      OP("MOV e, #i", 3, DP2, 0),
+
+    /* 9x */
+    BR("BCC r", 2),                 GO("TCALL 9", 1, TCALL),        OP("CLR1 d.4", 2, DP, 0),       BR("BBC d.4, r", 3),
+    OP("ADC A, d+X", 2, NONE, A),   OP("ADC A, !a+X", 3, NONE, A),  OP("ADC A, !a+Y", 3, NONE, A),  OP("ADC A, [d]+Y", 2, NONE, A),
+    OP("ADC e, #i", 3, DP2, 0),     OP("ADC (X), (Y)", 1, IX, 0),   OP("SUBW YA, d", 2, NONE, A|Y), OP("DEC d+X", 2, DPX, 0),
+    OP("DEC A", 1, NONE, A),        OP("MOV X, SP", 1, NONE, X),    OP("DIV YA, X", 1, NONE, A|Y),  OP("XCN A", 1, NONE, A),
+
+    /* Ax */
+    OP("EI", 1, NONE, 0),           GO("TCALL 10", 1, TCALL),       OP("SET1 d.5", 2, DP, 0),       BR("BBS d.5, r", 3),
+    OP("SBC A, d", 2, NONE, A),     OP("SBC A, !a", 3, NONE, A),    OP("SBC A, (X)", 1, NONE, A),   OP("SBC A, [d+X]", 2, NONE, A),
+    OP("SBC A, #i", 2, NONE, A),    OP("SBC e, d", 3, DP2, 0),      OP("MOV1 C, m", 3, NONE, 0),    OP("INC d", 2, DP, 0),
+    OP("INC !a", 3, ABS, 0),        OP("CMP Y, #i", 2, NONE, 0),    OP("POP A", 1, NONE, A),        OP("MOV (X)+, A", 1, IX, X),
+
+    /* Bx */
+    BR("BCS r", 2),                 GO("TCALL 11", 1, TCALL),       OP("CLR1 d.5", 2, DP, 0),       BR("BBC d.5, r", 3),
+    OP("SBC A, d+X", 2, NONE, A),   OP("SBC A, !a+X", 3, NONE, A),  OP("SBC A, !a+Y", 3, NONE, A),  OP("SBC A, [d]+Y", 2, NONE, A),
+    OP("SBC e, #i", 3, DP2, 0),     OP("SBC (X), (Y)", 1, IX, 0),   OP("MOVW YA, d", 2, NONE, A|Y), OP("INC d+X", 2, DPX, 0),
+    OP("INC A", 1, NONE, A),        OP("MOV SP, X", 1, NONE, 0),    OP("DAS A", 1, NONE, A),        OP("MOV A, (X)+", 1, NONE, A|X),
+
+    /* Cx */
+    OP("DI", 1, NONE, 0),           GO("TCALL 12", 1, TCALL),       OP("SET1 d.6", 2, DP, 0),       BR("BBS d.6, r", 3),
+    OP("MOV d, A", 2, DP, 0),       OP("MOV !a, A", 3, ABS, 0),     OP("MOV (X), A", 1, IX, 0),     OP("MOV [d+X], A", 2, IDX, 0),
+    OP("CMP X, #i", 2, NONE, 0),    OP("MOV !a, X", 3, ABS, 0),     OP("MOV1 m, C", 3, BIT, 0),     OP("MOV d, Y", 2, DP, 0),
+    OP("MOV !a, Y", 3, ABS, 0),     OP("MOV X, #i", 2, NONE, X),    OP("POP X", 1, NONE, X),        OP("MUL YA", 1, NONE, A|Y),
+
+    /* Dx */
+    BR("BNE r", 2),                 GO("TCALL 13", 1, TCALL),       OP("CLR1 d.6", 2, DP, 0),       BR("BBC d.6, r", 3),
+    OP("MOV d+X, A", 2, DPX, 0),    OP("MOV !a+X, A", 3, ABSX, 0),  OP("MOV !a+Y, A", 3, ABSY, 0),  OP("MOV [d]+Y, A", 2, IDY, 0),
+    OP("MOV d, X", 2, DP, 0),       OP("MOV d+Y, X", 2, DPY, 0),    OP("MOVW d, YA", 2, DPW, 0),    OP("MOV d+X, Y", 2, DPX, 0),
+    OP("DEC Y", 1, NONE, Y),        OP("MOV A, Y", 1, NONE, A),     BR("CBNE d+X, r", 3),           OP("DAA A", 1, NONE, A),
+
+    /* Ex */
+    OP("CLRV", 1, NONE, 0),         GO("TCALL 14", 1, TCALL),       OP("SET1 d.7", 2, DP, 0),       BR("BBS d.7, r", 3),
+    OP("MOV A, d", 2, NONE, A),     OP("MOV A, !a", 3, NONE, A),    OP("MOV A, (X)", 1, NONE, A),   OP("MOV A, [d+X]", 2, NONE, A),
+    OP("MOV A, #i", 2, NONE, A),    OP("MOV X, !a", 3, NONE, X),    OP("NOT1 m", 3, BIT, 0),        OP("MOV Y, d", 2, NONE, Y),
+    OP("MOV Y, !a", 3, NONE, Y),    OP("NOTC", 1, NONE, 0),         OP("POP Y", 1, NONE, Y),        GO("SLEEP", 1, STOP),
+
+    /* Fx */
+    BR("BEQ r", 2),                 GO("TCALL 15", 1, TCALL),       OP("CLR1 d.7", 2, DP, 0),       BR("BBC d.7, r", 3),
+    OP("MOV A, d+X", 2, NONE, A),   OP("MOV A, !a+X", 3, NONE, A),  OP("MOV A, !a+Y", 3, NONE, A),  OP("MOV A, [d]+Y", 2, NONE, A),
+    OP("MOV X, d", 2, NONE, X),     OP("MOV X, d+Y", 2, NONE, X),   OP("MOV e, d", 3, DP2, 0),      OP("MOV Y, d+X", 2, NONE, Y),
+    OP("INC Y", 1, NONE, Y),        OP("MOV Y, A", 1, NONE, Y),     { "DBNZ Y, r", 2, FLOW_BRANCH, STORE_NONE, Y }, GO("STOP", 1, STOP),
+};
+
+#undef A
+#undef X
+#undef Y
+
+const opinfo_t *disasmOp(int opcode)
+{
+    return &ops[opcode & 0xFF];
+}
+
+/* one instruction as text, operands filled in from RAM. Returns its length */
+int disasmFormat(const unsigned char *ram, int pc, char *text, size_t size)
+{
+    const opinfo_t *op = &ops[ram[pc & 0xFFFF]];
+    const char *c = op->text;
+    int b1 = ram[(pc + 1) & 0xFFFF], b2 = ram[(pc + 2) & 0xFFFF], last = op->length == 3 ? b2 : b1;
+    size_t used = 0;
+
+    for(; *c != '\0' && used + 8 < size; c++)
+    {
+        switch(*c)
+        {
+            case 'd': used += sprintf(text + used, "$%02X", b1); break;
+            case 'e': used += sprintf(text + used, "$%02X", b2); break;
+            case 'i': used += sprintf(text + used, "$%02X", b1); break;
+            case 'a': used += sprintf(text + used, "$%04X", b1 | b2 << 8); break;
+            case 'u': used += sprintf(text + used, "$FF%02X", b1); break;
+            case 'm': used += sprintf(text + used, "$%04X.%d", (b1 | b2 << 8) & 0x1FFF, b2 >> 5); break;
+            case 'r': used += sprintf(text + used, "$%04X", (pc + op->length + (signed char) last) & 0xFFFF); break;
+            default:  text[used++] = *c; break;
+        }
+    }
+
+    text[used] = '\0';
+
+    return op->length;
+}
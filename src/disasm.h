@@ -0,0 +1,61 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+
+/* where execution can go after an instruction */
+typedef enum OpFlow
+{
+    FLOW_NEXT   = 0,
+    FLOW_BRANCH = 1,    /* conditional, relative offset in the last byte */
+    FLOW_BRA    = 2,
+    FLOW_JMP    = 3,
+    FLOW_JMPX   = 4,    /* JMP [!a+X]: through a table */
+    FLOW_CALL   = 5,
+    FLOW_PCALL  = 6,    /* CALL $FFxx */
+    FLOW_TCALL  = 7,    /* CALL through the vector at $FFDE - 2n */
+    FLOW_RET    = 8,
+    FLOW_STOP   = 9,
+    FLOW_BRK    = 10
+
+} op_flow_t;
+
+/* how the memory an instruction writes is addressed */
+typedef enum OpStore
+{
+    STORE_NONE = 0,
+    STORE_DP,           /* direct page, first operand byte */
+    STORE_DP2,          /* direct page, second operand byte (d, #i and dd, ds forms) */
+    STORE_DPX,
+    STORE_DPY,
+    STORE_ABS,
+    STORE_ABSX,
+    STORE_ABSY,
+    STORE_IX,           /* (X) */
+    STORE_IDX,          /* [d+X] */
+    STORE_IDY,          /* [d]+Y */
+    STORE_BIT,          /* m.b: 13-bit address, 3-bit bit number */
+    STORE_DPW           /* a direct page word */
+
+} op_store_t;
+
+/* registers an instruction leaves with a value the analyzer can't follow */
+#define CLOBBER_A 1
+#define CLOBBER_X 2
+#define CLOBBER_Y 4
+
+typedef struct OpInfo
+{
+    const char *text;       /* operands: d/e first/second direct byte, i immediate, a absolute,
+                               r branch target, m bit address, u PCALL page offset */
+    unsigned char length;
+    unsigned char flow;
+    unsigned char store;
+    unsigned char clobbers;
+
+} opinfo_t;
+
+const opinfo_t *disasmOp(int opcode);
+int disasmFormat(const unsigned char *ram, int pc, char *text, size_t size);
+
+#endif /*DISASM_H*/
@@ -0,0 +1,37 @@
+#ifndef DSPREGS_H
+#define DSPREGS_H
+
+/* S-DSP register numbers (voice registers are offset by voice * 10h), as indexes into the
+   128-byte DSP page of an .spc */
+#define DSP_VOLL  0x00
+#define DSP_VOLR  0x01
+#define DSP_PITCHL 0x02
+#define DSP_PITCHH 0x03
+#define DSP_SRCN  0x04
+#define DSP_ADSR0 0x05
+#define DSP_ADSR1 0x06
+#define DSP_GAIN  0x07
+#define DSP_ENVX  0x08
+#define DSP_OUTX  0x09
+#define DSP_FIR   0x0F
+
+#define DSP_MVOLL 0x0C
+#define DSP_MVOLR 0x1C
+#define DSP_EVOLL 0x2C
+#define DSP_EVOLR 0x3C
+#define DSP_KON   0x4C
+#define DSP_KOFF  0x5C
+#define DSP_FLG   0x6C
+#define DSP_ENDX  0x7C
+#define DSP_EFB   0x0D
+#define DSP_PMON  0x2D
+#define DSP_NON   0x3D
+#define DSP_EON   0x4D
+#define DSP_DIR   0x5D
+#define DSP_ESA   0x6D
+#define DSP_EDL   0x7D
+
+/* FLG bit 5: the echo buffer is not written */
+#define FLG_ECHO_OFF 0x20
+
+#endif
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fir.h"
+#include "stats.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIR_X86 1
+#include <immintrin.h>
+#endif
+
+#define FIR_RATE     32000.0
+#define FIR_POINTS   64         /* graded frequencies, evenly spread up to 16kHz */
+#define FIR_RESTARTS 256        /* searches per design, shared out between the workers */
+#define TRANSITION   1000.0     /* Hz either side of a band edge left ungraded, at most */
+#define STABLE_MARGIN 0.97      /* keep the echo loop gain this far under 1 */
+#define TELEPHONE_LOW  300.0
+#define TELEPHONE_HIGH 3400.0
+
+/* the first seven products are summed in 16 bits. Echo history holds samples >> 1, so each
+   product can reach 256 * |tap|, and seven taps wrap once their magnitudes pass 127 */
+#define WRAP_LIMIT 127
+
+static const char *implNames[] = { "scalar", "sse2" };
+
+/* everything a worker needs to grade a set of taps; read-only once built */
+typedef struct FirGrid
+{
+    float cosTab[FIR_TAPS][FIR_POINTS] __attribute__((aligned(16)));
+    float sinTab[FIR_TAPS][FIR_POINTS] __attribute__((aligned(16)));
+    float target[FIR_POINTS] __attribute__((aligned(16)));
+    float weight[FIR_POINTS] __attribute__((aligned(16)));
+    float limit;            /* largest gain allowed anywhere */
+    fir_impl_t impl;
+    signed char start[FIR_TAPS];    /* quantized window design every search starts near */
+
+} fir_grid_t;
+
+typedef struct FirPool
+{
+    const fir_grid_t *grid;
+    pthread_mutex_t lock;
+    int nextRestart;
+
+    signed char best[FIR_TAPS];
+    double bestError;
+    int bestRestart;
+    long evaluations;
+
+} fir_pool_t;
+
+int firParseTarget(const char *text, fir_target_t *target)
+{
+    char *end;
+
+    memset(target, 0, sizeof *target);
+
+    if(strcmp(text, "flat") == 0) target->shape = FIR_FLAT;
+    else if(strcmp(text, "telephone") == 0)
+    {
+        target->shape = FIR_BANDPASS;
+        target->low = TELEPHONE_LOW;
+        target->high = TELEPHONE_HIGH;
+    }
+    else if(strncmp(text, "lowpass:", 8) == 0)
+    {
+        target->shape = FIR_LOWPASS;
+        target->low = strtod(text + 8, &end);
+        if(*end != '\0' || end == text + 8) return 0;
+    }
+    else if(strncmp(text, "highpass:", 9) == 0)
+    {
+        target->shape = FIR_HIGHPASS;
+        target->high = strtod(text + 9, &end);
+        if(*end != '\0' || end == text + 9) return 0;
+    }
+    else if(strncmp(text, "bandpass:", 9) == 0)
+    {
+        target->shape = FIR_BANDPASS;
+        target->low = strtod(text + 9, &end);
+        if(*end != '-' || end == text + 9) return 0;
+
+        text = end + 1;
+        target->high = strtod(text, &end);
+        if(*end != '\0' || end == text) return 0;
+    }
+    else return 0;
+
+    /* edges must sit strictly inside 0-16kHz */
+    switch(target->shape)
+    {
+        case FIR_LOWPASS:  return target->low > 0 && target->low < FIR_RATE / 2;
+        case FIR_HIGHPASS: return target->high > 0 && target->high < FIR_RATE / 2;
+        case FIR_BANDPASS: return target->low > 0 && target->low < target->high && target->high < FIR_RATE / 2;
+        default:           return 1;
+    }
+}
+
+const char *firDescribe(const fir_target_t *target, char *text, size_t size)
+{
+    switch(target->shape)
+    {
+        case FIR_LOWPASS:  snprintf(text, size, "low-pass at %.0fHz", target->low); break;
+        case FIR_HIGHPASS: snprintf(text, size, "high-pass at %.0fHz", target->high); break;
+        case FIR_BANDPASS: snprintf(text, size, "band-pass %.0f-%.0fHz", target->low, target->high); break;
+        default:           snprintf(text, size, "flat"); break;
+    }
+
+    return text;
+}
+
+fir_impl_t firBest(void)
+{
+#ifdef FIR_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("sse2")) return FIR_SSE2;
+#endif
+
+    return FIR_SCALAR;
+}
+
+const char *firName(fir_impl_t impl)
+{
+    return implNames[impl];
+}
+
+/* gain of the taps at one frequency, 1.0 = unity. Tap 0 is applied to the oldest of the eight samples */
+double firResponse(const signed char *taps, double hz)
+{
+    double re = 0, im = 0, w = 2 * M_PI * hz / FIR_RATE;
+    int i = 0;
+
+    for(; i < FIR_TAPS; i++)
+    {
+        re += taps[i] * cos(w * (FIR_TAPS - 1 - i));
+        im -= taps[i] * sin(w * (FIR_TAPS - 1 - i));
+    }
+
+    return sqrt(re * re + im * im) / 128;
+}
+
+/* weighted squared error over the grid; *peak gets the largest gain seen */
+static float evaluateScalar(const fir_grid_t *grid, const float *taps, float *peak)
+{
+    float err = 0, top = 0;
+    int k = 0, i;
+
+    for(; k < FIR_POINTS; k++)
+    {
+        float re = 0, im = 0, mag, d;
+
+        for(i = 0; i < FIR_TAPS; i++)
+        {
+            re += taps[i] * grid->cosTab[i][k];
+            im += taps[i] * grid->sinTab[i][k];
+        }
+
+        mag = sqrtf(re * re + im * im);
+        if(mag > top) top = mag;
+
+        d = mag - grid->target[k];
+        err += grid->weight[k] * d * d;
+    }
+
+    *peak = top;
+    return err;
+}
+
+#ifdef FIR_X86
+__attribute__((target("sse2")))
+static float evaluateSse2(const fir_grid_t *grid, const float *taps, float *peak)
+{
+    __m128 err = _mm_setzero_ps(), top = _mm_setzero_ps(), tap[FIR_TAPS];
+    float lanes[4] __attribute__((aligned(16)));
+    int k = 0, i;
+
+    for(i = 0; i < FIR_TAPS; i++) tap[i] = _mm_set1_ps(taps[i]);
+
+    for(; k < FIR_POINTS; k += 4)
+    {
+        __m128 re = _mm_setzero_ps(), im = _mm_setzero_ps(), mag, d;
+
+        for(i = 0; i < FIR_TAPS; i++)
+        {
+            re = _mm_add_ps(re, _mm_mul_ps(tap[i], _mm_load_ps(&grid->cosTab[i][k])));
+            im = _mm_add_ps(im, _mm_mul_ps(tap[i], _mm_load_ps(&grid->sinTab[i][k])));
+        }
+
+        mag = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)));
+        top = _mm_max_ps(top, mag);
+
+        d = _mm_sub_ps(mag, _mm_load_ps(&grid->target[k]));
+        err = _mm_add_ps(err, _mm_mul_ps(_mm_load_ps(&grid->weight[k]), _mm_mul_ps(d, d)));
+    }
+
+    _mm_store_ps(lanes, top);
+    *peak = lanes[0];
+    for(i = 1; i < 4; i++) if(lanes[i] > *peak) *peak = lanes[i];
+
+    _mm_store_ps(lanes, err);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+/* error of a set of taps, or -1 if it would wrap or let the echo feedback run away */
+static float grade(const fir_grid_t *grid, const signed char *taps, long *evaluations)
+{
+    float scaled[FIR_TAPS], peak, err;
+    int i = 0, sum = 0;
+
+    for(; i < FIR_TAPS - 1; i++) sum += abs(taps[i]);
+    if(sum > WRAP_LIMIT) return -1;
+
+    for(i = 0; i < FIR_TAPS; i++) scaled[i] = taps[i] / 128.0f;
+
+#ifdef FIR_X86
+    if(grid->impl == FIR_SSE2) err = evaluateSse2(grid, scaled, &peak);
+    else
+#endif
+    err = evaluateScalar(grid, scaled, &peak);
+
+    (*evaluations)++;
+
+    return peak > grid->limit ? -1 : err;
+}
+
+static int clampTap(int v)
+{
+    return v < -128 ? -128 : v > 127 ? 127 : v;
+}
+
+/* Hamming-windowed sinc, shifted up the spectrum for high and band passes, scaled to the passband gain */
+static void windowDesign(const fir_target_t *target, double gain, double *h)
+{
+    double fc, shift = 0, sum = 0;
+    int n = 0;
+
+    switch(target->shape)
+    {
+        case FIR_LOWPASS:  fc = target->low / FIR_RATE; break;
+        case FIR_HIGHPASS: fc = 0.5 - target->high / FIR_RATE; shift = 0.5; break;
+        case FIR_BANDPASS: fc = (target->high - target->low) / 2 / FIR_RATE;
+                           shift = (target->high + target->low) / 2 / FIR_RATE; break;
+        default:
+            memset(h, 0, FIR_TAPS * sizeof *h);
+            h[FIR_TAPS - 1] = gain;
+            return;
+    }
+
+    for(; n < FIR_TAPS; n++)
+    {
+        double t = n - (FIR_TAPS - 1) / 2.0, x = 2 * M_PI * fc * t;
+
+        h[n] = 2 * fc * (x == 0 ? 1 : sin(x) / x) * (0.54 - 0.46 * cos(2 * M_PI * n / (FIR_TAPS - 1)));
+        h[n] *= shift > 0 ? 2 * cos(2 * M_PI * shift * t) : 1;
+    }
+
+    /* normalize at the middle of the passband */
+    for(n = 0; n < FIR_TAPS; n++) sum += h[n] * cos(2 * M_PI * shift * (n - (FIR_TAPS - 1) / 2.0));
+    if(target->shape == FIR_HIGHPASS) sum = fabs(sum);
+
+    for(n = 0; n < FIR_TAPS; n++) h[n] *= sum != 0 ? gain / sum : 0;
+}
+
+/* Hz either side of edge left ungraded: TRANSITION, or half the way to 0Hz or 16kHz if that is
+   less, so a low edge such as the telephone band's 300Hz still has a stopband below it */
+static double transitionAt(double edge)
+{
+    double room = (edge < FIR_RATE / 2 - edge ? edge : FIR_RATE / 2 - edge) / 2;
+
+    return room < TRANSITION ? room : TRANSITION;
+}
+
+/* whether hz is in the passband, edges aside */
+static int passAt(const fir_target_t *target, double hz)
+{
+    switch(target->shape)
+    {
+        case FIR_LOWPASS:  return hz < target->low;
+        case FIR_HIGHPASS: return hz > target->high;
+        case FIR_BANDPASS: return hz > target->low && hz < target->high;
+        default:           return 1;
+    }
+}
+
+/* 1 in the passband, 0 in the stopband, -1 close enough to an edge not to be graded */
+static int bandAt(const fir_target_t *target, double hz)
+{
+    int lowEdge = target->shape == FIR_LOWPASS || target->shape == FIR_BANDPASS;
+    int highEdge = target->shape == FIR_HIGHPASS || target->shape == FIR_BANDPASS;
+
+    if((lowEdge && fabs(hz - target->low) < transitionAt(target->low)) ||
+       (highEdge && fabs(hz - target->high) < transitionAt(target->high))) return -1;
+
+    return passAt(target, hz);
+}
+
+static void buildGrid(fir_grid_t *grid, const fir_target_t *target, double limit)
+{
+    double h[FIR_TAPS], gain = limit < 1 ? limit : 1, scale = 128;
+    long unused = 0;
+    int k = 0, i;
+
+    memset(grid, 0, sizeof *grid);
+    grid->limit = (float) limit;
+    grid->impl = firBest();
+
+    for(; k < FIR_POINTS; k++)
+    {
+        double hz = (k + 0.5) * FIR_RATE / 2 / FIR_POINTS;
+        int band = bandAt(target, hz);
+
+        for(i = 0; i < FIR_TAPS; i++)
+        {
+            double angle = 2 * M_PI * hz / FIR_RATE * (FIR_TAPS - 1 - i);
+
+            grid->cosTab[i][k] = (float) cos(angle);
+            grid->sinTab[i][k] = (float) -sin(angle);
+        }
+
+        /* the point nearest DC is always graded, as whichever side of the edge it falls */
+        if(band < 0 && k == 0) band = passAt(target, hz);
+
+        grid->target[k] = band > 0 ? (float) gain : 0;
+        grid->weight[k] = band < 0 ? 0 : 1;
+    }
+
+    /* quantize the window design, backing off until it neither wraps nor runs away */
+    windowDesign(target, gain, h);
+
+    for(; scale > 1; scale *= 0.95)
+    {
+        for(i = 0; i < FIR_TAPS; i++) grid->start[i] = (signed char) clampTap((int) lrint(h[i] * scale));
+        if(grade(grid, grid->start, &unused) >= 0) return;
+    }
+
+    memset(grid->start, 0, sizeof grid->start);
+}
+
+static unsigned int nextRandom(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/* one restart: jitter the start, then take integer steps on one tap or between two taps while the error drops */
+static double searchFrom(const fir_grid_t *grid, int restart, signed char *taps, long *evaluations)
+{
+    static const int steps[] = { 16, 8, 4, 2, 1 };
+    unsigned int seed = 0x9E3779B9u * (unsigned int) (restart + 1);
+    int spread = 4 + (restart % 8) * 6, i, j, s, improved = 1;
+    double err;
+
+    memcpy(taps, grid->start, FIR_TAPS);
+
+    if(restart > 0)
+    {
+        signed char jittered[FIR_TAPS];
+
+        for(i = 0; i < FIR_TAPS; i++)
+            jittered[i] = (signed char) clampTap(taps[i] + (int) (nextRandom(&seed) % (2 * spread + 1)) - spread);
+
+        /* halve the jitter until the start is usable again */
+        while(spread > 0 && grade(grid, jittered, evaluations) < 0)
+        {
+            for(i = 0; i < FIR_TAPS; i++) jittered[i] = (signed char) ((jittered[i] + taps[i]) / 2);
+            spread /= 2;
+        }
+
+        if(spread > 0) memcpy(taps, jittered, FIR_TAPS);
+    }
+
+    err = grade(grid, taps, evaluations);
+
+    while(improved)
+    {
+        improved = 0;
+
+        for(s = 0; s < (int) (sizeof steps / sizeof *steps); s++)
+        {
+            for(i = 0; i < FIR_TAPS; i++)
+            {
+                for(j = -1; j < FIR_TAPS; j++)
+                {
+                    int dir;
+
+                    if(j == i) continue;
+
+                    for(dir = -1; dir <= 1; dir += 2)
+                    {
+                        signed char trial[FIR_TAPS];
+                        double e;
+
+                        memcpy(trial, taps, FIR_TAPS);
+                        trial[i] = (signed char) clampTap(trial[i] + dir * steps[s]);
+                        if(j >= 0) trial[j] = (signed char) clampTap(trial[j] - dir * steps[s]);
+
+                        if((e = grade(grid, trial, evaluations)) < 0 || e >= err) continue;
+
+                        memcpy(taps, trial, FIR_TAPS);
+                        err = e;
+                        improved = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    return err;
+}
+
+static void *firWorker(void *arg)
+{
+    fir_pool_t *pool = arg;
+    long evaluations = 0;
+
+    for(;;)
+    {
+        signed char taps[FIR_TAPS];
+        double err;
+        int restart;
+
+        pthread_mutex_lock(&pool->lock);
+        restart = pool->nextRestart < FIR_RESTARTS ? pool->nextRestart++ : -1;
+        pthread_mutex_unlock(&pool->lock);
+
+        if(restart < 0) break;
+
+        err = searchFrom(pool->grid, restart, taps, &evaluations);
+
+        /* ties go to the lowest restart so the result doesn't depend on the worker count */
+        pthread_mutex_lock(&pool->lock);
+        if(err >= 0 && (pool->bestError < 0 || err < pool->bestError ||
+                        (err == pool->bestError && restart < pool->bestRestart)))
+        {
+            memcpy(pool->best, taps, FIR_TAPS);
+            pool->bestError = err;
+            pool->bestRestart = restart;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->evaluations += evaluations;
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/* best taps for the target that neither wrap in the 16-bit sum nor, with this feedback
+   level, push the echo loop gain to 1. workers <= 0 uses one per core */
+spcecho_error_t spcechoDesignFir(const fir_target_t *target, int feedback, int workers, fir_design_t *design)
+{
+    fir_grid_t *grid;
+    fir_pool_t pool;
+    pthread_t *threads;
+    double start = statsClock(), limit = 2, graded = 0;
+    int started = 0, k;
+
+    if(feedback != 0) limit = 128.0 / abs(feedback);
+
+    if(workers <= 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (int) cores : 1;
+    }
+
+    if(workers > FIR_RESTARTS) workers = FIR_RESTARTS;
+
+    if((grid = malloc(sizeof *grid)) == NULL) return SPCECHO_E_NOMEM;
+    if((threads = malloc((size_t) workers * sizeof *threads)) == NULL)
+    {
+        free(grid);
+        return SPCECHO_E_NOMEM;
+    }
+
+    buildGrid(grid, target, STABLE_MARGIN * limit);
+
+    memset(&pool, 0, sizeof pool);
+    pool.grid = grid;
+    pool.bestError = -1;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    for(; started < workers; started++)
+        if(pthread_create(&threads[started], NULL, firWorker, &pool) != 0) break;
+
+    /* no threads at all still gets a design */
+    if(started == 0) firWorker(&pool);
+
+    while(started > 0) pthread_join(threads[--started], NULL);
+
+    pthread_mutex_destroy(&pool.lock);
+
+    memset(design, 0, sizeof *design);
+    memcpy(design->taps, pool.bestError >= 0 ? pool.best : grid->start, FIR_TAPS);
+
+    for(k = 0; k < FIR_POINTS; k++) graded += grid->weight[k];
+    design->error = pool.bestError > 0 && graded > 0 ? sqrt(pool.bestError / graded) : 0;
+
+    /* the grid only samples the response; report the peak and the band gains from a finer sweep */
+    design->passLow = -1;
+
+    for(k = 0; k <= 1024; k++)
+    {
+        double hz = k * FIR_RATE / 2 / 1024, gain = firResponse(design->taps, hz);
+        int band = bandAt(target, hz);
+
+        if(gain > design->peak) design->peak = gain;
+        if(band == 0 && gain > design->stopHigh) design->stopHigh = gain;
+        if(band == 1 && (design->passLow < 0 || gain < design->passLow)) design->passLow = gain;
+    }
+
+    design->edgesMet = target->shape == FIR_FLAT || design->stopHigh * 2 <= design->passLow;
+
+    design->limit = limit;
+    design->evaluations = pool.evaluations;
+    design->workers = workers;
+    design->elapsed = statsClock() - start;
+
+    free(threads);
+    free(grid);
+
+    return SPCECHO_OK;
+}
+
+void spcechoSetFir(spcecho_ctx *ctx, const signed char *taps)
+{
+    memcpy(ctx->fir, taps, FIR_TAPS);
+    ctx->firOverwrite = 1;
+}
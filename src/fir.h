@@ -0,0 +1,58 @@
+#ifndef FIR_H
+#define FIR_H
+
+#include "spcecho.h"
+
+#define FIR_TAPS 8
+
+/* the shapes a target response can be asked for in */
+typedef enum FirShape
+{
+    FIR_FLAT     = 0,   /* pass everything: a single full tap */
+    FIR_LOWPASS  = 1,
+    FIR_HIGHPASS = 2,
+    FIR_BANDPASS = 3
+
+} fir_shape_t;
+
+typedef struct FirTarget
+{
+    fir_shape_t shape;
+    double low;         /* Hz; lowpass cutoff, or the bottom of the band */
+    double high;        /* Hz; highpass cutoff, or the top of the band */
+
+} fir_target_t;
+
+typedef enum FirImpl
+{
+    FIR_SCALAR = 0,
+    FIR_SSE2   = 1      /* four frequencies per step */
+
+} fir_impl_t;
+
+typedef struct FirDesign
+{
+    signed char taps[FIR_TAPS];     /* $0F, $1F ... $7F; tap 0 meets the oldest sample */
+    double error;           /* RMS distance from the target over the graded frequencies, 1.0 = full scale */
+    double peak;            /* largest gain of the chosen taps, 1.0 = unity */
+    double limit;           /* largest gain the feedback level leaves stable */
+    double passLow;         /* smallest gain in the passband, away from the edges */
+    double stopHigh;        /* largest gain in the stopband, away from the edges */
+    int edgesMet;           /* the passband stands at least 6dB over the stopband everywhere */
+    long evaluations;       /* responses computed during the search */
+    int workers;
+    double elapsed;         /* wall-clock seconds spent searching */
+
+} fir_design_t;
+
+int firParseTarget(const char *text, fir_target_t *target);
+const char *firDescribe(const fir_target_t *target, char *text, size_t size);
+
+fir_impl_t firBest(void);
+const char *firName(fir_impl_t impl);
+
+double firResponse(const signed char *taps, double hz);
+spcecho_error_t spcechoDesignFir(const fir_target_t *target, int feedback, int workers, fir_design_t *design);
+void spcechoSetFir(spcecho_ctx *ctx, const signed char *taps);
+
+#endif /*FIR_H*/
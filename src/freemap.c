@@ -0,0 +1,80 @@
+#include "freemap.h"
+#include "scan.h"
+
+/* collects the free runs above the stack page in one sweep of the page map,
+   and the length of the longest one */
+int freeMapBuild(const unsigned char *pageMap, freerun_t *runs, int *largest)
+{
+    int page = FIRST_FREE_PAGE, count = 0;
+
+    *largest = 0;
+
+    while(page < 0x100)
+    {
+        int start;
+
+        if(PAGE_USED(pageMap, page))
+        {
+            page++;
+            continue;
+        }
+
+        start = page;
+        while(page < 0x100 && !PAGE_USED(pageMap, page)) page++;
+
+        runs[count].page = start;
+        runs[count].pages = page - start;
+
+        if(runs[count].pages > *largest) *largest = runs[count].pages;
+
+        count++;
+    }
+
+    return count;
+}
+
+/* first page of the tightest run that holds the given number of pages, or -1.
+   Ties go to the higher run, keeping the echo buffer near the top of RAM like before */
+int freeMapBestFit(const freerun_t *runs, int count, int pages)
+{
+    int i = 0, best = -1;
+
+    for(; i < count; i++)
+    {
+        if(runs[i].pages < pages) continue;
+
+        if(best < 0 || runs[i].pages <= runs[best].pages) best = i;
+    }
+
+    return best < 0 ? -1 : runs[best].page;
+}
+
+/* page just past the free run containing page, or -1 if that page holds data */
+int freeMapRunEnd(const freerun_t *runs, int count, int page)
+{
+    int i = 0;
+
+    for(; i < count; i++)
+    {
+        if(page >= runs[i].page && page < runs[i].page + runs[i].pages) return runs[i].page + runs[i].pages;
+    }
+
+    return -1;
+}
+
+/* every step of echo speed (EDL) takes 2kb, i.e. 8 pages; EDL 0 still writes 4 bytes at ESA */
+int freeMapEchoPages(int echoSpeed)
+{
+    echoSpeed &= 0x0F;
+
+    return echoSpeed ? echoSpeed << 3 : 1;
+}
+
+/* largest echo speed whose buffer fits in the given number of pages, -1 if not even EDL 0 does */
+int freeMapSpeedFor(int pages)
+{
+    if(pages < 1) return -1;
+    if(pages >= 15 << 3) return 15;
+
+    return pages >> 3;
+}
@@ -0,0 +1,24 @@
+#ifndef FREEMAP_H
+#define FREEMAP_H
+
+/* a run of consecutive RAM pages that hold nothing but 00h/FFh */
+typedef struct FreeRun
+{
+    int page;       /* first page */
+    int pages;      /* length in pages */
+
+} freerun_t;
+
+/* 256 pages can't hold more than 128 separate runs */
+#define MAX_FREE_RUNS 128
+
+/* pages 00h (direct page, I/O registers) and 01h (stack) are never handed out */
+#define FIRST_FREE_PAGE 0x02
+
+int freeMapBuild(const unsigned char *pageMap, freerun_t *runs, int *largest);
+int freeMapBestFit(const freerun_t *runs, int count, int pages);
+int freeMapRunEnd(const freerun_t *runs, int count, int page);
+int freeMapEchoPages(int echoSpeed);
+int freeMapSpeedFor(int pages);
+
+#endif /*FREEMAP_H*/
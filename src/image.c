@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "image.h"
+
+/* a padded struct would shift every field after it */
+_Static_assert(sizeof(spcheader_t) == 0x2E, "spcheader_t must be 2Eh bytes");
+_Static_assert(sizeof(spcid666_t) == 0xD2, "spcid666_t must be D2h bytes");
+_Static_assert(sizeof(spcdsp_t) == 0x80, "spcdsp_t must be 80h bytes");
+_Static_assert(sizeof(spclayout_t) == SPC_IMAGE_SIZE, "spclayout_t must be 10200h bytes");
+
+static unsigned long getLE(const unsigned char *in, int bytes)
+{
+    unsigned long value = 0;
+
+    while(bytes-- > 0) value = value << 8 | in[bytes];
+
+    return value;
+}
+
+/* the text layout keeps the dump date and lengths as ASCII, which the binary one can't */
+int spcechoId666Binary(const spcid666_t *tags)
+{
+    const unsigned char *field = (const unsigned char *) tags->text.date;
+    size_t i = 0, span = sizeof tags->text.date + sizeof tags->text.seconds + sizeof tags->text.fadeMs;
+
+    for(; i < span; i++)
+    {
+        if(!(field[i] == 0 || (field[i] >= '0' && field[i] <= '9') || field[i] == '/' || field[i] == '-')) return 1;
+    }
+
+    return 0;
+}
+
+/* checks the image once and points view at its parts; nothing is copied */
+spcecho_error_t spcechoView(unsigned char *bytes, size_t length, spcview_t *view)
+{
+    spclayout_t *layout = (spclayout_t *) bytes;
+
+    memset(view, 0, sizeof *view);
+
+    if(length < ADDRESS_OFFSET + sizeof layout->dsp) return SPCECHO_E_TOOSHORT;
+    if(memcmp(layout->header.signature, "SNES-SPC700 Sound File Data", 27) != 0) return SPCECHO_E_FORMAT;
+
+    view->layout = layout;
+    view->header = &layout->header;
+    view->ram = layout->ram;
+    view->dsp = &layout->dsp;
+
+    if(length >= SPC_IMAGE_SIZE) view->extraRam = layout->extraRam;
+
+    if(layout->header.hasId666 == 26)
+    {
+        view->id666 = &layout->id666;
+        view->id666Binary = spcechoId666Binary(view->id666);
+    }
+
+    /* "xid6", chunk size (u32), sub-chunks; a truncated chunk keeps what is there */
+    if(length >= SPC_XID6_OFFSET + 8 && memcmp(bytes + SPC_XID6_OFFSET, "xid6", 4) == 0)
+    {
+        size_t chunk = getLE(bytes + SPC_XID6_OFFSET + 4, 4), room = length - SPC_XID6_OFFSET - 8;
+
+        view->xid6 = bytes + SPC_XID6_OFFSET + 8;
+        view->xid6Length = chunk < room ? chunk : room;
+    }
+
+    return SPCECHO_OK;
+}
+
+/* the extended tag at *cursor (start at 0), and moves past it; 0 when there are no more */
+int spcechoXid6Next(const spcview_t *view, size_t *cursor, spcxid6item_t *item)
+{
+    const unsigned char *at;
+    size_t size;
+
+    if(view->xid6 == NULL || *cursor + 4 > view->xid6Length) return 0;
+
+    at = view->xid6 + *cursor;
+    size = getLE(at + 2, 2);
+
+    item->id = at[0];
+    item->type = at[1];
+
+    /* type 0 keeps its value in the size field; the others are followed by size bytes, padded to 4 */
+    if(item->type == 0)
+    {
+        item->value = (unsigned) size;
+        item->data = NULL;
+        item->length = 0;
+        *cursor += 4;
+
+        return 1;
+    }
+
+    if(*cursor + 4 + size > view->xid6Length) return 0;
+
+    item->data = at + 4;
+    item->length = size;
+    item->value = item->type == 4 && size >= 4 ? (unsigned) getLE(at + 4, 4) : 0;
+    *cursor += 4 + ((size + 3) & ~(size_t) 3);
+
+    return 1;
+}
+
+/* spcechoLoadFile() into the caller's image instead of the heap: no allocation at all, not even
+   a FILE. A file bigger than the image gives SPCECHO_E_TOOLONG and can go to the heap instead */
+spcecho_error_t spcechoLoadInto(spcecho_ctx *ctx, spcimage_t *image, const char *path)
+{
+    unsigned char extra;
+    ssize_t got = 0;
+    int fd;
+
+    spcechoFree(ctx);
+    image->length = 0;
+
+    if((fd = open(path, O_RDONLY)) < 0) return SPCECHO_E_OPEN;
+
+    while(image->length < sizeof image->bytes)
+    {
+        got = read(fd, image->bytes + image->length, sizeof image->bytes - image->length);
+
+        if(got < 0 && errno == EINTR) continue;
+        if(got <= 0) break;
+
+        image->length += (size_t) got;
+    }
+
+    if(got < 0)
+    {
+        close(fd);
+        return SPCECHO_E_READ;
+    }
+
+    if(image->length == sizeof image->bytes && read(fd, &extra, 1) == 1)
+    {
+        close(fd);
+        return SPCECHO_E_TOOLONG;
+    }
+
+    close(fd);
+
+    return spcechoAttach(ctx, image->bytes, image->length);
+}
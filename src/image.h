@@ -0,0 +1,144 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "dspregs.h"
+#include "spcecho.h"
+
+/* The .spc file layout as typed views. Every member is a byte or a byte array, so each struct
+   is exactly its file size with no padding and can be pointed straight at the bytes of an
+   image: nothing is copied and nothing is converted until a field is read */
+
+#define SPC_IMAGE_SIZE 0x10200          /* header, tags, RAM, DSP page and extra RAM */
+#define SPC_XID6_OFFSET SPC_IMAGE_SIZE
+#define SPC_XID6_MAX 0x4000             /* extended tags an arena has room for */
+
+typedef struct SpcHeader
+{
+    char signature[33];                 /* "SNES-SPC700 Sound File Data v0.30" */
+    unsigned char separator[2];         /* 26, 26 */
+    unsigned char hasId666;             /* 26 if the tag block holds ID666, 27 if not */
+    unsigned char version;              /* minor version, 30 */
+    unsigned char pc[2];                /* SPC700 registers, little-endian PC */
+    unsigned char a, x, y, psw, sp;
+    unsigned char reserved[2];
+
+} spcheader_t;
+
+/* ID666 with its dates and lengths as ASCII */
+typedef struct SpcId666Text
+{
+    char title[32];
+    char game[32];
+    char dumper[16];
+    char comment[32];
+    char date[11];                      /* MM/DD/YYYY */
+    char seconds[3];                    /* play time before fading */
+    char fadeMs[5];
+    char artist[32];
+    unsigned char defaultChannels;
+    unsigned char emulator;
+    unsigned char reserved[45];
+
+} spcid666text_t;
+
+/* ID666 with them as little-endian numbers, which moves the artist back one byte */
+typedef struct SpcId666Binary
+{
+    char title[32];
+    char game[32];
+    char dumper[16];
+    char comment[32];
+    unsigned char date[4];              /* day, month, year (u16) */
+    unsigned char unused[7];
+    unsigned char seconds[3];
+    unsigned char fadeMs[4];
+    char artist[32];
+    unsigned char defaultChannels;
+    unsigned char emulator;
+    unsigned char reserved[46];
+
+} spcid666binary_t;
+
+typedef union SpcId666
+{
+    spcid666text_t text;
+    spcid666binary_t binary;
+
+} spcid666_t;
+
+/* one row $x0-$xF of the DSP page: voice x's registers, then one global register in $xC
+   and one in $xD (see spc_dsp_reg_t), then FIR tap x */
+typedef struct SpcDspRow
+{
+    unsigned char volL, volR;
+    unsigned char pitch[2];
+    unsigned char srcn;
+    unsigned char adsr[2];
+    unsigned char gain;
+    unsigned char envx, outx;
+    unsigned char unusedA, unusedB;
+    unsigned char globalC, globalD;
+    unsigned char unusedE;
+    unsigned char fir;
+
+} spcdsprow_t;
+
+typedef union SpcDsp
+{
+    unsigned char reg[0x80];
+    spcdsprow_t voice[8];
+
+} spcdsp_t;
+
+/* the first SPC_IMAGE_SIZE bytes of a .spc */
+typedef struct SpcLayout
+{
+    spcheader_t header;                 /* 00000h */
+    spcid666_t id666;                   /* 0002Eh */
+    unsigned char ram[0x10000];         /* 00100h */
+    spcdsp_t dsp;                       /* 10100h */
+    unsigned char unused[0x40];         /* 10180h */
+    unsigned char extraRam[0x40];       /* 101C0h: RAM under the IPL ROM at $FFC0 */
+
+} spclayout_t;
+
+/* a fixed-size home for one image, for arenas and pools: loading into it allocates nothing */
+typedef struct SpcImage
+{
+    unsigned char bytes[SPC_IMAGE_SIZE + 8 + SPC_XID6_MAX];
+    size_t length;
+
+} spcimage_t;
+
+/* typed pointers into an image's own bytes, filled in by one pass of spcechoView() */
+typedef struct SpcView
+{
+    spclayout_t *layout;
+    spcheader_t *header;
+    spcid666_t *id666;                  /* NULL when the header says there are no tags */
+    int id666Binary;                    /* id666 uses the binary layout */
+    unsigned char *ram;
+    spcdsp_t *dsp;
+    unsigned char *extraRam;            /* NULL if the image stops after the DSP page */
+    const unsigned char *xid6;          /* sub-chunks of the extended tags, NULL if none */
+    size_t xid6Length;
+
+} spcview_t;
+
+/* one extended tag; data points at its bytes, or for inline values is NULL with value set */
+typedef struct SpcXid6Item
+{
+    unsigned char id;
+    unsigned char type;                 /* 0: value only, 1: string, 4: integer */
+    unsigned value;
+    const unsigned char *data;
+    size_t length;
+
+} spcxid6item_t;
+
+int spcechoId666Binary(const spcid666_t *tags);
+spcecho_error_t spcechoView(unsigned char *bytes, size_t length, spcview_t *view);
+int spcechoXid6Next(const spcview_t *view, size_t *cursor, spcxid6item_t *item);
+spcecho_error_t spcechoLoadInto(spcecho_ctx *ctx, spcimage_t *image, const char *path);
+
+#endif /*IMAGE_H*/
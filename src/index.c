@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "dspregs.h"
+#include "index.h"
+#include "image.h"
+#include "spcecho.h"
+#include "stats.h"
+
+/* DSP register behind each byte column, and whether it holds a signed value */
+static const struct
+{
+    const char *name;
+    int reg;
+    int isSigned;
+
+} indexColumns[INDEX_COLUMNS] =
+{
+    { "EVOLL", DSP_EVOLL, 1 },
+    { "EVOLR", DSP_EVOLR, 1 },
+    { "EFB",   DSP_EFB,   1 },
+    { "EDL",   DSP_EDL,   0 },
+    { "EON",   DSP_EON,   0 },
+    { "ESA",   DSP_ESA,   0 },
+    { "FLG",   DSP_FLG,   0 },
+    { "FIR0",  0x0F, 1 },
+    { "FIR1",  0x1F, 1 },
+    { "FIR2",  0x2F, 1 },
+    { "FIR3",  0x3F, 1 },
+    { "FIR4",  0x4F, 1 },
+    { "FIR5",  0x5F, 1 },
+    { "FIR6",  0x6F, 1 },
+    { "FIR7",  0x7F, 1 },
+};
+
+static const char *stringNames[INDEX_STRINGS] = { "path", "title", "game", "artist" };
+
+#define ID666_TEXT 33
+
+/* one scanned file, filled in by a worker */
+typedef struct IndexRow
+{
+    int valid;
+    unsigned char columns[INDEX_COLUMNS];
+    char title[ID666_TEXT];
+    char game[ID666_TEXT];
+    char artist[ID666_TEXT];
+
+} indexrow_t;
+
+static void putLE(unsigned char *out, unsigned long value, int bytes)
+{
+    int i = 0;
+
+    for(; i < bytes; i++) out[i] = (unsigned char) (value >> (i * 8));
+}
+
+static unsigned long getLE(const unsigned char *in, int bytes)
+{
+    unsigned long value = 0;
+
+    while(bytes-- > 0) value = value << 8 | in[bytes];
+
+    return value;
+}
+
+static void copyTag(char *out, const char *tag, int length)
+{
+    int i = 0;
+
+    for(; i < length && tag[i] != '\0'; i++) out[i] = isprint((unsigned char) tag[i]) ? tag[i] : '?';
+
+    out[i] = '\0';
+}
+
+/* xid6 names that stand in for the ID666 ones */
+#define XID6_SONG   0x01
+#define XID6_GAME   0x02
+#define XID6_ARTIST 0x03
+
+/* the header, tags, DSP page and xid6 chunk, read where they sit into an image whose RAM is
+   never filled in; spcechoView() then checks the signature and finds the tags as it would for
+   a whole file. The artist field moves by one byte between the text and binary tag layouts,
+   and xid6 names, which aren't cut off at 32 characters, win over the ID666 ones */
+static void scanFile(const char *path, void *record, void *arg)
+{
+    indexrow_t *row = record;
+    spcimage_t image;
+    spcview_t view;
+    spcxid6item_t item;
+    size_t cursor = 0;
+    ssize_t trailer;
+    int fd, i = 0;
+
+    (void) arg;
+
+    if((fd = open(path, O_RDONLY)) < 0) return;
+
+    if(pread(fd, image.bytes, RAM_OFFSET, 0) != (ssize_t) RAM_OFFSET ||
+       pread(fd, image.bytes + ADDRESS_OFFSET, sizeof(spcdsp_t), ADDRESS_OFFSET) != (ssize_t) sizeof(spcdsp_t))
+    {
+        close(fd);
+        return;
+    }
+
+    trailer = pread(fd, image.bytes + SPC_XID6_OFFSET, sizeof image.bytes - SPC_XID6_OFFSET, SPC_XID6_OFFSET);
+
+    close(fd);
+
+    image.length = trailer > 0 ? SPC_XID6_OFFSET + (size_t) trailer : ADDRESS_OFFSET + sizeof(spcdsp_t);
+
+    if(spcechoView(image.bytes, image.length, &view) != SPCECHO_OK) return;
+
+    for(; i < INDEX_COLUMNS; i++) row->columns[i] = view.dsp->reg[indexColumns[i].reg];
+
+    if(view.id666 != NULL)
+    {
+        copyTag(row->title, view.id666->text.title, 32);
+        copyTag(row->game, view.id666->text.game, 32);
+        copyTag(row->artist, view.id666Binary ? view.id666->binary.artist : view.id666->text.artist, 32);
+    }
+
+    while(spcechoXid6Next(&view, &cursor, &item))
+    {
+        char *name = item.id == XID6_SONG ? row->title : item.id == XID6_GAME ? row->game :
+                     item.id == XID6_ARTIST ? row->artist : NULL;
+
+        if(name != NULL && item.type == 1)
+            copyTag(name, (const char *) item.data, item.length < ID666_TEXT - 1 ? (int) item.length : ID666_TEXT - 1);
+    }
+
+    row->valid = 1;
+}
+
+static int writeSegment(FILE *out, const indexrow_t *rows, char **paths, size_t count, size_t *kept)
+{
+    unsigned char header[INDEX_HEADER], offset[4];
+    unsigned long stringBytes = 0;
+    size_t i, rowCount = 0;
+    int column = 0, s;
+
+    for(i = 0; i < count; i++)
+    {
+        if(!rows[i].valid) continue;
+
+        rowCount++;
+        stringBytes += strlen(paths[i]) + strlen(rows[i].title) + strlen(rows[i].game) + strlen(rows[i].artist) + 4;
+    }
+
+    *kept = rowCount;
+
+    memcpy(header, INDEX_MAGIC, 4);
+    putLE(header + 4, INDEX_VERSION, 2);
+    putLE(header + 6, INDEX_COLUMNS, 2);
+    putLE(header + 8, rowCount, 4);
+    putLE(header + 12, stringBytes, 4);
+
+    if(fwrite(header, 1, sizeof header, out) < sizeof header) return 0;
+
+    for(; column < INDEX_COLUMNS; column++)
+    {
+        for(i = 0; i < count; i++)
+        {
+            if(rows[i].valid && putc(rows[i].columns[column], out) == EOF) return 0;
+        }
+    }
+
+    stringBytes = 0;
+
+    for(i = 0; i < count; i++)
+    {
+        const char *strings[INDEX_STRINGS] = { paths[i], rows[i].title, rows[i].game, rows[i].artist };
+
+        if(!rows[i].valid) continue;
+
+        for(s = 0; s < INDEX_STRINGS; s++)
+        {
+            putLE(offset, stringBytes, 4);
+            if(fwrite(offset, 1, 4, out) < 4) return 0;
+
+            stringBytes += strlen(strings[s]) + 1;
+        }
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        const char *strings[INDEX_STRINGS] = { paths[i], rows[i].title, rows[i].game, rows[i].artist };
+
+        if(!rows[i].valid) continue;
+
+        for(s = 0; s < INDEX_STRINGS; s++)
+        {
+            if(fwrite(strings[s], 1, strlen(strings[s]) + 1, out) < strlen(strings[s]) + 1) return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* index mode: every file source names is scanned on the worker pool and appended to the
+   index as one new segment */
+int runIndex(const char *source, const char *indexPath, int jobs)
+{
+    indexrow_t *rows;
+    char **paths;
+    size_t count, kept = 0, i = 0;
+    double started = statsClock();
+    FILE *out;
+    int ok;
+
+    if((rows = batchEach(source, jobs, sizeof *rows, scanFile, NULL, &paths, &count)) == NULL) return 0;
+
+    if((out = fopen(indexPath, "ab")) == NULL)
+    {
+        printf("%s: %s!\n", indexPath, spcechoStrerror(SPCECHO_E_OPEN));
+        ok = 0;
+    }
+    else
+    {
+        ok = writeSegment(out, rows, paths, count, &kept);
+        if(fclose(out) != 0) ok = 0;
+
+        if(!ok) printf("%s: %s!\n", indexPath, spcechoStrerror(SPCECHO_E_WRITE));
+    }
+
+    if(ok) printf("\nIndexed %lu of %lu files into %s in %.3f s\n", (unsigned long) kept, (unsigned long) count,
+                  indexPath, statsClock() - started);
+
+    for(; i < count; i++) free(paths[i]);
+
+    free(paths);
+    free(rows);
+
+    return ok && kept == count;
+}
+
+typedef enum QueryOp
+{
+    OP_EQ = 0,
+    OP_NE = 1,
+    OP_LT = 2,
+    OP_LE = 3,
+    OP_GT = 4,
+    OP_GE = 5,
+    OP_HAS = 6          /* ~: case-insensitive substring, for the string columns */
+
+} query_op_t;
+
+typedef struct QueryTerm
+{
+    int column;         /* byte column, or INDEX_COLUMNS + string number */
+    query_op_t op;
+    int value;
+    const char *text;
+
+} queryterm_t;
+
+static int parseTerm(const char *term, queryterm_t *out)
+{
+    static const char *ops[] = { "!=", "<=", ">=", "=", "<", ">", "~" };
+    static const query_op_t opValues[] = { OP_NE, OP_LE, OP_GE, OP_EQ, OP_LT, OP_GT, OP_HAS };
+    size_t nameLength = strcspn(term, "=!<>~");
+    const char *rest = term + nameLength;
+    char *end;
+    int i = 0;
+    long value;
+
+    out->column = -1;
+
+    for(; i < INDEX_COLUMNS + INDEX_STRINGS && out->column < 0; i++)
+    {
+        const char *name = i < INDEX_COLUMNS ? indexColumns[i].name : stringNames[i - INDEX_COLUMNS];
+
+        if(strlen(name) == nameLength && strncasecmp(term, name, nameLength) == 0) out->column = i;
+    }
+
+    if(out->column < 0) return 0;
+
+    for(i = 0; i < 7 && strncmp(rest, ops[i], strlen(ops[i])) != 0; i++);
+    if(i == 7) return 0;
+
+    out->op = opValues[i];
+    rest += strlen(ops[i]);
+
+    if(out->column >= INDEX_COLUMNS)
+    {
+        out->text = rest;
+        return out->op == OP_HAS;
+    }
+
+    if(out->op == OP_HAS) return 0;
+
+    /* $xx and 0xNN are hex like the rest of spcecho's register values */
+    if(rest[0] == '$') value = strtol(rest + 1, &end, 16);
+    else value = strtol(rest, &end, 0);
+
+    if(end == rest || *end != '\0' || value < -128 || value > 255) return 0;
+
+    out->value = (int) value;
+
+    return 1;
+}
+
+static int compare(int a, query_op_t op, int b)
+{
+    switch(op)
+    {
+        case OP_EQ: return a == b;
+        case OP_NE: return a != b;
+        case OP_LT: return a < b;
+        case OP_LE: return a <= b;
+        case OP_GT: return a > b;
+        case OP_GE: return a >= b;
+
+        default: return 0;
+    }
+}
+
+static int contains(const char *haystack, const char *needle)
+{
+    size_t length = strlen(needle);
+
+    for(; *haystack != '\0'; haystack++)
+    {
+        if(strncasecmp(haystack, needle, length) == 0) return 1;
+    }
+
+    return length == 0;
+}
+
+/* narrows match[] to the rows of one segment whose column passes the term; byte columns are
+   compared a whole column at a time, signed registers as signed, EDL by its low four bits */
+static void filterColumn(const queryterm_t *term, const unsigned char *column, unsigned char *match, unsigned long rows)
+{
+    unsigned long row = 0;
+
+    for(; row < rows; row++)
+    {
+        int value = column[row];
+
+        if(!match[row]) continue;
+
+        if(indexColumns[term->column].isSigned) value = (signed char) value;
+        else if(indexColumns[term->column].reg == DSP_EDL) value &= 0x0F;
+
+        match[row] = (unsigned char) compare(value, term->op, term->value);
+    }
+}
+
+static void printRow(const unsigned char *columns, unsigned long rows, unsigned long row, const char *const *strings)
+{
+    printf("%-5u %-5d %-5d %-4d %-4d $%02X  $%02X  $%02X %4d %4d %4d %4d %4d %4d %4d %4d  %s",
+           (unsigned) columns[3 * rows + row] & 0x0F, (signed char) columns[row], (signed char) columns[rows + row],
+           (signed char) columns[2 * rows + row], (columns[3 * rows + row] & 0x0F) * 16, columns[4 * rows + row],
+           columns[5 * rows + row], columns[6 * rows + row],
+           (signed char) columns[7 * rows + row], (signed char) columns[8 * rows + row],
+           (signed char) columns[9 * rows + row], (signed char) columns[10 * rows + row],
+           (signed char) columns[11 * rows + row], (signed char) columns[12 * rows + row],
+           (signed char) columns[13 * rows + row], (signed char) columns[14 * rows + row], strings[0]);
+
+    if(strings[1][0] != '\0' || strings[2][0] != '\0') printf("  [%s / %s]", strings[2], strings[1]);
+
+    printf("\n");
+}
+
+/* query mode: the whole index is read once and every term must hold, eg: EDL>=8 EFB<0 game~zelda */
+int runQuery(const char *indexPath, char **termText, int count)
+{
+    queryterm_t *terms;
+    unsigned char *data, *segment, *match = NULL;
+    unsigned long total = 0, matched = 0;
+    double started = statsClock();
+    long length;
+    FILE *in;
+    int i = 0, ok = 1;
+
+    if((terms = calloc((size_t) count, sizeof *terms)) == NULL) return 0;
+
+    for(; i < count; i++)
+    {
+        if(!parseTerm(termText[i], &terms[i]))
+        {
+            printf("\n!!!! Cannot read query term %s! !!!!\n", termText[i]);
+            free(terms);
+            return 0;
+        }
+    }
+
+    if((in = fopen(indexPath, "rb")) == NULL)
+    {
+        printf("%s: %s!\n", indexPath, spcechoStrerror(SPCECHO_E_OPEN));
+        free(terms);
+        return 0;
+    }
+
+    fseek(in, 0, SEEK_END);
+    length = ftell(in);
+    rewind(in);
+
+    if(length < 0 || (data = malloc(length > 0 ? (size_t) length : 1)) == NULL ||
+       fread(data, 1, (size_t) length, in) < (size_t) length)
+    {
+        printf("%s: %s!\n", indexPath, spcechoStrerror(SPCECHO_E_READ));
+        fclose(in);
+        free(terms);
+        return 0;
+    }
+
+    fclose(in);
+
+    printf("\nEDL   EVOLL EVOLR EFB  ms   EON  ESA  FLG  FIR0 FIR1 FIR2 FIR3 FIR4 FIR5 FIR6 FIR7  file\n");
+
+    for(segment = data; segment < data + length && ok; )
+    {
+        unsigned long rows, stringBytes, row = 0, size;
+        const unsigned char *columns, *offsets;
+        const char *strings;
+
+        if(data + length - segment < INDEX_HEADER || memcmp(segment, INDEX_MAGIC, 4) != 0 ||
+           getLE(segment + 4, 2) != INDEX_VERSION || getLE(segment + 6, 2) != INDEX_COLUMNS)
+        {
+            ok = 0;
+            break;
+        }
+
+        rows = getLE(segment + 8, 4);
+        stringBytes = getLE(segment + 12, 4);
+        size = INDEX_HEADER + rows * INDEX_COLUMNS + rows * INDEX_STRINGS * 4 + stringBytes;
+
+        if((unsigned long) (data + length - segment) < size || (match = realloc(match, rows ? rows : 1)) == NULL)
+        {
+            ok = 0;
+            break;
+        }
+
+        columns = segment + INDEX_HEADER;
+        offsets = columns + rows * INDEX_COLUMNS;
+        strings = (const char *) offsets + rows * INDEX_STRINGS * 4;
+
+        if(stringBytes > 0 && strings[stringBytes - 1] != '\0')
+        {
+            ok = 0;
+            break;
+        }
+
+        memset(match, 1, rows);
+
+        for(i = 0; i < count; i++)
+        {
+            if(terms[i].column < INDEX_COLUMNS) filterColumn(&terms[i], columns + terms[i].column * rows, match, rows);
+        }
+
+        for(; row < rows; row++)
+        {
+            const char *rowStrings[INDEX_STRINGS];
+            int s = 0;
+
+            if(!match[row]) continue;
+
+            for(; s < INDEX_STRINGS; s++)
+            {
+                unsigned long at = getLE(offsets + (row * INDEX_STRINGS + s) * 4, 4);
+                rowStrings[s] = at < stringBytes ? strings + at : "";
+            }
+
+            for(i = 0; i < count && match[row]; i++)
+            {
+                if(terms[i].column >= INDEX_COLUMNS) match[row] = (unsigned char) contains(rowStrings[terms[i].column - INDEX_COLUMNS], terms[i].text);
+            }
+
+            if(!match[row]) continue;
+
+            printRow(columns, rows, row, rowStrings);
+            matched++;
+        }
+
+        total += rows;
+        segment += size;
+    }
+
+    if(!ok) printf("%s: %s!\n", indexPath, spcechoStrerror(SPCECHO_E_READ));
+
+    printf("\n%lu of %lu songs match (%.3f ms)\n", matched, total, (statsClock() - started) * 1000);
+
+    free(match);
+    free(data);
+    free(terms);
+
+    return ok;
+}
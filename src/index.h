@@ -0,0 +1,24 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+/* An index file is a run of segments, one per `spcecho index` run, so it can be appended to.
+   Each segment is stored column by column, little-endian:
+
+     0  "SPCX"
+     4  version (u16), currently 1
+     6  byte columns (u16), INDEX_COLUMNS
+     8  rows (u32)
+    12  string bytes (u32)
+    16  each byte column, rows bytes long, in indexColumns order
+        then rows * INDEX_STRINGS string offsets (u32) into the strings that follow,
+        each string NUL-terminated: path, title, game, artist */
+#define INDEX_MAGIC "SPCX"
+#define INDEX_VERSION 1
+#define INDEX_HEADER 16
+#define INDEX_COLUMNS 15
+#define INDEX_STRINGS 4
+
+int runIndex(const char *source, const char *indexPath, int jobs);
+int runQuery(const char *indexPath, char **terms, int count);
+
+#endif /*INDEX_H*/
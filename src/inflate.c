@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "inflate.h"
+
+#define MAX_BITS 15
+#define MAX_LITLEN 288
+#define MAX_DIST 30
+
+/* reads a raw deflate stream (RFC 1951) a byte at a time, so it stops exactly where the
+   stream ends and whatever follows it in the file, such as a zip data descriptor, is left */
+typedef struct BitReader
+{
+    FILE *in;
+    unsigned long bits;
+    int count;
+    int overrun;
+    size_t consumed;
+
+} bitreader_t;
+
+/* canonical Huffman code as counts per length and symbols in code order */
+typedef struct Huffman
+{
+    short count[MAX_BITS + 1];
+    short symbol[MAX_LITLEN];
+
+} huffman_t;
+
+static const short lengthBase[29] =
+    { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const short lengthExtra[29] =
+    { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const short distBase[30] =
+    { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+      4097, 6145, 8193, 12289, 16385, 24577 };
+static const short distExtra[30] =
+    { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static int getBits(bitreader_t *br, int need)
+{
+    int value;
+
+    while(br->count < need)
+    {
+        int c = getc(br->in);
+
+        if(c == EOF)
+        {
+            br->overrun = 1;
+            c = 0;
+        }
+        else br->consumed++;
+
+        br->bits |= (unsigned long) c << br->count;
+        br->count += 8;
+    }
+
+    value = (int) (br->bits & ((1UL << need) - 1));
+    br->bits >>= need;
+    br->count -= need;
+
+    return value;
+}
+
+/* 0 on success, -1 if the lengths describe more codes than fit */
+static int buildHuffman(huffman_t *h, const short *lengths, int n)
+{
+    short offsets[MAX_BITS + 1];
+    int symbol = 0, len = 1, left = 1;
+
+    memset(h->count, 0, sizeof h->count);
+
+    for(; symbol < n; symbol++) h->count[lengths[symbol]]++;
+
+    for(; len <= MAX_BITS; len++)
+    {
+        left = (left << 1) - h->count[len];
+        if(left < 0) return -1;
+    }
+
+    offsets[1] = 0;
+    for(len = 1; len < MAX_BITS; len++) offsets[len + 1] = (short) (offsets[len] + h->count[len]);
+
+    for(symbol = 0; symbol < n; symbol++)
+    {
+        if(lengths[symbol] != 0) h->symbol[offsets[lengths[symbol]]++] = (short) symbol;
+    }
+
+    return 0;
+}
+
+static int decodeSymbol(bitreader_t *br, const huffman_t *h)
+{
+    int code = 0, first = 0, index = 0, len = 1;
+
+    for(; len <= MAX_BITS; len++)
+    {
+        int count = h->count[len];
+
+        code |= getBits(br, 1);
+
+        if(code - count < first) return h->symbol[index + (code - first)];
+
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+
+        if(br->overrun) break;
+    }
+
+    return -1;
+}
+
+static int putByte(spcinflate_t *out, unsigned char byte)
+{
+    if(out->length == out->capacity)
+    {
+        size_t capacity = out->capacity ? out->capacity * 2 : 0x10000;
+        unsigned char *grown;
+
+        if(out->length >= out->limit) return 0;
+        if(capacity > out->limit) capacity = out->limit;
+        if((grown = realloc(out->data, capacity)) == NULL) return 0;
+
+        out->data = grown;
+        out->capacity = capacity;
+    }
+
+    out->data[out->length++] = byte;
+
+    return 1;
+}
+
+static spcecho_error_t storedBlock(bitreader_t *br, spcinflate_t *out)
+{
+    unsigned len, nlen;
+
+    /* back to a byte boundary */
+    br->bits = 0;
+    br->count = 0;
+
+    len = (unsigned) getBits(br, 16);
+    nlen = (unsigned) getBits(br, 16);
+
+    if(br->overrun || len != (~nlen & 0xFFFF)) return SPCECHO_E_READ;
+
+    while(len-- > 0)
+    {
+        int c = getBits(br, 8);
+
+        if(br->overrun) return SPCECHO_E_READ;
+        if(!putByte(out, (unsigned char) c)) return SPCECHO_E_NOMEM;
+    }
+
+    return SPCECHO_OK;
+}
+
+static spcecho_error_t codesBlock(bitreader_t *br, spcinflate_t *out, const huffman_t *litlen, const huffman_t *dist)
+{
+    for(;;)
+    {
+        int symbol = decodeSymbol(br, litlen), len, distance;
+
+        if(symbol < 0) return SPCECHO_E_READ;
+        if(symbol == 256) return SPCECHO_OK;
+
+        if(symbol < 256)
+        {
+            if(!putByte(out, (unsigned char) symbol)) return SPCECHO_E_NOMEM;
+            continue;
+        }
+
+        if((symbol -= 257) >= 29) return SPCECHO_E_READ;
+        len = lengthBase[symbol] + getBits(br, lengthExtra[symbol]);
+
+        if((symbol = decodeSymbol(br, dist)) < 0 || symbol >= 30) return SPCECHO_E_READ;
+        distance = distBase[symbol] + getBits(br, distExtra[symbol]);
+
+        if((size_t) distance > out->length) return SPCECHO_E_READ;
+
+        while(len-- > 0)
+        {
+            if(!putByte(out, out->data[out->length - (size_t) distance])) return SPCECHO_E_NOMEM;
+        }
+    }
+}
+
+static spcecho_error_t fixedBlock(bitreader_t *br, spcinflate_t *out)
+{
+    huffman_t litlen, dist;
+    short lengths[MAX_LITLEN];
+    int symbol = 0;
+
+    for(; symbol < 144; symbol++) lengths[symbol] = 8;
+    for(; symbol < 256; symbol++) lengths[symbol] = 9;
+    for(; symbol < 280; symbol++) lengths[symbol] = 7;
+    for(; symbol < MAX_LITLEN; symbol++) lengths[symbol] = 8;
+
+    buildHuffman(&litlen, lengths, MAX_LITLEN);
+
+    for(symbol = 0; symbol < MAX_DIST; symbol++) lengths[symbol] = 5;
+
+    buildHuffman(&dist, lengths, MAX_DIST);
+
+    return codesBlock(br, out, &litlen, &dist);
+}
+
+static spcecho_error_t dynamicBlock(bitreader_t *br, spcinflate_t *out)
+{
+    static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    short lengths[MAX_LITLEN + MAX_DIST];
+    huffman_t lencode, litlen, dist;
+    int nlen = getBits(br, 5) + 257, ndist = getBits(br, 5) + 1, ncode = getBits(br, 4) + 4, index = 0;
+
+    if(nlen > 286 || ndist > 30) return SPCECHO_E_READ;
+
+    for(; index < ncode; index++) lengths[order[index]] = (short) getBits(br, 3);
+    for(; index < 19; index++) lengths[order[index]] = 0;
+
+    if(buildHuffman(&lencode, lengths, 19) != 0) return SPCECHO_E_READ;
+
+    for(index = 0; index < nlen + ndist; )
+    {
+        int symbol = decodeSymbol(br, &lencode), len = 0, repeat;
+
+        if(symbol < 0) return SPCECHO_E_READ;
+
+        if(symbol < 16)
+        {
+            lengths[index++] = (short) symbol;
+            continue;
+        }
+
+        if(symbol == 16)
+        {
+            if(index == 0) return SPCECHO_E_READ;
+            len = lengths[index - 1];
+            repeat = 3 + getBits(br, 2);
+        }
+        else if(symbol == 17) repeat = 3 + getBits(br, 3);
+        else repeat = 11 + getBits(br, 7);
+
+        if(index + repeat > nlen + ndist) return SPCECHO_E_READ;
+
+        while(repeat-- > 0) lengths[index++] = (short) len;
+    }
+
+    if(lengths[256] == 0) return SPCECHO_E_READ;
+
+    if(buildHuffman(&litlen, lengths, nlen) != 0 || buildHuffman(&dist, lengths + nlen, ndist) != 0)
+        return SPCECHO_E_READ;
+
+    return codesBlock(br, out, &litlen, &dist);
+}
+
+/* inflates one raw deflate stream from in, appending to out->data up to out->limit bytes */
+spcecho_error_t spcechoInflate(FILE *in, spcinflate_t *out)
+{
+    bitreader_t br = { NULL, 0, 0, 0, 0 };
+    spcecho_error_t err = SPCECHO_OK;
+    int last = 0;
+
+    br.in = in;
+
+    while(!last && err == SPCECHO_OK)
+    {
+        int type;
+
+        last = getBits(&br, 1);
+        type = getBits(&br, 2);
+
+        if(type == 0) err = storedBlock(&br, out);
+        else if(type == 1) err = fixedBlock(&br, out);
+        else if(type == 2) err = dynamicBlock(&br, out);
+        else err = SPCECHO_E_READ;
+
+        if(br.overrun) err = SPCECHO_E_READ;
+    }
+
+    out->consumed = br.consumed;
+
+    return err;
+}
+
+/* CRC-32 as zip uses it, a nibble at a time from a 16-entry table */
+unsigned long spcechoCrc32(unsigned long crc, const unsigned char *data, size_t length)
+{
+    static const unsigned long table[16] =
+    {
+        0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL,
+        0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL,
+        0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL,
+        0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL
+    };
+
+    crc = ~crc & 0xFFFFFFFFUL;
+
+    while(length-- > 0)
+    {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ table[crc & 15];
+        crc = (crc >> 4) ^ table[crc & 15];
+    }
+
+    return ~crc & 0xFFFFFFFFUL;
+}
@@ -0,0 +1,23 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "spcecho.h"
+
+/* output of one deflate stream; data grows as needed and belongs to the caller */
+typedef struct SpcInflate
+{
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    size_t limit;               /* longest output accepted */
+    size_t consumed;            /* compressed bytes read */
+
+} spcinflate_t;
+
+spcecho_error_t spcechoInflate(FILE *in, spcinflate_t *out);
+unsigned long spcechoCrc32(unsigned long crc, const unsigned char *data, size_t length);
+
+#endif /*INFLATE_H*/
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "inplace.h"
+
+static int readFully(int fd, unsigned char *buffer, size_t length, off_t offset)
+{
+    while(length > 0)
+    {
+        ssize_t got = pread(fd, buffer, length, offset);
+
+        if(got < 0 && errno == EINTR) continue;
+        if(got <= 0) return 0;
+
+        buffer += got;
+        offset += got;
+        length -= (size_t) got;
+    }
+
+    return 1;
+}
+
+static int writeFully(int fd, const unsigned char *buffer, size_t length, off_t offset)
+{
+    while(length > 0)
+    {
+        ssize_t put = pwrite(fd, buffer, length, offset);
+
+        if(put < 0 && errno == EINTR) continue;
+        if(put <= 0) return 0;
+
+        buffer += put;
+        offset += put;
+        length -= (size_t) put;
+    }
+
+    return 1;
+}
+
+/* reads only the header and the DSP page; RAM is left unread until spcechoInPlaceLoadData() */
+spcecho_error_t spcechoInPlaceOpen(spcecho_ctx *ctx, spcinplace_t *io, const char *path)
+{
+    struct stat st;
+    unsigned char *image;
+    spcecho_error_t err;
+
+    memset(io, 0, sizeof *io);
+    spcechoFree(ctx);
+
+    if((io->fd = open(path, O_RDWR)) < 0) return SPCECHO_E_OPEN;
+
+    if(fstat(io->fd, &st) != 0)
+    {
+        spcechoInPlaceClose(ctx, io);
+        return SPCECHO_E_READ;
+    }
+
+    io->fileLength = (size_t) st.st_size;
+
+    if(io->fileLength < ADDRESS_OFFSET + 0x80)
+    {
+        spcechoInPlaceClose(ctx, io);
+        return SPCECHO_E_TOOSHORT;
+    }
+
+    if((image = calloc(1, io->fileLength)) == NULL)
+    {
+        spcechoInPlaceClose(ctx, io);
+        return SPCECHO_E_NOMEM;
+    }
+
+    /* the header carries the signature that spcechoAttach() checks */
+    if(!readFully(io->fd, image, RAM_OFFSET, 0) || !readFully(io->fd, image + ADDRESS_OFFSET, 0x80, ADDRESS_OFFSET))
+    {
+        free(image);
+        spcechoInPlaceClose(ctx, io);
+        return SPCECHO_E_READ;
+    }
+
+    io->bytesRead = RAM_OFFSET + 0x80;
+    memcpy(io->original, image + ADDRESS_OFFSET, sizeof io->original);
+
+    err = spcechoAttach(ctx, image, io->fileLength);
+    ctx->ownsBuffer = 1;
+
+    if(err != SPCECHO_OK) spcechoInPlaceClose(ctx, io);
+
+    return err;
+}
+
+/* the free-region index needs every RAM page, so RAM comes in as one read */
+spcecho_error_t spcechoInPlaceLoadData(spcecho_ctx *ctx, spcinplace_t *io)
+{
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+    if(io->ramLoaded) return SPCECHO_OK;
+
+    if(!readFully(io->fd, ctx->buffer + RAM_OFFSET, ADDRESS_OFFSET - RAM_OFFSET, RAM_OFFSET)) return SPCECHO_E_READ;
+
+    io->bytesRead += ADDRESS_OFFSET - RAM_OFFSET;
+    io->ramLoaded = 1;
+
+    return SPCECHO_OK;
+}
+
+/* pwrites each run of DSP bytes that differs from what was read */
+spcecho_error_t spcechoInPlaceCommit(spcecho_ctx *ctx, spcinplace_t *io)
+{
+    const unsigned char *page;
+    size_t i = 0;
+    spcecho_error_t err;
+
+    if((err = spcechoPatch(ctx)) != SPCECHO_OK) return err;
+
+    page = ctx->buffer + ADDRESS_OFFSET;
+
+    while(i < sizeof io->original)
+    {
+        size_t run = i;
+
+        if(page[i] == io->original[i])
+        {
+            i++;
+            continue;
+        }
+
+        while(run < sizeof io->original && page[run] != io->original[run]) run++;
+
+        if(!writeFully(io->fd, page + i, run - i, (off_t) (ADDRESS_OFFSET + i))) return SPCECHO_E_WRITE;
+
+        io->bytesWritten += run - i;
+        i = run;
+    }
+
+    memcpy(io->original, page, sizeof io->original);
+
+    return SPCECHO_OK;
+}
+
+static void syncDirectory(const char *path)
+{
+    char dirPath[FILENAME_MAX];
+    char *slash;
+    int dirFd;
+
+    snprintf(dirPath, sizeof dirPath, "%s", path);
+
+    if((slash = strrchr(dirPath, '/')) == NULL) snprintf(dirPath, sizeof dirPath, ".");
+    else if(slash == dirPath) slash[1] = '\0';
+    else *slash = '\0';
+
+    if((dirFd = open(dirPath, O_RDONLY)) < 0) return;
+
+    fsync(dirFd);
+    close(dirFd);
+}
+
+/* crash-safe variant: full copy to a temp file in the same directory, then rename over the original */
+spcecho_error_t spcechoInPlaceCommitAtomic(spcecho_ctx *ctx, spcinplace_t *io, const char *path)
+{
+    char tempPath[FILENAME_MAX];
+    struct stat st;
+    int tempFd;
+    spcecho_error_t err;
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+
+    /* everything not read yet: RAM if no scan ran, and the tail after the DSP page */
+    if((err = spcechoInPlaceLoadData(ctx, io)) != SPCECHO_OK) return err;
+    if(!readFully(io->fd, ctx->buffer + ADDRESS_OFFSET + 0x80, io->fileLength - ADDRESS_OFFSET - 0x80, ADDRESS_OFFSET + 0x80))
+        return SPCECHO_E_READ;
+
+    io->bytesRead += io->fileLength - ADDRESS_OFFSET - 0x80;
+
+    if((err = spcechoPatch(ctx)) != SPCECHO_OK) return err;
+
+    if(snprintf(tempPath, sizeof tempPath, "%s.XXXXXX", path) >= (int) sizeof tempPath) return SPCECHO_E_OPEN;
+    if((tempFd = mkstemp(tempPath)) < 0) return SPCECHO_E_OPEN;
+
+    if(fstat(io->fd, &st) == 0) fchmod(tempFd, st.st_mode & 07777);
+
+    if(!writeFully(tempFd, ctx->buffer, io->fileLength, 0) || fsync(tempFd) != 0)
+    {
+        close(tempFd);
+        unlink(tempPath);
+        return SPCECHO_E_WRITE;
+    }
+
+    close(tempFd);
+
+    if(rename(tempPath, path) != 0)
+    {
+        unlink(tempPath);
+        return SPCECHO_E_WRITE;
+    }
+
+    syncDirectory(path);
+
+    io->bytesWritten += io->fileLength;
+    memcpy(io->original, ctx->buffer + ADDRESS_OFFSET, sizeof io->original);
+
+    return SPCECHO_OK;
+}
+
+void spcechoInPlaceClose(spcecho_ctx *ctx, spcinplace_t *io)
+{
+    if(io->fd >= 0) close(io->fd);
+
+    io->fd = -1;
+    spcechoFree(ctx);
+}
@@ -0,0 +1,28 @@
+#ifndef INPLACE_H
+#define INPLACE_H
+
+#include <stddef.h>
+
+#include "spcecho.h"
+
+/* an SPC file opened for patching without rewriting it */
+typedef struct SpcInPlace
+{
+    int fd;
+    size_t fileLength;
+    int ramLoaded;          /* the 64kb RAM image has been read */
+
+    size_t bytesRead;
+    size_t bytesWritten;
+
+    unsigned char original[0x80];   /* DSP page as it was on disk */
+
+} spcinplace_t;
+
+spcecho_error_t spcechoInPlaceOpen(spcecho_ctx *ctx, spcinplace_t *io, const char *path);
+spcecho_error_t spcechoInPlaceLoadData(spcecho_ctx *ctx, spcinplace_t *io);
+spcecho_error_t spcechoInPlaceCommit(spcecho_ctx *ctx, spcinplace_t *io);
+spcecho_error_t spcechoInPlaceCommitAtomic(spcecho_ctx *ctx, spcinplace_t *io, const char *path);
+void spcechoInPlaceClose(spcecho_ctx *ctx, spcinplace_t *io);
+
+#endif /*INPLACE_H*/
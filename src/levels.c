@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fir.h"
+#include "levels.h"
+#include "stats.h"
+#include "tune.h"
+
+/* loudness is gated over 400ms blocks that start every 100ms, so energy is kept per 100ms */
+#define LEVELS_BLOCK (DSP_RATE / 10)
+
+/* the tail is followed in 10ms steps */
+#define LEVELS_WINDOW (DSP_RATE / 100)
+
+/* mean square of a 4 LSB signal, about -78dBFS: the echo's rounding can keep it ticking over below this */
+#define LEVELS_FLOOR 16.0
+
+/* points between 0Hz and Nyquist the FIR's peak gain is looked for at */
+#define LEVELS_FIR_POINTS 512
+
+typedef struct LevelsBiquad
+{
+    double b[3];
+    double a[3];
+
+} levels_biquad_t;
+
+/* K-weighting: the BS.1770 head shelf then its high pass, redone for 32kHz from the analog
+   prototypes, since the standard only lists 48kHz coefficients */
+typedef struct LevelsFilter
+{
+    levels_biquad_t stage[2];
+
+} levels_filter_t;
+
+/* one signal being measured */
+typedef struct LevelsMeter
+{
+    double state[2][2][2];      /* [channel][stage]: the two delay terms */
+    double *blocks;             /* K-weighted energy of each 100ms, both channels summed */
+    long blockCount;
+    double energy;              /* of the 100ms being filled */
+    long filled;
+    int peak;
+    long clipped;
+
+} levels_meter_t;
+
+static void kWeighting(levels_filter_t *filter)
+{
+    double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+    double k = tan(M_PI * f0 / DSP_RATE), vh = pow(10, gain / 20), vb = pow(vh, 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+
+    filter->stage[0].b[0] = (vh + vb * k / q + k * k) / a0;
+    filter->stage[0].b[1] = 2 * (k * k - vh) / a0;
+    filter->stage[0].b[2] = (vh - vb * k / q + k * k) / a0;
+    filter->stage[0].a[1] = 2 * (k * k - 1) / a0;
+    filter->stage[0].a[2] = (1 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / DSP_RATE);
+    a0 = 1 + k / q + k * k;
+
+    filter->stage[1].b[0] = 1;
+    filter->stage[1].b[1] = -2;
+    filter->stage[1].b[2] = 1;
+    filter->stage[1].a[1] = 2 * (k * k - 1) / a0;
+    filter->stage[1].a[2] = (1 - k / q + k * k) / a0;
+}
+
+static void meterAdd(levels_meter_t *meter, const levels_filter_t *filter, const short *frame)
+{
+    int ch = 0, s;
+
+    for(; ch < 2; ch++)
+    {
+        double y = frame[ch] / 32768.0;
+
+        if(frame[ch] == 0x7FFF || frame[ch] == -0x8000) meter->clipped++;
+        if(abs(frame[ch]) > meter->peak) meter->peak = abs(frame[ch]);
+
+        for(s = 0; s < 2; s++)
+        {
+            const levels_biquad_t *q = &filter->stage[s];
+            double *z = meter->state[ch][s], x = y;
+
+            y = q->b[0] * x + z[0];
+            z[0] = q->b[1] * x - q->a[1] * y + z[1];
+            z[1] = q->b[2] * x - q->a[2] * y;
+        }
+
+        meter->energy += y * y;
+    }
+
+    if(++meter->filled == LEVELS_BLOCK)
+    {
+        meter->blocks[meter->blockCount++] = meter->energy;
+        meter->energy = 0;
+        meter->filled = 0;
+    }
+}
+
+/* mean of the 400ms blocks louder than gate, in LUFS; *kept gets how many there were */
+static double gatedLoudness(const levels_meter_t *meter, double gate, long *kept)
+{
+    double sum = 0;
+    long i = 0;
+
+    for(*kept = 0; i + 3 < meter->blockCount; i++)
+    {
+        double z = (meter->blocks[i] + meter->blocks[i + 1] + meter->blocks[i + 2] + meter->blocks[i + 3]) /
+                   (4.0 * LEVELS_BLOCK);
+
+        if(z > 0 && -0.691 + 10 * log10(z) > gate)
+        {
+            sum += z;
+            (*kept)++;
+        }
+    }
+
+    return *kept > 0 ? -0.691 + 10 * log10(sum / *kept) : -HUGE_VAL;
+}
+
+static void meterResult(const levels_meter_t *meter, spclevel_t *level)
+{
+    long kept;
+    double absolute = gatedLoudness(meter, -70, &kept);
+
+    level->peak = meter->peak > 0 ? 20 * log10(meter->peak / 32768.0) : -HUGE_VAL;
+    level->clipped = meter->clipped;
+
+    /* the relative gate sits 10LU under the blocks that passed the absolute one */
+    level->loudness = kept > 0 ? gatedLoudness(meter, absolute - 10 > -70 ? absolute - 10 : -70, &kept) : -HUGE_VAL;
+}
+
+/* the main mix as it would play with EVOL at 0, following the song's own MVOL and FLG writes */
+static void measureDry(const spctune_t *tune, const spcecho_ctx *ctx, const levels_filter_t *filter, levels_meter_t *meter)
+{
+    const spctune_write_t *write = tune->writes, *end = tune->writes + tune->writeCount;
+    unsigned char regs[0x80];
+    long n = 0;
+
+    memcpy(regs, ctx->buffer + ADDRESS_OFFSET, sizeof regs);
+
+    for(; n < tune->frames; n++)
+    {
+        short out[2];
+        int ch = 0;
+
+        for(; write < end && write->sample <= n; write++) regs[write->addr] = write->data;
+
+        for(; ch < 2; ch++)
+        {
+            int sample = (short) ((tune->dry[n].main[ch] * (signed char) regs[DSP_MVOLL + (ch << 4)]) >> 7);
+
+            out[ch] = regs[DSP_FLG] & 0x40 ? 0 : (short) (sample < -0x8000 ? -0x8000 : sample > 0x7FFF ? 0x7FFF : sample);
+        }
+
+        meterAdd(meter, filter, out);
+    }
+}
+
+/* keeps the echo stage running on silence until its output has fallen 60dB, or to the floor */
+static double measureTail(sdsp_t *dsp)
+{
+    double reference = -1, threshold = 0;
+    long n = 0;
+
+    for(; n < (long) LEVELS_TAIL_MAX * DSP_RATE; n += LEVELS_WINDOW)
+    {
+        double energy = 0;
+        int i = 0;
+
+        for(; i < LEVELS_WINDOW; i++)
+        {
+            int mainOut[2] = { 0, 0 }, echoOut[2] = { 0, 0 };
+            short out[2];
+
+            sdspEcho(dsp, mainOut, echoOut, out);
+            energy += (double) out[0] * out[0] + (double) out[1] * out[1];
+        }
+
+        energy /= 2 * LEVELS_WINDOW;
+
+        if(reference < 0)
+        {
+            reference = energy;
+            threshold = reference * 1e-6 > LEVELS_FLOOR ? reference * 1e-6 : LEVELS_FLOOR;
+        }
+
+        if(energy <= threshold) return (double) n / DSP_RATE;
+    }
+
+    return -1;
+}
+
+/* plays the patched image in ctx for the given number of seconds and measures it with and
+   without the echo, then how the echo dies away once the voices stop. The voices are played
+   once and the echo stage run over them, as serve does, so nothing here is shared between calls */
+spcecho_error_t spcechoLevels(const spcecho_ctx *ctx, int seconds, spclevels_t *levels)
+{
+    double started = statsClock();
+    levels_meter_t dry, wet;
+    levels_filter_t filter;
+    spcecho_error_t err;
+    spctune_t tune;
+    signed char taps[FIR_TAPS];
+    const unsigned char *regs;
+    long n = 0, blocks;
+    int i = 0;
+
+    memset(levels, 0, sizeof *levels);
+
+    if((err = spcechoTuneLoad(&tune, ctx, seconds)) != SPCECHO_OK) return err;
+
+    if((err = spcechoTuneRender(&tune, ctx)) != SPCECHO_OK)
+    {
+        spcechoTuneFree(&tune);
+        return err;
+    }
+
+    memset(&dry, 0, sizeof dry);
+    memset(&wet, 0, sizeof wet);
+
+    blocks = tune.frames / LEVELS_BLOCK + 1;
+    dry.blocks = malloc((size_t) blocks * sizeof *dry.blocks);
+    wet.blocks = malloc((size_t) blocks * sizeof *wet.blocks);
+
+    if(dry.blocks == NULL || wet.blocks == NULL)
+    {
+        free(dry.blocks);
+        free(wet.blocks);
+        spcechoTuneFree(&tune);
+        return SPCECHO_E_NOMEM;
+    }
+
+    kWeighting(&filter);
+
+    measureDry(&tune, ctx, &filter, &dry);
+
+    for(; n < tune.frames; n++) meterAdd(&wet, &filter, tune.pcm + n * 2);
+
+    meterResult(&dry, &levels->dry);
+    meterResult(&wet, &levels->wet);
+
+    /* the render left the echo unit with the song's last register values and a full ring */
+    regs = tune.echo->dsp.regs;
+
+    for(; i < FIR_TAPS; i++) taps[i] = (signed char) regs[(i << 4) | DSP_FIR];
+
+    for(i = 0; i <= LEVELS_FIR_POINTS; i++)
+    {
+        double gain = firResponse(taps, DSP_RATE / 2.0 * i / LEVELS_FIR_POINTS);
+
+        if(gain > levels->firPeak) levels->firPeak = gain;
+    }
+
+    levels->loopGain = levels->firPeak * abs((signed char) regs[DSP_EFB]) / 128;
+    levels->tail = measureTail(&tune.echo->dsp);
+    levels->unstable = levels->loopGain >= 1 || levels->tail < 0;
+
+    levels->samples = tune.frames;
+    levels->elapsed = statsClock() - started;
+    levels->realtime = levels->elapsed > 0 ? (double) tune.frames / DSP_RATE / levels->elapsed : 0;
+
+    free(dry.blocks);
+    free(wet.blocks);
+    spcechoTuneFree(&tune);
+
+    return SPCECHO_OK;
+}
@@ -0,0 +1,36 @@
+#ifndef LEVELS_H
+#define LEVELS_H
+
+#include "spcecho.h"
+
+/* seconds of echo tail followed after the voices stop before calling it endless */
+#define LEVELS_TAIL_MAX 20
+
+typedef struct SpcLevel
+{
+    double peak;                /* dBFS of the loudest sample, -HUGE_VAL if silent */
+    long clipped;               /* samples at full scale, both channels counted */
+    double loudness;            /* integrated LUFS, ITU-R BS.1770 K-weighted and gated; -HUGE_VAL if silent */
+
+} spclevel_t;
+
+typedef struct SpcLevels
+{
+    long samples;               /* stereo sample frames measured */
+    double elapsed;             /* wall-clock seconds spent emulating and measuring */
+    double realtime;            /* seconds of audio per second of work */
+
+    spclevel_t dry;             /* the main mix alone, as if EVOL were 0 */
+    spclevel_t wet;             /* the main mix with the echo, as it plays */
+
+    /* the echo registers in effect when the song ends */
+    double firPeak;             /* largest gain of the FIR taps, 1.0 = unity */
+    double loopGain;            /* EFB times firPeak: at 1.0 or more the echo never dies out */
+    double tail;                /* seconds for the echo to fall 60dB once the voices stop, -1 if it didn't */
+    int unstable;               /* loopGain >= 1, or the tail outlasted LEVELS_TAIL_MAX */
+
+} spclevels_t;
+
+spcecho_error_t spcechoLevels(const spcecho_ctx *ctx, int seconds, spclevels_t *levels);
+
+#endif /*LEVELS_H*/
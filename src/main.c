@@ -44,11 +44,22 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
 
 #include "addresses.h"
+#include "apply.h"
+#include "archive.h"
+#include "batch.h"
+#include "cache.h"
+#include "fir.h"
+#include "index.h"
 #include "readwrite.h"
+#include "serve.h"
+#include "sweep.h"
+#include "watch.h"
 
 #ifdef  _DEBUG
 #define _CRTDBG_MAP_ALLOC
@@ -72,7 +83,20 @@ void usage()
         "such as SPC Play or Chipsynth SFC before attempting playback on a \n"
         "real Super Nintendo(tm)/Super Famicom(tm).\n\n"
         "Usage: spcecho inputname.spc [options] [outputname.spc]\n"
-        "[NOTE: if outputname is not entered, inputname will be used]\n\n"
+        "       spcecho -b directory|\"glob\"|@listfile [options] [-o outputdir]\n"
+        "       spcecho -b set.zip|set.tar [options] -o outputdir|out.zip|out.tar\n"
+        "       spcecho render inputname.spc [options] [--seconds=N] [outputname.wav]\n"
+        "       spcecho render -b directory|\"glob\"|@listfile [options] [-o outputdir]\n"
+        "       spcecho serve inputname.spc [options] --socket=PATH [--seconds=N] [outputname.wav | -]\n"
+        "       spcecho verify inputname.spc|-b directory|\"glob\"|@listfile [options] [--seconds=N]\n"
+        "       spcecho levels inputname.spc|-b directory|\"glob\"|@listfile [options] [--seconds=N]\n"
+        "       spcecho sweep inputname.spc [options with lists/ranges] [--name=TEMPLATE] [-o outputdir]\n"
+        "       spcecho apply source.spc patch.spcd|- [patch.spcd ...] [-o outputdir]\n"
+        "       spcecho index directory|\"glob\"|@listfile indexfile [-j jobs]\n"
+        "       spcecho query indexfile [TERM ...]\n"
+        "       spcecho watch directory profilefile -o outputdir [-p fix|skip|force]\n"
+        "[NOTE: if outputname is not entered, inputname will be used.\n"
+        " - as inputname reads standard input, as outputname writes standard output]\n\n"
         "Options:\n\n"
         "-l | left echo volume\t | percentage of left echo volume between -100 and 100\n\n"
         "-r | right echo volume\t | percentage of right echo volume between -100 and 100\n\n"
@@ -84,8 +108,100 @@ void usage()
         "\t\t\t   [eg: XOXOXOOO will turn echo on for 1, 3, and 5\n\t\t\t   but keep echo off for 2, 4, 6, 7, and 8]\n\n"
         "-a | echo buffer address | address in hex from 02-FF for echo buffer\n"
         "\t\t\t   [NOTE: not using this option will automatically set the\n"
-        "\t\t\t   echo buffer to the address block immediately after the\n\t\t\t   SPC's audio data. Recommended to not use this option\n"
+        "\t\t\t   echo buffer to the tightest free block of RAM that\n\t\t\t   fits the echo time. Recommended to not use this option\n"
         "\t\t\t   unless you absolutely want to specify the buffer address]\n\n"
+        "-p | prompt policy\t | answer prompts without asking: fix, skip or force\n"
+        "\t\t\t   [fix: move buffer address / lower echo speed and\n"
+        "\t\t\t   overwrite existing files. skip: leave the file untouched\n"
+        "\t\t\t   whenever a prompt would appear. force: keep requested\n"
+        "\t\t\t   values and overwrite existing files]\n\n"
+        "-b | batch\t\t | process every .spc in a directory, a quoted glob or a\n"
+        "\t\t\t   list file (@list.txt, one path per line, @- for stdin)\n"
+        "\t\t\t   on a worker pool. Prompt policy defaults to fix.\n"
+        "\t\t\t   A .zip or .tar is read in one pass without extracting\n\n"
+        "-o | output directory\t | batch only: write results here instead of\n"
+        "\t\t\t   overwriting the input files. For a .zip or .tar\n"
+        "\t\t\t   source, a name ending in .zip or .tar writes a new\n"
+        "\t\t\t   archive instead\n\n"
+        "-j | jobs\t\t | batch only: number of workers (default: one per core)\n\n"
+        );
+
+    /* long options; split from the above to keep each string a portable length */
+    printf(
+        "--in-place\t\t | patch the input file by writing only the DSP bytes that\n"
+        "\t\t\t   change, without reading past the DSP registers.\n"
+        "\t\t\t   --in-place=atomic writes a patched temp file\n"
+        "\t\t\t   and renames it over the input instead (crash-safe)\n\n"
+        "--delta\t\t\t | write a .spcd patch holding only the bytes that change\n"
+        "\t\t\t   instead of a whole .spc (works with -b and sweep).\n"
+        "\t\t\t   spcecho apply turns patches back into .spc files\n\n"
+        "--io=uring\t\t | batch only: keep many reads and writes in flight\n"
+        "\t\t\t   through io_uring, into a fixed pool of buffers.\n"
+        "\t\t\t   Falls back to stdio where io_uring isn't available\n\n"
+        "--stats=json\t\t | time each phase of every file and count bytes, fixes and\n"
+        "\t\t\t   prompts answered by -p, then write it all as JSON to\n"
+        "\t\t\t   stderr, or to PATH with --stats=json:PATH\n\n"
+        "--cache=PATH\t\t | remember what was written in PATH and skip inputs that\n"
+        "\t\t\t   haven't changed since, if their output is still there\n"
+        "\t\t\t   with the same settings\n\n"
+        "--map\t\t\t | print what each page of RAM is used for (code, samples,\n"
+        "\t\t\t   sample directory, stack, echo) and where the echo buffer\n"
+        "\t\t\t   would go, without writing anything\n\n"
+        "--defrag\t\t | pack samples together and fix up the sample directory\n"
+        "\t\t\t   so the free RAM after them can hold a longer echo.\n"
+        "\t\t\t   Samples are checked to decode identically after the move.\n"
+        "\t\t\t   With --map, shows the map after defragmenting\n\n"
+        "--analyze\t\t | list every write to an echo register that the song's\n"
+        "\t\t\t   driver code can reach from its starting PC, without\n"
+        "\t\t\t   writing anything. Drivers that write their own echo\n"
+        "\t\t\t   values will undo the ones set here once they run\n\n"
+        "--pin-echo\t\t | also patch those writes so the values set here stick:\n"
+        "\t\t\t   MOV $F3,#value gets the new value, other writes get\n"
+        "\t\t\t   their register number moved out of the DSP's range.\n"
+        "\t\t\t   Only registers given as options are pinned\n\n"
+        "--fir=TARGET\t\t | design the echo's 8-tap FIR filter for a target response\n"
+        "\t\t\t   and write it with the echo settings. TARGET is one of\n"
+        "\t\t\t   lowpass:HZ | highpass:HZ | bandpass:LO-HI | telephone | flat\n"
+        "\t\t\t   [eg: --fir=lowpass:4000 for a darker echo. Taps are kept\n"
+        "\t\t\t   from wrapping and, at the -f feedback level (full\n"
+        "\t\t\t   feedback if -f isn't given), from running away]\n\n"
+        "--seconds=N\t\t | render, serve, verify and levels: seconds to play (default: 30)\n\n"
+        "--socket=PATH\t\t | serve only: Unix socket to take new values on\n\n"
+        );
+
+    printf(
+        "render\t\t\t | instead of saving the .spc, play it with the echo settings\n"
+        "\t\t\t   applied on the built-in SPC700/S-DSP emulator and write\n"
+        "\t\t\t   the output as a 32kHz stereo .wav file\n\n"
+        "serve\t\t\t | play the song's voices once, then wait on --socket for\n"
+        "\t\t\t   lines of new values (eg: -f 40 -t 96, --fir=telephone,\n"
+        "\t\t\t   reset, quit). Each line re-runs only the echo and rewrites\n"
+        "\t\t\t   the .wav, or streams raw 32kHz stereo PCM to stdout with -\n\n"
+        "sweep\t\t\t | read and scan the input once and write a file for every\n"
+        "\t\t\t   combination of values. -l -r -f -t -c -a take comma lists\n"
+        "\t\t\t   and FROM:TO[:STEP] ranges [eg: -t 16:240 -f 0,25,50:100:25]\n"
+        "\t\t\t   -t steps 16ms and the others 1 unless STEP is given\n\n"
+        "--name=TEMPLATE\t\t | sweep only: output file names, from {name} (input without\n"
+        "\t\t\t   .spc), {n} (variant number) and {l} {r} {f} {t} {c} {a}\n"
+        "\t\t\t   [default: {name} plus _t{t} etc. for each swept option]\n\n"
+        "apply\t\t\t | replay .spcd patches, or a stream of them on stdin with -,\n"
+        "\t\t\t   onto the source they were made from and write each\n"
+        "\t\t\t   result under the name it was made for\n\n"
+        "index\t\t\t | read the ID666 tags and echo registers (EVOLL EVOLR EFB\n"
+        "\t\t\t   EDL EON ESA FLG FIR0-7) of every file and append them to\n"
+        "\t\t\t   indexfile, on the worker pool\n\n"
+        "query\t\t\t | list the songs in an index matching every TERM: a register\n"
+        "\t\t\t   with = != < <= > >= and a value (eg: EDL>=8 EFB<0 ESA=$C0),\n"
+        "\t\t\t   or path, title, game or artist ~ text\n\n"
+        "verify\t\t\t | play the song with the echo settings applied and report\n"
+        "\t\t\t   any RAM in the echo window that its code reads or writes\n"
+        "\t\t\t   or that the DSP fetches samples from. Nothing is written;\n"
+        "\t\t\t   exits non-zero if any file collides\n\n"
+        "levels\t\t\t | play the song with the echo settings applied and report\n"
+        "\t\t\t   peak, clipped samples and loudness (LUFS) with and without\n"
+        "\t\t\t   the echo, the EFB x FIR loop gain and how long the echo\n"
+        "\t\t\t   takes to die away. Nothing is written; exits non-zero if\n"
+        "\t\t\t   any file clips or its echo never dies out\n\n"
         
         );
 }
@@ -100,14 +216,174 @@ static int checkForUndefined(const char command)
         case 't': return 1;
         case 'c': return 1;
         case 'a': return 1;
+        case 'p': return 1;
+        case 'b': return 1;
+        case 'o': return 1;
+        case 'j': return 1;
 
         default: return 0;
     }
 }
 
+/* long options carry their value after '=' */
+static int longOption(spcfile_t *file, const char *option)
+{
+    if(strcmp(option, "in-place") == 0) file->writeMode = WRITE_IN_PLACE;
+    else if(strcmp(option, "in-place=atomic") == 0) file->writeMode = WRITE_ATOMIC;
+    else if(strcmp(option, "map") == 0) file->showMap = 1;
+    else if(strcmp(option, "defrag") == 0) file->defrag = 1;
+    else if(strcmp(option, "analyze") == 0) file->showAnalysis = 1;
+    else if(strcmp(option, "pin-echo") == 0) file->ctx.pinWrites = 1;
+    else if(strcmp(option, "delta") == 0) file->deltaOut = 1;
+    else if(strcmp(option, "io=uring") == 0) file->ioUring = 1;
+    else if(strcmp(option, "stats=json") == 0) file->statsPath = "-";
+    else if(strncmp(option, "stats=json:", 11) == 0 && option[11] != '\0') file->statsPath = option + 11;
+    else if(strcmp(option, "io=stdio") == 0) file->ioUring = 0;
+    else if(strncmp(option, "cache=", 6) == 0 && option[6] != '\0') file->cachePath = option + 6;
+    else if(strncmp(option, "fir=", 4) == 0)
+    {
+        fir_target_t target;
+
+        if(!firParseTarget(option + 4, &target))
+        {
+            printf("\n!!!! Unknown FIR target %s! !!!!\n", option + 4);
+            return 0;
+        }
+
+        file->firTarget = option + 4;
+    }
+    else if(strncmp(option, "socket=", 7) == 0 && option[7] != '\0') file->socketPath = option + 7;
+    else if(strncmp(option, "name=", 5) == 0 && option[5] != '\0') file->sweepName = option + 5;
+    else if(strncmp(option, "seconds=", 8) == 0)
+    {
+        char *end;
+        long seconds = strtol(option + 8, &end, 10);
+
+        if(*end != '\0' || seconds < 1 || seconds > 3600) return 0;
+        file->renderSeconds = (int) seconds;
+    }
+    else return 0;
+
+    return 1;
+}
+
+static int policyValue(const char *policy, response_policy_t *val)
+{
+    if(strcmp(policy, "fix") == 0)   *val = POLICY_FIX;
+    else if(strcmp(policy, "skip") == 0)  *val = POLICY_SKIP;
+    else if(strcmp(policy, "force") == 0) *val = POLICY_FORCE;
+    else return 0;
+
+    return 1;
+}
+
+/* --stats=json for a single-file run */
+static void writeStats(const spcfile_t *file, const char *inName)
+{
+    if(file->stats != NULL && !statsWrite(file->statsPath, &inName, file->stats, 1))
+        printf("%s: %s!\n", file->statsPath, spcechoStrerror(SPCECHO_E_WRITE));
+}
+
 int main(int argc, char* argv[])
 {
     char inName[128], outName[128];
+    const char *batchSource = NULL, *outDir = NULL;
+    response_policy_t policy = POLICY_PROMPT;
+    spcstats_t stats;
+    int jobs = 0, render = 0, serve = 0, verify = 0, levels = 0, sweep = 0, toStdout = 0, pipeIn, pipeOut, i;
+    spcsweep_t sweepValues;
+    spcfile_t file;
+
+    /* apply takes a source, patch files and nothing else but -o */
+    if(argc > 3 && strcmp(argv[1], "apply") == 0)
+    {
+        const char *outDir = NULL;
+        int count = 0;
+
+        for(i = 3; i < argc; i++)
+        {
+            if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) outDir = argv[++i];
+            else argv[3 + count++] = argv[i];
+        }
+
+        if(count == 0)
+        {
+            printf("\n!!!! apply needs at least one patch file! !!!!\n");
+            usage();
+            return 0;
+        }
+
+        return runApply(argv[2], argv + 3, count, outDir) ? 0 : 1;
+    }
+
+    /* index SOURCE INDEXFILE [-j N] */
+    if(argc > 3 && strcmp(argv[1], "index") == 0)
+    {
+        char *err = NULL;
+        long jobsVal = 0;
+
+        if(argc == 6 && strcmp(argv[4], "-j") == 0) jobsVal = strtol(argv[5], &err, 10);
+
+        if(!(argc == 4 || (err != NULL && *err == '\0' && jobsVal >= 1)))
+        {
+            printf("\n!!!! index takes a directory, glob or @listfile, the index file and -j! !!!!\n");
+            usage();
+            return 0;
+        }
+
+        return runIndex(argv[2], argv[3], (int) jobsVal) ? 0 : 1;
+    }
+
+    /* query INDEXFILE TERM... */
+    if(argc > 2 && strcmp(argv[1], "query") == 0) return runQuery(argv[2], argv + 3, argc - 3) ? 0 : 1;
+
+    /* watch DIRECTORY PROFILEFILE -o OUTDIR [-p POLICY], in any order after the profile file */
+    if(argc > 3 && strcmp(argv[1], "watch") == 0)
+    {
+        const char *outDir = NULL;
+        int ok = 1;
+
+        for(i = 4; ok && i + 1 < argc; i += 2)
+        {
+            if(strcmp(argv[i], "-o") == 0) outDir = argv[i + 1];
+            else if(strcmp(argv[i], "-p") == 0) ok = policyValue(argv[i + 1], &policy);
+            else ok = 0;
+        }
+
+        if(!ok || i != argc || outDir == NULL)
+        {
+            printf("\n!!!! watch takes a directory, a profile file, -o and -p! !!!!\n");
+            usage();
+            return 0;
+        }
+
+        /* nobody is there to answer prompts */
+        fileInit(&file, policy == POLICY_PROMPT ? POLICY_FIX : policy);
+        return runWatch(argv[2], argv[3], outDir, &file) ? 0 : 1;
+    }
+
+    /* render, serve, verify, levels and sweep modes take the same arguments after the mode name */
+    if(argc > 2)
+    {
+        render = strcmp(argv[1], "render") == 0;
+        serve = strcmp(argv[1], "serve") == 0;
+        verify = strcmp(argv[1], "verify") == 0;
+        levels = strcmp(argv[1], "levels") == 0;
+        sweep = strcmp(argv[1], "sweep") == 0;
+    }
+
+    if(render || serve || verify || levels || sweep)
+    {
+        argv++;
+        argc--;
+    }
+
+    /* serve can stream to stdout instead of a file */
+    if(serve && argc > 2 && strcmp(argv[argc - 1], "-") == 0)
+    {
+        toStdout = 1;
+        argc--;
+    }
 
     if(argc <= 1)
     {
@@ -115,17 +391,59 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    fileInit(&file, POLICY_PROMPT);
+    memset(&sweepValues, 0, sizeof sweepValues);
+
+    /* long options take no separate value, so they may also be the last argument */
+    for(i = 1; i < argc; i++)
+    {
+        if(strncmp(argv[i], "--", 2) != 0) continue;
+
+        if(!longOption(&file, argv[i] + 2))
+        {
+            printf("\n!!!! Cannot read options! !!!!\n");
+            usage();
+            return 0;
+        }
+    }
+
     sprintf(inName, "%s", argv[1]);
     sprintf(outName, "%s", argv[argc - 1]);
 
-    if(outName[0] == '-' || isdigit(outName[1]))
+    /* the last argument is only an output name if it isn't the value of an option */
+    if(outName[0] == '-' || isdigit(outName[1]) ||
+       (argc > 2 && argv[argc - 2][0] == '-' && argv[argc - 2][1] != '\0' && argv[argc - 2][2] == '\0' &&
+        checkForUndefined(argv[argc - 2][1])))
         sprintf(outName, "%s", inName);
 
+    /* a lone "-" is standard input as the first argument and standard output as the last */
+    if(argc > 2 && strcmp(argv[argc - 1], "-") == 0) sprintf(outName, "-");
+
+    pipeIn = strcmp(inName, "-") == 0;
+    pipeOut = strcmp(outName, "-") == 0;
+
     while(--argc > 0)
     {
         int value;
         const char* command = *argv++;
 
+        /* long options were read before the loop */
+        if(strncmp(command, "--", 2) == 0) continue;
+
+        /* sweep mode takes lists and ranges for the echo values */
+        if(sweep && command[0] == '-' && sweepIsOption(command[1]) && command[2] == '\0' && argc > 1)
+        {
+            if(!sweepOption(&sweepValues, command[1], *argv))
+            {
+                usage();
+                return 0;
+            }
+
+            argv++;
+            argc--;
+            continue;
+        }
+
         /* outputs error if invalid argument is made */
         if (command[0] == '-' && isalpha(command[1]))
         {
@@ -138,7 +456,7 @@ int main(int argc, char* argv[])
         }
         
 
-        if(command[0] == '-' || command[0] == '/')
+        if(command[0] == '-' || (command[0] == '/' && command[1] != '\0' && command[2] == '\0'))
         {
             switch((command[1]))
             {
@@ -152,7 +470,7 @@ int main(int argc, char* argv[])
                         return 0;
                     }
 
-                    valueSet(command[1], value);
+                    valueSet(&file, command[1], value);
                     break;
 
                 /* right channel echo volume, from - 100 % to 100 % */
@@ -165,7 +483,7 @@ int main(int argc, char* argv[])
                         return 0;
                     }
 
-                    valueSet(command[1], value);
+                    valueSet(&file, command[1], value);
                     break;
                 
                 /* echo feedback level, from - 100 % to 100 % */
@@ -178,7 +496,7 @@ int main(int argc, char* argv[])
                         return 0;
                     }
 
-                    valueSet(command[1], value);
+                    valueSet(&file, command[1], value);
                     break;
 
                 /* echo timing, from 0 - 240ms in 16ms increments, using 2kb of buffer per 16ms */
@@ -191,7 +509,7 @@ int main(int argc, char* argv[])
                         return 0;
                     }
 
-                    valueSet(command[1], value);
+                    valueSet(&file, command[1], value);
                     break;
 
                 /* echo channel enable for audo channels 1 through 8 */
@@ -204,7 +522,7 @@ int main(int argc, char* argv[])
                         return 0;
                     }
                     
-                    valueSet(command[1], value);
+                    valueSet(&file, command[1], value);
                     break;
 
                 /* echo buffer address from, value multiplied by 100h for actuall SPC RAM address used.
@@ -218,35 +536,331 @@ int main(int argc, char* argv[])
                         return 0;
                     }
                     
-                    valueSet(command[1], value);
+                    valueSet(&file, command[1], value);
+                    break;
+
+                /* non-interactive answers for underflow, overflow and overwrite prompts */
+                case 'p':
+
+                    if(!policyValue(*argv, &policy))
+                    {
+                        printf("\n!!!! Invalid prompt policy! !!!!\n");
+                        usage();
+                        return 0;
+                    }
+
+                    break;
+
+                /* directory, glob or @listfile of .spc files to run through the worker pool */
+                case 'b':
+
+                    batchSource = *argv;
+                    break;
+
+                case 'o':
+
+                    outDir = *argv;
                     break;
+
+                case 'j':
+                {
+                    char *err;
+                    long jobsVal = strtol(*argv, &err, 10);
+
+                    if(jobsVal < 1 || *err != '\0')
+                    {
+                        printf("\n!!!! Invalid number of jobs! !!!!\n");
+                        usage();
+                        return 0;
+                    }
+
+                    jobs = (int) jobsVal;
+                    break;
+                }
+
+                default:
+                    continue;
             }
+
+            /* skip the option's value so paths such as /tmp/... aren't read as options */
+            argv++;
+            argc--;
+        }
+    }
+
+    if(outDir != NULL && file.writeMode != WRITE_COPY)
+    {
+        printf("\n!!!! Option -o can't be used with --in-place! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(render || serve || verify || levels)
+    {
+        if(file.writeMode != WRITE_COPY || file.showMap)
+        {
+            printf("\n!!!! %s can't be used with --in-place or --map! !!!!\n",
+                   render ? "render" : serve ? "serve" : verify ? "verify" : "levels");
+            usage();
+            return 0;
         }
+
+        if(file.renderSeconds == 0) file.renderSeconds = 30;
+        file.verify = verify;
+        file.levels = levels;
+    }
+    else if(file.renderSeconds != 0)
+    {
+        printf("\n!!!! Option --seconds is only used with render, serve, verify and levels! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(serve != (file.socketPath != NULL))
+    {
+        printf("\n!!!! serve needs --socket=PATH, and --socket is only used with serve! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(file.defrag && file.writeMode == WRITE_IN_PLACE)
+    {
+        printf("\n!!!! --defrag rewrites RAM, use --in-place=atomic instead of --in-place! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(file.ctx.pinWrites && file.writeMode == WRITE_IN_PLACE)
+    {
+        printf("\n!!!! --pin-echo rewrites driver code, use --in-place=atomic instead of --in-place! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(file.deltaOut && (render || serve || verify || levels || file.writeMode != WRITE_COPY || file.showMap || file.showAnalysis))
+    {
+        printf("\n!!!! --delta writes patch files, it can't be used with render, serve, verify, levels, --in-place, --map or --analyze! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(file.cachePath != NULL && (render || serve || verify || levels || sweep || file.showMap || file.showAnalysis))
+    {
+        printf("\n!!!! --cache only applies to writing .spc files, not render, serve, verify, levels, sweep, --map or --analyze! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(file.ioUring && (batchSource == NULL || render || verify || levels || file.deltaOut || file.cachePath != NULL ||
+                        file.writeMode != WRITE_COPY))
+    {
+        printf("\n!!!! --io=uring is for writing .spc files with -b, not render, verify, levels, --delta, --cache or --in-place! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(file.statsPath != NULL && (serve || sweep || file.ioUring || (batchSource != NULL && isArchive(batchSource))))
+    {
+        printf("\n!!!! --stats can't be used with serve, sweep, --io=uring or a .zip/.tar! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(file.sweepName != NULL && !sweep)
+    {
+        printf("\n!!!! Option --name is only used with sweep! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(file.showAnalysis && (render || serve || verify || levels || sweep || batchSource != NULL || file.showMap))
+    {
+        printf("\n!!!! --analyze works on one file and can't be used with render, serve, verify, levels, sweep, -b or --map! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if((pipeIn || pipeOut) && (batchSource != NULL || serve || file.writeMode != WRITE_COPY || file.cachePath != NULL))
+    {
+        printf("\n!!!! - can't be used with -b, serve, --in-place or --cache! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(pipeOut && (render || verify || levels || sweep || file.deltaOut || file.showMap || file.showAnalysis))
+    {
+        printf("\n!!!! Only a patched .spc can go to standard output, not render, verify, levels, sweep, --delta, --map or --analyze! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    /* the song arrives on stdin, so there is no one to answer prompts there */
+    if(pipeIn && policy == POLICY_PROMPT) policy = POLICY_FIX;
+
+    /* the .spc owns standard output; everything we print goes to stderr instead */
+    if(pipeOut)
+    {
+        int fd;
+
+        fflush(stdout);
+
+        if((fd = dup(STDOUT_FILENO)) < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 || (file.pipeOut = fdopen(fd, "wb")) == NULL)
+        {
+            printf("Unable to write to standard output!\n");
+            return 1;
+        }
+    }
+
+    if(file.firTarget != NULL && !firDesign(&file)) return 0;
+
+    if(serve)
+    {
+        char wavName[FILENAME_MAX];
+
+        if(batchSource != NULL || outDir != NULL || jobs != 0)
+        {
+            printf("\n!!!! serve works on one file, drop -b, -o and -j! !!!!\n");
+            usage();
+            return 0;
+        }
+
+        file.policy = policy == POLICY_PROMPT ? POLICY_FIX : policy;
+        wavPath(wavName, sizeof wavName, outName);
+        return runServe(inName, toStdout ? NULL : wavName, &file) ? 0 : 1;
+    }
+
+    if(sweep)
+    {
+        if(batchSource != NULL || jobs != 0 || file.writeMode != WRITE_COPY || file.showMap)
+        {
+            printf("\n!!!! sweep works on one file, drop -b, -j, --in-place and --map! !!!!\n");
+            usage();
+            return 0;
+        }
+
+        file.policy = policy == POLICY_PROMPT ? POLICY_FIX : policy;
+        sweepValues.nameTemplate = file.sweepName;
+        return runSweep(inName, outDir, &sweepValues, &file) ? 0 : 1;
+    }
+
+    if(file.cachePath != NULL && (file.cache = cacheOpen(file.cachePath)) == NULL)
+    {
+        printf("Unable to allocate memory for cache!\n");
+        return 0;
+    }
+
+    if(batchSource != NULL && isArchive(batchSource))
+    {
+        if(outDir == NULL || render || verify || levels || file.deltaOut || file.cache != NULL || file.writeMode != WRITE_COPY || file.showMap)
+        {
+            printf("\n!!!! A .zip or .tar needs -o, and can't be used with render, verify, levels, --delta, --cache, --in-place or --map! !!!!\n");
+            usage();
+            return 0;
+        }
+
+        file.policy = policy == POLICY_PROMPT ? POLICY_FIX : policy;
+        return runArchive(batchSource, outDir, &file) ? 0 : 1;
+    }
+
+    if(batchSource != NULL)
+    {
+        int ok;
+
+        file.policy = policy == POLICY_PROMPT ? POLICY_FIX : policy;
+        ok = runBatch(batchSource, outDir, jobs, &file);
+
+        return cacheClose(file.cache) && ok ? 0 : 1;
+    }
+
+    if(outDir != NULL || jobs != 0)
+    {
+        printf("\n!!!! Options -o and -j are only used with -b! !!!!\n");
+        usage();
+        return 0;
+    }
+
+    if(file.statsPath != NULL)
+    {
+        memset(&stats, 0, sizeof stats);
+        file.stats = &stats;
+    }
+
+    file.policy = policy;
+
+    if(file.showMap)
+    {
+        fileMap(&file, inName);
+        return 0;
+    }
+
+    if(file.showAnalysis)
+    {
+        fileAnalyze(&file, inName);
+        return 0;
+    }
+
+    if(file.writeMode != WRITE_COPY)
+    {
+        if(strcmp(outName, inName) != 0)
+        {
+            printf("\n!!!! --in-place patches the input file, drop the output name! !!!!\n");
+            return 0;
+        }
+
+        if(!(file.cache != NULL ? cachedWrite(&file, inName, outName) : filePatchInPlace(&file, inName)))
+            printf("\nFile not saved!\n");
+
+        writeStats(&file, inName);
+        cacheClose(file.cache);
+        return 0;
+    }
+
+    if(file.cache != NULL)
+    {
+        if(!cachedWrite(&file, inName, outName)) printf("\nFile not saved!\n");
+
+        writeStats(&file, inName);
+        freeBuffer(&file);
+        cacheClose(file.cache);
+        return 0;
     }
 
     // if no output file name is declared, use input file name //
-    if(!fileRead(inName))
+    if(!fileRead(&file, inName))
     {
         printf("\nFile not saved!\n");
-        freeBuffer();
+        writeStats(&file, inName);
+        freeBuffer(&file);
         return 0;
     }
 
-    if(!echoAddress())
+    if(!echoAddress(&file))
     {
         printf("\nFile not saved!\n");
-        freeBuffer();
+        writeStats(&file, inName);
+        freeBuffer(&file);
         return 0;
     }
 
-    if(!fileWrite(outName))
+    if(verify || levels)
+    {
+        int clean = verify ? fileVerify(&file, inName) : fileLevels(&file, inName);
+
+        writeStats(&file, inName);
+        freeBuffer(&file);
+        return clean ? 0 : 1;
+    }
+
+    if(!(file.renderSeconds > 0 ? fileRender(&file, outName) : fileWrite(&file, outName)))
     {
         printf("\nFile not saved!\n");
-        freeBuffer();
+        writeStats(&file, inName);
+        freeBuffer(&file);
         return 0;
     }
-    
-    freeBuffer();
+
+    writeStats(&file, inName);
+    freeBuffer(&file);
 
 #ifdef _DEBUG
     _CrtDumpMemoryLeaks();
@@ -2,339 +2,914 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-
+#include <stdarg.h>
+
+#include "analyze.h"
+#include "compact.h"
+#include "delta.h"
+#include "disasm.h"
+#include "fir.h"
+#include "inplace.h"
+#include "levels.h"
 #include "readwrite.h"
+#include "render.h"
+#include "trace.h"
+
+typedef enum PromptKind
+{
+    PROMPT_FIX       = 0,   /* move buffer address / lower echo speed */
+    PROMPT_PROCEED   = 1,   /* keep going with a known underflow/overflow */
+    PROMPT_OVERWRITE = 2    /* replace an existing output file */
 
-/* SPC700 DSP registers begin at 10100h */
-#define ADDRESS_OFFSET 0x10100
+} prompt_kind_t;
 
-static char *fileBuffer = NULL;
-static size_t fileLength = 0;
+/* canned answers for each non-interactive policy, indexed by prompt kind */
+static const char policyAnswers[4][3] =
+{
+    { 0, 0, 0 },    /* POLICY_PROMPT: unused */
+    { 1, 0, 1 },    /* POLICY_FIX */
+    { 0, 0, 0 },    /* POLICY_SKIP */
+    { 0, 1, 1 },    /* POLICY_FORCE */
+};
 
-typedef enum EchoControls
+static void report(const spcfile_t *file, const char *fmt, ...)
 {
-    LEFT_VOL  = 0,
-    RIGHT_VOL = 1,
-    FEEDBACK  = 2,
-    ECHO_SPD  = 3,
-    ECHO_CHNL = 4,
-    ECHO_ADDR = 5
+    va_list args;
 
-} echo_controls_t;
+    if(file->quiet) return;
+
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+void spcPath(char *filepath, size_t size, const char *spcName)
+{
+    if(strstr(spcName, ".spc") == NULL) snprintf(filepath, size, "%s.spc", spcName);
+    else snprintf(filepath, size, "%s", spcName);
+}
 
-typedef struct SpcAddress
+/* song.spc -> song.wav, anything else gets .wav appended */
+void wavPath(char *filepath, size_t size, const char *spcName)
 {
-    int  address;
-    unsigned char value;
-    char overwrite;
+    size_t length = strlen(spcName);
 
-} spcaddress_t;
+    if(length >= 4 && strcmp(spcName + length - 4, ".wav") == 0) snprintf(filepath, size, "%s", spcName);
+    else if(length >= 4 && strcmp(spcName + length - 4, ".spc") == 0)
+        snprintf(filepath, size, "%.*s.wav", (int) (length - 4), spcName);
+    else snprintf(filepath, size, "%s.wav", spcName);
+}
 
-static spcaddress_t spcAddresses[6] =
+/* song.spc -> song.spcd, anything else gets .spcd appended */
+void deltaPath(char *filepath, size_t size, const char *spcName)
 {
-    { ADDRESS_OFFSET + 0x2C, 0, 0 },    /* left channel echo volume address  : 1012Ch */
-    { ADDRESS_OFFSET + 0x3C, 0, 0 },    /* right channel echo volume address : 1013Ch */
-    { ADDRESS_OFFSET + 0x0D, 0, 0 },    /* echo feedback level address : 1010Dh */
-    { ADDRESS_OFFSET + 0x7D, 0, 0 },    /* echo speed address : 1017Dh */
-    { ADDRESS_OFFSET + 0x4D, 0, 0 },    /* channel echo enable/mute address : 1014Dh */
-    { ADDRESS_OFFSET + 0x6D, 0, 0 },    /* echo buffer address : 1016Dh */
-};
+    size_t length = strlen(spcName);
 
-static int readAddresses(void)
+    if(length >= 5 && strcmp(spcName + length - 5, ".spcd") == 0) snprintf(filepath, size, "%s", spcName);
+    else if(length >= 4 && strcmp(spcName + length - 4, ".spc") == 0) snprintf(filepath, size, "%sd", spcName);
+    else snprintf(filepath, size, "%s.spcd", spcName);
+}
+
+void fileInit(spcfile_t *file, response_policy_t policy)
 {
-    int i = 0;
-    if(fileLength < ADDRESS_OFFSET + 0x80) return 0;
+    memset(file, 0, sizeof *file);
 
-    for(; i < 6; i++)
-    {
-        if(spcAddresses[i].overwrite) continue;
-        spcAddresses[i].value = fileBuffer[spcAddresses[i].address];
-    }
+    spcechoInit(&file->ctx);
+    file->policy = policy;
+}
 
-    return 1;
+/* new file state with the control values, policy and verbosity of settings */
+void fileInitFrom(spcfile_t *file, const spcfile_t *settings)
+{
+    fileInit(file, settings->policy);
+
+    spcechoInitFrom(&file->ctx, &settings->ctx);
+    file->writeMode = settings->writeMode;
+    file->quiet = settings->quiet;
+    file->defrag = settings->defrag;
+    file->renderSeconds = settings->renderSeconds;
+    file->verify = settings->verify;
+    file->levels = settings->levels;
+    file->deltaOut = settings->deltaOut;
+    file->cache = settings->cache;
 }
 
-static int writeAddresses(void)
+int fileRead(spcfile_t *file, const char* spcName)
 {
-    int i = 0;
-    if(fileLength < ADDRESS_OFFSET + 0x80) return 0;
+    char filepath[FILENAME_MAX];
+    spcecho_error_t err;
+    double started = STATS_START(file->stats);
+
+    file->fixApplied = file->forceApplied = file->skipApplied = file->fileSaved = file->cacheHit = 0;
+    file->bytesRead = file->bytesWritten = 0;
+    file->error = SPCECHO_OK;
 
-    for(; i < 6; i++)
+    spcPath(filepath, sizeof filepath, spcName);
+
+    /* "-" reads standard input */
+    if(strcmp(spcName, "-") == 0) err = spcechoLoadStream(&file->ctx, stdin);
+    else
+    {
+        /* anything too big for the arena still gets a heap buffer */
+        err = file->arena != NULL ? spcechoLoadInto(&file->ctx, file->arena, filepath) : SPCECHO_E_TOOLONG;
+        if(err == SPCECHO_E_TOOLONG) err = spcechoLoadFile(&file->ctx, filepath);
+    }
+
+    STATS_STOP(file->stats, STAT_READ, started);
+
+    if(err != SPCECHO_OK)
+    {
+        file->error = err;
+        report(file, "%s!\n", spcechoStrerror(err));
+        return 0;
+    }
+
+    file->bytesRead = file->ctx.length;
+    STATS_ADD(file->stats, bytesRead, file->bytesRead);
+
+    /* --defrag and --pin-echo change more than the DSP page, so the patch is a diff
+       against the whole image as it was read */
+    if(file->deltaOut)
     {
-        if(!spcAddresses[i].overwrite) continue;
-        fileBuffer[spcAddresses[i].address] = spcAddresses[i].value;
+        if((file->original = malloc(file->ctx.length)) == NULL)
+        {
+            file->error = SPCECHO_E_NOMEM;
+            report(file, "Unable to allocate memory for file!\n");
+            freeBuffer(file);
+            return 0;
+        }
+
+        memcpy(file->original, file->ctx.buffer, file->ctx.length);
+        file->ownsOriginal = 1;
     }
 
     return 1;
 }
 
-int fileRead(const char* spcName)
+static int getResponse(spcfile_t *file, const char* msg, prompt_kind_t kind)
 {
-    FILE* spcRead;
-    char filepath[128];
+	char proceed = '\0', ignore = '\0';
 
-    if(strstr(spcName, ".spc") == NULL) sprintf(filepath, "%s.spc", spcName);
-    else sprintf(filepath, "%s", spcName);
+	report(file, "%s", msg);
 
-    if((spcRead = fopen(filepath, "rb")) == NULL)
+    if(file->policy != POLICY_PROMPT)
     {
-        printf("Unable to open file!\nFile in use or not found!\n");
-        return 0;
+        STATS_ADD(file->stats, promptsAvoided, 1);
+        proceed = policyAnswers[file->policy][kind] ? 'Y' : 'N';
+        report(file, "%c\n", tolower(proceed));
     }
-    
-    fseek(spcRead, 0, SEEK_END);
-    fileLength = ftell(spcRead);
-    rewind(spcRead);
+    else
+    {
+        proceed = (char)toupper(getchar());
 
-    fileBuffer = malloc(fileLength * sizeof *fileBuffer);
+	    /* ignores all other input other than y/Y and n/N
+	     * -- necessary for recursion as to ignore '\n' -- */
+	    if (proceed == '\n')
+		    ignore = proceed;
 
-    if(fileBuffer == NULL)
+	    while (ignore != '\n' && ignore != EOF)
+		    ignore = getchar();
+    }
+
+	if (proceed == 'Y')
+    {
+        if(kind == PROMPT_FIX)
+        {
+            file->fixApplied = 1;
+            STATS_ADD(file->stats, fixes, 1);
+        }
+
+        if(kind == PROMPT_PROCEED) file->forceApplied = 1;
+        return 1;
+    }
+	else if (proceed == 'N' || proceed == (char) EOF)
     {
-        printf("Unable to allocate memory for file!\n");
-        fclose(spcRead);
+        file->skipApplied = 1;
         return 0;
     }
+	else return getResponse(file, msg, kind);
+}
+
+static int underflowCheck(spcfile_t *file)
+{
+        if(!getResponse(file, "\nMove echo buffer address? (y / n) ", PROMPT_FIX))  
+        {
+            report(file, "\nEcho buffer underflow can overwrite music data and cause unexpected and/or unwanted glitches in SPC playback.");
+            return (getResponse(file, "\nProceed anyway ? (y / n) ", PROMPT_PROCEED));
+        }
+
+        spcechoRaiseAddress(&file->ctx);
+
+        return 1;
+
+}
+
+/* --defrag: moves samples down so the free RAM above them joins up */
+static int defragment(spcfile_t *file)
+{
+    spccompact_t result;
+    spcecho_error_t err;
 
-    if(fread(fileBuffer, 1, fileLength, spcRead) < fileLength)
+    if((err = spcechoCompact(&file->ctx, &result)) != SPCECHO_OK)
     {
-        printf("Error while reading input file!\n");
+        report(file, "\nDefragment: %s, samples left where they were\n", spcechoStrerror(err));
+        return err != SPCECHO_E_NOMEM;
+    }
+
+    report(file, "\nDefragment: moved %d sample span(s), %d bytes; %d samples verified."
+           "\nLargest free run: %d pages before, %d pages after\n",
+           result.unitsMoved, result.bytesMoved, result.samplesVerified, result.largestBefore, result.largestAfter);
+
+    return 1;
+}
 
-        freeBuffer();
-        fclose(spcRead);
+/* --defrag if asked, then maps the RAM for echoPlace() */
+int fileScan(spcfile_t *file)
+{
+    double started = STATS_START(file->stats);
+    spcecho_error_t err;
+
+    if(file->defrag && !defragment(file)) return 0;
+
+    err = spcechoScan(&file->ctx);
 
+    STATS_STOP(file->stats, STAT_SCAN, started);
+    STATS_ADD(file->stats, bytesScanned, 0x10000);
+
+    if(err != SPCECHO_OK)
+    {
+        file->error = err;
+        report(file, "Unexpected error with allocated memory!\n");
         return 0;
     }
 
-    fclose(spcRead);
-    
+    return 1;
+}
+
+int echoAddress(spcfile_t *file)
+{
+    return fileScan(file) && echoPlace(file);
+}
+
+/* places the echo buffer using the maps from the last fileScan() */
+int echoPlace(spcfile_t *file)
+{
+    spcecho_ctx *ctx = &file->ctx;
+    int autoAddress = !ctx->addresses[ECHO_ADDR].overwrite;
+    double started = STATS_START(file->stats);
+    spcecho_error_t err = spcechoPlace(ctx);
+
+    STATS_STOP(file->stats, STAT_PLACE, started);
 
-    if(!readAddresses())
+    switch(err)
     {
-        printf("Error while reading SPC addresses!\n");
-        freeBuffer();
+    case SPCECHO_OK:
+
+        break;
+
+    case SPCECHO_E_UNDERFLOW:
+
+        report(file, "\nCAUTION: buffer underflow detected! Echo buffer at 0x%02X00 overlaps music data."
+               "\nConsider moving buffer address to: 0x%02X00\n", ctx->addresses[ECHO_ADDR].value, ctx->viableAddress);
 
+        return underflowCheck(file);
+
+    default:
+
+        file->error = err;
+        report(file, "Unexpected error with allocated memory!\n");
         return 0;
     }
 
+    if(autoAddress)
+    {
+        report(file, "\nEnd of audio data found at address: 0x%04X\n", ctx->dataEnd);
+
+        report(file, "\nViable echo buffer address at: 0x%02X00\n", ctx->viableAddress);
+    }
+
+    if(ctx->maxEchoSpeed < 0) report(file, "\nNo free RAM left for an echo buffer!\n");
+    else report(file, "\nLongest echo that fits in free RAM: %dms\n", ctx->maxEchoSpeed << 4);
+
     return 1;
 }
 
-static int getResponse(const char* msg)
+void valueSet(spcfile_t *file, char v, int controlValue)
 {
-	char proceed = '\0', ignore = '\0';
+    spcechoSetValue(&file->ctx, v, controlValue);
+}
+
+static int overflowCheck(spcfile_t *file)
+{
+    /* Gives option to trunicate speed to fit buffer size, proceed with buffer overflow, or exit */
+    report(file, "\nCAUTION: buffer overflow detected! Consider lowering echo speed to: %dms", (spcechoTruncatedSpeed(&file->ctx) << 4));
+    
+    if (getResponse(file, "\nLower echo speed ? (y / n) ", PROMPT_FIX))
+    {
+        spcechoLowerSpeed(&file->ctx);
+        return 1;
+    }
 
-	printf("%s", msg);
+    report(file, "\nEcho buffer overflow can cause unexpected and/or unwanted glitches in SPC playback.");
+    return (getResponse(file, "\nProceed anyway ? (y / n) ", PROMPT_PROCEED));
+}
 
-    proceed = (char)toupper(getchar());
+/* settles an overflow, if there is one, the way the policy says */
+static int settleOverflow(spcfile_t *file)
+{
+    double started = STATS_START(file->stats);
+    int ok = spcechoCheckOverflow(&file->ctx) != SPCECHO_E_OVERFLOW || overflowCheck(file);
 
-	/* ignores all other input other than y/Y and n/N
-	 * -- necessary for recursion as to ignore '\n' -- */
-	if (proceed == '\n')
-		ignore = proceed;
+    STATS_STOP(file->stats, STAT_CHECK, started);
 
-	while (ignore != '\n')
-		ignore = getchar();
-	
-	if (proceed == 'Y') return 1;
-	else if (proceed == 'N') return 0;
-	else return getResponse(msg);
+    return ok;
 }
 
-static int underflowCheck(void)
+/* the DSP values into the image */
+static int patchImage(spcfile_t *file)
 {
-        if(!getResponse("\nRaise echo buffer address? (y / n) "))  
-        {
-            printf("\nEcho buffer underflow can overwrite music data and cause unexpected and/or unwanted glitches in SPC playback.");
-            return (getResponse("\nProceed anyway ? (y / n) "));
-        }
+    double started = STATS_START(file->stats);
+    spcecho_error_t err = spcechoPatch(&file->ctx);
 
-        return 1;
+    STATS_STOP(file->stats, STAT_PATCH, started);
+
+    if(err != SPCECHO_OK)
+    {
+        file->error = err;
+        report(file, "Error while writing SPC addresses!\n");
+        return 0;
+    }
 
+    return 1;
 }
 
-int echoAddress(void)
+/* --delta: the patched image goes out as the bytes that changed, named for the .spc
+   it stands in for so `spcecho apply` can recreate it */
+static int deltaWrite(spcfile_t *file, const char *spcName, const char *filepath)
 {
-    int i = 0xFFFF;
-    unsigned char echoAddy = 0;
+    char name[FILENAME_MAX];
+    const char *base;
+    FILE *out;
+    size_t written = 0;
+    unsigned long changes;
+    spcecho_error_t err;
+
+    spcPath(name, sizeof name, spcName);
+    base = strrchr(name, '/') != NULL ? strrchr(name, '/') + 1 : name;
+
+    if((out = fopen(filepath, "wb")) == NULL) err = SPCECHO_E_OPEN;
+    else
+    {
+        err = spcechoDeltaWrite(&file->ctx, file->original, base, out, &written);
+        if(fclose(out) != 0 && err == SPCECHO_OK) err = SPCECHO_E_WRITE;
+    }
 
-    if(fileBuffer == NULL)
+    if(err != SPCECHO_OK)
     {
-        printf("Unexpected error with allocated memory!\n");
+        file->error = err;
+        report(file, "%s: %s!\n", filepath, spcechoStrerror(err));
+        freeBuffer(file);
+
         return 0;
-    } 
-    
-    for (; i > 0; i--)
+    }
+
+    changes = (unsigned long) ((written - DELTA_HEADER - strlen(base)) / DELTA_CHANGE);
+    report(file, "\nWriting %lu changed byte%s for %s to %s... saved!\n", changes, changes == 1 ? "" : "s", base, filepath);
+
+    file->bytesWritten = written;
+    freeBuffer(file);
+
+    file->fileSaved = 1;
+
+    return 1;
+}
+
+int fileWrite(spcfile_t *file, const char* spcName)
+{
+    FILE* spcWrite;
+    char filepath[FILENAME_MAX];
+    spcecho_error_t err;
+    double started;
+    int ok;
+
+    if(file->ctx.buffer == NULL) return 0;
+
+    if(!settleOverflow(file)) return 0;
+
+    spcPath(filepath, sizeof filepath, spcName);
+    if(file->deltaOut) deltaPath(filepath, sizeof filepath, spcName);
+
+    /* the write phase is the existence check and the save, not the patch between them */
+    started = STATS_START(file->stats);
+
+    /* "-" writes standard output, which always "exists" */
+    if(strcmp(spcName, "-") == 0) snprintf(filepath, sizeof filepath, "standard output");
+    else if((spcWrite = fopen(filepath, "rb")) != NULL)
     {
-        if (fileBuffer[i] == (char) 0x00) continue;
-        if (fileBuffer[i] == (char) 0xFF) continue;
+        fclose(spcWrite);
+
+        if(!getResponse(file, "\nFile already exists! Overwrite file? (y / n) ", PROMPT_OVERWRITE))
+        {
+            freeBuffer(file);
+            return 0;
+        }
+    }
 
-        echoAddy = ((i & ~0x00FF) >> 8) + 1;
+    STATS_STOP(file->stats, STAT_WRITE, started);
 
-        break;
+    if(!patchImage(file))
+    {
+        freeBuffer(file);
+        return 0;
     }
 
-    if(spcAddresses[ECHO_ADDR].overwrite)
+    started = STATS_START(file->stats);
+
+    if(file->deltaOut)
     {
-        if(echoAddy > spcAddresses[ECHO_ADDR].value)
-        {
-            printf("\nCAUTION: buffer underflow detected! Consider raising buffer address to: 0x%02X00\n", echoAddy);
+        ok = deltaWrite(file, spcName, filepath);
 
-            if(underflowCheck()) 
-                spcAddresses[ECHO_ADDR].value = echoAddy;
-            else 
-                return 0;
-        }
+        STATS_STOP(file->stats, STAT_WRITE, started);
+        STATS_ADD(file->stats, bytesWritten, file->bytesWritten);
+
+        return ok;
     }
-    else
+
+    if(strcmp(spcName, "-") == 0) err = spcechoSaveStream(&file->ctx, file->pipeOut != NULL ? file->pipeOut : stdout);
+    else err = spcechoSaveFile(&file->ctx, filepath);
+
+    STATS_STOP(file->stats, STAT_WRITE, started);
+
+    if(err != SPCECHO_OK)
     {
-        printf("\nEnd of audio data found at address: 0x%04X\n", i);
+        file->error = err;
+        report(file, "%s: %s!\n", filepath, spcechoStrerror(err));
+        freeBuffer(file);
 
-        printf("\nViable echo buffer address at: 0x%02X00\n", echoAddy);
+        return 0;
+    }
+
+    report(file, "\nWriting echo DSP registers for %s... saved!\n", filepath);
+    if(file->ctx.pinWrites) report(file, "Pinned %d byte%s of driver code to the new values\n",
+                                   file->ctx.pinnedWrites, file->ctx.pinnedWrites == 1 ? "" : "s");
+
+    file->bytesWritten = file->ctx.length;
+    STATS_ADD(file->stats, bytesWritten, file->bytesWritten);
+    freeBuffer(file);
+
+    file->fileSaved = 1;
 
-        spcAddresses[ECHO_ADDR].value = echoAddy;
-        spcAddresses[ECHO_ADDR].overwrite = 1;
+    return 1;
+}
+
+/* settles an overflow the way the policy says and writes the values into the image in memory */
+int filePatch(spcfile_t *file)
+{
+    if(file->ctx.buffer == NULL) return 0;
+
+    return settleOverflow(file) && patchImage(file);
+}
+
+/* render mode: the patched image is played for renderSeconds and written as a WAV
+   instead of an .spc, so the echo settings can be heard without a player */
+int fileRender(spcfile_t *file, const char* wavName)
+{
+    char filepath[FILENAME_MAX];
+    spcrender_t result;
+    spcecho_error_t err;
+
+    if(file->ctx.buffer == NULL) return 0;
+
+    if(!filePatch(file))
+    {
+        freeBuffer(file);
+        return 0;
+    }
+
+    wavPath(filepath, sizeof filepath, wavName);
+
+    if((err = spcechoRender(&file->ctx, file->renderSeconds, filepath, &result)) != SPCECHO_OK)
+    {
+        file->error = err;
+        report(file, "%s: %s!\n", filepath, spcechoStrerror(err));
+        freeBuffer(file);
+
+        return 0;
     }
 
+    report(file, "\nRendered %ds to %s in %.3fs (%.0fx realtime)\n",
+           file->renderSeconds, filepath, result.elapsed, result.realtime);
+
+    file->bytesWritten = (size_t) result.samples * 4 + WAV_HEADER;
+    freeBuffer(file);
+
+    file->fileSaved = 1;
+
     return 1;
 }
 
-void valueSet(char v, int controlValue)
+/* plays the patched image without writing it and checks that nothing the song touches
+   lies in the echo window. A collision is printed even when quiet, so batch runs show it */
+int fileVerify(spcfile_t *file, const char* spcName)
 {
-    switch(v)
+    spctrace_report_t *trace;
+    spcecho_error_t err;
+    int used, end;
+
+    if(file->ctx.buffer == NULL) return 0;
+
+    if(!filePatch(file))
     {
-    case 'l':
+        freeBuffer(file);
+        return 0;
+    }
 
-        spcAddresses[LEFT_VOL].value = controlValue;
-        spcAddresses[LEFT_VOL].overwrite = 1;
-        break;
+    if((trace = malloc(sizeof *trace)) == NULL)
+    {
+        file->error = SPCECHO_E_NOMEM;
+        report(file, "Unable to allocate memory for the trace!\n");
+        freeBuffer(file);
+        return 0;
+    }
 
-    case 'r':
+    if((err = spcechoTrace(&file->ctx, file->renderSeconds, trace)) != SPCECHO_OK)
+    {
+        file->error = err;
+        report(file, "%s: %s!\n", spcName, spcechoStrerror(err));
+        free(trace);
+        freeBuffer(file);
+        return 0;
+    }
 
-        spcAddresses[RIGHT_VOL].value = controlValue;
-        spcAddresses[RIGHT_VOL].overwrite = 1;
-        
-        break;
+    used = trace->windowRead + trace->windowWritten + trace->windowFetched;
+    end = (trace->echoStart + trace->echoLength - 1) & 0xFFFF;
 
-    case 'f':
+    report(file, "\nTraced %ds in %.3fs (%.0fx realtime): echo window $%04X-$%04X, %d byte%s of ring written\n",
+           file->renderSeconds, trace->elapsed, trace->realtime, trace->echoStart, end,
+           trace->ringBytes, trace->ringBytes == 1 ? "" : "s");
 
-        spcAddresses[FEEDBACK].value = controlValue;
-        spcAddresses[FEEDBACK].overwrite = 1;
-        
-        break;
+    if(used == 0) report(file, "No reads, writes or sample fetches from the song fall in the echo window\n");
+    else printf("%s: echo window $%04X-$%04X collides with the song at $%04X "
+                "(%d byte%s read, %d written, %d fetched as samples)\n",
+                spcName, trace->echoStart, end, trace->firstCollision,
+                trace->windowRead, trace->windowRead == 1 ? "" : "s", trace->windowWritten, trace->windowFetched);
 
-    case 't':
+    free(trace);
+    freeBuffer(file);
 
-        spcAddresses[ECHO_SPD].value = controlValue;
-        spcAddresses[ECHO_SPD].overwrite = 1;
+    file->fileSaved = used == 0;
 
-        break;
+    return used == 0;
+}
 
-    case 'c':
+/* plays the patched image without writing it and measures it with and without the echo. The
+   result is printed even when quiet, so batch runs show every file; clipping or an echo that
+   doesn't die out counts as a failure */
+int fileLevels(spcfile_t *file, const char* spcName)
+{
+    spclevels_t levels;
+    spcecho_error_t err;
+    char tail[32];
+    int clean;
 
-        spcAddresses[ECHO_CHNL].value = controlValue;
-        spcAddresses[ECHO_CHNL].overwrite = 1;
-        
-        break;
+    if(file->ctx.buffer == NULL) return 0;
 
-    case 'a':
+    if(!filePatch(file))
+    {
+        freeBuffer(file);
+        return 0;
+    }
 
-        spcAddresses[ECHO_ADDR].value = controlValue;
-        spcAddresses[ECHO_ADDR].overwrite = 1;
-        
-        break;
+    if((err = spcechoLevels(&file->ctx, file->renderSeconds, &levels)) != SPCECHO_OK)
+    {
+        file->error = err;
+        report(file, "%s: %s!\n", spcName, spcechoStrerror(err));
+        freeBuffer(file);
+        return 0;
     }
+
+    freeBuffer(file);
+
+    report(file, "\nMeasured %ds in %.3fs (%.0fx realtime)\n", file->renderSeconds, levels.elapsed, levels.realtime);
+
+    if(levels.tail < 0) snprintf(tail, sizeof tail, "over %ds", LEVELS_TAIL_MAX);
+    else snprintf(tail, sizeof tail, "%.2fs", levels.tail);
+
+    clean = levels.wet.clipped == 0 && !levels.unstable;
+
+    printf("%s: dry %.1f dBFS %.1f LUFS %ld clipped, wet %.1f dBFS %.1f LUFS %ld clipped, "
+           "loop gain %.2f, tail %s%s%s\n", spcName,
+           levels.dry.peak, levels.dry.loudness, levels.dry.clipped,
+           levels.wet.peak, levels.wet.loudness, levels.wet.clipped, levels.loopGain, tail,
+           levels.wet.clipped > 0 ? " CLIPS" : "", levels.unstable ? " UNSTABLE" : "");
+
+    file->fileSaved = clean;
+
+    return clean;
 }
 
-static int overflowCheck(void)
+/* searches for the taps once, before any file is read; every file then gets the same values.
+   Without -f the feedback level isn't known yet, so the taps are kept stable at full feedback */
+int firDesign(spcfile_t *file)
 {
-    /* Gives option to trunicate speed to fit buffer size, proceed with buffer overflow, or exit */
-    int  truncatedSpeed = (0xFF - spcAddresses[ECHO_ADDR].value) >> 3;
+    fir_target_t target;
+    fir_design_t design;
+    char name[64];
+    int feedback = 128, i;
 
-    printf("\nCAUTION: buffer overflow detected! Consider lowering echo speed to: %dms", (truncatedSpeed << 4));
-    
-    if (getResponse("\nLower echo speed ? (y / n) "))
+    if(!firParseTarget(file->firTarget, &target)) return 0;
+
+    if(file->ctx.addresses[FEEDBACK].overwrite) feedback = (signed char) file->ctx.addresses[FEEDBACK].value;
+
+    if(spcechoDesignFir(&target, feedback, 0, &design) != SPCECHO_OK)
     {
-        spcAddresses[ECHO_SPD].value = truncatedSpeed;
-        return 1;
+        printf("Unable to allocate memory for FIR search!\n");
+        return 0;
     }
 
-    printf("\nEcho buffer overflow can cause unexpected and/or unwanted glitches in SPC playback.");
-    return (getResponse("\nProceed anyway ? (y / n) "));
+    spcechoSetFir(&file->ctx, design.taps);
+
+    printf("\nFIR %s:", firDescribe(&target, name, sizeof name));
+    for(i = 0; i < FIR_TAPS; i++) printf(" $%XF=%02X", i, (unsigned char) design.taps[i]);
+
+    printf("\nRMS response error %.4f, peak gain %.3f", design.error, design.peak);
+    if(feedback != 0) printf(" (echo loop stays stable up to %.3f)", design.limit);
+
+    /* eight taps only resolve about 4kHz, so narrow or low bands come out as an approximation */
+    if(!design.edgesMet)
+        printf("\n8 taps can't make this response: stopband gain reaches %.2f, passband falls to %.2f",
+               design.stopHigh, design.passLow);
+
+    printf("\nSearched %ld responses on %d thread%s (%s) in %.3fs\n", design.evaluations, design.workers,
+           design.workers == 1 ? "" : "s", firName(firBest()), design.elapsed);
+
+    return 1;
 }
 
-int fileWrite(const char* spcName)
+int filePatchInPlace(spcfile_t *file, const char* spcName)
 {
-    FILE* spcWrite;
-    char filepath[128];
+    spcinplace_t io;
+    char filepath[FILENAME_MAX];
+    spcecho_error_t err;
+    double started = STATS_START(file->stats);
 
-    if(fileBuffer == NULL) return 0;
-    /* Checks for buffer overflow. Every 16 ms takes 2kb of buffer so echo buffer address + echo speed must be under end of SPC data */
-    if ((((unsigned short)spcAddresses[ECHO_SPD].value << 11) + ((unsigned short)spcAddresses[ECHO_ADDR].value << 8)) > 0xFFFF)
-        {
-            if (!overflowCheck()) return 0;
-        }
+    file->fixApplied = file->forceApplied = file->skipApplied = file->fileSaved = file->cacheHit = 0;
+    file->bytesRead = file->bytesWritten = 0;
+    file->error = SPCECHO_OK;
+
+    spcPath(filepath, sizeof filepath, spcName);
 
-    if(strstr(spcName, ".spc") == NULL) sprintf(filepath, "%s.spc", spcName);
-    else sprintf(filepath, "%s", spcName);
+    err = spcechoInPlaceOpen(&file->ctx, &io, filepath);
+    STATS_STOP(file->stats, STAT_READ, started);
 
-    if((spcWrite = fopen(filepath, "rb")) != NULL)
+    if(err != SPCECHO_OK)
     {
-        fclose(spcWrite);
+        file->error = err;
+        report(file, "%s: %s!\n", filepath, spcechoStrerror(err));
+        return 0;
+    }
+
+    /* a forced buffer address never looks below the DSP page, so RAM stays unread */
+    if(!(file->ctx.addresses[ECHO_ADDR].overwrite && file->policy == POLICY_FORCE) || file->defrag)
+    {
+        started = STATS_START(file->stats);
+        err = spcechoInPlaceLoadData(&file->ctx, &io);
+        STATS_STOP(file->stats, STAT_READ, started);
 
-        if(!getResponse("\nFile already exists! Overwrite file? (y / n) "))
+        if(err != SPCECHO_OK)
         {
-            freeBuffer();
+            file->error = err;
+            report(file, "%s: %s!\n", filepath, spcechoStrerror(err));
+            spcechoInPlaceClose(&file->ctx, &io);
+            return 0;
+        }
+
+        if(!echoAddress(file))
+        {
+            spcechoInPlaceClose(&file->ctx, &io);
             return 0;
         }
     }
 
-    fclose(spcWrite);
-    
-    if(!writeAddresses())
+    if(!settleOverflow(file))
     {
-        printf("Error while writing SPC addresses!\n");
-        freeBuffer();
+        spcechoInPlaceClose(&file->ctx, &io);
+        return 0;
+    }
+
+    started = STATS_START(file->stats);
+
+    if(file->writeMode == WRITE_ATOMIC) err = spcechoInPlaceCommitAtomic(&file->ctx, &io, filepath);
+    else err = spcechoInPlaceCommit(&file->ctx, &io);
+
+    STATS_STOP(file->stats, STAT_WRITE, started);
+
+    file->bytesRead = io.bytesRead;
+    file->bytesWritten = io.bytesWritten;
+    STATS_ADD(file->stats, bytesRead, file->bytesRead);
+    STATS_ADD(file->stats, bytesWritten, file->bytesWritten);
 
+    spcechoInPlaceClose(&file->ctx, &io);
+
+    if(err != SPCECHO_OK)
+    {
+        file->error = err;
+        report(file, "%s: %s!\n", filepath, spcechoStrerror(err));
         return 0;
     }
 
-    /* set bit at value 20h mutes echo. clears bit while leaving other bits as they were */
-    fileBuffer[ADDRESS_OFFSET + 0x6C] &= ~(1 << 5);
+    report(file, "\nPatching echo DSP registers of %s in place... saved! (%lu bytes read, %lu bytes written)\n",
+           filepath, (unsigned long) file->bytesRead, (unsigned long) file->bytesWritten);
+    if(file->ctx.pinWrites) report(file, "Pinned %d byte%s of driver code to the new values\n",
+                                   file->ctx.pinnedWrites, file->ctx.pinnedWrites == 1 ? "" : "s");
+
+    file->fileSaved = 1;
+
+    return 1;
+}
+
+void freeBuffer(spcfile_t *file)
+{
+    spcechoFree(&file->ctx);
+
+    if(file->ownsOriginal) free(file->original);
+
+    file->original = NULL;
+    file->ownsOriginal = 0;
+}
+
+file_outcome_t fileOutcome(const spcfile_t *file)
+{
+    if(file->cacheHit) return OUTCOME_CACHED;
+    if(!file->fileSaved) return file->skipApplied ? OUTCOME_SKIPPED : OUTCOME_FAILED;
+    if(file->forceApplied) return OUTCOME_FORCED;
+    if(file->fixApplied) return OUTCOME_FIXED;
+
+    return OUTCOME_WRITTEN;
+}
 
-    if((spcWrite = fopen(filepath, "wb")) == NULL)
+/* --map: what every page of RAM is used for and where an echo buffer would go */
+int fileMap(spcfile_t *file, const char* spcName)
+{
+    const aram_map_t *map = &file->ctx.aram;
+    int page = 0, type = 0, i = 0;
+
+    if(!fileRead(file, spcName)) return 0;
+
+    if(file->defrag && !defragment(file))
     {
-        fclose(spcWrite);
-        freeBuffer();
+        freeBuffer(file);
+        return 0;
+    }
 
-        printf("Unable to write %s!\n", filepath);
+    if(spcechoScan(&file->ctx) != SPCECHO_OK)
+    {
+        printf("Error while reading SPC addresses!\n");
+        freeBuffer(file);
         return 0;
     }
 
-    printf("\nWriting echo DSP registers for %s... saved!\n", filepath);
+    printf("\nARAM map of %s (sample directory at 0x%04X, %d entries, %d valid samples)\n\n",
+           spcName, map->directory, map->entries, map->validSamples);
 
-    if(fwrite(fileBuffer, 1, fileLength, spcWrite) < fileLength)
+    printf("      0123456789ABCDEF0123456789ABCDEF0123456789ABCDEF0123456789ABCDEF\n");
+
+    for(; page < 0x100; page++)
     {
-        printf("Error while writing output file!\n");
+        if((page & 0x3F) == 0) printf("%04X  ", page << 8);
 
-        freeBuffer();
-        fclose(spcWrite);
+        putchar(aramTypeLetter((aram_type_t) map->pageType[page]));
 
-        return 0;
+        if((page & 0x3F) == 0x3F) putchar('\n');
+    }
+
+    printf("\n");
+
+    for(; type < ARAM_TYPES; type++) printf("%c %s  ", aramTypeLetter((aram_type_t) type), aramTypeName((aram_type_t) type));
+
+    printf("\n\nRegions:\n");
+
+    for(page = 0; page < 0x100;)
+    {
+        int start = page;
+
+        while(page < 0x100 && map->pageType[page] == map->pageType[start]) page++;
+
+        printf("  0x%04X-0x%04X  %3d pages  %s\n", start << 8, (page << 8) - 1, page - start,
+               aramTypeName((aram_type_t) map->pageType[start]));
+    }
+
+    if(map->validSamples > 0)
+    {
+        printf("\nSamples:\n   #  start   end     loop    blocks\n");
+
+        for(; i < map->entries; i++)
+        {
+            const aram_sample_t *sample = &map->samples[i];
+
+            if(!sample->valid)
+            {
+                printf("  %02X  (no BRR chain)\n", i);
+                continue;
+            }
+
+            printf("  %02X  0x%04X  0x%04X  0x%04X  %6d  %s\n", i, sample->start, sample->end - 1, sample->loop,
+                   sample->blocks, sample->loops ? "looped" : "one-shot");
+        }
     }
 
-    freeBuffer();
+    printf("\nBest-fit echo buffer address for %dms: 0x%02X00\n",
+           (file->ctx.addresses[ECHO_SPD].value & 0x0F) << 4, file->ctx.viableAddress);
+
+    if(file->ctx.maxEchoSpeed < 0) printf("No free RAM left for an echo buffer!\n");
+    else printf("Longest echo that fits in free RAM: %dms\n", file->ctx.maxEchoSpeed << 4);
+
+    freeBuffer(file);
 
     return 1;
 }
 
-void freeBuffer(void)
+/* --analyze: every store to an echo register the driver's code can reach, and how --pin-echo would pin it */
+int fileAnalyze(spcfile_t *file, const char* spcName)
 {
-    if(fileBuffer != NULL)
+    spcanalysis_t *analysis;
+    spcecho_error_t err;
+    int unknown = 0, i = 0;
+
+    if(!fileRead(file, spcName)) return 0;
+
+    if((analysis = malloc(sizeof *analysis)) == NULL)
+    {
+        printf("Unable to allocate memory for analysis!\n");
+        freeBuffer(file);
+        return 0;
+    }
+
+    if((err = spcechoAnalyze(&file->ctx, analysis)) != SPCECHO_OK)
     {
-        free(fileBuffer);
-        fileBuffer = NULL;
+        printf("%s!\n", spcechoStrerror(err));
+        free(analysis);
+        freeBuffer(file);
+        return 0;
     }
 
-    if(fileBuffer != NULL) 
-        printf("Error while freeing memory!\n");
-}
\ No newline at end of file
+    printf("\nCode reached from PC 0x%04X in %s: %d instructions, %d states, %d DSP store%s",
+           file->ctx.buffer[0x25] | file->ctx.buffer[0x26] << 8, spcName, analysis->instructions,
+           analysis->states, analysis->dspStores, analysis->dspStores == 1 ? "" : "s");
+
+    if(analysis->unresolvedJumps > 0) printf(", %d jump table%s guessed", analysis->unresolvedJumps,
+                                             analysis->unresolvedJumps == 1 ? "" : "s");
+
+    printf(" (%.3fms)\n", analysis->elapsed * 1000);
+
+    for(; i < analysis->writeCount; i++) unknown += analysis->writes[i].reg < 0;
+
+    if(unknown == analysis->writeCount) printf("\nNo writes to echo registers found\n");
+    else printf("\n  at      instruction          register   value  set at  pin\n");
+
+    for(i = 0; i < analysis->writeCount; i++)
+    {
+        const spcdspwrite_t *write = &analysis->writes[i];
+        char text[32], data[8];
+
+        if(write->reg < 0) continue;
+
+        disasmFormat(file->ctx.buffer + RAM_OFFSET, write->pc, text, sizeof text);
+
+        if(write->data < 0) snprintf(data, sizeof data, "?");
+        else snprintf(data, sizeof data, "$%02X", (unsigned) write->data & 0xFF);
+
+        printf("  0x%04X  %-20s $%02X %-6s %-6s ", write->pc, text, write->reg, spcechoRegisterName(write->reg), data);
+
+        if(write->regFrom < 0) printf("-       ");
+        else printf("0x%04X  ", (unsigned) write->regFrom & 0xFFFF);
+
+        if(write->pin == PIN_NONE) printf("-\n");
+        else printf("%s at 0x%04X\n", write->pin == PIN_VALUE ? "value" : "mute", write->patchAt);
+    }
+
+    /* stores the walk couldn't tie to a register might still hit an echo register */
+    if(unknown > 0)
+    {
+        printf("\nDSP stores to a register that couldn't be worked out:");
+
+        for(i = 0; i < analysis->writeCount; i++)
+        {
+            int j = 0;
+
+            if(analysis->writes[i].reg >= 0) continue;
+
+            while(j < i && (analysis->writes[j].reg >= 0 || analysis->writes[j].pc != analysis->writes[i].pc)) j++;
+            if(j == i) printf(" 0x%04X", analysis->writes[i].pc);
+        }
+
+        printf("\n");
+    }
+
+    if(analysis->truncated) printf("  ...more writes than could be listed\n");
+
+    free(analysis);
+    freeBuffer(file);
+
+    return 1;
+}
@@ -1,10 +1,102 @@
 #ifndef READ_WRITE_H
 #define READ_WRITE_H
 
-void freeBuffer(void);
-int echoAddress();
-int fileRead(const char* spcName);
-int fileWrite(const char* spcName);
-void valueSet(char v, int controlValue);
+#include "spcecho.h"
+#include "image.h"
+#include "stats.h"
+
+/* how prompts are answered when spcecho isn't running interactively */
+typedef enum ResponsePolicy
+{
+    POLICY_PROMPT = 0,      /* ask on stdin */
+    POLICY_FIX    = 1,      /* move address / lower speed, overwrite outputs */
+    POLICY_SKIP   = 2,      /* leave the file untouched whenever a prompt would appear */
+    POLICY_FORCE  = 3       /* keep the requested values and overwrite outputs */
+
+} response_policy_t;
+
+/* what happened to a file handed to fileRead() / echoAddress() / fileWrite() */
+typedef enum FileOutcome
+{
+    OUTCOME_WRITTEN = 0,
+    OUTCOME_FIXED   = 1,
+    OUTCOME_FORCED  = 2,
+    OUTCOME_SKIPPED = 3,
+    OUTCOME_CACHED  = 4,    /* unchanged since the run recorded in --cache, nothing done */
+    OUTCOME_FAILED  = 5
+
+} file_outcome_t;
+
+/* how fileWrite()/filePatchInPlace() put the result on disk */
+typedef enum WriteMode
+{
+    WRITE_COPY     = 0,     /* write a whole new file */
+    WRITE_IN_PLACE = 1,     /* pwrite only the changed DSP bytes into the input */
+    WRITE_ATOMIC   = 2      /* patched copy to a temp file, renamed over the input */
+
+} write_mode_t;
+
+struct SpcCache;
+
+/* command line front end state for one file: the library context plus how to talk to the user */
+typedef struct SpcFile
+{
+    spcecho_ctx ctx;
+    response_policy_t policy;
+    write_mode_t writeMode;
+    int quiet;
+    int showMap;
+    int showAnalysis;       /* --analyze: list the driver's echo register writes instead of patching */
+    int defrag;             /* pack samples together before placing the echo buffer */
+    int renderSeconds;      /* render mode: seconds of audio to write instead of an .spc */
+    int verify;             /* verify mode: trace renderSeconds of playback instead of writing */
+    int levels;             /* levels mode: measure renderSeconds of playback instead of writing */
+    int deltaOut;           /* --delta: write the changed bytes as a patch instead of a whole .spc */
+    unsigned char *original;    /* --delta: the image as it was read, to diff against */
+    int ownsOriginal;
+    const char *firTarget;  /* --fir: target response to design echo FIR taps for */
+    const char *socketPath; /* serve mode: where to listen for new values */
+    const char *sweepName;  /* sweep mode: output file name template */
+    const char *cachePath;  /* --cache: where results of earlier runs are kept */
+    struct SpcCache *cache;
+    int ioUring;            /* --io=uring: batch reads and writes go through io_uring */
+    const char *statsPath;  /* --stats=json: where the JSON goes, "-" for stderr */
+    spcstats_t *stats;      /* this file's timers and counters, NULL when --stats is off */
+    FILE *pipeOut;          /* output name "-": the real standard output, with stdout sent to stderr */
+    spcimage_t *arena;      /* fileRead loads into this instead of the heap when set */
+
+    int fixApplied;
+    int forceApplied;
+    int skipApplied;
+    int fileSaved;
+    int cacheHit;           /* nothing done, the output from an earlier run is still current */
+    spcecho_error_t error;  /* what made the file fail, kept for batch summaries since workers run quiet */
+
+    size_t bytesRead;
+    size_t bytesWritten;
+
+} spcfile_t;
+
+void fileInit(spcfile_t *file, response_policy_t policy);
+void fileInitFrom(spcfile_t *file, const spcfile_t *settings);
+void freeBuffer(spcfile_t *file);
+int fileScan(spcfile_t *file);
+int echoAddress(spcfile_t *file);
+int echoPlace(spcfile_t *file);
+int fileRead(spcfile_t *file, const char* spcName);
+int fileWrite(spcfile_t *file, const char* spcName);
+int filePatchInPlace(spcfile_t *file, const char* spcName);
+int fileMap(spcfile_t *file, const char* spcName);
+int fileAnalyze(spcfile_t *file, const char* spcName);
+int filePatch(spcfile_t *file);
+int fileRender(spcfile_t *file, const char* wavName);
+int fileVerify(spcfile_t *file, const char* spcName);
+int fileLevels(spcfile_t *file, const char* spcName);
+int firDesign(spcfile_t *file);
+void wavPath(char *filepath, size_t size, const char *spcName);
+void deltaPath(char *filepath, size_t size, const char *spcName);
+void spcPath(char *filepath, size_t size, const char *spcName);
+void valueSet(spcfile_t *file, char v, int controlValue);
+file_outcome_t fileOutcome(const spcfile_t *file);
 
 #endif /*READ_WRITE_H*/
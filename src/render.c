@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "render.h"
+#include "spc700.h"
+#include "stats.h"
+
+/* frames emulated between writes */
+#define RENDER_CHUNK 4096
+
+static void putLE(unsigned char *out, unsigned long value, int bytes)
+{
+    int i = 0;
+
+    for(; i < bytes; i++) out[i] = (unsigned char) (value >> (i * 8));
+}
+
+/* 44-byte RIFF header for 16-bit stereo PCM at the DSP's 32kHz */
+void spcechoWavHeader(unsigned char *header, unsigned long frames)
+{
+    unsigned long dataBytes = frames * 4;
+
+    memcpy(header, "RIFF", 4);
+    putLE(header + 4, 36 + dataBytes, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    putLE(header + 16, 16, 4);
+    putLE(header + 20, 1, 2);
+    putLE(header + 22, 2, 2);
+    putLE(header + 24, DSP_RATE, 4);
+    putLE(header + 28, DSP_RATE * 4, 4);
+    putLE(header + 32, 4, 2);
+    putLE(header + 34, 16, 2);
+    memcpy(header + 36, "data", 4);
+    putLE(header + 40, dataBytes, 4);
+}
+
+/* plays the image in ctx from its saved CPU and DSP state for the given number of
+   seconds and writes what the S-DSP outputs, echo included, as a WAV file */
+spcecho_error_t spcechoRender(const spcecho_ctx *ctx, int seconds, const char *wavPath, spcrender_t *result)
+{
+    unsigned char header[WAV_HEADER], *bytes;
+    short *samples;
+    spc700_t *cpu;
+    FILE *wav;
+    long frames, done = 0;
+    double started = statsClock();
+    spcecho_error_t err = SPCECHO_OK;
+
+    memset(result, 0, sizeof *result);
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+    if(ctx->length < ADDRESS_OFFSET + 0x80) return SPCECHO_E_TOOSHORT;
+    if(seconds <= 0) return SPCECHO_E_ARG;
+
+    frames = (long) seconds * DSP_RATE;
+
+    cpu = malloc(sizeof *cpu);
+    samples = malloc(RENDER_CHUNK * 2 * sizeof *samples);
+    bytes = malloc(RENDER_CHUNK * 4);
+
+    if(cpu == NULL || samples == NULL || bytes == NULL)
+    {
+        err = SPCECHO_E_NOMEM;
+        goto done;
+    }
+
+    spc700Load(cpu, ctx->buffer, (long) ctx->length);
+
+    if((wav = fopen(wavPath, "wb")) == NULL)
+    {
+        err = SPCECHO_E_OPEN;
+        goto done;
+    }
+
+    spcechoWavHeader(header, (unsigned long) frames);
+
+    if(fwrite(header, 1, sizeof header, wav) < sizeof header) err = SPCECHO_E_WRITE;
+
+    while(err == SPCECHO_OK && done < frames)
+    {
+        int count = frames - done < RENDER_CHUNK ? (int) (frames - done) : RENDER_CHUNK, i = 0;
+
+        spc700Run(cpu, samples, count);
+
+        for(; i < count * 2; i++)
+        {
+            bytes[i * 2] = (unsigned char) samples[i];
+            bytes[i * 2 + 1] = (unsigned char) ((unsigned short) samples[i] >> 8);
+        }
+
+        if(fwrite(bytes, 4, (size_t) count, wav) < (size_t) count) err = SPCECHO_E_WRITE;
+
+        done += count;
+    }
+
+    if(fclose(wav) != 0 && err == SPCECHO_OK) err = SPCECHO_E_WRITE;
+
+    result->samples = done;
+    result->elapsed = statsClock() - started;
+    result->realtime = result->elapsed > 0 ? (double) done / DSP_RATE / result->elapsed : 0;
+
+done:
+    free(cpu);
+    free(samples);
+    free(bytes);
+
+    return err;
+}
@@ -0,0 +1,19 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "spcecho.h"
+
+typedef struct SpcRender
+{
+    long samples;               /* stereo sample frames written */
+    double elapsed;             /* wall-clock seconds spent emulating and writing */
+    double realtime;            /* seconds of audio per second of work */
+
+} spcrender_t;
+
+#define WAV_HEADER 44
+
+void spcechoWavHeader(unsigned char *header, unsigned long frames);
+spcecho_error_t spcechoRender(const spcecho_ctx *ctx, int seconds, const char *wavPath, spcrender_t *result);
+
+#endif /*RENDER_H*/
@@ -0,0 +1,221 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static const char *implNames[] = { "scalar", "sse2", "avx2" };
+
+static scan_impl_t bestImpl = SCAN_SCALAR;
+static pthread_once_t bestOnce = PTHREAD_ONCE_INIT;
+
+/* a byte counts as music data unless it is 00h or FFh */
+#define MEANINGFUL(b) ((unsigned char) ((b) + 1) > 1)
+
+static void pickBest(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2")) bestImpl = SCAN_AVX2;
+    else if(__builtin_cpu_supports("sse2")) bestImpl = SCAN_SSE2;
+#endif
+}
+
+scan_impl_t scanBest(void)
+{
+    pthread_once(&bestOnce, pickBest);
+    return bestImpl;
+}
+
+const char *scanName(scan_impl_t impl)
+{
+    return implNames[impl];
+}
+
+static void pagesScalar(const unsigned char *ram, unsigned char *pageMap)
+{
+    int page = 0;
+
+    memset(pageMap, 0, PAGE_MAP_BYTES);
+
+    for(; page < 0x100; page++)
+    {
+        const unsigned char *p = ram + (page << 8);
+        int i = 0;
+
+        for(; i < 0x100; i++)
+        {
+            if(!MEANINGFUL(p[i])) continue;
+
+            pageMap[page >> 3] |= (unsigned char) (1 << (page & 7));
+            break;
+        }
+    }
+}
+
+static int lastScalar(const unsigned char *data, size_t length)
+{
+    size_t i = length;
+
+    while(i-- > 0)
+    {
+        if(MEANINGFUL(data[i])) return (int) i;
+    }
+
+    return -1;
+}
+
+#ifdef SCAN_X86
+
+/* bits set for the bytes in v that are 00h or FFh */
+__attribute__((target("sse2")))
+static inline unsigned emptyMask16(__m128i v)
+{
+    __m128i empty = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8((char) 0xFF)));
+
+    return (unsigned) _mm_movemask_epi8(empty);
+}
+
+__attribute__((target("sse2")))
+static void pagesSse2(const unsigned char *ram, unsigned char *pageMap)
+{
+    int page = 0;
+
+    memset(pageMap, 0, PAGE_MAP_BYTES);
+
+    for(; page < 0x100; page++)
+    {
+        const unsigned char *p = ram + (page << 8);
+        __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi8((char) 0xFF);
+        __m128i empty = ones;
+        int i = 0;
+
+        for(; i < 0x100; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+            empty = _mm_and_si128(empty, _mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, ones)));
+        }
+
+        if(_mm_movemask_epi8(empty) != 0xFFFF) pageMap[page >> 3] |= (unsigned char) (1 << (page & 7));
+    }
+}
+
+__attribute__((target("sse2")))
+static int lastSse2(const unsigned char *data, size_t length)
+{
+    size_t i = length;
+
+    /* unaligned tail at the top, then 16 bytes per step down to the head */
+    while(i & 15)
+    {
+        i--;
+        if(MEANINGFUL(data[i])) return (int) i;
+    }
+
+    while(i >= 16)
+    {
+        unsigned used;
+
+        i -= 16;
+        used = ~emptyMask16(_mm_loadu_si128((const __m128i *) (data + i))) & 0xFFFF;
+
+        if(used) return (int) (i + 31 - (size_t) __builtin_clz(used));
+    }
+
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static void pagesAvx2(const unsigned char *ram, unsigned char *pageMap)
+{
+    int page = 0;
+
+    memset(pageMap, 0, PAGE_MAP_BYTES);
+
+    for(; page < 0x100; page++)
+    {
+        const unsigned char *p = ram + (page << 8);
+        __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi8((char) 0xFF);
+        __m256i empty = ones;
+        int i = 0;
+
+        for(; i < 0x100; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+            empty = _mm256_and_si256(empty, _mm256_or_si256(_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(v, ones)));
+        }
+
+        if((unsigned) _mm256_movemask_epi8(empty) != 0xFFFFFFFFu) pageMap[page >> 3] |= (unsigned char) (1 << (page & 7));
+    }
+}
+
+__attribute__((target("avx2")))
+static int lastAvx2(const unsigned char *data, size_t length)
+{
+    size_t i = length;
+    __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi8((char) 0xFF);
+
+    while(i & 31)
+    {
+        i--;
+        if(MEANINGFUL(data[i])) return (int) i;
+    }
+
+    while(i >= 32)
+    {
+        __m256i v;
+        unsigned used;
+
+        i -= 32;
+        v = _mm256_loadu_si256((const __m256i *) (data + i));
+        used = ~(unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(v, ones)));
+
+        if(used) return (int) (i + 31 - (size_t) __builtin_clz(used));
+    }
+
+    return -1;
+}
+
+#endif /*SCAN_X86*/
+
+void scanPagesWith(scan_impl_t impl, const unsigned char *ram, unsigned char *pageMap)
+{
+    switch(impl)
+    {
+#ifdef SCAN_X86
+    case SCAN_AVX2: pagesAvx2(ram, pageMap); return;
+    case SCAN_SSE2: pagesSse2(ram, pageMap); return;
+#endif
+    default: pagesScalar(ram, pageMap); return;
+    }
+}
+
+int scanLastDataWith(scan_impl_t impl, const unsigned char *data, size_t length)
+{
+    switch(impl)
+    {
+#ifdef SCAN_X86
+    case SCAN_AVX2: return lastAvx2(data, length);
+    case SCAN_SSE2: return lastSse2(data, length);
+#endif
+    default: return lastScalar(data, length);
+    }
+}
+
+/* occupancy of all 256 pages of the 64kb RAM image */
+void scanPages(const unsigned char *ram, unsigned char *pageMap)
+{
+    scanPagesWith(scanBest(), ram, pageMap);
+}
+
+/* index of the last byte in data that isn't 00h/FFh, or -1 */
+int scanLastData(const unsigned char *data, size_t length)
+{
+    return scanLastDataWith(scanBest(), data, length);
+}
@@ -0,0 +1,29 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/* one bit per 256-byte page of SPC700 RAM (bit p & 7 of byte p >> 3),
+   set when the page holds anything other than 00h/FFh */
+#define PAGE_MAP_BYTES 32
+
+typedef enum ScanImpl
+{
+    SCAN_SCALAR = 0,
+    SCAN_SSE2   = 1,
+    SCAN_AVX2   = 2
+
+} scan_impl_t;
+
+scan_impl_t scanBest(void);
+const char *scanName(scan_impl_t impl);
+
+void scanPages(const unsigned char *ram, unsigned char *pageMap);
+int scanLastData(const unsigned char *data, size_t length);
+
+void scanPagesWith(scan_impl_t impl, const unsigned char *ram, unsigned char *pageMap);
+int scanLastDataWith(scan_impl_t impl, const unsigned char *data, size_t length);
+
+#define PAGE_USED(pageMap, page) (((pageMap)[(page) >> 3] >> ((page) & 7)) & 1)
+
+#endif /*SCAN_H*/
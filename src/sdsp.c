@@ -0,0 +1,533 @@
+#include <string.h>
+
+#include "sdsp.h"
+
+#define CLAMP16(s) ((s) < -0x8000 ? -0x8000 : (s) > 0x7FFF ? 0x7FFF : (s))
+
+#define VREG(dsp, v, r) ((dsp)->regs[((v) << 4) + (r)])
+
+/* the global counter runs through every rate's period once per 30720 samples */
+#define COUNTER_RANGE (2048 * 5 * 3)
+
+/* each rate is 2^n, 3 * 2^n or 5 * 2^n samples and fires when (counter + offset) % rate is
+   0, with offset 0, 1040 or 536 by kind. So rate r fires when the low
+   bits of counter + offset are clear and the counter's residues mod 3 and mod 5 (see
+   stepCounter()) are the kind's: a mask and two compares instead of a division */
+typedef struct CounterRate
+{
+    unsigned short mask;
+    unsigned short offset;
+    unsigned char residueMask;      /* 03h: mod 3, 1Ch: mod 5, 0: a power of two */
+    unsigned char residue;
+
+} counter_rate_t;
+
+static const counter_rate_t counterRates[32] =
+{
+    {    0,    0, 0x03, 0x03 },     /* never fires: the mod 3 residue is never 3 */
+    { 2047,    0, 0x00, 0x00 }, {  511, 1040, 0x03, 0x00 },
+    {  255,  536, 0x1C, 0x00 }, { 1023,    0, 0x00, 0x00 }, {  255, 1040, 0x03, 0x00 },
+    {  127,  536, 0x1C, 0x00 }, {  511,    0, 0x00, 0x00 }, {  127, 1040, 0x03, 0x00 },
+    {   63,  536, 0x1C, 0x00 }, {  255,    0, 0x00, 0x00 }, {   63, 1040, 0x03, 0x00 },
+    {   31,  536, 0x1C, 0x00 }, {  127,    0, 0x00, 0x00 }, {   31, 1040, 0x03, 0x00 },
+    {   15,  536, 0x1C, 0x00 }, {   63,    0, 0x00, 0x00 }, {   15, 1040, 0x03, 0x00 },
+    {    7,  536, 0x1C, 0x00 }, {   31,    0, 0x00, 0x00 }, {    7, 1040, 0x03, 0x00 },
+    {    3,  536, 0x1C, 0x00 }, {   15,    0, 0x00, 0x00 }, {    3, 1040, 0x03, 0x00 },
+    {    1,  536, 0x1C, 0x00 }, {    7,    0, 0x00, 0x00 }, {    1, 1040, 0x03, 0x00 },
+    {    0,  536, 0x1C, 0x00 }, {    3,    0, 0x00, 0x00 }, {    0, 1040, 0x03, 0x00 },
+    {    1,    0, 0x00, 0x00 },
+    {    0,    0, 0x00, 0x00 }
+};
+
+/* the DSP's 4-point gaussian interpolation kernel, 512 points of one half */
+static const short gauss[512] =
+{
+   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,
+   2,   2,   3,   3,   3,   3,   3,   4,   4,   4,   4,   4,   5,   5,   5,   5,
+   6,   6,   6,   6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  10,
+  11,  11,  11,  12,  12,  13,  13,  14,  14,  15,  15,  15,  16,  16,  17,  17,
+  18,  19,  19,  20,  20,  21,  21,  22,  23,  23,  24,  24,  25,  26,  27,  27,
+  28,  29,  29,  30,  31,  32,  32,  33,  34,  35,  36,  36,  37,  38,  39,  40,
+  41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51,  52,  53,  54,  55,  56,
+  58,  59,  60,  61,  62,  64,  65,  66,  67,  69,  70,  71,  73,  74,  76,  77,
+  78,  80,  81,  83,  84,  86,  87,  89,  90,  92,  94,  95,  97,  99, 100, 102,
+ 104, 106, 107, 109, 111, 113, 115, 117, 118, 120, 122, 124, 126, 128, 130, 132,
+ 134, 137, 139, 141, 143, 145, 147, 150, 152, 154, 156, 159, 161, 163, 166, 168,
+ 171, 173, 175, 178, 180, 183, 186, 188, 191, 193, 196, 199, 201, 204, 207, 210,
+ 212, 215, 218, 221, 224, 227, 230, 233, 236, 239, 242, 245, 248, 251, 254, 257,
+ 260, 263, 267, 270, 273, 276, 280, 283, 286, 290, 293, 297, 300, 304, 307, 311,
+ 314, 318, 321, 325, 328, 332, 336, 339, 343, 347, 351, 354, 358, 362, 366, 370,
+ 374, 378, 381, 385, 389, 393, 397, 401, 405, 410, 414, 418, 422, 426, 430, 434,
+ 439, 443, 447, 451, 456, 460, 464, 469, 473, 477, 482, 486, 491, 495, 499, 504,
+ 508, 513, 517, 522, 527, 531, 536, 540, 545, 550, 554, 559, 563, 568, 573, 577,
+ 582, 587, 592, 596, 601, 606, 611, 615, 620, 625, 630, 635, 640, 644, 649, 654,
+ 659, 664, 669, 674, 678, 683, 688, 693, 698, 703, 708, 713, 718, 723, 728, 732,
+ 737, 742, 747, 752, 757, 762, 767, 772, 777, 782, 787, 792, 797, 802, 806, 811,
+ 816, 821, 826, 831, 836, 841, 846, 851, 855, 860, 865, 870, 875, 880, 884, 889,
+ 894, 899, 904, 908, 913, 918, 923, 927, 932, 937, 941, 946, 951, 955, 960, 965,
+ 969, 974, 978, 983, 988, 992, 997,1001,1005,1010,1014,1019,1023,1027,1032,1036,
+1040,1045,1049,1053,1057,1061,1066,1070,1074,1078,1082,1086,1090,1094,1098,1102,
+1106,1109,1113,1117,1121,1125,1128,1132,1136,1139,1143,1146,1150,1153,1157,1160,
+1164,1167,1170,1174,1177,1180,1183,1186,1190,1193,1196,1199,1202,1205,1207,1210,
+1213,1216,1219,1221,1224,1227,1229,1232,1234,1237,1239,1241,1244,1246,1248,1251,
+1253,1255,1257,1259,1261,1263,1265,1267,1269,1270,1272,1274,1275,1277,1279,1280,
+1282,1283,1284,1286,1287,1288,1290,1291,1292,1293,1294,1295,1296,1297,1297,1298,
+1299,1300,1300,1301,1302,1302,1303,1303,1303,1304,1304,1304,1304,1304,1305,1305,
+};
+
+/* true when an event at this rate doesn't fire on the current sample */
+static int readCounter(const sdsp_t *dsp, int rate)
+{
+    const counter_rate_t *r = &counterRates[rate];
+
+    return ((dsp->counter + r->offset) & r->mask) != 0 || (dsp->counterResidues & r->residueMask) != r->residue;
+}
+
+/* the counter counts down through COUNTER_RANGE, which every rate divides; its residues
+   mod 3 (of counter + 1040) and mod 5 (of counter + 536) count down alongside it */
+static void stepCounter(sdsp_t *dsp)
+{
+    int mod3 = dsp->counterResidues & 0x03, mod5 = dsp->counterResidues >> 2;
+
+    dsp->counter = dsp->counter ? dsp->counter - 1 : COUNTER_RANGE - 1;
+    mod3 = mod3 ? mod3 - 1 : 2;
+    mod5 = mod5 ? mod5 - 1 : 4;
+
+    dsp->counterResidues = mod3 | mod5 << 2;
+}
+
+void sdspLoad(sdsp_t *dsp, const unsigned char *regs, unsigned char *ram)
+{
+    int v = 0;
+
+    memset(dsp, 0, sizeof *dsp);
+    memcpy(dsp->regs, regs, sizeof dsp->regs);
+    dsp->ram = ram;
+
+    for(; v < DSP_VOICES; v++) dsp->voices[v].brrOffset = 1;
+
+    /* the counter starts at 0 */
+    dsp->counterResidues = 1040 % 3 | (536 % 5) << 2;
+
+    dsp->newKon = dsp->regs[DSP_KON];
+    dsp->esa = dsp->regs[DSP_ESA];
+    dsp->noise = 0x4000;
+    dsp->everyOtherSample = 1;
+}
+
+int sdspRead(const sdsp_t *dsp, int addr)
+{
+    return dsp->regs[addr & 0x7F];
+}
+
+void sdspWrite(sdsp_t *dsp, int addr, int data)
+{
+    addr &= 0x7F;
+    dsp->regs[addr] = (unsigned char) data;
+
+    if(dsp->onWrite != NULL) dsp->onWrite(dsp->onWriteArg, dsp->samples, addr, data & 0xFF);
+
+    if(addr == DSP_KON) dsp->newKon = data & 0xFF;
+
+    /* any write to ENDX clears it */
+    if(addr == DSP_ENDX) dsp->regs[DSP_ENDX] = 0;
+}
+
+static void runEnvelope(sdsp_t *dsp, int v)
+{
+    sdsp_voice_t *voice = &dsp->voices[v];
+    int env = voice->env, adsr0 = VREG(dsp, v, DSP_ADSR0), envData, rate;
+
+    if(voice->envMode == ENV_RELEASE)
+    {
+        if((env -= 0x8) < 0) env = 0;
+        voice->env = env;
+        return;
+    }
+
+    envData = VREG(dsp, v, DSP_ADSR1);
+
+    if(adsr0 & 0x80)
+    {
+        if(voice->envMode >= ENV_DECAY)
+        {
+            env--;
+            env -= env >> 8;
+            rate = envData & 0x1F;
+            if(voice->envMode == ENV_DECAY) rate = ((adsr0 >> 3) & 0x0E) + 0x10;
+        }
+        else
+        {
+            rate = (adsr0 & 0x0F) * 2 + 1;
+            env += rate < 31 ? 0x20 : 0x400;
+        }
+    }
+    else
+    {
+        int mode;
+
+        envData = VREG(dsp, v, DSP_GAIN);
+        mode = envData >> 5;
+
+        if(mode < 4)
+        {
+            /* direct gain */
+            env = envData * 0x10;
+            rate = 31;
+        }
+        else
+        {
+            rate = envData & 0x1F;
+
+            if(mode == 4) env -= 0x20;
+            else if(mode < 6)
+            {
+                env--;
+                env -= env >> 8;
+            }
+            else
+            {
+                env += 0x20;
+
+                /* bent line: slower above 3/4 */
+                if(mode > 6 && (unsigned) voice->hiddenEnv >= 0x600) env += 0x8 - 0x20;
+            }
+        }
+    }
+
+    /* sustain level */
+    if((env >> 8) == (envData >> 5) && voice->envMode == ENV_DECAY) voice->envMode = ENV_SUSTAIN;
+
+    voice->hiddenEnv = env;
+
+    /* unsigned so a linear decrease past zero is caught too */
+    if((unsigned) env > 0x7FF)
+    {
+        env = env < 0 ? 0 : 0x7FF;
+        if(voice->envMode == ENV_ATTACK) voice->envMode = ENV_DECAY;
+    }
+
+    if(!readCounter(dsp, rate)) voice->env = env;
+}
+
+/* decodes the next 4 samples of the current block, from the byte pair at brrOffset */
+static void decodeBrr(sdsp_t *dsp, sdsp_voice_t *voice, int header)
+{
+    int nybbles = dsp->ram[(voice->brrAddr + voice->brrOffset) & 0xFFFF] << 8 |
+                  dsp->ram[(voice->brrAddr + voice->brrOffset + 1) & 0xFFFF];
+    int shift = header >> 4, filter = header & 0x0C;
+    int *pos = &voice->buf[voice->bufPos], *end = pos + 4;
+
+    if(dsp->trace)
+    {
+        TRACE_MARK(dsp->trace->fetched, voice->brrAddr + voice->brrOffset);
+        TRACE_MARK(dsp->trace->fetched, voice->brrAddr + voice->brrOffset + 1);
+    }
+
+    if((voice->bufPos += 4) >= DSP_BRR_BUF) voice->bufPos = 0;
+
+    for(; pos < end; pos++, nybbles <<= 4)
+    {
+        int s = (short) nybbles >> 12;
+        int p1 = pos[DSP_BRR_BUF - 1], p2 = pos[DSP_BRR_BUF - 2] >> 1;
+
+        s = (s << shift) >> 1;
+        if(shift >= 0x0D) s = (s >> 25) << 11;
+
+        if(filter >= 8)
+        {
+            s += p1 - p2;
+
+            if(filter == 8) s += (p2 >> 4) + ((p1 * -3) >> 6);
+            else s += ((p1 * -13) >> 7) + ((p2 * 3) >> 4);
+        }
+        else if(filter) s += (p1 >> 1) + ((-p1) >> 5);
+
+        s = CLAMP16(s);
+        s = (short) (s * 2);
+
+        pos[DSP_BRR_BUF] = pos[0] = s;
+    }
+}
+
+static int interpolate(const sdsp_voice_t *voice)
+{
+    int offset = (voice->interpPos >> 4) & 0xFF;
+    const short *fwd = gauss + 255 - offset, *rev = gauss + offset;
+    const int *in = &voice->buf[(voice->interpPos >> 12) + voice->bufPos];
+    int out;
+
+    out  = (fwd[0] * in[0]) >> 11;
+    out += (fwd[256] * in[1]) >> 11;
+    out += (rev[256] * in[2]) >> 11;
+    out = (short) out;
+    out += (rev[0] * in[3]) >> 11;
+
+    return CLAMP16(out) & ~1;
+}
+
+/* the start or loop address stored at a sample directory entry */
+static int dirAddress(const sdsp_t *dsp, int entry)
+{
+    return dsp->ram[entry & 0xFFFF] | dsp->ram[(entry + 1) & 0xFFFF] << 8;
+}
+
+/* the global registers the voices read, copied once per sample. Each voice ends with byte
+   stores (ENVX, OUTX, ENDX) that the compiler must assume could change any of them, so
+   reading them through dsp would reload every one of them for every voice; the stores are
+   collected here instead and made once the voices have run */
+typedef struct SampleRegs
+{
+    int dir;
+    int pmon;
+    int non;
+    int eon;
+    int reset;                  /* FLG bit 7 */
+    int kon;                    /* KON and KOFF, or 0 on the samples they aren't polled */
+    int koff;
+    int looped;                 /* ENDX bits to set, then the ones to clear */
+    int keyedOn;
+
+} sample_regs_t;
+
+/* the directory entry a voice reads: the start address during key on, the loop address after */
+static int dirEntry(const sdsp_t *dsp, const sample_regs_t *regs, int v, int startup)
+{
+    return (regs->dir * 0x100 + VREG(dsp, v, DSP_SRCN) * 4 + (startup ? 0 : 2)) & 0xFFFF;
+}
+
+/* one voice for one sample: returns its output, adds it to the main and echo mixes */
+static int runVoice(sdsp_t *dsp, sample_regs_t *regs, int v, int prevOutput, int *mainOut, int *echoOut)
+{
+    sdsp_voice_t *voice = &dsp->voices[v];
+    int vbit = 1 << v, startup = voice->konDelay, header, pitch, output;
+
+    /* the hardware reads the directory entry every sample, but its address is only used
+       at key on and at the end of a looping block, so it's looked up then */
+    header = dsp->ram[voice->brrAddr];
+
+    if(dsp->trace)
+    {
+        int entry = dirEntry(dsp, regs, v, startup);
+
+        TRACE_MARK(dsp->trace->fetched, entry);
+        TRACE_MARK(dsp->trace->fetched, entry + 1);
+        TRACE_MARK(dsp->trace->fetched, voice->brrAddr);
+    }
+
+    pitch = VREG(dsp, v, DSP_PITCHL) | (VREG(dsp, v, DSP_PITCHH) & 0x3F) << 8;
+
+    if(regs->pmon & vbit) pitch += ((prevOutput >> 5) * pitch) >> 10;
+
+    if(startup)
+    {
+        if(startup == 5)
+        {
+            voice->brrAddr = dirAddress(dsp, dirEntry(dsp, regs, v, startup));
+            voice->brrOffset = 1;
+            voice->bufPos = 0;
+            header = 0;
+        }
+
+        voice->env = 0;
+        voice->hiddenEnv = 0;
+
+        /* the first three samples of the startup fill the decode buffer */
+        voice->interpPos = 0;
+        if(--voice->konDelay & 3) voice->interpPos = 0x4000;
+
+        pitch = 0;
+    }
+
+    /* a silent envelope zeroes whatever the interpolator would have produced */
+    output = 0;
+
+    if(voice->env)
+    {
+        output = (regs->non & vbit) ? (short) (dsp->noise * 2) : interpolate(voice);
+        output = ((output * voice->env) >> 11) & ~1;
+    }
+
+    /* end of a non-looping sample, or soft reset */
+    if(regs->reset || (header & 3) == 1)
+    {
+        voice->envMode = ENV_RELEASE;
+        voice->env = 0;
+    }
+
+    if(regs->koff & vbit) voice->envMode = ENV_RELEASE;
+
+    if(regs->kon & vbit)
+    {
+        voice->konDelay = 5;
+        voice->envMode = ENV_ATTACK;
+    }
+
+    if(!voice->konDelay) runEnvelope(dsp, v);
+
+    if(voice->interpPos >= 0x4000)
+    {
+        decodeBrr(dsp, voice, header);
+
+        if((voice->brrOffset += 2) >= 9)
+        {
+            voice->brrAddr = (voice->brrAddr + 9) & 0xFFFF;
+
+            if(header & 1)
+            {
+                voice->brrAddr = dirAddress(dsp, dirEntry(dsp, regs, v, startup));
+                regs->looped |= vbit;
+            }
+
+            voice->brrOffset = 1;
+        }
+    }
+
+    voice->interpPos = (voice->interpPos & 0x3FFF) + pitch;
+    if(voice->interpPos > 0x7FFF) voice->interpPos = 0x7FFF;
+
+    if(output)
+    {
+        int left = (output * (signed char) VREG(dsp, v, DSP_VOLL)) >> 7;
+        int right = (output * (signed char) VREG(dsp, v, DSP_VOLR)) >> 7;
+
+        mainOut[0] = CLAMP16(mainOut[0] + left);
+        mainOut[1] = CLAMP16(mainOut[1] + right);
+
+        /* silent voices are left at the zero the capture buffer starts with */
+        if(dsp->dry != NULL)
+        {
+            dsp->dry->voices[v][0] = (short) left;
+            dsp->dry->voices[v][1] = (short) right;
+        }
+
+        if(regs->eon & vbit)
+        {
+            echoOut[0] = CLAMP16(echoOut[0] + left);
+            echoOut[1] = CLAMP16(echoOut[1] + right);
+        }
+    }
+
+    if(voice->konDelay == 5) regs->keyedOn |= vbit;
+
+    return output;
+}
+
+#define FIR_TAP(dsp, i, ch) \
+    (((dsp)->echoHist[(dsp)->echoHistPos + 1 + (i)][ch] * (signed char) (dsp)->regs[((i) << 4) + DSP_FIR]) >> 6)
+
+/* reads the ring at ESA, runs the 8-tap FIR (oldest sample on tap 0), mixes the result
+   into the output at EVOL and back into the ring at EFB, then advances through EDL */
+void sdspEcho(sdsp_t *dsp, const int *mainOut, int *echoOut, short *out)
+{
+    int ptr = (dsp->esa * 0x100 + dsp->echoOffset) & 0xFFFF, ch = 0;
+
+    dsp->echoHistPos = (dsp->echoHistPos + 1) & 7;
+
+    for(; ch < 2; ch++)
+    {
+        int addr = (ptr + ch * 2) & 0xFFFF, echoIn, sample, i = 0;
+
+        dsp->echoHist[dsp->echoHistPos + 8][ch] = dsp->echoHist[dsp->echoHistPos][ch] =
+            (short) (dsp->ram[addr] | dsp->ram[(addr + 1) & 0xFFFF] << 8) >> 1;
+
+        /* the first seven taps wrap at 16 bits, only the last one clamps */
+        for(echoIn = 0; i < 7; i++) echoIn += FIR_TAP(dsp, i, ch);
+        echoIn = (short) echoIn;
+        echoIn += (short) FIR_TAP(dsp, 7, ch);
+        echoIn = CLAMP16(echoIn) & ~1;
+
+        sample = (short) ((mainOut[ch] * (signed char) dsp->regs[DSP_MVOLL + (ch << 4)]) >> 7) +
+                 (short) ((echoIn * (signed char) dsp->regs[DSP_EVOLL + (ch << 4)]) >> 7);
+        out[ch] = (short) CLAMP16(sample);
+
+        if(dsp->regs[DSP_FLG] & 0x40) out[ch] = 0;
+
+        echoOut[ch] += (short) ((echoIn * (signed char) dsp->regs[DSP_EFB]) >> 7);
+        echoOut[ch] = CLAMP16(echoOut[ch]) & ~1;
+    }
+
+    dsp->esa = dsp->regs[DSP_ESA];
+
+    /* EDL only takes effect when the ring wraps */
+    if(!dsp->echoOffset) dsp->echoLength = (dsp->regs[DSP_EDL] & 0x0F) * 0x800;
+
+    dsp->echoOffset += 4;
+    if(dsp->echoOffset >= dsp->echoLength) dsp->echoOffset = 0;
+
+    if(!(dsp->regs[DSP_FLG] & FLG_ECHO_OFF))
+    {
+        for(ch = 0; ch < 2; ch++)
+        {
+            int addr = (ptr + ch * 2) & 0xFFFF;
+
+            dsp->ram[addr] = (unsigned char) echoOut[ch];
+            dsp->ram[(addr + 1) & 0xFFFF] = (unsigned char) (echoOut[ch] >> 8);
+
+            if(dsp->trace)
+            {
+                TRACE_MARK(dsp->trace->echo, addr);
+                TRACE_MARK(dsp->trace->echo, addr + 1);
+            }
+        }
+    }
+}
+
+/* one 32kHz stereo sample */
+void sdspSample(sdsp_t *dsp, short *out)
+{
+    int mainOut[2] = { 0, 0 }, echoOut[2] = { 0, 0 }, outputs[DSP_VOICES], output = 0, v = 0;
+    sample_regs_t regs;
+
+    stepCounter(dsp);
+
+    if(!readCounter(dsp, dsp->regs[DSP_FLG] & 0x1F))
+    {
+        int feedback = (dsp->noise << 13) ^ (dsp->noise << 14);
+        dsp->noise = (feedback & 0x4000) ^ (dsp->noise >> 1);
+    }
+
+    dsp->everyOtherSample ^= 1;
+
+    if(dsp->everyOtherSample)
+    {
+        dsp->newKon &= ~dsp->kon;
+        dsp->kon = dsp->newKon;
+        dsp->koff = dsp->regs[DSP_KOFF];
+    }
+
+    dsp->samples++;
+
+    regs.dir = dsp->regs[DSP_DIR];
+    regs.pmon = dsp->regs[DSP_PMON] & 0xFE;
+    regs.non = dsp->regs[DSP_NON];
+    regs.eon = dsp->regs[DSP_EON];
+    regs.reset = dsp->regs[DSP_FLG] & 0x80;
+    regs.kon = dsp->everyOtherSample ? dsp->kon : 0;
+    regs.koff = dsp->everyOtherSample ? dsp->koff : 0;
+    regs.looped = regs.keyedOn = 0;
+
+    /* one call site, so runVoice is inlined into the loop */
+    for(; v < DSP_VOICES; v++) output = outputs[v] = runVoice(dsp, &regs, v, output, mainOut, echoOut);
+
+    dsp->regs[DSP_ENDX] = (unsigned char) ((dsp->regs[DSP_ENDX] | regs.looped) & ~regs.keyedOn);
+
+    for(v = 0; v < DSP_VOICES; v++)
+    {
+        VREG(dsp, v, DSP_ENVX) = (unsigned char) (dsp->voices[v].env >> 4);
+        VREG(dsp, v, DSP_OUTX) = (unsigned char) (outputs[v] >> 8);
+    }
+
+    if(dsp->dry != NULL)
+    {
+        dsp->dry->main[0] = (short) mainOut[0];
+        dsp->dry->main[1] = (short) mainOut[1];
+        dsp->dry++;
+
+        out[0] = out[1] = 0;
+        return;
+    }
+
+    sdspEcho(dsp, mainOut, echoOut, out);
+}
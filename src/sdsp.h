@@ -0,0 +1,100 @@
+#ifndef SDSP_H
+#define SDSP_H
+
+#include "dspregs.h"
+
+#define DSP_VOICES 8
+
+/* one output sample every 32 SPC700 clocks, 32000 per second */
+#define DSP_RATE   32000
+
+/* 12 decoded BRR samples, stored twice so interpolation never has to wrap */
+#define DSP_BRR_BUF 12
+
+typedef enum SdspEnvMode
+{
+    ENV_RELEASE = 0,
+    ENV_ATTACK  = 1,
+    ENV_DECAY   = 2,
+    ENV_SUSTAIN = 3
+
+} sdsp_env_mode_t;
+
+typedef struct SdspVoice
+{
+    int buf[DSP_BRR_BUF * 2];
+    int bufPos;                 /* where the next 4 decoded samples go */
+    int interpPos;              /* 12.12 position into buf; >= 4000h means decode more */
+    int brrAddr;                /* current block */
+    int brrOffset;              /* byte pair within the block being decoded */
+    int konDelay;               /* samples left in the key-on startup */
+    sdsp_env_mode_t envMode;
+    int env;
+    int hiddenEnv;
+
+} sdsp_voice_t;
+
+/* one sample of dry output, kept so the echo stage can be run again on its own */
+typedef struct SdspDry
+{
+    short voices[DSP_VOICES][2];    /* each voice after VOLL/VOLR, whether or not EON sends it */
+    short main[2];                  /* every voice mixed, before MVOL */
+
+} sdsp_dry_t;
+
+/* which RAM bytes were touched while a trace is attached, one bit per address */
+typedef struct SpcTrace
+{
+    unsigned char read[0x2000];         /* CPU reads, opcode and operand fetches included */
+    unsigned char written[0x2000];      /* CPU writes */
+    unsigned char fetched[0x2000];      /* DSP sample directory and BRR reads */
+    unsigned char echo[0x2000];         /* DSP writes to the echo ring */
+
+} spctrace_t;
+
+#define TRACE_MARK(map, addr) ((map)[((addr) & 0xFFFF) >> 3] |= (unsigned char) (1 << ((addr) & 7)))
+
+/* sample-accurate S-DSP: voices, envelopes, noise, pitch modulation and the echo
+   unit, with the same integer math, clamping and ordering as the hardware */
+typedef struct Sdsp
+{
+    unsigned char regs[0x80];
+    unsigned char *ram;         /* the SPC700's 64kb, shared for BRR reads and the echo ring */
+
+    sdsp_voice_t voices[DSP_VOICES];
+
+    int everyOtherSample;       /* KON/KOFF are only polled at 16kHz */
+    int kon;
+    int newKon;
+    int koff;
+    int counter;                /* global rate counter for envelopes and noise, counting down */
+    int counterResidues;        /* (counter + 1040) % 3, and (counter + 536) % 5 << 2 */
+    int noise;
+
+    int esa;                    /* ESA latched for the next sample */
+    int echoOffset;
+    int echoLength;
+    int echoHist[16][2];        /* FIR input history, echoHistPos is the newest; stored twice like buf */
+    int echoHistPos;
+
+    long samples;               /* samples run since sdspLoad() */
+
+    /* when set, only the voices run: each sample's dry mix goes to *dry, which then advances */
+    sdsp_dry_t *dry;
+
+    /* when set, called for every register write with the number of samples run before it */
+    void (*onWrite)(void *arg, long sample, int addr, int data);
+    void *onWriteArg;
+
+    /* when set, every sample fetch and echo ring write is marked in it */
+    spctrace_t *trace;
+
+} sdsp_t;
+
+void sdspLoad(sdsp_t *dsp, const unsigned char *regs, unsigned char *ram);
+int sdspRead(const sdsp_t *dsp, int addr);
+void sdspWrite(sdsp_t *dsp, int addr, int data);
+void sdspSample(sdsp_t *dsp, short *out);
+void sdspEcho(sdsp_t *dsp, const int *mainOut, int *echoOut, short *out);
+
+#endif /*SDSP_H*/
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "addresses.h"
+#include "dspregs.h"
+#include "fir.h"
+#include "serve.h"
+#include "tune.h"
+
+#define SERVE_LINE 512
+
+typedef struct ServeSession
+{
+    const spcfile_t *defaults;  /* values from the command line, restored by reset */
+    spcfile_t values;           /* values as tuned so far; holds no image */
+
+    unsigned char *image;       /* as loaded, never patched */
+    unsigned char *work;        /* patched copy for the current values */
+    size_t length;
+
+    spctune_t tune;
+    const char *outName;        /* NULL streams raw PCM to stdout */
+
+} servesession_t;
+
+/* all messages go to stderr: stdout may be carrying audio */
+static void note(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void note(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+/* a patched copy of the image for the current values; the -p policy settles any prompt */
+static int patchWork(servesession_t *session, spcfile_t *file)
+{
+    fileInitFrom(file, &session->values);
+    file->quiet = 1;
+
+    memcpy(session->work, session->image, session->length);
+
+    if(spcechoAttach(&file->ctx, session->work, session->length) != SPCECHO_OK) return 0;
+    if(!echoAddress(file)) return 0;
+
+    return filePatch(file);
+}
+
+/* the output file is replaced in one rename so a player reloading it never sees half a render */
+static int writeOutput(servesession_t *session)
+{
+    char tempName[FILENAME_MAX];
+    spcecho_error_t err;
+    FILE *out;
+
+    if(session->outName == NULL) return spcechoTuneWrite(&session->tune, stdout, 0) == SPCECHO_OK;
+
+    snprintf(tempName, sizeof tempName, "%s.tmp", session->outName);
+
+    if((out = fopen(tempName, "wb")) == NULL) return 0;
+
+    err = spcechoTuneWrite(&session->tune, out, 1);
+
+    if(fclose(out) != 0 || err != SPCECHO_OK || rename(tempName, session->outName) != 0)
+    {
+        remove(tempName);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* re-runs the echo stage for the current values and describes the result in reply */
+static int rerender(servesession_t *session, char *reply, size_t size)
+{
+    const unsigned char *dsp = session->work + ADDRESS_OFFSET;
+    spcfile_t file;
+
+    if(!patchWork(session, &file))
+    {
+        snprintf(reply, size, "error: values can't be written to this image\n");
+        return 0;
+    }
+
+    if(spcechoTuneRender(&session->tune, &file.ctx) != SPCECHO_OK || !writeOutput(session))
+    {
+        snprintf(reply, size, "error: unable to write the preview\n");
+        return 0;
+    }
+
+    snprintf(reply, size, "ok EVOL=%02X/%02X EFB=%02X EDL=%X ESA=%02X EON=%02X: %.1fs re-rendered in %.1fms\n",
+             dsp[DSP_EVOLL], dsp[DSP_EVOLR], dsp[DSP_EFB], dsp[DSP_EDL] & 0x0F, dsp[DSP_ESA], dsp[DSP_EON],
+             (double) session->tune.frames / DSP_RATE, session->tune.renderTime * 1000);
+
+    return 1;
+}
+
+/* one option and its value, with the same parsers and ranges as the command line */
+int applyOption(spcfile_t *values, const char *option, const char *value, char *reply, size_t size)
+{
+    int parsed = 0, controlValue;
+
+    if(strncmp(option, "--fir=", 6) == 0)
+    {
+        fir_target_t target;
+        fir_design_t design;
+        int feedback = 128;
+
+        if(!firParseTarget(option + 6, &target))
+        {
+            snprintf(reply, size, "error: unknown FIR target %s\n", option + 6);
+            return 0;
+        }
+
+        if(values->ctx.addresses[FEEDBACK].overwrite) feedback = (signed char) values->ctx.addresses[FEEDBACK].value;
+
+        if(spcechoDesignFir(&target, feedback, 0, &design) != SPCECHO_OK)
+        {
+            snprintf(reply, size, "error: out of memory\n");
+            return 0;
+        }
+
+        spcechoSetFir(&values->ctx, design.taps);
+        return 1;
+    }
+
+    if(option[0] != '-' || option[1] == '\0' || option[2] != '\0' || value == NULL)
+    {
+        snprintf(reply, size, "error: can't read %s\n", option);
+        return 0;
+    }
+
+    switch(option[1])
+    {
+        case 'l': case 'r': case 'f': parsed = percentToSign(value, &controlValue); break;
+        case 't': parsed = millisecondToInt(value, &controlValue); break;
+        case 'c': parsed = channelAddress(value, &controlValue); break;
+        case 'a': parsed = bufferAddress(value, &controlValue); break;
+
+        default:
+            snprintf(reply, size, "error: unknown option %s\n", option);
+            return 0;
+    }
+
+    if(parsed) valueSet(values, option[1], controlValue);
+    else snprintf(reply, size, "error: invalid value for %s\n", option);
+
+    return parsed;
+}
+
+/* a line is any number of options, "reset" or "quit". Returns 0 once quit is asked for */
+static int handleLine(servesession_t *session, char *line, char *reply, size_t size)
+{
+    spcfile_t next = session->values;
+    char *token, *save;
+
+    if((token = strtok_r(line, " \t\r\n", &save)) == NULL)
+    {
+        snprintf(reply, size, "error: empty line\n");
+        return 1;
+    }
+
+    if(strcmp(token, "quit") == 0)
+    {
+        snprintf(reply, size, "bye\n");
+        return 0;
+    }
+
+    if(strcmp(token, "reset") == 0) fileInitFrom(&next, session->defaults);
+    else
+    {
+        for(; token != NULL; token = strtok_r(NULL, " \t\r\n", &save))
+        {
+            const char *value = strncmp(token, "--", 2) == 0 ? NULL : strtok_r(NULL, " \t\r\n", &save);
+
+            /* nothing changes unless the whole line is good */
+            if(!applyOption(&next, token, value, reply, size)) return 1;
+        }
+    }
+
+    session->values = next;
+    rerender(session, reply, size);
+
+    return 1;
+}
+
+static int listenOn(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat info;
+    int fd;
+
+    if(strlen(path) >= sizeof addr.sun_path)
+    {
+        note("\n!!!! Socket path is too long! !!!!\n");
+        return -1;
+    }
+
+    /* a socket left behind by an earlier run is replaced, anything else is left alone */
+    if(stat(path, &info) == 0)
+    {
+        if(!S_ISSOCK(info.st_mode))
+        {
+            note("\n!!!! %s exists and isn't a socket! !!!!\n", path);
+            return -1;
+        }
+
+        unlink(path);
+    }
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+
+    if(bind(fd, (struct sockaddr *) &addr, sizeof addr) != 0 || listen(fd, 4) != 0)
+    {
+        note("\n!!!! Unable to listen on %s! !!!!\n", path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* serves one client at a time until one of them sends quit */
+static void serveClients(servesession_t *session, int listener)
+{
+    int running = 1;
+
+    while(running)
+    {
+        char line[SERVE_LINE], reply[SERVE_LINE];
+        FILE *in, *out;
+        int client = accept(listener, NULL, NULL);
+
+        if(client < 0) continue;
+
+        in = fdopen(client, "r");
+        out = fdopen(dup(client), "w");
+
+        if(in == NULL || out == NULL)
+        {
+            if(in != NULL) fclose(in);
+            else close(client);
+            if(out != NULL) fclose(out);
+            continue;
+        }
+
+        while(running && fgets(line, sizeof line, in) != NULL)
+        {
+            running = handleLine(session, line, reply, sizeof reply);
+
+            fputs(reply, out);
+            fflush(out);
+            note("%s", reply);
+        }
+
+        fclose(in);
+        fclose(out);
+    }
+}
+
+int runServe(const char *inName, const char *outName, const spcfile_t *settings)
+{
+    servesession_t session;
+    spcfile_t loaded, file;
+    char reply[SERVE_LINE];
+    spcecho_error_t err;
+    int listener, ok = 0;
+
+    memset(&session, 0, sizeof session);
+    session.defaults = settings;
+    session.outName = outName;
+    fileInitFrom(&session.values, settings);
+
+    fileInitFrom(&loaded, settings);
+    loaded.quiet = 1;
+
+    if(!fileRead(&loaded, inName))
+    {
+        note("\n!!!! Unable to read %s! !!!!\n", inName);
+        return 0;
+    }
+
+    session.image = loaded.ctx.buffer;
+    session.length = loaded.ctx.length;
+
+    if((session.work = malloc(session.length)) == NULL)
+    {
+        freeBuffer(&loaded);
+        return 0;
+    }
+
+    /* the voices don't depend on the echo values, so one pass with the starting values serves every change */
+    if(!patchWork(&session, &file))
+        note("\n!!!! Values can't be written to %s! !!!!\n", inName);
+    else if((err = spcechoTuneLoad(&session.tune, &file.ctx, settings->renderSeconds)) != SPCECHO_OK)
+        note("\n!!!! %s! !!!!\n", spcechoStrerror(err));
+    else if((listener = listenOn(settings->socketPath)) >= 0)
+    {
+        signal(SIGPIPE, SIG_IGN);
+
+        note("\nPlayed %ds of voices in %.3fs; listening on %s\n", settings->renderSeconds,
+             session.tune.captureTime, settings->socketPath);
+
+        rerender(&session, reply, sizeof reply);
+        note("%s", reply);
+
+        serveClients(&session, listener);
+
+        close(listener);
+        unlink(settings->socketPath);
+        ok = 1;
+    }
+
+    spcechoTuneFree(&session.tune);
+    free(session.work);
+    freeBuffer(&loaded);
+
+    return ok;
+}
@@ -0,0 +1,11 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "readwrite.h"
+
+int runServe(const char *inName, const char *outName, const spcfile_t *settings);
+
+/* -l -r -f -t -c -a with a value or --fir=TARGET; on failure reply says why. Watch profiles use it too */
+int applyOption(spcfile_t *values, const char *option, const char *value, char *reply, size_t size);
+
+#endif /*SERVE_H*/
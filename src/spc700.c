@@ -0,0 +1,661 @@
+#include <string.h>
+
+#include "spc700.h"
+
+#define FLAG_N 0x80
+#define FLAG_V 0x40
+#define FLAG_P 0x20
+#define FLAG_B 0x10
+#define FLAG_H 0x08
+#define FLAG_I 0x04
+#define FLAG_Z 0x02
+#define FLAG_C 0x01
+
+/* boot ROM mapped over $FFC0-$FFFF while bit 7 of CONTROL is set */
+static const unsigned char iplRom[0x40] =
+{
+    0xCD, 0xEF, 0xBD, 0xE8, 0x00, 0xC6, 0x1D, 0xD0, 0xFC, 0x8F, 0xAA, 0xF4, 0x8F, 0xBB, 0xF5, 0x78,
+    0xCC, 0xF4, 0xD0, 0xFB, 0x2F, 0x19, 0xEB, 0xF4, 0xD0, 0xFC, 0x7E, 0xF4, 0xD0, 0x0B, 0xE4, 0xF5,
+    0xCB, 0xF4, 0xD7, 0x00, 0xFC, 0xD0, 0xF3, 0xAB, 0x01, 0x10, 0xEF, 0x7E, 0xF4, 0x10, 0xEB, 0xBA,
+    0xF6, 0xDA, 0x00, 0xBA, 0xF4, 0xC4, 0xF4, 0xDD, 0x5D, 0xD0, 0xDB, 0x1F, 0x00, 0x00, 0xC0, 0xFF
+};
+
+/* clocks per opcode, branches not taken (taken branches add 2) */
+static const unsigned char cycleTable[0x100] =
+{
+    2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 5, 4, 5, 4, 6, 8,
+    2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 6, 5, 2, 2, 4, 6,
+    2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 5, 4, 5, 4, 5, 4,
+    2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 6, 5, 2, 2, 3, 8,
+    2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 4, 4, 5, 4, 6, 6,
+    2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 4, 5, 2, 2, 4, 3,
+    2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 4, 4, 5, 4, 5, 5,
+    2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 5, 5, 2, 2, 3, 6,
+    2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 5, 4, 5, 2, 4, 5,
+    2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 5, 5, 2, 2, 12, 5,
+    3, 8, 4, 5, 3, 4, 3, 6, 2, 6, 4, 4, 5, 2, 4, 4,
+    2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 5, 5, 2, 2, 3, 4,
+    3, 8, 4, 5, 4, 5, 4, 7, 2, 5, 6, 4, 5, 2, 4, 9,
+    2, 8, 4, 5, 5, 6, 6, 7, 4, 5, 5, 5, 2, 2, 6, 3,
+    2, 8, 4, 5, 3, 4, 3, 6, 2, 4, 5, 3, 4, 3, 4, 3,
+    2, 8, 4, 5, 4, 5, 5, 6, 3, 4, 5, 4, 2, 2, 4, 3
+};
+
+/* timers only count when read or reprogrammed, so they're brought up to date lazily */
+static void timerRun(spctimer_t *timer, long clock)
+{
+    long ticks, stage;
+    int target;
+
+    if(clock < timer->nextTick) return;
+
+    ticks = (clock - timer->nextTick) / timer->period + 1;
+    timer->nextTick += ticks * timer->period;
+
+    if(!timer->enabled) return;
+
+    target = timer->target ? timer->target : 0x100;
+    stage = timer->stage + ticks;
+
+    timer->counter = (int) ((timer->counter + stage / target) & 0x0F);
+    timer->stage = (int) (stage % target);
+}
+
+static int ioRead(spc700_t *cpu, int addr, long clock)
+{
+    spctimer_t *timer;
+    int value;
+
+    switch(addr)
+    {
+    case 0xF2: return cpu->dspAddr;
+    case 0xF3: return sdspRead(&cpu->dsp, cpu->dspAddr);
+    case 0xF4: case 0xF5: case 0xF6: case 0xF7: return cpu->portsIn[addr - 0xF4];
+    case 0xF8: case 0xF9: return cpu->ram[addr];
+
+    case 0xFD: case 0xFE: case 0xFF:
+
+        timer = &cpu->timers[addr - 0xFD];
+        timerRun(timer, clock);
+
+        value = timer->counter;
+        timer->counter = 0;
+
+        return value;
+
+    /* TEST, CONTROL and the timer targets are write-only */
+    default: return 0;
+    }
+}
+
+static void ioWrite(spc700_t *cpu, int addr, int data, long clock)
+{
+    int i = 0;
+
+    cpu->ram[addr] = (unsigned char) data;
+
+    switch(addr)
+    {
+    case 0xF1:
+
+        for(; i < 3; i++)
+        {
+            spctimer_t *timer = &cpu->timers[i];
+            int enable = (data >> i) & 1;
+
+            timerRun(timer, clock);
+
+            if(enable && !timer->enabled) timer->stage = timer->counter = 0;
+            timer->enabled = enable;
+        }
+
+        if(data & 0x10) cpu->portsIn[0] = cpu->portsIn[1] = 0;
+        if(data & 0x20) cpu->portsIn[2] = cpu->portsIn[3] = 0;
+
+        cpu->control = data;
+        break;
+
+    case 0xF2: cpu->dspAddr = data; break;
+    case 0xF3: if(cpu->dspAddr < 0x80) sdspWrite(&cpu->dsp, cpu->dspAddr, data); break;
+    case 0xF4: case 0xF5: case 0xF6: case 0xF7: cpu->portsOut[addr - 0xF4] = (unsigned char) data; break;
+
+    case 0xFA: case 0xFB: case 0xFC:
+
+        timerRun(&cpu->timers[addr - 0xFA], clock);
+        cpu->timers[addr - 0xFA].target = data;
+        break;
+    }
+}
+
+static inline int memRead(spc700_t *cpu, int addr, long clock)
+{
+    if(cpu->trace) TRACE_MARK(cpu->trace->read, addr);
+
+    if((unsigned) (addr - 0xF0) < 0x10) return ioRead(cpu, addr, clock);
+    if(addr >= 0xFFC0 && (cpu->control & 0x80)) return iplRom[addr - 0xFFC0];
+
+    return cpu->ram[addr];
+}
+
+static inline void memWrite(spc700_t *cpu, int addr, int data, long clock)
+{
+    if(cpu->trace) TRACE_MARK(cpu->trace->written, addr);
+
+    if((unsigned) (addr - 0xF0) < 0x10) ioWrite(cpu, addr, data, clock);
+    else cpu->ram[addr] = (unsigned char) data;
+}
+
+static inline int setNZ(int psw, int value)
+{
+    return (psw & ~(FLAG_N | FLAG_Z)) | (value & 0x80) | ((value & 0xFF) ? 0 : FLAG_Z);
+}
+
+static inline int setNZ16(int psw, int value)
+{
+    return (psw & ~(FLAG_N | FLAG_Z)) | ((value >> 8) & 0x80) | ((value & 0xFFFF) ? 0 : FLAG_Z);
+}
+
+static inline int adc(int *psw, int a, int b)
+{
+    int t = a + b + (*psw & FLAG_C);
+
+    *psw = (*psw & ~(FLAG_V | FLAG_H | FLAG_C)) |
+           ((~(a ^ b) & (a ^ t) & 0x80) ? FLAG_V : 0) | (((a ^ b ^ t) & 0x10) ? FLAG_H : 0) | (t > 0xFF ? FLAG_C : 0);
+    *psw = setNZ(*psw, t);
+
+    return t & 0xFF;
+}
+
+static inline int compare(int psw, int a, int b)
+{
+    int t = a - b;
+
+    return setNZ((psw & ~FLAG_C) | (t >= 0 ? FLAG_C : 0), t);
+}
+
+/* OR, AND, EOR, CMP, ADC, SBC by row pair; CMP leaves the destination as it was */
+static inline int alu(int *psw, int kind, int a, int b)
+{
+    switch(kind)
+    {
+    case 0: a |= b; break;
+    case 1: a &= b; break;
+    case 2: a ^= b; break;
+    case 3: *psw = compare(*psw, a, b); return a;
+    case 4: return adc(psw, a, b);
+    default: return adc(psw, a, b ^ 0xFF);
+    }
+
+    *psw = setNZ(*psw, a);
+
+    return a;
+}
+
+/* ASL, ROL, LSR, ROR, DEC, INC by row pair */
+static inline int shift(int *psw, int kind, int v)
+{
+    int carry = *psw & FLAG_C;
+
+    switch(kind)
+    {
+    case 0: carry = v >> 7; v <<= 1; break;
+    case 1: v = (v << 1) | carry; carry = v >> 8; break;
+    case 2: carry = v & 1; v >>= 1; break;
+    case 3: v |= carry << 8; carry = v & 1; v >>= 1; break;
+    case 4: v--; break;
+    default: v++; break;
+    }
+
+    v &= 0xFF;
+    *psw = setNZ((*psw & ~FLAG_C) | carry, v);
+
+    return v;
+}
+
+int spc700Load(spc700_t *cpu, const unsigned char *image, long length)
+{
+    int i = 0;
+
+    if(length < 0x10180) return 0;
+
+    memset(cpu, 0, sizeof *cpu);
+    memcpy(cpu->ram, image + 0x100, sizeof cpu->ram);
+
+    cpu->pc = image[0x25] | image[0x26] << 8;
+    cpu->a = image[0x27];
+    cpu->x = image[0x28];
+    cpu->y = image[0x29];
+    cpu->psw = image[0x2A];
+    cpu->sp = image[0x2B];
+
+    cpu->control = cpu->ram[0xF1];
+    cpu->dspAddr = cpu->ram[0xF2];
+    memcpy(cpu->portsIn, cpu->ram + 0xF4, sizeof cpu->portsIn);
+
+    /* with the boot ROM mapped in, the RAM underneath is kept after the DSP registers */
+    if(length >= 0x10200 && (cpu->control & 0x80)) memcpy(cpu->ram + 0xFFC0, image + 0x101C0, 0x40);
+
+    for(; i < 3; i++)
+    {
+        spctimer_t *timer = &cpu->timers[i];
+
+        timer->period = i == 2 ? 16 : 128;
+        timer->nextTick = timer->period;
+        timer->target = cpu->ram[0xFA + i];
+        timer->counter = cpu->ram[0xFD + i] & 0x0F;
+        timer->enabled = (cpu->control >> i) & 1;
+    }
+
+    sdspLoad(&cpu->dsp, image + 0x10100, cpu->ram);
+
+    /* whatever the ring held when the song was ripped would otherwise play as a burst of noise */
+    if(!(cpu->dsp.regs[DSP_FLG] & FLG_ECHO_OFF))
+    {
+        int start = cpu->dsp.regs[DSP_ESA] * 0x100;
+        int end = start + (cpu->dsp.regs[DSP_EDL] & 0x0F) * 0x800;
+
+        if(end == start) end = start + 4;
+        if(end > 0x10000) end = 0x10000;
+
+        memset(cpu->ram + start, 0, (size_t) (end - start));
+    }
+
+    cpu->nextSample = SPC_CLOCKS_PER_SAMPLE;
+
+    return 1;
+}
+
+/* the stack page is used directly, so it is marked here rather than in memRead/memWrite */
+static inline void stackMark(spc700_t *cpu, int sp, int write)
+{
+    if(cpu->trace) TRACE_MARK(write ? cpu->trace->written : cpu->trace->read, 0x100 | sp);
+}
+
+/* marks every RAM access from here on, the DSP's included, in trace; NULL stops tracing */
+void spc700Trace(spc700_t *cpu, spctrace_t *trace)
+{
+    cpu->trace = trace;
+    cpu->dsp.trace = trace;
+}
+
+#define READ(addr)          memRead(cpu, (addr), clock)
+#define WRITE(addr, data)   memWrite(cpu, (addr), (data), clock)
+#define FETCH()             (pc = (pc + 1) & 0xFFFF, READ((pc - 1) & 0xFFFF))
+#define DPADDR(o)           (((psw & FLAG_P) << 3) | ((o) & 0xFF))
+#define PUSH(v)             (stackMark(cpu, sp, 1), cpu->ram[0x100 | sp] = (unsigned char) (v), sp = (sp - 1) & 0xFF)
+#define POP()               (sp = (sp + 1) & 0xFF, stackMark(cpu, sp, 0), cpu->ram[0x100 | sp])
+#define BRANCH(cond)        { int rel = (signed char) FETCH(); if(cond) { pc = (pc + rel) & 0xFFFF; clock += 2; } }
+
+/* an opcode column in all 16 rows */
+#define ALL_ROWS(c) case (c): case (c) + 0x10: case (c) + 0x20: case (c) + 0x30: \
+                    case (c) + 0x40: case (c) + 0x50: case (c) + 0x60: case (c) + 0x70: \
+                    case (c) + 0x80: case (c) + 0x90: case (c) + 0xA0: case (c) + 0xB0: \
+                    case (c) + 0xC0: case (c) + 0xD0: case (c) + 0xE0: case (c) + 0xF0
+
+/* columns 4-7 of a row pair: the eight ways of addressing memory against A. Each opcode
+   gets its own case so the operation is a constant and the ALU switch folds away */
+#define A_MODES(row, BODY) \
+    case (row) + 0x04: addr = DPADDR(FETCH()); BODY; break; \
+    case (row) + 0x14: addr = DPADDR(FETCH() + x); BODY; break; \
+    case (row) + 0x05: addr = FETCH(); addr |= FETCH() << 8; BODY; break; \
+    case (row) + 0x15: addr = FETCH(); addr = ((addr | FETCH() << 8) + x) & 0xFFFF; BODY; break; \
+    case (row) + 0x06: addr = DPADDR(x); BODY; break; \
+    case (row) + 0x16: addr = FETCH(); addr = ((addr | FETCH() << 8) + y) & 0xFFFF; BODY; break; \
+    case (row) + 0x07: t = FETCH() + x; addr = READ(DPADDR(t)) | READ(DPADDR(t + 1)) << 8; BODY; break; \
+    case (row) + 0x17: t = FETCH(); addr = ((READ(DPADDR(t)) | READ(DPADDR(t + 1)) << 8) + y) & 0xFFFF; BODY; break
+
+/* memory destination; CMP only sets flags */
+#define ALU_WRITE(kind, addr, data) { t = alu(&psw, kind, READ(addr), data); if((kind) != 3) WRITE(addr, t); }
+
+/* columns 8-9 of an ALU row pair: immediate, dp <- immediate, dp <- dp, (X) <- (Y) */
+#define ALU_MODES(row, kind) \
+    A_MODES(row, a = alu(&psw, kind, a, READ(addr))); \
+    case (row) + 0x08: a = alu(&psw, kind, a, FETCH()); break; \
+    case (row) + 0x18: data = FETCH(); addr = DPADDR(FETCH()); ALU_WRITE(kind, addr, data); break; \
+    case (row) + 0x09: data = READ(DPADDR(FETCH())); addr = DPADDR(FETCH()); ALU_WRITE(kind, addr, data); break; \
+    case (row) + 0x19: data = READ(DPADDR(y)); addr = DPADDR(x); ALU_WRITE(kind, addr, data); break
+
+/* ASL, ROL, LSR, ROR, DEC, INC on dp, dp+X, !abs and A */
+#define SHIFT_MODES(row, kind) \
+    case (row) + 0x0B: addr = DPADDR(FETCH()); WRITE(addr, shift(&psw, kind, READ(addr))); break; \
+    case (row) + 0x1B: addr = DPADDR(FETCH() + x); WRITE(addr, shift(&psw, kind, READ(addr))); break; \
+    case (row) + 0x0C: addr = FETCH(); addr |= FETCH() << 8; WRITE(addr, shift(&psw, kind, READ(addr))); break; \
+    case (row) + 0x1C: a = shift(&psw, kind, a); break
+
+/* runs the CPU and produces samples stereo samples of DSP output */
+void spc700Run(spc700_t *cpu, short *out, int samples)
+{
+    int pc = cpu->pc, a = cpu->a, x = cpu->x, y = cpu->y, sp = cpu->sp, psw = cpu->psw;
+    long clock = cpu->clock, nextSample = cpu->nextSample;
+    int stopped = cpu->stopped, produced = 0;
+
+    while(produced < samples)
+    {
+        while(clock < nextSample && !stopped)
+        {
+            int op = FETCH(), addr, data, t;
+
+            clock += cycleTable[op];
+
+            switch(op)
+            {
+            ALU_MODES(0x00, 0);
+            ALU_MODES(0x20, 1);
+            ALU_MODES(0x40, 2);
+            ALU_MODES(0x60, 3);
+            ALU_MODES(0x80, 4);
+            ALU_MODES(0xA0, 5);
+            A_MODES(0xC0, WRITE(addr, a));
+            A_MODES(0xE0, a = READ(addr); psw = setNZ(psw, a));
+
+            /* TCALL n */
+            ALL_ROWS(0x01):
+                PUSH(pc >> 8);
+                PUSH(pc);
+                t = 0xFFDE - ((op >> 4) << 1);
+                pc = READ(t) | READ(t + 1) << 8;
+                break;
+
+            /* SET1 / CLR1 dp.bit */
+            ALL_ROWS(0x02):
+                addr = DPADDR(FETCH());
+                data = READ(addr);
+                if(op & 0x10) data &= ~(1 << (op >> 5));
+                else data |= 1 << (op >> 5);
+                WRITE(addr, data);
+                break;
+
+            /* BBS / BBC dp.bit, rel */
+            ALL_ROWS(0x03):
+                data = READ(DPADDR(FETCH()));
+                BRANCH(((data >> (op >> 5)) & 1) ^ ((op >> 4) & 1));
+                break;
+
+            case 0x00: break;
+            case 0x10: BRANCH(!(psw & FLAG_N)); break;
+            case 0x20: psw &= ~FLAG_P; break;
+            case 0x30: BRANCH(psw & FLAG_N); break;
+            case 0x40: psw |= FLAG_P; break;
+            case 0x50: BRANCH(!(psw & FLAG_V)); break;
+            case 0x60: psw &= ~FLAG_C; break;
+            case 0x70: BRANCH(psw & FLAG_V); break;
+            case 0x80: psw |= FLAG_C; break;
+            case 0x90: BRANCH(!(psw & FLAG_C)); break;
+            case 0xA0: psw |= FLAG_I; break;
+            case 0xB0: BRANCH(psw & FLAG_C); break;
+            case 0xC0: psw &= ~FLAG_I; break;
+            case 0xD0: BRANCH(!(psw & FLAG_Z)); break;
+            case 0xE0: psw &= ~(FLAG_V | FLAG_H); break;
+            case 0xF0: BRANCH(psw & FLAG_Z); break;
+
+            case 0xC8: psw = compare(psw, x, FETCH()); break;
+            case 0xD8: WRITE(DPADDR(FETCH()), x); break;
+            case 0xE8: a = FETCH(); psw = setNZ(psw, a); break;
+            case 0xF8: x = READ(DPADDR(FETCH())); psw = setNZ(psw, x); break;
+
+            case 0xC9: addr = FETCH(); WRITE(addr | FETCH() << 8, x); break;
+            case 0xD9: WRITE(DPADDR(FETCH() + y), x); break;
+            case 0xE9: addr = FETCH(); x = READ(addr | FETCH() << 8); psw = setNZ(psw, x); break;
+            case 0xF9: x = READ(DPADDR(FETCH() + y)); psw = setNZ(psw, x); break;
+
+            /* OR1, AND1, EOR1, MOV1, NOT1 on a 13-bit address and bit number */
+            case 0x0A: case 0x2A: case 0x4A: case 0x6A: case 0x8A: case 0xAA: case 0xCA: case 0xEA:
+            {
+                int bitAddr, bit, value;
+
+                t = FETCH();
+                t |= FETCH() << 8;
+                bitAddr = t & 0x1FFF;
+                bit = t >> 13;
+                data = READ(bitAddr);
+                value = (data >> bit) & 1;
+
+                switch(op)
+                {
+                case 0x0A: psw |= value; break;
+                case 0x2A: psw |= !value; break;
+                case 0x4A: psw &= ~FLAG_C | value; break;
+                case 0x6A: psw &= ~FLAG_C | !value; break;
+                case 0x8A: psw ^= value; break;
+                case 0xAA: psw = (psw & ~FLAG_C) | value; break;
+                case 0xCA: WRITE(bitAddr, (data & ~(1 << bit)) | (psw & FLAG_C) << bit); break;
+                default: WRITE(bitAddr, data ^ (1 << bit)); break;
+                }
+                break;
+            }
+
+            /* word ops on YA and a direct page pair */
+            case 0x1A: case 0x3A:
+                addr = FETCH();
+                t = READ(DPADDR(addr)) | READ(DPADDR(addr + 1)) << 8;
+                t = (t + (op == 0x3A ? 1 : -1)) & 0xFFFF;
+                WRITE(DPADDR(addr), t & 0xFF);
+                WRITE(DPADDR(addr + 1), t >> 8);
+                psw = setNZ16(psw, t);
+                break;
+
+            case 0x5A: case 0x7A: case 0x9A: case 0xBA:
+            {
+                int ya = y << 8 | a, word;
+
+                addr = FETCH();
+                word = READ(DPADDR(addr)) | READ(DPADDR(addr + 1)) << 8;
+
+                if(op == 0xBA)
+                {
+                    a = word & 0xFF;
+                    y = word >> 8;
+                    psw = setNZ16(psw, word);
+                    break;
+                }
+
+                if(op == 0x5A)
+                {
+                    t = ya - word;
+                    psw = setNZ16((psw & ~FLAG_C) | (t >= 0 ? FLAG_C : 0), t);
+                    break;
+                }
+
+                if(op == 0x7A)
+                {
+                    t = ya + word;
+                    psw &= ~(FLAG_V | FLAG_H | FLAG_C);
+                    psw |= ((~(ya ^ word) & (ya ^ t) & 0x8000) ? FLAG_V : 0) |
+                           (((ya ^ word ^ t) & 0x1000) ? FLAG_H : 0) | (t > 0xFFFF ? FLAG_C : 0);
+                }
+                else
+                {
+                    t = ya - word;
+                    psw &= ~(FLAG_V | FLAG_H | FLAG_C);
+                    psw |= (((ya ^ word) & (ya ^ t) & 0x8000) ? FLAG_V : 0) |
+                           (((ya ^ word ^ t) & 0x1000) ? 0 : FLAG_H) | (t >= 0 ? FLAG_C : 0);
+                }
+
+                t &= 0xFFFF;
+                a = t & 0xFF;
+                y = t >> 8;
+                psw = setNZ16(psw, t);
+                break;
+            }
+
+            case 0xDA:
+                addr = FETCH();
+                WRITE(DPADDR(addr), a);
+                WRITE(DPADDR(addr + 1), y);
+                break;
+
+            case 0xFA: data = READ(DPADDR(FETCH())); WRITE(DPADDR(FETCH()), data); break;
+
+            /* columns B-C: read-modify-write on dp, dp+X, !abs and A, then MOV with Y */
+            SHIFT_MODES(0x00, 0);
+            SHIFT_MODES(0x20, 1);
+            SHIFT_MODES(0x40, 2);
+            SHIFT_MODES(0x60, 3);
+            SHIFT_MODES(0x80, 4);
+            SHIFT_MODES(0xA0, 5);
+
+            case 0xCB: WRITE(DPADDR(FETCH()), y); break;
+            case 0xDB: WRITE(DPADDR(FETCH() + x), y); break;
+            case 0xEB: y = READ(DPADDR(FETCH())); psw = setNZ(psw, y); break;
+            case 0xFB: y = READ(DPADDR(FETCH() + x)); psw = setNZ(psw, y); break;
+
+            case 0xCC: addr = FETCH(); WRITE(addr | FETCH() << 8, y); break;
+            case 0xDC: y = (y - 1) & 0xFF; psw = setNZ(psw, y); break;
+            case 0xEC: addr = FETCH(); y = READ(addr | FETCH() << 8); psw = setNZ(psw, y); break;
+            case 0xFC: y = (y + 1) & 0xFF; psw = setNZ(psw, y); break;
+
+            case 0x0D: PUSH(psw); break;
+            case 0x1D: x = (x - 1) & 0xFF; psw = setNZ(psw, x); break;
+            case 0x2D: PUSH(a); break;
+            case 0x3D: x = (x + 1) & 0xFF; psw = setNZ(psw, x); break;
+            case 0x4D: PUSH(x); break;
+            case 0x5D: x = a; psw = setNZ(psw, x); break;
+            case 0x6D: PUSH(y); break;
+            case 0x7D: a = x; psw = setNZ(psw, a); break;
+            case 0x8D: y = FETCH(); psw = setNZ(psw, y); break;
+            case 0x9D: x = sp; psw = setNZ(psw, x); break;
+            case 0xAD: psw = compare(psw, y, FETCH()); break;
+            case 0xBD: sp = x; break;
+            case 0xCD: x = FETCH(); psw = setNZ(psw, x); break;
+            case 0xDD: a = y; psw = setNZ(psw, a); break;
+            case 0xED: psw ^= FLAG_C; break;
+            case 0xFD: y = a; psw = setNZ(psw, y); break;
+
+            case 0x0E: case 0x4E:
+                addr = FETCH();
+                addr |= FETCH() << 8;
+                data = READ(addr);
+                psw = setNZ(psw, a - data);
+                WRITE(addr, op == 0x0E ? data | a : data & ~a);
+                break;
+            case 0x1E: addr = FETCH(); psw = compare(psw, x, READ(addr | FETCH() << 8)); break;
+            case 0x3E: psw = compare(psw, x, READ(DPADDR(FETCH()))); break;
+            case 0x5E: addr = FETCH(); psw = compare(psw, y, READ(addr | FETCH() << 8)); break;
+            case 0x7E: psw = compare(psw, y, READ(DPADDR(FETCH()))); break;
+
+            case 0x2E: data = READ(DPADDR(FETCH())); BRANCH(a != data); break;
+            case 0xDE: data = READ(DPADDR(FETCH() + x)); BRANCH(a != data); break;
+            case 0x6E:
+                addr = DPADDR(FETCH());
+                data = (READ(addr) - 1) & 0xFF;
+                WRITE(addr, data);
+                BRANCH(data != 0);
+                break;
+            case 0xFE: y = (y - 1) & 0xFF; BRANCH(y != 0); break;
+
+            case 0x8E: psw = POP(); break;
+            case 0xAE: a = POP(); break;
+            case 0xCE: x = POP(); break;
+            case 0xEE: y = POP(); break;
+
+            case 0x9E:
+            {
+                int ya = y << 8 | a;
+
+                psw &= ~(FLAG_V | FLAG_H);
+                if(y >= x) psw |= FLAG_V;
+                if((y & 0x0F) >= (x & 0x0F)) psw |= FLAG_H;
+
+                /* quotients that don't fit in 8 bits come out the way the hardware's
+                   shift-subtract divider leaves them */
+                if(y < (x << 1))
+                {
+                    a = ya / x;
+                    y = ya % x;
+                }
+                else
+                {
+                    a = 255 - (ya - (x << 9)) / (256 - x);
+                    y = x + (ya - (x << 9)) % (256 - x);
+                }
+
+                a &= 0xFF;
+                y &= 0xFF;
+                psw = setNZ(psw, a);
+                break;
+            }
+
+            case 0xBE:
+                if(!(psw & FLAG_C) || a > 0x99)
+                {
+                    a -= 0x60;
+                    psw &= ~FLAG_C;
+                }
+                if(!(psw & FLAG_H) || (a & 0x0F) > 9) a -= 6;
+                a &= 0xFF;
+                psw = setNZ(psw, a);
+                break;
+
+            case 0xDF:
+                if((psw & FLAG_C) || a > 0x99)
+                {
+                    a += 0x60;
+                    psw |= FLAG_C;
+                }
+                if((psw & FLAG_H) || (a & 0x0F) > 9) a += 6;
+                a &= 0xFF;
+                psw = setNZ(psw, a);
+                break;
+
+            case 0x0F:
+                PUSH(pc >> 8);
+                PUSH(pc);
+                PUSH(psw);
+                psw = (psw | FLAG_B) & ~FLAG_I;
+                pc = READ(0xFFDE) | READ(0xFFDF) << 8;
+                break;
+            case 0x1F:
+                addr = FETCH();
+                addr = ((addr | FETCH() << 8) + x) & 0xFFFF;
+                pc = READ(addr) | READ((addr + 1) & 0xFFFF) << 8;
+                break;
+            case 0x2F: BRANCH(1); clock -= 2; break;
+            case 0x3F:
+                addr = FETCH();
+                addr |= FETCH() << 8;
+                PUSH(pc >> 8);
+                PUSH(pc);
+                pc = addr;
+                break;
+            case 0x4F:
+                addr = FETCH();
+                PUSH(pc >> 8);
+                PUSH(pc);
+                pc = 0xFF00 | addr;
+                break;
+            case 0x5F: addr = FETCH(); pc = addr | FETCH() << 8; break;
+            case 0x6F: pc = POP(); pc |= POP() << 8; break;
+            case 0x7F: psw = POP(); pc = POP(); pc |= POP() << 8; break;
+            case 0x8F: data = FETCH(); WRITE(DPADDR(FETCH()), data); break;
+            case 0x9F: a = ((a >> 4) | (a << 4)) & 0xFF; psw = setNZ(psw, a); break;
+            case 0xAF: WRITE(DPADDR(x), a); x = (x + 1) & 0xFF; break;
+            case 0xBF: a = READ(DPADDR(x)); x = (x + 1) & 0xFF; psw = setNZ(psw, a); break;
+            case 0xCF:
+                t = y * a;
+                a = t & 0xFF;
+                y = t >> 8;
+                psw = setNZ(psw, y);
+                break;
+
+            /* SLEEP / STOP: nothing but the DSP runs from here on */
+            case 0xEF: case 0xFF: stopped = 1; pc = (pc - 1) & 0xFFFF; break;
+            }
+        }
+
+        if(clock < nextSample) clock = nextSample;
+
+        sdspSample(&cpu->dsp, out + produced * 2);
+        produced++;
+        nextSample += SPC_CLOCKS_PER_SAMPLE;
+    }
+
+    cpu->pc = pc;
+    cpu->a = a;
+    cpu->x = x;
+    cpu->y = y;
+    cpu->sp = sp;
+    cpu->psw = psw;
+    cpu->clock = clock;
+    cpu->nextSample = nextSample;
+    cpu->stopped = stopped;
+}
@@ -0,0 +1,53 @@
+#ifndef SPC700_H
+#define SPC700_H
+
+#include "sdsp.h"
+
+/* SPC700 clocks per DSP sample */
+#define SPC_CLOCKS_PER_SAMPLE 32
+
+typedef struct SpcTimer
+{
+    int period;                 /* clocks per stage tick: 128 for timers 0-1 (8kHz), 16 for timer 2 */
+    long nextTick;
+    int stage;
+    int target;                 /* 0 counts as 256 */
+    int counter;                /* 4-bit output, cleared when read */
+    int enabled;
+
+} spctimer_t;
+
+/* SPC700 core, its I/O registers and timers, and the S-DSP it feeds, restored from an .spc image */
+typedef struct Spc700
+{
+    unsigned char ram[0x10000];
+
+    int pc;
+    int a;
+    int x;
+    int y;
+    int sp;
+    int psw;
+    int stopped;                /* SLEEP/STOP or an unusable opcode stream */
+
+    long clock;                 /* SPC700 clocks since the image was loaded */
+    long nextSample;
+
+    int control;                /* $F1 */
+    int dspAddr;                /* $F2 */
+    unsigned char portsIn[4];   /* what the SNES last wrote to $2140-$2143 */
+    unsigned char portsOut[4];
+    spctimer_t timers[3];
+
+    sdsp_t dsp;
+
+    /* when set, every CPU access to RAM is marked in it; see spc700Trace() */
+    spctrace_t *trace;
+
+} spc700_t;
+
+int spc700Load(spc700_t *cpu, const unsigned char *image, long length);
+void spc700Run(spc700_t *cpu, short *out, int samples);
+void spc700Trace(spc700_t *cpu, spctrace_t *trace);
+
+#endif /*SPC700_H*/
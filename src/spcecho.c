@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analyze.h"
+#include "dspregs.h"
+#include "image.h"
+#include "spcecho.h"
+
+static const spcaddress_t defaultAddresses[6] =
+{
+    { ADDRESS_OFFSET + DSP_EVOLL, 0, 0 },    /* left channel echo volume address  : 1012Ch */
+    { ADDRESS_OFFSET + DSP_EVOLR, 0, 0 },    /* right channel echo volume address : 1013Ch */
+    { ADDRESS_OFFSET + DSP_EFB,   0, 0 },    /* echo feedback level address : 1010Dh */
+    { ADDRESS_OFFSET + DSP_EDL,   0, 0 },    /* echo speed address : 1017Dh */
+    { ADDRESS_OFFSET + DSP_EON,   0, 0 },    /* channel echo enable/mute address : 1014Dh */
+    { ADDRESS_OFFSET + DSP_ESA,   0, 0 },    /* echo buffer address : 1016Dh */
+};
+
+static const char *errorStrings[] =
+{
+    "Success",
+    "Unable to allocate memory for file",
+    "Unable to open file, file in use or not found",
+    "Error while reading input file",
+    "Error while writing output file",
+    "Error while reading SPC addresses",
+    "No SPC image loaded",
+    "Echo buffer underflow",
+    "Echo buffer overflow",
+    "Invalid control value",
+    "Sample relocation failed verification",
+    "Patch does not match the source file",
+    "Not an SPC file",
+    "File is larger than the image buffer",
+};
+
+void spcechoInit(spcecho_ctx *ctx)
+{
+    memset(ctx, 0, sizeof *ctx);
+    memcpy(ctx->addresses, defaultAddresses, sizeof ctx->addresses);
+}
+
+/* fresh context carrying over only the requested control values */
+void spcechoInitFrom(spcecho_ctx *ctx, const spcecho_ctx *settings)
+{
+    spcechoInit(ctx);
+    memcpy(ctx->addresses, settings->addresses, sizeof ctx->addresses);
+    memcpy(ctx->fir, settings->fir, sizeof ctx->fir);
+    ctx->firOverwrite = settings->firOverwrite;
+    ctx->pinWrites = settings->pinWrites;
+}
+
+void spcechoFree(spcecho_ctx *ctx)
+{
+    if(ctx->ownsBuffer) free(ctx->buffer);
+
+    ctx->buffer = NULL;
+    ctx->length = 0;
+    ctx->ownsBuffer = 0;
+    ctx->scanned = 0;
+}
+
+spcecho_error_t spcechoSetValue(spcecho_ctx *ctx, char v, int controlValue)
+{
+    echo_controls_t control;
+
+    switch(v)
+    {
+        case 'l': control = LEFT_VOL;  break;
+        case 'r': control = RIGHT_VOL; break;
+        case 'f': control = FEEDBACK;  break;
+        case 't': control = ECHO_SPD;  break;
+        case 'c': control = ECHO_CHNL; break;
+        case 'a': control = ECHO_ADDR; break;
+
+        default: return SPCECHO_E_ARG;
+    }
+
+    ctx->addresses[control].value = (unsigned char) controlValue;
+    ctx->addresses[control].overwrite = 1;
+
+    return SPCECHO_OK;
+}
+
+/* every load and attach ends here, so each one turns away the same files through spcechoView() */
+static spcecho_error_t readAddresses(spcecho_ctx *ctx)
+{
+    spcview_t view;
+    spcecho_error_t err;
+    int i = 0;
+
+    if((err = spcechoView(ctx->buffer, ctx->length, &view)) != SPCECHO_OK) return err;
+
+    for(; i < 6; i++)
+    {
+        if(ctx->addresses[i].overwrite) continue;
+        ctx->addresses[i].value = ctx->buffer[ctx->addresses[i].address];
+    }
+
+    return SPCECHO_OK;
+}
+
+static spcecho_error_t writeAddresses(spcecho_ctx *ctx)
+{
+    int i = 0;
+    if(ctx->length < ADDRESS_OFFSET + 0x80) return SPCECHO_E_TOOSHORT;
+
+    for(; i < 6; i++)
+    {
+        if(!ctx->addresses[i].overwrite) continue;
+        ctx->buffer[ctx->addresses[i].address] = ctx->addresses[i].value;
+    }
+
+    /* FIR taps live at the top of each voice's register block: $0F, $1F ... $7F */
+    for(i = 0; ctx->firOverwrite && i < 8; i++)
+        ctx->buffer[ADDRESS_OFFSET + i * sizeof(spcdsprow_t) + offsetof(spcdsprow_t, fir)] = (unsigned char) ctx->fir[i];
+
+    return SPCECHO_OK;
+}
+
+/* patches the caller's image in place; the caller keeps ownership */
+spcecho_error_t spcechoAttach(spcecho_ctx *ctx, unsigned char *image, size_t length)
+{
+    spcechoFree(ctx);
+
+    ctx->buffer = image;
+    ctx->length = length;
+
+    return readAddresses(ctx);
+}
+
+spcecho_error_t spcechoLoadFile(spcecho_ctx *ctx, const char *path)
+{
+    FILE* spcRead;
+    long fileLength;
+    spcecho_error_t err;
+
+    spcechoFree(ctx);
+
+    if((spcRead = fopen(path, "rb")) == NULL) return SPCECHO_E_OPEN;
+
+    fseek(spcRead, 0, SEEK_END);
+    fileLength = ftell(spcRead);
+    rewind(spcRead);
+
+    if(fileLength < 0)
+    {
+        fclose(spcRead);
+        return SPCECHO_E_READ;
+    }
+
+    if((ctx->buffer = malloc(fileLength > 0 ? (size_t) fileLength : 1)) == NULL)
+    {
+        fclose(spcRead);
+        return SPCECHO_E_NOMEM;
+    }
+
+    ctx->length = (size_t) fileLength;
+    ctx->ownsBuffer = 1;
+
+    if(fread(ctx->buffer, 1, ctx->length, spcRead) < ctx->length)
+    {
+        spcechoFree(ctx);
+        fclose(spcRead);
+
+        return SPCECHO_E_READ;
+    }
+
+    fclose(spcRead);
+
+    if((err = readAddresses(ctx)) != SPCECHO_OK) spcechoFree(ctx);
+
+    return err;
+}
+
+/* reads an image from a stream that can't seek, such as a pipe, in chunks as they arrive */
+spcecho_error_t spcechoLoadStream(spcecho_ctx *ctx, FILE *in)
+{
+    size_t capacity = ADDRESS_OFFSET + 0x100, got;
+    spcecho_error_t err;
+
+    spcechoFree(ctx);
+
+    if((ctx->buffer = malloc(capacity)) == NULL) return SPCECHO_E_NOMEM;
+
+    ctx->ownsBuffer = 1;
+
+    while((got = fread(ctx->buffer + ctx->length, 1, capacity - ctx->length, in)) > 0)
+    {
+        ctx->length += got;
+
+        /* a plain .spc fills the first allocation exactly; ID666 extensions need more */
+        if(ctx->length == capacity)
+        {
+            unsigned char *grown = realloc(ctx->buffer, capacity * 2);
+
+            if(grown == NULL)
+            {
+                spcechoFree(ctx);
+                return SPCECHO_E_NOMEM;
+            }
+
+            ctx->buffer = grown;
+            capacity *= 2;
+        }
+    }
+
+    if(ferror(in))
+    {
+        spcechoFree(ctx);
+        return SPCECHO_E_READ;
+    }
+
+    if((err = readAddresses(ctx)) != SPCECHO_OK) spcechoFree(ctx);
+
+    return err;
+}
+
+spcecho_error_t spcechoSaveStream(const spcecho_ctx *ctx, FILE *out)
+{
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+
+    if(fwrite(ctx->buffer, 1, ctx->length, out) < ctx->length || fflush(out) != 0) return SPCECHO_E_WRITE;
+
+    return SPCECHO_OK;
+}
+
+spcecho_error_t spcechoSaveFile(const spcecho_ctx *ctx, const char *path)
+{
+    FILE* spcWrite;
+    spcecho_error_t err;
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+
+    if((spcWrite = fopen(path, "wb")) == NULL) return SPCECHO_E_OPEN;
+
+    if((err = spcechoSaveStream(ctx, spcWrite)) != SPCECHO_OK)
+    {
+        fclose(spcWrite);
+        return err;
+    }
+
+    if(fclose(spcWrite) != 0) return SPCECHO_E_WRITE;
+
+    return SPCECHO_OK;
+}
+
+/* best-fit free run for the current echo speed */
+static void viableAddress(spcecho_ctx *ctx)
+{
+    int largest = 0, fit, i = 0;
+
+    for(; i < ctx->freeRunCount; i++) if(ctx->freeRuns[i].pages > largest) largest = ctx->freeRuns[i].pages;
+
+    fit = freeMapBestFit(ctx->freeRuns, ctx->freeRunCount, freeMapEchoPages(ctx->addresses[ECHO_SPD].value));
+
+    /* nothing big enough: take the largest run and let the overflow check shorten the echo */
+    if(fit < 0) fit = freeMapBestFit(ctx->freeRuns, ctx->freeRunCount, largest);
+    if(fit < 0) fit = 0xFF;
+
+    ctx->viableAddress = (unsigned char) fit;
+}
+
+/* maps what every RAM page is used for, indexes the free runs between them and picks
+   the best-fit echo buffer page for the current echo speed */
+spcecho_error_t spcechoScan(spcecho_ctx *ctx)
+{
+    const unsigned char *ram;
+    int page = 0xFF, largest;
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+    if(ctx->length < ADDRESS_OFFSET + 0x80) return SPCECHO_E_TOOSHORT;
+
+    ram = ctx->buffer + RAM_OFFSET;
+
+    scanPages(ram, ctx->pageMap);
+
+    ctx->dataEnd = -1;
+
+    for(; page >= 0 && ctx->dataEnd < 0; page--)
+    {
+        if(PAGE_USED(ctx->pageMap, page)) ctx->dataEnd = (page << 8) + scanLastData(ram + (page << 8), 0x100);
+    }
+
+    aramMapBuild(&ctx->aram, ram, ctx->buffer + ADDRESS_OFFSET, ctx->pageMap);
+    aramBlockedPages(&ctx->aram, ctx->blockedMap);
+
+    ctx->freeRunCount = freeMapBuild(ctx->blockedMap, ctx->freeRuns, &largest);
+    ctx->maxEchoSpeed = freeMapSpeedFor(largest);
+    ctx->scanned = 1;
+
+    viableAddress(ctx);
+
+    return SPCECHO_OK;
+}
+
+/* auto-selects the echo buffer address, or reports an underflow if the requested one overlaps data */
+spcecho_error_t spcechoEchoAddress(spcecho_ctx *ctx)
+{
+    spcecho_error_t err;
+
+    if((err = spcechoScan(ctx)) != SPCECHO_OK) return err;
+
+    return spcechoPlace(ctx);
+}
+
+/* spcechoEchoAddress() without the scan: reuses the maps from an earlier spcechoScan() of the
+   same RAM, so one scan can place the buffer for any number of echo speeds */
+spcecho_error_t spcechoPlace(spcecho_ctx *ctx)
+{
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+    if(!ctx->scanned) return spcechoEchoAddress(ctx);
+
+    viableAddress(ctx);
+
+    if(ctx->addresses[ECHO_ADDR].overwrite)
+    {
+        int page = ctx->addresses[ECHO_ADDR].value;
+        int end = page + freeMapEchoPages(ctx->addresses[ECHO_SPD].value);
+
+        if(end > 0x100) end = 0x100;
+
+        for(; page < end; page++)
+        {
+            if(PAGE_USED(ctx->blockedMap, page) || page < FIRST_FREE_PAGE) return SPCECHO_E_UNDERFLOW;
+        }
+    }
+    else
+    {
+        ctx->addresses[ECHO_ADDR].value = ctx->viableAddress;
+        ctx->addresses[ECHO_ADDR].overwrite = 1;
+    }
+
+    return SPCECHO_OK;
+}
+
+void spcechoScanSave(const spcecho_ctx *ctx, spcscan_t *scan)
+{
+    memset(scan, 0, sizeof *scan);
+
+    scan->dataEnd = ctx->dataEnd;
+    scan->maxEchoSpeed = ctx->maxEchoSpeed;
+    memcpy(scan->pageMap, ctx->pageMap, sizeof scan->pageMap);
+    memcpy(scan->blockedMap, ctx->blockedMap, sizeof scan->blockedMap);
+}
+
+/* stands in for spcechoScan() on an image known to be the one scan was saved from. Only the
+   free runs are rebuilt. The page-type map is left empty; --map and spcechoCompact(), the
+   only things that read it, run their own scan */
+spcecho_error_t spcechoScanRestore(spcecho_ctx *ctx, const spcscan_t *scan)
+{
+    int largest;
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+    if(ctx->length < ADDRESS_OFFSET + 0x80) return SPCECHO_E_TOOSHORT;
+
+    ctx->dataEnd = scan->dataEnd;
+    ctx->maxEchoSpeed = scan->maxEchoSpeed;
+    memcpy(ctx->pageMap, scan->pageMap, sizeof ctx->pageMap);
+    memcpy(ctx->blockedMap, scan->blockedMap, sizeof ctx->blockedMap);
+    memset(&ctx->aram, 0, sizeof ctx->aram);
+
+    ctx->freeRunCount = freeMapBuild(ctx->blockedMap, ctx->freeRuns, &largest);
+    ctx->scanned = 1;
+
+    viableAddress(ctx);
+
+    return SPCECHO_OK;
+}
+
+void spcechoRaiseAddress(spcecho_ctx *ctx)
+{
+    ctx->addresses[ECHO_ADDR].value = ctx->viableAddress;
+    ctx->addresses[ECHO_ADDR].overwrite = 1;
+}
+
+/* first page the echo buffer must stay under: the end of the free run it starts in,
+   or just $FFFF if it starts on data (or no scan was run) */
+static int echoLimit(const spcecho_ctx *ctx)
+{
+    int end = freeMapRunEnd(ctx->freeRuns, ctx->freeRunCount, ctx->addresses[ECHO_ADDR].value);
+
+    return end < 0 ? 0x100 : end;
+}
+
+/* Every 16 ms takes 2kb of buffer, so the buffer must end inside its free run and under $FFFF */
+spcecho_error_t spcechoCheckOverflow(const spcecho_ctx *ctx)
+{
+    if (ctx->addresses[ECHO_ADDR].value + freeMapEchoPages(ctx->addresses[ECHO_SPD].value) > echoLimit(ctx))
+        return SPCECHO_E_OVERFLOW;
+
+    return SPCECHO_OK;
+}
+
+/* longest echo speed that still fits at the current buffer address */
+int spcechoTruncatedSpeed(const spcecho_ctx *ctx)
+{
+    int speed = freeMapSpeedFor(echoLimit(ctx) - ctx->addresses[ECHO_ADDR].value);
+
+    return speed < 0 ? 0 : speed;
+}
+
+void spcechoLowerSpeed(spcecho_ctx *ctx)
+{
+    ctx->addresses[ECHO_SPD].value = (unsigned char) spcechoTruncatedSpeed(ctx);
+    ctx->addresses[ECHO_SPD].overwrite = 1;
+}
+
+spcecho_error_t spcechoPatch(spcecho_ctx *ctx)
+{
+    spcecho_error_t err;
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+
+    if((err = writeAddresses(ctx)) != SPCECHO_OK) return err;
+
+    /* set bit at value 20h mutes echo. clears bit while leaving other bits as they were */
+    ctx->buffer[ADDRESS_OFFSET + DSP_FLG] &= ~FLG_ECHO_OFF;
+
+    if(ctx->pinWrites)
+    {
+        spcanalysis_t *analysis = malloc(sizeof *analysis);
+
+        if(analysis == NULL) return SPCECHO_E_NOMEM;
+
+        if((err = spcechoAnalyze(ctx, analysis)) == SPCECHO_OK) ctx->pinnedWrites = spcechoPinWrites(ctx, analysis);
+
+        free(analysis);
+        if(err != SPCECHO_OK) return err;
+    }
+
+    return SPCECHO_OK;
+}
+
+const char *spcechoStrerror(spcecho_error_t err)
+{
+    if((unsigned) err >= sizeof errorStrings / sizeof *errorStrings) return "Unknown error";
+
+    return errorStrings[err];
+}
@@ -0,0 +1,119 @@
+#ifndef SPCECHO_H
+#define SPCECHO_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "aram.h"
+#include "freemap.h"
+#include "scan.h"
+
+/* SPC700 DSP registers begin at 10100h */
+#define ADDRESS_OFFSET 0x10100
+
+/* 64kb of SPC700 RAM begins at 100h */
+#define RAM_OFFSET 0x100
+
+typedef enum SpcEchoError
+{
+    SPCECHO_OK           = 0,
+    SPCECHO_E_NOMEM      = 1,   /* could not allocate the image */
+    SPCECHO_E_OPEN       = 2,   /* file in use or not found */
+    SPCECHO_E_READ       = 3,   /* short read */
+    SPCECHO_E_WRITE      = 4,   /* short write */
+    SPCECHO_E_TOOSHORT   = 5,   /* image ends before the DSP registers */
+    SPCECHO_E_NOIMAGE    = 6,   /* no image loaded or attached */
+    SPCECHO_E_UNDERFLOW  = 7,   /* echo buffer would overwrite music data */
+    SPCECHO_E_OVERFLOW   = 8,   /* echo buffer would run past its free region or $FFFF */
+    SPCECHO_E_ARG        = 9,   /* unknown control or out of range value */
+    SPCECHO_E_VERIFY     = 10,  /* relocated samples would not decode identically */
+    SPCECHO_E_MISMATCH   = 11,  /* patch was made from a different image */
+    SPCECHO_E_FORMAT     = 12,  /* no SPC signature */
+    SPCECHO_E_TOOLONG    = 13   /* file is larger than the caller's image */
+
+} spcecho_error_t;
+
+typedef enum EchoControls
+{
+    LEFT_VOL  = 0,
+    RIGHT_VOL = 1,
+    FEEDBACK  = 2,
+    ECHO_SPD  = 3,
+    ECHO_CHNL = 4,
+    ECHO_ADDR = 5
+
+} echo_controls_t;
+
+typedef struct SpcAddress
+{
+    int  address;
+    unsigned char value;
+    char overwrite;
+
+} spcaddress_t;
+
+/* everything needed to patch one SPC image; no state is shared between contexts */
+typedef struct SpcEchoCtx
+{
+    unsigned char *buffer;
+    size_t length;
+    int ownsBuffer;
+
+    spcaddress_t addresses[6];
+    signed char fir[8];             /* echo FIR taps for $0F-$7F, written when firOverwrite is set */
+    char firOverwrite;
+    char pinWrites;                 /* also rewrite the driver's own stores to the registers above */
+    int pinnedWrites;               /* code bytes spcechoPatch() changed to pin them */
+
+    /* filled in by spcechoScan() */
+    int scanned;                    /* the maps below describe the current RAM */
+    int dataEnd;                    /* last RAM address that isn't 00h/FFh, -1 if RAM is empty */
+    unsigned char viableAddress;    /* best-fit echo buffer page for the current echo speed */
+    int maxEchoSpeed;               /* largest echo speed that fits anywhere, -1 if none does */
+    unsigned char pageMap[PAGE_MAP_BYTES];  /* RAM pages holding data */
+    aram_map_t aram;                        /* what each page is used for */
+    unsigned char blockedMap[PAGE_MAP_BYTES];   /* pages the echo buffer must not touch */
+    freerun_t freeRuns[MAX_FREE_RUNS];      /* free page runs, lowest first */
+    int freeRunCount;
+
+} spcecho_ctx;
+
+/* what spcechoScan() found, small enough to keep between runs for an image that hasn't changed */
+typedef struct SpcScanSummary
+{
+    int dataEnd;
+    int maxEchoSpeed;
+    unsigned char pageMap[PAGE_MAP_BYTES];
+    unsigned char blockedMap[PAGE_MAP_BYTES];
+
+} spcscan_t;
+
+void spcechoInit(spcecho_ctx *ctx);
+void spcechoInitFrom(spcecho_ctx *ctx, const spcecho_ctx *settings);
+void spcechoFree(spcecho_ctx *ctx);
+
+spcecho_error_t spcechoSetValue(spcecho_ctx *ctx, char v, int controlValue);
+
+/* each load and attach checks the image with spcechoView(): no SPC signature gives SPCECHO_E_FORMAT */
+spcecho_error_t spcechoAttach(spcecho_ctx *ctx, unsigned char *image, size_t length);
+spcecho_error_t spcechoLoadFile(spcecho_ctx *ctx, const char *path);
+spcecho_error_t spcechoSaveFile(const spcecho_ctx *ctx, const char *path);
+spcecho_error_t spcechoLoadStream(spcecho_ctx *ctx, FILE *in);
+spcecho_error_t spcechoSaveStream(const spcecho_ctx *ctx, FILE *out);
+
+spcecho_error_t spcechoScan(spcecho_ctx *ctx);
+spcecho_error_t spcechoEchoAddress(spcecho_ctx *ctx);
+spcecho_error_t spcechoPlace(spcecho_ctx *ctx);
+void spcechoScanSave(const spcecho_ctx *ctx, spcscan_t *scan);
+spcecho_error_t spcechoScanRestore(spcecho_ctx *ctx, const spcscan_t *scan);
+void spcechoRaiseAddress(spcecho_ctx *ctx);
+
+spcecho_error_t spcechoCheckOverflow(const spcecho_ctx *ctx);
+int spcechoTruncatedSpeed(const spcecho_ctx *ctx);
+void spcechoLowerSpeed(spcecho_ctx *ctx);
+
+spcecho_error_t spcechoPatch(spcecho_ctx *ctx);
+
+const char *spcechoStrerror(spcecho_error_t err);
+
+#endif /*SPCECHO_H*/
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+/* log2 buckets by whole microseconds: <1, <2, <4 ... <2^(STAT_BUCKETS-1), and the rest */
+#define STAT_BUCKETS 24
+
+static const char *phaseNames[STAT_PHASES] = { "read", "scan", "place", "check", "patch", "write" };
+
+double statsClock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void jsonString(FILE *out, const char *text)
+{
+    fputc('"', out);
+
+    for(; *text != '\0'; text++)
+    {
+        unsigned char c = (unsigned char) *text;
+
+        if(c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if(c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+
+    fputc('"', out);
+}
+
+static void jsonCounters(FILE *out, const spcstats_t *stats, const char *indent)
+{
+    int phase = 0;
+
+    fprintf(out, "%s\"us\": {", indent);
+
+    for(; phase < STAT_PHASES; phase++)
+        fprintf(out, "%s\"%s\": %.3f", phase ? ", " : " ", phaseNames[phase], stats->seconds[phase] * 1e6);
+
+    fprintf(out, " },\n%s\"bytes_read\": %llu, \"bytes_scanned\": %llu, \"bytes_written\": %llu,\n", indent,
+            stats->bytesRead, stats->bytesScanned, stats->bytesWritten);
+    fprintf(out, "%s\"fixes\": %lu, \"prompts_avoided\": %lu\n", indent, stats->fixes, stats->promptsAvoided);
+}
+
+static int bucketOf(double seconds)
+{
+    double micros = seconds * 1e6;
+    int bucket = 0;
+
+    for(; micros >= 1.0 && bucket < STAT_BUCKETS - 1; bucket++) micros /= 2.0;
+
+    return bucket;
+}
+
+/* --stats=json: every file's phases and counters, their totals, and a histogram of each phase
+   across the files. where is a path, or "-" for stderr so the JSON stays apart from the report */
+int statsWrite(const char *where, const char *const *paths, const spcstats_t *files, size_t count)
+{
+    unsigned long histogram[STAT_PHASES][STAT_BUCKETS];
+    spcstats_t total;
+    FILE *out = strcmp(where, "-") == 0 ? stderr : fopen(where, "w");
+    size_t i = 0;
+    int phase, bucket, ok;
+
+    if(out == NULL) return 0;
+
+    memset(&total, 0, sizeof total);
+    memset(histogram, 0, sizeof histogram);
+
+    fprintf(out, "{\n  \"files\": [\n");
+
+    for(; i < count; i++)
+    {
+        const spcstats_t *file = &files[i];
+
+        fprintf(out, "    {\n      \"path\": ");
+        jsonString(out, paths[i]);
+        fprintf(out, ",\n");
+        jsonCounters(out, file, "      ");
+        fprintf(out, "    }%s\n", i + 1 < count ? "," : "");
+
+        for(phase = 0; phase < STAT_PHASES; phase++)
+        {
+            total.seconds[phase] += file->seconds[phase];
+            histogram[phase][bucketOf(file->seconds[phase])]++;
+        }
+
+        total.bytesRead += file->bytesRead;
+        total.bytesScanned += file->bytesScanned;
+        total.bytesWritten += file->bytesWritten;
+        total.fixes += file->fixes;
+        total.promptsAvoided += file->promptsAvoided;
+    }
+
+    fprintf(out, "  ],\n  \"total\": {\n    \"files\": %lu,\n", (unsigned long) count);
+    jsonCounters(out, &total, "    ");
+
+    /* bucket n counts files whose phase took under 2^n microseconds (and not under 2^(n-1)) */
+    fprintf(out, "  },\n  \"histograms\": {\n    \"under_us\": [");
+    for(bucket = 0; bucket < STAT_BUCKETS; bucket++)
+    {
+        if(bucket == STAT_BUCKETS - 1) fprintf(out, ", null");
+        else fprintf(out, "%s%lu", bucket ? ", " : "", 1UL << bucket);
+    }
+    fprintf(out, "]");
+
+    for(phase = 0; phase < STAT_PHASES; phase++)
+    {
+        fprintf(out, ",\n    \"%s\": [", phaseNames[phase]);
+        for(bucket = 0; bucket < STAT_BUCKETS; bucket++) fprintf(out, "%s%lu", bucket ? ", " : "", histogram[phase][bucket]);
+        fprintf(out, "]");
+    }
+
+    fprintf(out, "\n  }\n}\n");
+
+    ok = !ferror(out);
+    if(out != stderr && fclose(out) != 0) ok = 0;
+
+    return ok;
+}
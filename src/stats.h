@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* where a file's time goes; read includes reading the DSP values out of the image,
+   scan includes --defrag, check is the overflow check and its prompt, patch writes the
+   DSP values into the image */
+typedef enum StatPhase
+{
+    STAT_READ  = 0,
+    STAT_SCAN  = 1,
+    STAT_PLACE = 2,
+    STAT_CHECK = 3,
+    STAT_PATCH = 4,
+    STAT_WRITE = 5,
+    STAT_PHASES = 6
+
+} stat_phase_t;
+
+/* --stats: one file's timers and counters */
+typedef struct SpcStats
+{
+    double seconds[STAT_PHASES];
+    unsigned long long bytesRead;
+    unsigned long long bytesScanned;
+    unsigned long long bytesWritten;
+    unsigned long fixes;            /* prompts answered by moving the buffer or lowering the speed */
+    unsigned long promptsAvoided;   /* prompts answered by -p instead of a person */
+
+} spcstats_t;
+
+/* with stats off each of these is one NULL test and no clock read */
+#define STATS_START(stats) ((stats) != NULL ? statsClock() : 0.0)
+#define STATS_STOP(stats, phase, started) \
+    do { if((stats) != NULL) (stats)->seconds[phase] += statsClock() - (started); } while(0)
+#define STATS_ADD(stats, field, amount) \
+    do { if((stats) != NULL) (stats)->field += (amount); } while(0)
+
+double statsClock(void);
+int statsWrite(const char *where, const char *const *paths, const spcstats_t *files, size_t count);
+
+#endif /*STATS_H*/
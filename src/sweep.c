@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "addresses.h"
+#include "batch.h"
+#include "stats.h"
+#include "sweep.h"
+
+static const char *outcomeNames[] =
+{
+    "written",
+    "fixed",
+    "forced",
+    "skipped",
+    "cached",
+    "failed",
+};
+
+int sweepIsOption(char option)
+{
+    return option != '\0' && strchr(SWEEP_OPTIONS, option) != NULL;
+}
+
+/* the same checks, and the same conversion, as the option given once */
+static int optionValue(char option, const char *text, int *val)
+{
+    switch(option)
+    {
+        case 'l':
+        case 'r':
+        case 'f': return percentToSign(text, val);
+        case 't': return millisecondToInt(text, val);
+        case 'c': return channelAddress(text, val);
+        case 'a': return bufferAddress(text, val);
+
+        default: return 0;
+    }
+}
+
+static int addValue(sweepaxis_t *axis, char option, const char *text)
+{
+    int val;
+
+    if(axis->count >= SWEEP_MAX_VALUES)
+    {
+        printf("\n!!!! More than %d values for -%c! !!!!\n", SWEEP_MAX_VALUES, option);
+        return 0;
+    }
+
+    if(strlen(text) >= SWEEP_VALUE_LENGTH || !optionValue(option, text, &val))
+    {
+        printf("\n!!!! Invalid value %s for -%c! !!!!\n", text, option);
+        return 0;
+    }
+
+    snprintf(axis->values[axis->count++], SWEEP_VALUE_LENGTH, "%s", text);
+
+    return 1;
+}
+
+/* FROM:TO[:STEP], counting down when TO is below FROM. -t steps 16ms by default, the rest by 1;
+   -a is hex like the option itself */
+static int addRange(sweepaxis_t *axis, char option, const char *range)
+{
+    int base = option == 'a' ? 16 : 10;
+    long from, to, step = option == 't' ? 16 : 1, value;
+    char *end, text[SWEEP_VALUE_LENGTH];
+
+    from = strtol(range, &end, base);
+    if(end == range || *end != ':') return 0;
+
+    range = end + 1;
+    to = strtol(range, &end, base);
+    if(end == range || (*end != ':' && *end != '\0')) return 0;
+
+    if(*end == ':')
+    {
+        range = end + 1;
+        step = strtol(range, &end, base);
+        if(end == range || *end != '\0' || step <= 0) return 0;
+    }
+
+    for(value = from; from <= to ? value <= to : value >= to; value += from <= to ? step : -step)
+    {
+        snprintf(text, sizeof text, base == 16 ? "%02lX" : "%ld", value);
+        if(!addValue(axis, option, text)) return -1;
+    }
+
+    return 1;
+}
+
+/* a comma-separated list of values and FROM:TO[:STEP] ranges, eg: -t 16:240 or -f 0,25,50:100:25.
+   The option may be given more than once; its values add up */
+int sweepOption(spcsweep_t *sweep, char option, const char *spec)
+{
+    sweepaxis_t *axis;
+    char item[64];
+
+    if(!sweepIsOption(option)) return 0;
+
+    axis = &sweep->axes[strchr(SWEEP_OPTIONS, option) - SWEEP_OPTIONS];
+
+    while(*spec != '\0')
+    {
+        size_t length = strcspn(spec, ",");
+
+        if(length == 0 || length >= sizeof item)
+        {
+            printf("\n!!!! Invalid list for -%c! !!!!\n", option);
+            return 0;
+        }
+
+        memcpy(item, spec, length);
+        item[length] = '\0';
+        spec += length + (spec[length] == ',');
+
+        if(strchr(item, ':') != NULL && option != 'c')
+        {
+            int added = addRange(axis, option, item);
+
+            if(added < 0) return 0;
+            if(added == 0)
+            {
+                printf("\n!!!! Invalid range %s for -%c! !!!!\n", item, option);
+                return 0;
+            }
+        }
+        else if(!addValue(axis, option, item)) return 0;
+    }
+
+    return 1;
+}
+
+/* song.spc -> song, for {name} */
+static void baseName(char *out, size_t size, const char *path)
+{
+    const char *base = strrchr(path, '/');
+    size_t length;
+
+    base = base != NULL ? base + 1 : path;
+    length = strlen(base);
+
+    if(length >= 4 && strcmp(base + length - 4, ".spc") == 0) length -= 4;
+
+    snprintf(out, size, "%.*s", (int) length, base);
+}
+
+/* {name}, {n} (1-based variant number) and {l} {r} {f} {t} {c} {a}, each the value as it was
+   typed; an option that isn't swept expands to nothing */
+static void expandName(char *out, size_t size, const char *nameTemplate, const char *name,
+                       long variant, const spcsweep_t *sweep, const int *at)
+{
+    size_t used = 0;
+
+    while(*nameTemplate != '\0' && used + 1 < size)
+    {
+        const char *close = *nameTemplate == '{' ? strchr(nameTemplate, '}') : NULL;
+        char field[FILENAME_MAX] = "";
+        const char *option;
+
+        if(close == NULL)
+        {
+            out[used++] = *nameTemplate++;
+            continue;
+        }
+
+        if(close - nameTemplate == 5 && strncmp(nameTemplate, "{name}", 6) == 0)
+            snprintf(field, sizeof field, "%s", name);
+        else if(close - nameTemplate == 2 && nameTemplate[1] == 'n')
+            snprintf(field, sizeof field, "%ld", variant + 1);
+        else if(close - nameTemplate == 2 && (option = strchr(SWEEP_OPTIONS, nameTemplate[1])) != NULL)
+        {
+            int axis = (int) (option - SWEEP_OPTIONS);
+
+            if(sweep->axes[axis].count > 0) snprintf(field, sizeof field, "%s", sweep->axes[axis].values[at[axis]]);
+        }
+        else
+        {
+            out[used++] = *nameTemplate++;
+            continue;
+        }
+
+        snprintf(out + used, size - used, "%s", field);
+
+        used += strlen(out + used);
+        nameTemplate = close + 1;
+    }
+
+    out[used < size ? used : size - 1] = '\0';
+}
+
+static void defaultTemplate(char *out, size_t size, const spcsweep_t *sweep)
+{
+    int axis = 0;
+
+    snprintf(out, size, "{name}");
+
+    for(; axis < 6; axis++)
+    {
+        size_t used = strlen(out);
+
+        if(sweep->axes[axis].count > 1)
+            snprintf(out + used, size - used, "_%c{%c}", SWEEP_OPTIONS[axis], SWEEP_OPTIONS[axis]);
+    }
+
+    snprintf(out + strlen(out), size - strlen(out), ".spc");
+}
+
+/* reads and scans the input once, then writes every combination of the swept values:
+   each variant is patched on one scratch copy of the image, reusing the scan's RAM maps */
+int runSweep(const char *inName, const char *outDir, const spcsweep_t *sweep, const spcfile_t *settings)
+{
+    char name[FILENAME_MAX], dir[FILENAME_MAX], nameTemplate[64];
+    const char *slash = strrchr(inName, '/');
+    unsigned char *scratch;
+    size_t totals[OUTCOME_FAILED + 1] = { 0 };
+    long variants = 1, variant = 0;
+    int at[6] = { 0 }, axis = 0;
+    double started = statsClock();
+    spcfile_t source;
+
+    for(; axis < 6; axis++)
+    {
+        if(sweep->axes[axis].count > 0) variants *= sweep->axes[axis].count;
+
+        if(variants > SWEEP_MAX_VARIANTS)
+        {
+            printf("\n!!!! Sweep has more than %d combinations! !!!!\n", SWEEP_MAX_VARIANTS);
+            return 0;
+        }
+    }
+
+    if(sweep->nameTemplate == NULL) defaultTemplate(nameTemplate, sizeof nameTemplate, sweep);
+    else snprintf(nameTemplate, sizeof nameTemplate, "%s", sweep->nameTemplate);
+
+    baseName(name, sizeof name, inName);
+
+    if(outDir != NULL) snprintf(dir, sizeof dir, "%s/", outDir);
+    else snprintf(dir, sizeof dir, "%.*s", slash != NULL ? (int) (slash - inName + 1) : 0, inName);
+
+    if(!prepareOutDir(outDir)) return 0;
+
+    fileInitFrom(&source, settings);
+
+    if(!fileRead(&source, inName) || !fileScan(&source))
+    {
+        freeBuffer(&source);
+        return 0;
+    }
+
+    if((scratch = malloc(source.ctx.length)) == NULL)
+    {
+        printf("Unable to allocate memory for variants!\n");
+        freeBuffer(&source);
+        return 0;
+    }
+
+    printf("\n%-8s  file\n", "status");
+
+    for(; variant < variants; variant++)
+    {
+        char outPath[FILENAME_MAX];
+        spcfile_t file;
+        file_outcome_t outcome;
+
+        fileInitFrom(&file, settings);
+        file.quiet = 1;
+
+        /* the source's image, its register values and its RAM maps, on the scratch copy */
+        file.ctx = source.ctx;
+        file.ctx.buffer = scratch;
+        file.ctx.ownsBuffer = 0;
+        file.original = source.original;
+        memcpy(scratch, source.ctx.buffer, source.ctx.length);
+
+        for(axis = 0; axis < 6; axis++)
+        {
+            int val;
+
+            if(sweep->axes[axis].count == 0) continue;
+
+            optionValue(SWEEP_OPTIONS[axis], sweep->axes[axis].values[at[axis]], &val);
+            valueSet(&file, SWEEP_OPTIONS[axis], val);
+        }
+
+        snprintf(outPath, sizeof outPath, "%s", dir);
+        expandName(outPath + strlen(outPath), sizeof outPath - strlen(outPath), nameTemplate, name, variant, sweep, at);
+
+        if(echoPlace(&file)) fileWrite(&file, outPath);
+
+        outcome = fileOutcome(&file);
+        totals[outcome]++;
+
+        /* variants are written quietly, so this is the only place the reason shows */
+        printf("%-8s  %s", outcomeNames[outcome], outPath);
+        if(outcome == OUTCOME_FAILED && file.error != SPCECHO_OK) printf(": %s", spcechoStrerror(file.error));
+        printf("\n");
+
+        /* next combination, last option fastest */
+        for(axis = 5; axis >= 0; axis--)
+        {
+            if(sweep->axes[axis].count == 0) continue;
+            if(++at[axis] < sweep->axes[axis].count) break;
+
+            at[axis] = 0;
+        }
+    }
+
+    printf("\n%ld variants: %lu written, %lu fixed, %lu forced, %lu skipped, %lu failed\n", variants,
+           (unsigned long) totals[OUTCOME_WRITTEN], (unsigned long) totals[OUTCOME_FIXED],
+           (unsigned long) totals[OUTCOME_FORCED], (unsigned long) totals[OUTCOME_SKIPPED],
+           (unsigned long) totals[OUTCOME_FAILED]);
+
+    printf("%.3f s elapsed, %s read and scanned once\n", statsClock() - started, inName);
+
+    free(scratch);
+    freeBuffer(&source);
+
+    return totals[OUTCOME_FAILED] == 0;
+}
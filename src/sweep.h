@@ -0,0 +1,35 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "readwrite.h"
+
+/* values one option takes across a sweep, kept as text so each goes through the
+   same conversion as a single value on the command line */
+#define SWEEP_MAX_VALUES 256
+#define SWEEP_VALUE_LENGTH 16
+
+/* combinations written per run, at most */
+#define SWEEP_MAX_VARIANTS 100000
+
+typedef struct SweepAxis
+{
+    int count;
+    char values[SWEEP_MAX_VALUES][SWEEP_VALUE_LENGTH];
+
+} sweepaxis_t;
+
+/* one axis per sweepable option, in SWEEP_OPTIONS order */
+#define SWEEP_OPTIONS "lrftca"
+
+typedef struct SpcSweep
+{
+    sweepaxis_t axes[6];
+    const char *nameTemplate;   /* NULL: {name} plus each option with more than one value */
+
+} spcsweep_t;
+
+int sweepIsOption(char option);
+int sweepOption(spcsweep_t *sweep, char option, const char *spec);
+int runSweep(const char *inName, const char *outDir, const spcsweep_t *sweep, const spcfile_t *settings);
+
+#endif /*SWEEP_H*/
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "trace.h"
+#include "spc700.h"
+
+/* frames emulated per spc700Run() call; the output itself is thrown away */
+#define TRACE_CHUNK 4096
+
+#define TRACE_TEST(map, addr) (((map)[(addr) >> 3] >> ((addr) & 7)) & 1)
+
+/* plays the image in ctx, normally already patched, from its saved state with every
+   RAM access marked, then reports which bytes of the echo window the song itself used.
+   The window is the one ESA/EDL name plus whatever the DSP really wrote, so a driver
+   that moves the buffer at runtime is still caught */
+spcecho_error_t spcechoTrace(const spcecho_ctx *ctx, int seconds, spctrace_report_t *report)
+{
+    unsigned char *dsp;
+    unsigned char window[0x2000];
+    short *samples;
+    spc700_t *cpu;
+    long frames, done = 0;
+    double started = statsClock();
+    int addr = 0, edl;
+
+    memset(report, 0, sizeof *report);
+    report->firstCollision = -1;
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+    if(ctx->length < ADDRESS_OFFSET + 0x80) return SPCECHO_E_TOOSHORT;
+    if(seconds <= 0) return SPCECHO_E_ARG;
+
+    cpu = malloc(sizeof *cpu);
+    samples = malloc(TRACE_CHUNK * 2 * sizeof *samples);
+
+    if(cpu == NULL || samples == NULL)
+    {
+        free(cpu);
+        free(samples);
+        return SPCECHO_E_NOMEM;
+    }
+
+    spc700Load(cpu, ctx->buffer, (long) ctx->length);
+    spc700Trace(cpu, &report->map);
+
+    frames = (long) seconds * DSP_RATE;
+
+    while(done < frames)
+    {
+        int count = frames - done < TRACE_CHUNK ? (int) (frames - done) : TRACE_CHUNK;
+
+        spc700Run(cpu, samples, count);
+        done += count;
+    }
+
+    report->samples = done;
+    report->elapsed = statsClock() - started;
+    report->realtime = report->elapsed > 0 ? (double) done / DSP_RATE / report->elapsed : 0;
+
+    free(cpu);
+    free(samples);
+
+    dsp = ctx->buffer + ADDRESS_OFFSET;
+    edl = dsp[DSP_EDL] & 0x0F;
+
+    report->echoStart = dsp[DSP_ESA] << 8;
+    report->echoLength = edl ? edl * 0x800 : 4;
+
+    memcpy(window, report->map.echo, sizeof window);
+
+    for(; addr < report->echoLength; addr++) TRACE_MARK(window, report->echoStart + addr);
+
+    for(addr = 0; addr < 0x10000; addr++)
+    {
+        int read, written, fetched;
+
+        if(TRACE_TEST(report->map.echo, addr)) report->ringBytes++;
+        if(!TRACE_TEST(window, addr)) continue;
+
+        read = TRACE_TEST(report->map.read, addr);
+        written = TRACE_TEST(report->map.written, addr);
+        fetched = TRACE_TEST(report->map.fetched, addr);
+
+        report->windowRead += read;
+        report->windowWritten += written;
+        report->windowFetched += fetched;
+
+        if((read | written | fetched) && report->firstCollision < 0) report->firstCollision = addr;
+    }
+
+    return SPCECHO_OK;
+}
@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "spcecho.h"
+#include "sdsp.h"
+
+typedef struct SpcTraceReport
+{
+    long samples;               /* stereo sample frames emulated */
+    double elapsed;             /* wall-clock seconds spent emulating */
+    double realtime;            /* seconds of audio per second of work */
+
+    int echoStart;              /* the patched ESA/EDL window, which wraps at $FFFF */
+    int echoLength;
+    int ringBytes;              /* bytes the DSP actually wrote echo samples to */
+
+    /* bytes of the window, or of the ring wherever it strayed outside it, that the song used */
+    int windowRead;
+    int windowWritten;
+    int windowFetched;
+    int firstCollision;         /* lowest such address, -1 if there is none */
+
+    spctrace_t map;             /* everything that was touched */
+
+} spctrace_report_t;
+
+spcecho_error_t spcechoTrace(const spcecho_ctx *ctx, int seconds, spctrace_report_t *report);
+
+#endif /*TRACE_H*/
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "render.h"
+#include "stats.h"
+#include "tune.h"
+
+/* frames emulated or converted per step */
+#define TUNE_CHUNK 4096
+
+#define CLAMP16(s) ((s) < -0x8000 ? -0x8000 : (s) > 0x7FFF ? 0x7FFF : (s))
+
+/* everything sdspEcho() reads besides the ring: FLG for mute and echo writes, the FIR taps at $xF */
+static int echoRegister(int addr)
+{
+    switch(addr)
+    {
+    case DSP_MVOLL: case DSP_MVOLR: case DSP_EVOLL: case DSP_EVOLR:
+    case DSP_FLG: case DSP_EFB: case DSP_EON: case DSP_ESA: case DSP_EDL:
+        return 1;
+
+    default:
+        return (addr & 0x0F) == DSP_FIR;
+    }
+}
+
+static void recordWrite(void *arg, long sample, int addr, int data)
+{
+    spctune_t *tune = arg;
+    spctune_write_t *write;
+
+    if(!echoRegister(addr) || tune->outOfMemory) return;
+
+    if(tune->writeCount == tune->writeCapacity)
+    {
+        long capacity = tune->writeCapacity ? tune->writeCapacity * 2 : 256;
+        spctune_write_t *grown = realloc(tune->writes, (size_t) capacity * sizeof *grown);
+
+        if(grown == NULL)
+        {
+            tune->outOfMemory = 1;
+            return;
+        }
+
+        tune->writes = grown;
+        tune->writeCapacity = capacity;
+    }
+
+    write = &tune->writes[tune->writeCount++];
+    write->sample = sample;
+    write->addr = (unsigned char) addr;
+    write->data = (unsigned char) data;
+}
+
+/* plays the image in ctx for the given number of seconds with only the voices running,
+   keeping each voice's output and every write the song makes to an echo register */
+spcecho_error_t spcechoTuneLoad(spctune_t *tune, const spcecho_ctx *ctx, int seconds)
+{
+    double started = statsClock();
+    spc700_t *cpu;
+    short *scratch;
+    long done = 0;
+
+    memset(tune, 0, sizeof *tune);
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+    if(ctx->length < ADDRESS_OFFSET + 0x80) return SPCECHO_E_TOOSHORT;
+    if(seconds <= 0) return SPCECHO_E_ARG;
+
+    tune->frames = (long) seconds * DSP_RATE;
+    tune->dry = calloc((size_t) tune->frames, sizeof *tune->dry);
+    tune->pcm = malloc((size_t) tune->frames * 2 * sizeof *tune->pcm);
+    tune->echo = malloc(sizeof *tune->echo);
+
+    cpu = malloc(sizeof *cpu);
+    scratch = malloc(TUNE_CHUNK * 2 * sizeof *scratch);
+
+    if(tune->dry == NULL || tune->pcm == NULL || tune->echo == NULL || cpu == NULL || scratch == NULL)
+        tune->outOfMemory = 1;
+    else
+    {
+        spc700Load(cpu, ctx->buffer, (long) ctx->length);
+
+        cpu->dsp.dry = tune->dry;
+        cpu->dsp.onWrite = recordWrite;
+        cpu->dsp.onWriteArg = tune;
+
+        for(; done < tune->frames; done += TUNE_CHUNK)
+            spc700Run(cpu, scratch, tune->frames - done < TUNE_CHUNK ? (int) (tune->frames - done) : TUNE_CHUNK);
+    }
+
+    free(cpu);
+    free(scratch);
+
+    if(tune->outOfMemory)
+    {
+        spcechoTuneFree(tune);
+        return SPCECHO_E_NOMEM;
+    }
+
+    tune->captureTime = statsClock() - started;
+
+    return SPCECHO_OK;
+}
+
+/* runs the echo stage alone over the stored voices with the echo registers in ctx's image.
+   Matches a full render as long as the ring stays clear of anything the song reads or writes */
+spcecho_error_t spcechoTuneRender(spctune_t *tune, const spcecho_ctx *ctx)
+{
+    double started = statsClock();
+    const spctune_write_t *write = tune->writes, *end = tune->writes + tune->writeCount;
+    sdsp_t *dsp;
+    long n = 0;
+
+    if(ctx->buffer == NULL) return SPCECHO_E_NOIMAGE;
+    if(ctx->length < ADDRESS_OFFSET + 0x80) return SPCECHO_E_TOOSHORT;
+    if(tune->dry == NULL) return SPCECHO_E_ARG;
+
+    /* same RAM and register state a full render starts from, ring cleared the same way */
+    spc700Load(tune->echo, ctx->buffer, (long) ctx->length);
+    dsp = &tune->echo->dsp;
+
+    for(; n < tune->frames; n++)
+    {
+        const sdsp_dry_t *dry = &tune->dry[n];
+        int mainOut[2], echoOut[2] = { 0, 0 }, v = 0, ch;
+
+        for(; write < end && write->sample <= n; write++) dsp->regs[write->addr] = write->data;
+
+        /* voices are summed into the echo in order, clamping after each, as the DSP does */
+        for(; v < DSP_VOICES; v++)
+        {
+            if(!(dsp->regs[DSP_EON] & (1 << v))) continue;
+
+            for(ch = 0; ch < 2; ch++)
+            {
+                echoOut[ch] += dry->voices[v][ch];
+                echoOut[ch] = CLAMP16(echoOut[ch]);
+            }
+        }
+
+        mainOut[0] = dry->main[0];
+        mainOut[1] = dry->main[1];
+
+        sdspEcho(dsp, mainOut, echoOut, tune->pcm + n * 2);
+    }
+
+    tune->renderTime = statsClock() - started;
+
+    return SPCECHO_OK;
+}
+
+/* the latest render as 16-bit little-endian stereo, with or without a WAV header in front */
+spcecho_error_t spcechoTuneWrite(const spctune_t *tune, FILE *out, int wavHeader)
+{
+    unsigned char bytes[TUNE_CHUNK * 4];
+    long done = 0;
+
+    if(tune->pcm == NULL) return SPCECHO_E_NOIMAGE;
+
+    if(wavHeader)
+    {
+        unsigned char header[WAV_HEADER];
+
+        spcechoWavHeader(header, (unsigned long) tune->frames);
+        if(fwrite(header, 1, sizeof header, out) < sizeof header) return SPCECHO_E_WRITE;
+    }
+
+    for(; done < tune->frames; done += TUNE_CHUNK)
+    {
+        int count = tune->frames - done < TUNE_CHUNK ? (int) (tune->frames - done) : TUNE_CHUNK, i = 0;
+        const short *samples = tune->pcm + done * 2;
+
+        for(; i < count * 2; i++)
+        {
+            bytes[i * 2] = (unsigned char) samples[i];
+            bytes[i * 2 + 1] = (unsigned char) ((unsigned short) samples[i] >> 8);
+        }
+
+        if(fwrite(bytes, 4, (size_t) count, out) < (size_t) count) return SPCECHO_E_WRITE;
+    }
+
+    return fflush(out) == 0 ? SPCECHO_OK : SPCECHO_E_WRITE;
+}
+
+void spcechoTuneFree(spctune_t *tune)
+{
+    free(tune->dry);
+    free(tune->writes);
+    free(tune->echo);
+    free(tune->pcm);
+
+    memset(tune, 0, sizeof *tune);
+}
@@ -0,0 +1,42 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdio.h>
+
+#include "spcecho.h"
+#include "spc700.h"
+
+/* a write the song itself made to a register the echo stage reads */
+typedef struct SpcTuneWrite
+{
+    long sample;                /* takes effect from this sample on */
+    unsigned char addr;
+    unsigned char data;
+
+} spctune_write_t;
+
+/* a song played once with the echo stage left out, so echo settings can be auditioned
+   by running only that stage again over the stored voice output */
+typedef struct SpcTune
+{
+    long frames;
+    sdsp_dry_t *dry;            /* one entry per frame */
+    spctune_write_t *writes;    /* in the order the song made them */
+    long writeCount;
+    long writeCapacity;
+    int outOfMemory;
+
+    spc700_t *echo;             /* RAM holding the ring, and the echo unit's state */
+    short *pcm;                 /* frames * 2, the latest render */
+
+    double captureTime;         /* seconds spent emulating the voices */
+    double renderTime;          /* seconds spent on the latest echo pass */
+
+} spctune_t;
+
+spcecho_error_t spcechoTuneLoad(spctune_t *tune, const spcecho_ctx *ctx, int seconds);
+spcecho_error_t spcechoTuneRender(spctune_t *tune, const spcecho_ctx *ctx);
+spcecho_error_t spcechoTuneWrite(const spctune_t *tune, FILE *out, int wavHeader);
+void spcechoTuneFree(spctune_t *tune);
+
+#endif /*TUNE_H*/
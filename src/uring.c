@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "stats.h"
+#include "uring.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* each slot is one file on its way through, with at most one operation in flight */
+typedef enum SlotState
+{
+    SLOT_FREE      = 0,
+    SLOT_OPEN_IN   = 1,
+    SLOT_READ      = 2,
+    SLOT_CLOSE_IN  = 3,
+    SLOT_OPEN_OUT  = 4,
+    SLOT_WRITE     = 5,
+    SLOT_CLOSE_OUT = 6
+
+} slot_state_t;
+
+static const uring_op_t slotOps[] =
+{
+    URING_OPEN, URING_OPEN, URING_READ, URING_CLOSE, URING_OPEN, URING_WRITE, URING_CLOSE
+};
+
+static const char *opNames[URING_OPS] = { "open", "read", "write", "close" };
+
+typedef struct UringSlot
+{
+    slot_state_t state;
+    size_t index;
+    const char *inPath;
+    char outPath[FILENAME_MAX];
+    int fd;
+    int patched;            /* 1: ready to write, 0: nothing to write, -1: too big, use stdio */
+    size_t length;
+    size_t written;
+    double started;         /* when the file was taken */
+    double submitted;       /* when its current operation was queued */
+    spcfile_t file;
+
+} uringslot_t;
+
+typedef struct Ring
+{
+    int fd;
+    unsigned *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqMap, *cqMap;
+    size_t sqMapSize, cqMapSize, sqesSize;
+    unsigned pending;       /* queued, not yet handed to the kernel */
+    unsigned inFlight;      /* queued, not yet completed */
+
+} ring_t;
+
+typedef struct UringWorker
+{
+    ring_t ring;
+    uringslot_t *slots;
+    unsigned char *buffers;
+    int fixed;              /* buffers are registered: READ_FIXED and WRITE_FIXED */
+    unsigned active;
+    int draining;           /* next() has run out */
+
+    const spcfile_t *settings;
+    uring_next_t next;
+    uring_done_t done;
+    void *arg;
+    spciostats_t *stats;
+
+} uringworker_t;
+
+static void ringClose(ring_t *ring)
+{
+    if(ring->sqes != NULL) munmap(ring->sqes, ring->sqesSize);
+    if(ring->cqMap != NULL && ring->cqMap != ring->sqMap) munmap(ring->cqMap, ring->cqMapSize);
+    if(ring->sqMap != NULL) munmap(ring->sqMap, ring->sqMapSize);
+    if(ring->fd >= 0) close(ring->fd);
+}
+
+static int ringOpen(ring_t *ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof *ring);
+    memset(&p, 0, sizeof p);
+
+    if((ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p)) < 0) return 0;
+
+    /* OPENAT and CLOSE came with 5.6, the same release as this feature bit */
+    if(!(p.features & IORING_FEAT_RW_CUR_POS))
+    {
+        ringClose(ring);
+        return 0;
+    }
+
+    ring->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cqMapSize > ring->sqMapSize) ring->sqMapSize = ring->cqMapSize;
+        ring->cqMapSize = ring->sqMapSize;
+    }
+
+    ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sqMap == MAP_FAILED) ring->sqMap = NULL;
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP) ring->cqMap = ring->sqMap;
+    else
+    {
+        ring->cqMap = mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cqMap == MAP_FAILED) ring->cqMap = NULL;
+    }
+
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED) ring->sqes = NULL;
+
+    if(ring->sqMap == NULL || ring->cqMap == NULL || ring->sqes == NULL)
+    {
+        ringClose(ring);
+        return 0;
+    }
+
+    ring->sqTail = (unsigned *) ((char *) ring->sqMap + p.sq_off.tail);
+    ring->sqMask = (unsigned *) ((char *) ring->sqMap + p.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) ((char *) ring->sqMap + p.sq_off.array);
+    ring->cqHead = (unsigned *) ((char *) ring->cqMap + p.cq_off.head);
+    ring->cqTail = (unsigned *) ((char *) ring->cqMap + p.cq_off.tail);
+    ring->cqMask = (unsigned *) ((char *) ring->cqMap + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cqMap + p.cq_off.cqes);
+
+    return 1;
+}
+
+/* no more than one operation per slot, so the submission queue can't fill */
+static void ringQueue(ring_t *ring, const struct io_uring_sqe *sqe)
+{
+    unsigned tail = *ring->sqTail, index = tail & *ring->sqMask;
+
+    ring->sqes[index] = *sqe;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->pending++;
+    ring->inFlight++;
+}
+
+/* hands the queued operations to the kernel and waits for at least one to finish */
+static int ringEnter(uringworker_t *worker)
+{
+    ring_t *ring = &worker->ring;
+
+    worker->stats->enters++;
+    worker->stats->depthTotal += ring->inFlight;
+    if(ring->inFlight > worker->stats->depthPeak) worker->stats->depthPeak = ring->inFlight;
+
+    for(;;)
+    {
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if(submitted >= 0)
+        {
+            ring->pending -= (unsigned) submitted;
+            return 1;
+        }
+
+        if(errno != EINTR) return 0;
+    }
+}
+
+static void queueOp(uringworker_t *worker, uringslot_t *slot, slot_state_t state)
+{
+    struct io_uring_sqe sqe;
+    size_t index = (size_t) (slot - worker->slots);
+    unsigned char *buffer = worker->buffers + index * URING_SLOT_SIZE;
+
+    memset(&sqe, 0, sizeof sqe);
+    sqe.user_data = index;
+    sqe.fd = slot->fd;
+
+    switch(state)
+    {
+        case SLOT_OPEN_IN:
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = (uintptr_t) slot->inPath;
+            sqe.open_flags = O_RDONLY | O_CLOEXEC;
+            break;
+
+        /* skip never overwrites, so an existing output fails the open instead of another stat */
+        case SLOT_OPEN_OUT:
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = (uintptr_t) slot->outPath;
+            sqe.len = 0644;
+            sqe.open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (worker->settings->policy == POLICY_SKIP ? O_EXCL : 0);
+            break;
+
+        case SLOT_READ:
+            sqe.opcode = worker->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            sqe.addr = (uintptr_t) (buffer + slot->length);
+            sqe.len = (unsigned) (URING_SLOT_SIZE - slot->length);
+            sqe.off = slot->length;
+            sqe.buf_index = (unsigned short) index;
+            break;
+
+        case SLOT_WRITE:
+            sqe.opcode = worker->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            sqe.addr = (uintptr_t) (buffer + slot->written);
+            sqe.len = (unsigned) (slot->length - slot->written);
+            sqe.off = slot->written;
+            sqe.buf_index = (unsigned short) index;
+            break;
+
+        default:
+            sqe.opcode = IORING_OP_CLOSE;
+            break;
+    }
+
+    slot->state = state;
+    slot->submitted = statsClock();
+    ringQueue(&worker->ring, &sqe);
+}
+
+static void recordLatency(uringlatency_t *latency, double seconds)
+{
+    double micros = seconds * 1e6;
+    int bucket = 0;
+
+    for(; micros >= 2.0 && bucket < 31; bucket++) micros /= 2.0;
+
+    latency->count++;
+    latency->total += seconds;
+    latency->buckets[bucket]++;
+    if(seconds > latency->peak) latency->peak = seconds;
+}
+
+static void finishSlot(uringworker_t *worker, uringslot_t *slot)
+{
+    freeBuffer(&slot->file);
+    worker->done(worker->arg, slot->index, &slot->file, statsClock() - slot->started);
+
+    slot->state = SLOT_FREE;
+    worker->active--;
+}
+
+/* the same steps as a batch file, on the image in the slot's buffer */
+static int patchSlot(uringworker_t *worker, uringslot_t *slot)
+{
+    unsigned char *buffer = worker->buffers + (size_t) (slot - worker->slots) * URING_SLOT_SIZE;
+
+    if((slot->file.error = spcechoAttach(&slot->file.ctx, buffer, slot->length)) != SPCECHO_OK) return 0;
+
+    slot->file.bytesRead = slot->length;
+
+    return echoAddress(&slot->file) && filePatch(&slot->file);
+}
+
+/* one completion: moves the slot on to its next operation */
+static void advance(uringworker_t *worker, uringslot_t *slot, int result)
+{
+    recordLatency(&worker->stats->latency[slotOps[slot->state]], statsClock() - slot->submitted);
+
+    switch(slot->state)
+    {
+        case SLOT_OPEN_IN:
+            if(result < 0)
+            {
+                slot->file.error = SPCECHO_E_OPEN;
+                finishSlot(worker, slot);
+            }
+            else
+            {
+                slot->fd = result;
+                slot->length = 0;
+                queueOp(worker, slot, SLOT_READ);
+            }
+            break;
+
+        /* reads can come back short, so the file is only whole once a read returns 0 */
+        case SLOT_READ:
+            if(result > 0)
+            {
+                slot->length += (size_t) result;
+
+                if(slot->length < URING_SLOT_SIZE)
+                {
+                    queueOp(worker, slot, SLOT_READ);
+                    break;
+                }
+            }
+
+            if(result < 0)
+            {
+                slot->file.error = SPCECHO_E_READ;
+                slot->patched = 0;
+            }
+            else if(slot->length == URING_SLOT_SIZE) slot->patched = -1;
+            else slot->patched = patchSlot(worker, slot);
+
+            queueOp(worker, slot, SLOT_CLOSE_IN);
+            break;
+
+        case SLOT_CLOSE_IN:
+            if(slot->patched > 0) queueOp(worker, slot, SLOT_OPEN_OUT);
+            else
+            {
+                if(slot->patched < 0)
+                {
+                    spcfile_t *file = &slot->file;
+
+                    worker->stats->fallbacks++;
+                    if(fileRead(file, slot->inPath) && echoAddress(file)) fileWrite(file, slot->outPath);
+                }
+
+                finishSlot(worker, slot);
+            }
+            break;
+
+        case SLOT_OPEN_OUT:
+            if(result == -EEXIST) slot->file.skipApplied = 1;
+            else if(result < 0) slot->file.error = SPCECHO_E_OPEN;
+
+            if(result < 0) finishSlot(worker, slot);
+            else
+            {
+                slot->fd = result;
+                slot->written = 0;
+                queueOp(worker, slot, SLOT_WRITE);
+            }
+            break;
+
+        case SLOT_WRITE:
+            if(result <= 0)
+            {
+                slot->written = 0;
+                queueOp(worker, slot, SLOT_CLOSE_OUT);
+                break;
+            }
+
+            slot->written += (size_t) result;
+
+            if(slot->written < slot->length) queueOp(worker, slot, SLOT_WRITE);
+            else queueOp(worker, slot, SLOT_CLOSE_OUT);
+            break;
+
+        case SLOT_CLOSE_OUT:
+            if(result == 0 && slot->written == slot->length)
+            {
+                slot->file.fileSaved = 1;
+                slot->file.bytesWritten = slot->length;
+            }
+            else slot->file.error = SPCECHO_E_WRITE;
+
+            finishSlot(worker, slot);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* puts every free slot to work on a new file */
+static void fillSlots(uringworker_t *worker)
+{
+    unsigned i = 0;
+
+    for(; i < URING_DEPTH && !worker->draining; i++)
+    {
+        uringslot_t *slot = &worker->slots[i];
+
+        if(slot->state != SLOT_FREE) continue;
+
+        if(!worker->next(worker->arg, &slot->index, &slot->inPath, slot->outPath, sizeof slot->outPath))
+        {
+            worker->draining = 1;
+            break;
+        }
+
+        fileInitFrom(&slot->file, worker->settings);
+        slot->started = statsClock();
+        slot->patched = 0;
+        worker->active++;
+
+        queueOp(worker, slot, SLOT_OPEN_IN);
+    }
+}
+
+static void reapCompletions(uringworker_t *worker)
+{
+    ring_t *ring = &worker->ring;
+    unsigned head = *ring->cqHead, tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+    for(; head != tail; head++)
+    {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+
+        ring->inFlight--;
+        advance(worker, &worker->slots[cqe->user_data], cqe->res);
+    }
+
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/* one worker's files, URING_DEPTH at a time through its own ring; 0 if no ring could be set
+   up, in which case nothing was taken from next() and the caller should use stdio */
+int uringRun(const spcfile_t *settings, uring_next_t next, uring_done_t done, void *arg, spciostats_t *stats)
+{
+    uringworker_t worker;
+    struct iovec iov[URING_DEPTH];
+    unsigned i = 0;
+
+    memset(&worker, 0, sizeof worker);
+    memset(stats, 0, sizeof *stats);
+
+    worker.settings = settings;
+    worker.next = next;
+    worker.done = done;
+    worker.arg = arg;
+    worker.stats = stats;
+
+    if(!ringOpen(&worker.ring, URING_DEPTH)) return 0;
+
+    /* one allocation for every slot's buffer and state, made once per worker */
+    if(posix_memalign((void **) &worker.buffers, 4096, (size_t) URING_DEPTH * URING_SLOT_SIZE) != 0 ||
+       (worker.slots = calloc(URING_DEPTH, sizeof *worker.slots)) == NULL)
+    {
+        free(worker.buffers);
+        ringClose(&worker.ring);
+        return 0;
+    }
+
+    for(; i < URING_DEPTH; i++)
+    {
+        iov[i].iov_base = worker.buffers + (size_t) i * URING_SLOT_SIZE;
+        iov[i].iov_len = URING_SLOT_SIZE;
+    }
+
+    /* registering pins the buffers; past RLIMIT_MEMLOCK the plain READ and WRITE still work */
+    worker.fixed = syscall(__NR_io_uring_register, worker.ring.fd, IORING_REGISTER_BUFFERS, iov, URING_DEPTH) == 0;
+
+    stats->rings = 1;
+
+    fillSlots(&worker);
+
+    while(worker.active > 0)
+    {
+        if(!ringEnter(&worker))
+        {
+            /* the ring is unusable: whatever was in flight is reported as failed */
+            for(i = 0; i < URING_DEPTH; i++)
+            {
+                if(worker.slots[i].state == SLOT_FREE) continue;
+
+                worker.slots[i].file.fileSaved = 0;
+                finishSlot(&worker, &worker.slots[i]);
+            }
+
+            break;
+        }
+
+        reapCompletions(&worker);
+        fillSlots(&worker);
+    }
+
+    ringClose(&worker.ring);
+    free(worker.slots);
+    free(worker.buffers);
+
+    return 1;
+}
+
+#else
+
+static const char *opNames[URING_OPS] = { "open", "read", "write", "close" };
+
+int uringRun(const spcfile_t *settings, uring_next_t next, uring_done_t done, void *arg, spciostats_t *stats)
+{
+    (void) settings; (void) next; (void) done; (void) arg;
+
+    memset(stats, 0, sizeof *stats);
+    return 0;
+}
+
+#endif
+
+void uringMerge(spciostats_t *into, const spciostats_t *from)
+{
+    int op = 0, bucket;
+
+    into->rings += from->rings;
+    into->enters += from->enters;
+    into->depthTotal += from->depthTotal;
+    into->fallbacks += from->fallbacks;
+    if(from->depthPeak > into->depthPeak) into->depthPeak = from->depthPeak;
+
+    for(; op < URING_OPS; op++)
+    {
+        into->latency[op].count += from->latency[op].count;
+        into->latency[op].total += from->latency[op].total;
+        if(from->latency[op].peak > into->latency[op].peak) into->latency[op].peak = from->latency[op].peak;
+
+        for(bucket = 0; bucket < 32; bucket++) into->latency[op].buckets[bucket] += from->latency[op].buckets[bucket];
+    }
+}
+
+/* upper edge of the log2 bucket holding the 99th percentile, in seconds, never past the peak */
+static double percentile99(const uringlatency_t *latency)
+{
+    unsigned long seen = 0, target = latency->count - latency->count / 100;
+    double edge;
+    int bucket = 0;
+
+    for(; bucket < 31; bucket++)
+    {
+        seen += latency->buckets[bucket];
+        if(seen >= target) break;
+    }
+
+    edge = (double) (1UL << bucket) * 2.0 / 1e6;
+
+    return edge < latency->peak ? edge : latency->peak;
+}
+
+void uringReport(const spciostats_t *stats)
+{
+    int op = 0;
+
+    printf("\nio_uring: %d ring%s of %d, %.1f operations in flight on average, %lu at most\n",
+           stats->rings, stats->rings == 1 ? "" : "s", URING_DEPTH,
+           stats->enters ? (double) stats->depthTotal / (double) stats->enters : 0.0, stats->depthPeak);
+
+    if(stats->fallbacks > 0)
+        printf("%lu file%s larger than %d bytes went through stdio\n", stats->fallbacks, stats->fallbacks == 1 ? "" : "s", URING_SLOT_SIZE);
+
+    printf("%-6s %10s %10s %10s %10s\n", "op", "count", "avg ms", "p99 ms", "max ms");
+
+    for(; op < URING_OPS; op++)
+    {
+        const uringlatency_t *latency = &stats->latency[op];
+
+        if(latency->count == 0) continue;
+
+        printf("%-6s %10lu %10.3f %10.3f %10.3f\n", opNames[op], latency->count,
+               latency->total / (double) latency->count * 1000.0, percentile99(latency) * 1000.0, latency->peak * 1000.0);
+    }
+}
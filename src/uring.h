@@ -0,0 +1,51 @@
+#ifndef URING_H
+#define URING_H
+
+#include "readwrite.h"
+
+/* files each worker keeps in flight, and the size of the registered buffer each one gets:
+   a plain .spc is 66048 bytes, larger ones (ID666 extensions) go through stdio instead */
+#define URING_DEPTH 32
+#define URING_SLOT_SIZE (66 * 1024)
+
+typedef enum UringOp
+{
+    URING_OPEN  = 0,
+    URING_READ  = 1,
+    URING_WRITE = 2,
+    URING_CLOSE = 3,
+    URING_OPS   = 4
+
+} uring_op_t;
+
+typedef struct UringLatency
+{
+    unsigned long count;
+    double total;
+    double peak;
+    unsigned long buckets[32];  /* by whole microseconds, log2 */
+
+} uringlatency_t;
+
+typedef struct SpcIoStats
+{
+    int rings;
+    unsigned long enters;       /* io_uring_enter calls */
+    unsigned long depthTotal;   /* operations in flight, summed over enters */
+    unsigned long depthPeak;
+    unsigned long fallbacks;    /* files too big for a slot, done with stdio */
+    uringlatency_t latency[URING_OPS];
+
+} spciostats_t;
+
+/* hands out the next file: 0 when there are none left. outPath gets where it goes */
+typedef int (*uring_next_t)(void *arg, size_t *index, const char **inPath, char *outPath, size_t outSize);
+
+/* a file is finished; file holds its outcome and bytes written */
+typedef void (*uring_done_t)(void *arg, size_t index, const spcfile_t *file, double seconds);
+
+int uringRun(const spcfile_t *settings, uring_next_t next, uring_done_t done, void *arg, spciostats_t *stats);
+void uringMerge(spciostats_t *into, const spciostats_t *from);
+void uringReport(const spciostats_t *stats);
+
+#endif /*URING_H*/
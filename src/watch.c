@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "serve.h"
+#include "stats.h"
+#include "watch.h"
+
+#ifdef __linux__
+
+#include <fnmatch.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define WATCH_LINE 512
+
+static const char *outcomeNames[] =
+{
+    "written",
+    "fixed",
+    "forced",
+    "skipped",
+    "cached",
+    "failed"
+};
+
+/* one line of the profile file: files whose name matches get these values */
+typedef struct WatchProfile
+{
+    char *pattern;
+    spcfile_t values;       /* holds no image */
+
+} watchprofile_t;
+
+/* a file that was written to and is waiting for its writer to go quiet */
+typedef struct WatchPending
+{
+    char name[NAME_MAX + 1];
+    int profile;
+    double saved;           /* when the last write finished, for the latency report */
+    double due;             /* patched once this passes without another write */
+
+} watchpending_t;
+
+typedef struct WatchSession
+{
+    const char *dir;
+    const char *outDir;
+    watchprofile_t *profiles;
+    int profileCount;
+    spcimage_t *arena;      /* every file is read into this, nothing is allocated per change */
+
+    watchpending_t pending[WATCH_PENDING];     /* oldest first */
+    int pendingCount;
+
+} watchsession_t;
+
+/* "pattern options...", blank lines and # comments; options are the same as serve takes */
+static int loadProfiles(watchsession_t *session, const char *path, const spcfile_t *settings)
+{
+    char line[WATCH_LINE], reply[WATCH_LINE];
+    int lineNumber = 0, ok = 1;
+    FILE *in = fopen(path, "r");
+
+    if(in == NULL)
+    {
+        printf("\n!!!! Unable to open %s! !!!!\n", path);
+        return 0;
+    }
+
+    while(ok && fgets(line, sizeof line, in) != NULL)
+    {
+        watchprofile_t profile, *grown;
+        char *token, *save;
+
+        lineNumber++;
+
+        if((token = strtok_r(line, " \t\r\n", &save)) == NULL || token[0] == '#') continue;
+
+        fileInitFrom(&profile.values, settings);
+
+        while(ok && (token = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+        {
+            const char *value = strncmp(token, "--", 2) == 0 ? NULL : strtok_r(NULL, " \t\r\n", &save);
+
+            if(!(ok = applyOption(&profile.values, token, value, reply, sizeof reply)))
+            {
+                reply[strcspn(reply, "\n")] = '\0';
+                printf("\n!!!! %s line %d, %s! !!!!\n", path, lineNumber, reply);
+            }
+        }
+
+        if(!ok) break;
+
+        if((grown = realloc(session->profiles, (size_t) (session->profileCount + 1) * sizeof *grown)) == NULL ||
+           (profile.pattern = malloc(strlen(line) + 1)) == NULL)
+        {
+            if(grown != NULL) session->profiles = grown;
+            printf("Unable to allocate memory for profiles!\n");
+            ok = 0;
+            break;
+        }
+
+        strcpy(profile.pattern, line);
+        session->profiles = grown;
+        session->profiles[session->profileCount++] = profile;
+    }
+
+    fclose(in);
+
+    if(ok && session->profileCount == 0)
+    {
+        printf("\n!!!! %s has no profiles! !!!!\n", path);
+        ok = 0;
+    }
+
+    return ok;
+}
+
+/* the first profile whose pattern matches, -1 if none do or it isn't an .spc */
+static int findProfile(const watchsession_t *session, const char *name)
+{
+    int i = 0;
+
+    if(strstr(name, ".spc") == NULL) return -1;
+
+    for(; i < session->profileCount; i++)
+    {
+        if(fnmatch(session->profiles[i].pattern, name, 0) == 0) return i;
+    }
+
+    return -1;
+}
+
+static int findPending(const watchsession_t *session, const char *name)
+{
+    int i = 0;
+
+    for(; i < session->pendingCount; i++)
+    {
+        if(strcmp(session->pending[i].name, name) == 0) return i;
+    }
+
+    return -1;
+}
+
+static void dropPending(watchsession_t *session, int index)
+{
+    memmove(session->pending + index, session->pending + index + 1,
+            (size_t) (session->pendingCount - index - 1) * sizeof *session->pending);
+    session->pendingCount--;
+}
+
+/* reads, patches and writes one file; the output is replaced in one rename so a player
+   reloading it never sees half a file */
+static void patchPending(watchsession_t *session, int index)
+{
+    watchpending_t entry = session->pending[index];
+    const watchprofile_t *profile = &session->profiles[entry.profile];
+    char inPath[FILENAME_MAX], outPath[FILENAME_MAX], tempPath[FILENAME_MAX];
+    double started = statsClock(), finished;
+    file_outcome_t outcome;
+    spcfile_t file;
+
+    dropPending(session, index);
+
+    snprintf(inPath, sizeof inPath, "%s/%s", session->dir, entry.name);
+    snprintf(outPath, sizeof outPath, "%s/%s", session->outDir, entry.name);
+    snprintf(tempPath, sizeof tempPath, "%s/.%s.tmp", session->outDir, entry.name);
+
+    fileInitFrom(&file, &profile->values);
+    file.quiet = 1;
+    file.arena = session->arena;
+
+    remove(tempPath);
+
+    if(fileRead(&file, inPath) && echoAddress(&file)) fileWrite(&file, tempPath);
+
+    outcome = fileOutcome(&file);
+
+    if(file.fileSaved && rename(tempPath, outPath) != 0)
+    {
+        remove(tempPath);
+        outcome = OUTCOME_FAILED;
+    }
+
+    freeBuffer(&file);
+
+    finished = statsClock();
+    printf("%-8s  %s  [%s]  %.1f ms, %.1f ms after save\n", outcomeNames[outcome], entry.name, profile->pattern,
+           (finished - started) * 1000, (finished - entry.saved) * 1000);
+    fflush(stdout);
+}
+
+/* a finished write starts the file's quiet time, or starts it over if it was already waiting */
+static void schedule(watchsession_t *session, const char *name, int profile, double now)
+{
+    int index = findPending(session, name);
+    watchpending_t *entry;
+
+    if(index < 0)
+    {
+        if(session->pendingCount == WATCH_PENDING) patchPending(session, 0);
+
+        entry = &session->pending[session->pendingCount++];
+        snprintf(entry->name, sizeof entry->name, "%s", name);
+    }
+    else entry = &session->pending[index];
+
+    entry->profile = profile;
+    entry->saved = now;
+    entry->due = now + WATCH_DEBOUNCE_MS / 1000.0;
+}
+
+/* returns 0 once the directory itself is gone */
+static int handleEvent(watchsession_t *session, const struct inotify_event *event, double now)
+{
+    int index = event->len > 0 ? findPending(session, event->name) : -1, profile;
+
+    if(event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+        printf("\n!!!! %s was removed! !!!!\n", session->dir);
+        return 0;
+    }
+
+    if(event->mask & IN_Q_OVERFLOW)
+    {
+        printf("Too many changes at once, some were missed: save them again to patch them\n");
+        return 1;
+    }
+
+    if(event->len == 0) return 1;
+
+    /* still being written: hold it back a little longer */
+    if(event->mask & IN_MODIFY)
+    {
+        if(index >= 0) session->pending[index].due = now + WATCH_DEBOUNCE_MS / 1000.0;
+    }
+    else if(event->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        if(index >= 0) dropPending(session, index);
+    }
+    else if((profile = findProfile(session, event->name)) >= 0) schedule(session, event->name, profile, now);
+
+    return 1;
+}
+
+static int sameDirectory(const char *a, const char *b)
+{
+    struct stat infoA, infoB;
+
+    return stat(a, &infoA) == 0 && stat(b, &infoB) == 0 && infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+}
+
+/* runs until interrupted or the directory goes away */
+static void watchLoop(watchsession_t *session, int fd)
+{
+    char events[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    int running = 1;
+
+    while(running)
+    {
+        struct pollfd waitFor;
+        double now = statsClock();
+        int timeout = -1, i = 0;
+        ssize_t got;
+
+        /* patch whatever has been quiet long enough, then sleep until the next one is */
+        while(i < session->pendingCount)
+        {
+            if(session->pending[i].due <= now) patchPending(session, i);
+            else i++;
+        }
+
+        for(i = 0; i < session->pendingCount; i++)
+        {
+            int wait = (int) ((session->pending[i].due - now) * 1000) + 1;
+
+            if(timeout < 0 || wait < timeout) timeout = wait;
+        }
+
+        waitFor.fd = fd;
+        waitFor.events = POLLIN;
+
+        if(poll(&waitFor, 1, timeout) <= 0) continue;
+
+        if((got = read(fd, events, sizeof events)) <= 0) continue;
+
+        now = statsClock();
+
+        for(i = 0; running && i < got; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *) (events + i);
+
+            running = handleEvent(session, event, now);
+            i += (int) (sizeof *event + event->len);
+        }
+    }
+}
+
+int runWatch(const char *dir, const char *profilePath, const char *outDir, const spcfile_t *settings)
+{
+    watchsession_t session;
+    int fd = -1, i = 0;
+
+    memset(&session, 0, sizeof session);
+    session.dir = dir;
+    session.outDir = outDir;
+
+    /* the outputs would wake us up again */
+    if(sameDirectory(dir, outDir))
+    {
+        printf("\n!!!! watch needs an -o directory other than the one it watches! !!!!\n");
+        return 0;
+    }
+
+    if(!loadProfiles(&session, profilePath, settings))
+    {
+        for(; i < session.profileCount; i++) free(session.profiles[i].pattern);
+        free(session.profiles);
+        return 0;
+    }
+
+    if((session.arena = malloc(sizeof *session.arena)) == NULL)
+        printf("Unable to allocate memory for file!\n");
+    else if((fd = inotify_init1(IN_CLOEXEC)) < 0 ||
+            inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_DELETE | IN_MOVED_FROM |
+                                       IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) < 0)
+    {
+        printf("\n!!!! Unable to watch %s! !!!!\n", dir);
+        if(fd >= 0) close(fd);
+    }
+    else
+    {
+        printf("\nWatching %s with %d profile%s, writing to %s\n", dir, session.profileCount,
+               session.profileCount == 1 ? "" : "s", outDir);
+        fflush(stdout);
+
+        watchLoop(&session, fd);
+        close(fd);
+    }
+
+    for(; i < session.profileCount; i++) free(session.profiles[i].pattern);
+
+    free(session.profiles);
+    free(session.arena);
+
+    return 0;
+}
+
+#else
+
+int runWatch(const char *dir, const char *profilePath, const char *outDir, const spcfile_t *settings)
+{
+    (void) dir;
+    (void) profilePath;
+    (void) outDir;
+    (void) settings;
+
+    printf("\n!!!! watch needs inotify, which this system doesn't have! !!!!\n");
+    return 0;
+}
+
+#endif
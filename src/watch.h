@@ -0,0 +1,16 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "readwrite.h"
+
+/* quiet time after the last write to a file before it is patched */
+#define WATCH_DEBOUNCE_MS 20
+
+/* files waiting out their quiet time at once; past this the oldest is patched early */
+#define WATCH_PENDING 64
+
+/* patches every .spc written to dir with the first matching profile until interrupted;
+   returns only if it can't start or dir goes away */
+int runWatch(const char *dir, const char *profilePath, const char *outDir, const spcfile_t *settings);
+
+#endif /*WATCH_H*/
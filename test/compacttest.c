@@ -0,0 +1,132 @@
+/* spcechoCompact() on a built image: a sample page shared with code whose data ends in zero
+   bytes, a sample above a free gap, and code everywhere else. The sample must move into the
+   gap and the zero bytes after the code must come through untouched */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/spcecho.h"
+#include "../src/brr.h"
+#include "../src/compact.h"
+#include "../src/dspregs.h"
+
+#define IMAGE_SIZE 0x10200
+
+#define DIRECTORY  0x0200
+#define MIXED      0x3000       /* sample, then code, then the code's zeroed variables */
+#define CODE_END   0x3060
+#define GAP        0x4000       /* eight zeroed pages between code: free */
+#define GAP_PAGES  8
+#define HIGH       0x5000       /* sample that --defrag should pull down into the gap */
+#define BLOCKS     4
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    printf("%-6s %s\n", ok ? "ok" : "FAILED", what);
+    if(!ok) failures++;
+}
+
+/* BLOCKS blocks of BRR that end, without looping, at the last one */
+static void putSample(unsigned char *ram, unsigned int at)
+{
+    int block = 0;
+
+    for(; block < BLOCKS; block++, at += BRR_BLOCK)
+    {
+        ram[at] = (unsigned char) (0xB0 | (block == BLOCKS - 1 ? BRR_END : 0));
+        memset(ram + at + 1, 0x12 + block, BRR_BLOCK - 1);
+    }
+}
+
+static void putEntry(unsigned char *ram, int entry, unsigned int start)
+{
+    unsigned char *at = ram + DIRECTORY + entry * 4;
+
+    at[0] = at[2] = (unsigned char) start;
+    at[1] = at[3] = (unsigned char) (start >> 8);
+}
+
+static unsigned char *buildImage(void)
+{
+    unsigned char *image = calloc(1, IMAGE_SIZE), *ram, *dsp;
+    unsigned int page = 0x03;
+
+    if(image == NULL) return NULL;
+
+    ram = image + RAM_OFFSET;
+    dsp = image + ADDRESS_OFFSET;
+
+    memcpy(image, "SNES-SPC700 Sound File Data v0.30", 33);
+    image[0x21] = image[0x22] = 26;
+
+    /* nonzero filler stands in for code and song data */
+    for(; page < 0x100 && (page << 8) < HIGH; page++)
+    {
+        if(page == MIXED >> 8 || (page >= GAP >> 8 && page < (GAP >> 8) + GAP_PAGES)) continue;
+        memset(ram + (page << 8), 0x5A, 0x100);
+    }
+
+    putSample(ram, MIXED);
+    memset(ram + MIXED + BLOCKS * BRR_BLOCK, 0x5A, CODE_END - MIXED - BLOCKS * BRR_BLOCK);
+    putSample(ram, HIGH);
+
+    putEntry(ram, 0, MIXED);
+    putEntry(ram, 1, HIGH);
+
+    dsp[DSP_DIR] = DIRECTORY >> 8;
+    dsp[DSP_FLG] = FLG_ECHO_OFF;
+
+    return image;
+}
+
+int main(void)
+{
+    unsigned char *image = buildImage(), *original = malloc(IMAGE_SIZE), *ram;
+    spcecho_ctx ctx;
+    spccompact_t result;
+    spcecho_error_t err;
+    unsigned int i = CODE_END;
+    int zeroed = 1;
+
+    if(image == NULL || original == NULL)
+    {
+        printf("Unable to allocate memory!\n");
+        return 1;
+    }
+
+    memcpy(original, image, IMAGE_SIZE);
+
+    spcechoInit(&ctx);
+
+    if((err = spcechoAttach(&ctx, image, IMAGE_SIZE)) != SPCECHO_OK)
+    {
+        printf("%s\n", spcechoStrerror(err));
+        return 1;
+    }
+
+    err = spcechoCompact(&ctx, &result);
+    ram = ctx.buffer + RAM_OFFSET;
+
+    check(err == SPCECHO_OK, "compacts");
+    check(result.samplesVerified == 2, "both samples verified");
+
+    /* the page is typed as samples, but these zeros belong to the code before them */
+    for(; i < (MIXED & 0xFF00) + 0x100; i++) zeroed &= ram[i] == 0;
+    check(zeroed, "zero bytes after the code in the sample page left alone");
+    check(memcmp(ram + MIXED, original + RAM_OFFSET + MIXED, CODE_END - MIXED) == 0, "sample and code in the shared page unchanged");
+
+    check((ram[DIRECTORY] | ram[DIRECTORY + 1] << 8) == MIXED, "low sample stays put");
+    check((ram[DIRECTORY + 4] | ram[DIRECTORY + 5] << 8) == GAP, "high sample moves into the free gap");
+    check(memcmp(ram + GAP, original + RAM_OFFSET + HIGH, BLOCKS * BRR_BLOCK) == 0, "high sample's blocks copied");
+
+    spcechoFree(&ctx);
+    free(image);
+    free(original);
+
+    printf("\n%d check%s failed\n", failures, failures == 1 ? "" : "s");
+
+    return failures != 0;
+}